@@ -0,0 +1,492 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Benchmark suite, run with make bench.  Microbenchmarks time the
+   host side primitives in a loop; the end to end benchmarks run each
+   CLI command through dispatch against the in-process fake device,
+   from a scratch $HOME.  Results are written as JSON, to the file
+   given as the only argument or stdout, so they can be compared
+   across releases. */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fake_device.h"
+#include "../cli/cli_commands.h"
+#include "../cli/hash.h"
+#include "../driver/command_adaptation.h"
+#include "../driver/command_table.h"
+#include "../driver/crc.h"
+#include "../driver/hashlet.h"
+#include "../driver/hex.h"
+
+/* How long to run each microbenchmark */
+#define MICRO_SECONDS 0.2
+
+#define BULK_LEN 4096
+
+static uint8_t bulk[BULK_LEN];
+static char bulk_hex[HEX_LEN (BULK_LEN)];
+static uint8_t key[32];
+static uint8_t challenge[32];
+static uint8_t response[32];
+static struct Command_ATSHA204 mac_command =
+  {
+    .command = 0x03, .opcode = COMMAND_MAC, .data = challenge,
+    .data_len = sizeof (challenge)
+  };
+static int device_fd;
+static volatile unsigned int sink;
+
+static double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void crc16_command (void)
+{
+  sink += calculate_crc16 (bulk, 37);
+}
+
+static void crc16_zones (void)
+{
+  sink += calculate_crc16 (bulk, 576);
+}
+
+static void serialize_mac (void)
+{
+  uint8_t frame[COMMAND_FRAME_LEN (sizeof (challenge))];
+
+  sink += serialize_command (&mac_command, frame);
+}
+
+static void read_and_validate_32 (void)
+{
+  uint8_t buf[32];
+
+  fake_device_queue (device_fd, bulk, sizeof (buf));
+  sink += read_and_validate (device_fd, buf, sizeof (buf));
+}
+
+static void read_and_validate_status (void)
+{
+  uint8_t buf[1];
+
+  fake_device_queue (device_fd, bulk, sizeof (buf));
+  sink += read_and_validate (device_fd, buf, sizeof (buf));
+}
+
+static void hex_encode_32 (void)
+{
+  char hex[HEX_LEN (32)];
+
+  hex_encode (hex, bulk, 32);
+  sink += hex[0];
+}
+
+static void hex_encode_bulk (void)
+{
+  hex_encode (bulk_hex, bulk, BULK_LEN);
+}
+
+static void hex_decode_32 (void)
+{
+  uint8_t bin[32];
+
+  sink += hex_decode (bin, bulk_hex, HEX_LEN (32));
+}
+
+static void hex_decode_bulk (void)
+{
+  static uint8_t bin[BULK_LEN];
+
+  sink += hex_decode (bin, bulk_hex, HEX_LEN (BULK_LEN));
+}
+
+static void sha256_32 (void)
+{
+  struct octet_buffer data = { bulk, 32 };
+  struct octet_buffer digest = sha256_buffer (data);
+
+  sink += digest.ptr[0];
+  free_octet_buffer (digest);
+}
+
+static void sha256_bulk (void)
+{
+  struct octet_buffer data = { bulk, BULK_LEN };
+  struct octet_buffer digest = sha256_buffer (data);
+
+  sink += digest.ptr[0];
+  free_octet_buffer (digest);
+}
+
+static void verify_hash (void)
+{
+  struct octet_buffer c = { challenge, 32 }, r = { response, 32 };
+  struct octet_buffer k = { key, 32 };
+
+  sink += verify_hash_defaults (c, r, k, 0);
+}
+
+static void verify_hmac (void)
+{
+  struct octet_buffer c = { challenge, 32 }, r = { response, 32 };
+  struct octet_buffer k = { key, 32 };
+
+  sink += verify_hmac_defaults (c, r, k, 0);
+}
+
+struct micro
+{
+  const char *name;
+  unsigned int bytes;           /**< Bytes processed per call, or 0 */
+  void (*func) (void);
+};
+
+static const struct micro MICROS[] =
+  {
+    { "calculate_crc16/37", 37, crc16_command },
+    { "calculate_crc16/576", 576, crc16_zones },
+    { "serialize_command/mac", 0, serialize_mac },
+    { "read_and_validate/32", 32, read_and_validate_32 },
+    { "read_and_validate/status", 1, read_and_validate_status },
+    { "hex_encode/32", 32, hex_encode_32 },
+    { "hex_encode/4096", BULK_LEN, hex_encode_bulk },
+    { "hex_decode/32", 32, hex_decode_32 },
+    { "hex_decode/4096", BULK_LEN, hex_decode_bulk },
+    { "sha256_buffer/32", 32, sha256_32 },
+    { "sha256_buffer/4096", BULK_LEN, sha256_bulk },
+    { "verify_hash_defaults", 0, verify_hash },
+    { "verify_hmac_defaults", 0, verify_hmac }
+  };
+
+static void setup_micro (void)
+{
+  unsigned int x;
+
+  for (x = 0; x < BULK_LEN; x++)
+    bulk[x] = rand ();
+
+  bulk[0] = RSP_SUCCESS;
+  hex_encode (bulk_hex, bulk, BULK_LEN);
+  memcpy (key, bulk + 64, sizeof (key));
+  memcpy (challenge, bulk + 96, sizeof (challenge));
+  memcpy (response, bulk + 128, sizeof (response));
+
+  device_fd = hashlet_setup ("fake", 0x64);
+}
+
+static void run_micro (FILE *json, const struct micro *m, bool last)
+{
+  unsigned long iterations = 1;
+  unsigned long x;
+  double elapsed = 0;
+  double start;
+
+  /* Double the count until the run is long enough to time, then
+     scale it to MICRO_SECONDS */
+  while (elapsed < MICRO_SECONDS / 10)
+    {
+      iterations *= 2;
+      start = now ();
+      for (x = 0; x < iterations; x++)
+        m->func ();
+      elapsed = now () - start;
+    }
+
+  iterations = iterations * (MICRO_SECONDS / elapsed) + 1;
+
+  start = now ();
+  for (x = 0; x < iterations; x++)
+    m->func ();
+  elapsed = now () - start;
+
+  fprintf (json, "    {\"name\": \"%s\", \"iterations\": %lu, "
+           "\"ns_per_op\": %.1f", m->name, iterations,
+           elapsed * 1e9 / iterations);
+  if (m->bytes > 0)
+    fprintf (json, ", \"mb_per_s\": %.1f",
+             (double)m->bytes * iterations / elapsed / 1e6);
+  fprintf (json, "}%s\n", last ? "" : ",");
+}
+
+struct e2e
+{
+  const char *command;
+  unsigned int iterations;
+  bool reset;                   /**< Start each run from a factory device */
+  const char *file;             /**< Given with -f, in the scratch $HOME */
+  const char *name;             /**< Reported name, if not the command */
+};
+
+/* In order: personalize leaves the device and key files that the
+   later commands use, write changes a key and provision starts from
+   factory devices, so they come last */
+static const struct e2e E2ES[] =
+  {
+    { "personalize", 20, true, NULL },
+    { "random", 500, false, "input" },
+    { "serial-num", 500, false, "input" },
+    { "state", 500, false, "input" },
+    { "get-config", 500, false, "input" },
+    { "get-otp", 500, false, "input" },
+    { "dump", 500, false, "input" },
+    { "nonce", 500, false, "input" },
+    { "read", 500, false, "input" },
+    { "mac", 500, false, "input" },
+    { "hmac", 500, false, "input" },
+    { "check-mac", 500, false, "input" },
+    { "hash", 500, false, "input" },
+    { "offline-verify", 500, false, "input" },
+    { "offline-hmac", 500, false, "input" },
+    { "print-keys", 500, false, ".hashlet" },
+    { "stats", 500, false, "input" },
+    { "write", 500, false, "input" },
+    { "write", 100, false, "slots", "write-slots" },
+    { "provision", 20, true, NULL }
+  };
+
+/* Each provision run personalizes two devices on each of four buses */
+static char *PROVISION_DEVICES[] =
+  {
+    "bus-0:64", "bus-0:65", "bus-1:64", "bus-1:65",
+    "bus-2:64", "bus-2:65", "bus-3:64", "bus-3:65"
+  };
+
+static int cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Computes the MAC and HMAC of the input file by the device the
+ * commands use, which the offline commands then verify.
+ */
+static void device_responses (const struct arguments *args,
+                              const char *input, char *mac_hex,
+                              char *hmac_hex)
+{
+  struct mac_mode_encoding m = {0};
+  struct hmac_mode_encoding hm = {0};
+  struct octet_buffer digest = sha256_file (input);
+  struct mac_response rsp;
+  struct octet_buffer hmac;
+  int fd = hashlet_setup (args->bus, args->address);
+
+  rsp = perform_mac (fd, m, 0, digest);
+  assert (rsp.status);
+  hex_encode (mac_hex, rsp.mac.ptr, rsp.mac.len);
+  mac_hex[HEX_LEN (rsp.mac.len)] = '\0';
+
+  assert (load_nonce (fd, digest));
+  hm.temp_key_source = true;
+  hmac = perform_hmac (fd, hm, 0);
+  assert (NULL != hmac.ptr);
+  hex_encode (hmac_hex, hmac.ptr, hmac.len);
+  hmac_hex[HEX_LEN (hmac.len)] = '\0';
+
+  free_octet_buffer (rsp.mac);
+  free_octet_buffer (rsp.meta);
+  free_octet_buffer (hmac);
+  free_octet_buffer (digest);
+  hashlet_teardown (fd);
+}
+
+static void run_e2e (FILE *json, const struct e2e *e, struct arguments *base,
+                     bool last)
+{
+  double *samples = malloc (e->iterations * sizeof (double));
+  uint64_t waited = fake_device_wait_ns ();
+  unsigned int failures = 0;
+  unsigned int x;
+  double total = 0;
+  double start;
+
+  assert (NULL != samples);
+
+  for (x = 0; x < e->iterations; x++)
+    {
+      struct arguments args = *base;
+
+      if (e->reset)
+        fake_device_reset ();
+
+      start = now ();
+      if (HASHLET_COMMAND_SUCCESS != dispatch (e->command, &args))
+        failures++;
+      samples[x] = now () - start;
+      total += samples[x];
+    }
+
+  waited = fake_device_wait_ns () - waited;
+  qsort (samples, e->iterations, sizeof (double), cmp_double);
+
+  fprintf (json, "    {\"command\": \"%s\", \"iterations\": %u, "
+           "\"failures\": %u, \"ops_per_s\": %.1f, \"mean_us\": %.1f, "
+           "\"p50_us\": %.1f, \"p99_us\": %.1f, \"device_wait_us\": %.1f}%s\n",
+           NULL != e->name ? e->name : e->command, e->iterations,
+           failures, e->iterations / total,
+           total * 1e6 / e->iterations,
+           samples[e->iterations / 2] * 1e6,
+           samples[e->iterations * 99 / 100] * 1e6,
+           waited / 1e3 / e->iterations, last ? "" : ",");
+
+  free (samples);
+}
+
+int main (int argc, char **argv)
+{
+  const unsigned int NUM_MICROS = sizeof (MICROS) / sizeof (MICROS[0]);
+  const unsigned int NUM_E2ES = sizeof (E2ES) / sizeof (E2ES[0]);
+  char home[] = "/tmp/hashlet-bench-XXXXXX";
+  char input[sizeof (home) + 16];
+  char file[sizeof (home) + 16];
+  char mac_hex[HEX_LEN (32) + 1], hmac_hex[HEX_LEN (32) + 1];
+  char meta_hex[HEX_LEN (13) + 1];
+  char cmd[sizeof (home) + 16];
+  struct arguments args;
+  unsigned int x;
+  FILE *json;
+  int null_fd;
+
+  if (argc > 2)
+    {
+      fprintf (stderr, "Usage: %s [FILE]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  /* The commands print to stdout, so keep it for the results and
+     send theirs to /dev/null */
+  fflush (stdout);
+  if ((json = (2 == argc) ? fopen (argv[1], "w") : fdopen (dup (1), "w"))
+      == NULL || (null_fd = open ("/dev/null", O_WRONLY)) < 0)
+    {
+      perror ("Failed to open output");
+      return EXIT_FAILURE;
+    }
+  dup2 (null_fd, STDOUT_FILENO);
+  close (null_fd);
+
+  /* Nothing should wait for input */
+  if (NULL == freopen ("/dev/null", "r", stdin))
+    return EXIT_FAILURE;
+
+  if (NULL == mkdtemp (home))
+    {
+      perror ("Failed to create a scratch directory");
+      return EXIT_FAILURE;
+    }
+  setenv ("HOME", home, 1);
+
+  srand (1);
+  setup_micro ();
+  init_cli (&args);
+
+  fprintf (json, "{\n  \"version\": \"%s\",\n  \"hex\": \"%s\",\n"
+           "  \"micro\": [\n", PACKAGE_VERSION, hex_implementation ());
+
+  for (x = 0; x < NUM_MICROS; x++)
+    run_micro (json, &MICROS[x], x + 1 == NUM_MICROS);
+
+  hashlet_teardown (device_fd);
+
+  snprintf (input, sizeof (input), "%s/input", home);
+  FILE *f = fopen (input, "w");
+  assert (NULL != f);
+  fwrite (bulk, 1, BULK_LEN, f);
+  fclose (f);
+
+  hex_encode (meta_hex, bulk, 13);
+  meta_hex[HEX_LEN (13)] = '\0';
+  hex_encode (bulk_hex, bulk, 32);
+  bulk_hex[HEX_LEN (32)] = '\0';
+  strcpy (mac_hex, bulk_hex);
+  strcpy (hmac_hex, bulk_hex);
+
+  /* write --slots rewrites 14 slots with what they already hold */
+  snprintf (file, sizeof (file), "%s/slots", home);
+  f = fopen (file, "w");
+  assert (NULL != f);
+  for (x = 0; x < 14; x++)
+    fprintf (f, "%u %s %s\n", x, bulk_hex, bulk_hex);
+  fclose (f);
+
+  fprintf (json, "  ],\n  \"end_to_end\": [\n");
+
+  for (x = 0; x < NUM_E2ES; x++)
+    {
+      args.challenge = bulk_hex;
+      args.challenge_rsp = mac_hex;
+      args.meta = meta_hex;
+      args.write_data = bulk_hex;
+      args.key_slot = 0;
+
+      if (0 == strcmp ("offline-verify", E2ES[x].command) ||
+          0 == strcmp ("offline-hmac", E2ES[x].command))
+        {
+          device_responses (&args, input, mac_hex, hmac_hex);
+          args.challenge = NULL;
+          if (0 == strcmp ("offline-hmac", E2ES[x].command))
+            args.challenge_rsp = hmac_hex;
+        }
+      else if (0 == strcmp ("write", E2ES[x].command))
+        {
+          args.key_slot = 15;
+          args.write_slots = 0 == strcmp ("slots", E2ES[x].file);
+        }
+      else if (0 == strcmp ("provision", E2ES[x].command))
+        {
+          args.files = PROVISION_DEVICES;
+          args.num_files = sizeof (PROVISION_DEVICES) /
+            sizeof (PROVISION_DEVICES[0]);
+        }
+
+      if (NULL == E2ES[x].file)
+        args.input_file = NULL;
+      else
+        {
+          snprintf (file, sizeof (file), "%s/%s", home, E2ES[x].file);
+          args.input_file = file;
+        }
+
+      run_e2e (json, &E2ES[x], &args, x + 1 == NUM_E2ES);
+    }
+
+  fprintf (json, "  ]\n}\n");
+  fclose (json);
+
+  snprintf (cmd, sizeof (cmd), "rm -rf %s", home);
+  if (0 != system (cmd))
+    fprintf (stderr, "Failed to remove %s\n", home);
+
+  return EXIT_SUCCESS;
+}
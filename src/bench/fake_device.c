@@ -0,0 +1,566 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <gcrypt.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fake_device.h"
+#include "../cli/hash.h"
+#include "../driver/command.h"
+#include "../driver/command_table.h"
+#include "../driver/config_zone.h"
+#include "../driver/crc.h"
+#include "../driver/defs.h"
+#include "../driver/hashlet.h"
+#include "../driver/i2c.h"
+#include "../driver/stats.h"
+#include "../driver/temp_key.h"
+#include "../driver/zone_cache.h"
+
+/* Header and trailer of a command packet: word address, count,
+   opcode, param1, param2 and the CRC */
+#define PACKET_OVERHEAD 8
+
+struct fake_device
+{
+  uint8_t config[CONFIG_ZONE_LEN];
+  uint8_t otp[OTP_ZONE_LEN];
+  uint8_t data[DATA_ZONE_LEN];
+  uint8_t temp_key[32];
+  bool temp_key_valid;
+  uint8_t response[MAX_RESPONSE_FRAME_LEN];
+  unsigned int response_len;
+  uint64_t rng;
+};
+
+/* One device per bus and address, so that several can be driven at
+   once, as the provision command does */
+#define FAKE_MAX_DEVICES 32
+#define FAKE_MAX_FDS 1024
+
+struct fake_slot
+{
+  char bus[64];
+  int addr;
+  struct fake_device device;
+};
+
+static struct fake_slot slots[FAKE_MAX_DEVICES];
+static unsigned int num_slots = 0;
+/* Resets so far, so each gives new serial numbers */
+static unsigned int generation = 0;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *fd_bus[FAKE_MAX_FDS];
+static struct fake_device *fd_device[FAKE_MAX_FDS];
+static uint64_t waited_ns = 0;
+
+/* The device the calling thread is talking to */
+static __thread struct fake_device *device;
+
+/* The factory configuration zone: serial number, revision, I2C
+   address and OTP mode, unlocked slot configs and both lock bytes
+   unlocked */
+static const uint8_t FACTORY_CONFIG[32] =
+  {
+    0x01, 0x23, 0x4A, 0x5B, 0x00, 0x09, 0x04, 0x00,
+    0x6C, 0x7D, 0x8E, 0x9F, 0xEE, 0x00, 0x01, 0x00,
+    0xC8, 0x00, 0xAA, 0x00
+  };
+
+/* The driver sleeps while the device executes.  The benchmarks
+   measure the host, so skip the wait and count it instead. */
+int nanosleep (const struct timespec *req, struct timespec *rem)
+{
+  __atomic_fetch_add (&waited_ns, req->tv_sec * 1000000000ULL + req->tv_nsec,
+                      __ATOMIC_RELAXED);
+
+  if (NULL != rem)
+    rem->tv_sec = rem->tv_nsec = 0;
+
+  return 0;
+}
+
+uint64_t fake_device_wait_ns (void)
+{
+  return __atomic_load_n (&waited_ns, __ATOMIC_RELAXED);
+}
+
+static void reset_device (struct fake_device *d, unsigned int index)
+{
+  memset (d, 0, sizeof (*d));
+
+  memcpy (d->config, FACTORY_CONFIG, 20);
+  /* Each device gets its own serial number, and a reset is a new
+     device, as a real one can't be unlocked */
+  d->config[11] += index;
+  d->config[10] += generation;
+  memset (d->config + 52, 0xFF, 32);
+  d->config[LOCK_VALUE] = UNLOCKED;
+  d->config[LOCK_CONFIG] = UNLOCKED;
+
+  memset (d->otp, 0xFF, sizeof (d->otp));
+  memset (d->data, 0xFF, sizeof (d->data));
+
+  d->rng = 0x9E3779B97F4A7C15ULL + index;
+}
+
+void fake_device_reset (void)
+{
+  unsigned int x;
+
+  pthread_mutex_lock (&slots_lock);
+
+  generation++;
+
+  for (x = 0; x < num_slots; x++)
+    reset_device (&slots[x].device, x);
+
+  pthread_mutex_unlock (&slots_lock);
+}
+
+static bool is_locked (unsigned int lock_byte)
+{
+  return UNLOCKED != device->config[lock_byte];
+}
+
+static void random_bytes (uint8_t *buf, unsigned int len)
+{
+  unsigned int x;
+
+  for (x = 0; x < len; x++)
+    {
+      device->rng ^= device->rng << 13;
+      device->rng ^= device->rng >> 7;
+      device->rng ^= device->rng << 17;
+      buf[x] = device->rng >> 56;
+    }
+}
+
+static void queue_response (const uint8_t *data, unsigned int len)
+{
+  uint16_t crc;
+
+  assert (len + 3 <= MAX_RESPONSE_FRAME_LEN);
+
+  device->response[0] = len + 3;
+  memcpy (device->response + 1, data, len);
+  crc = calculate_crc16 (device->response, len + 1);
+  memcpy (device->response + len + 1, &crc, sizeof (crc));
+  device->response_len = len + 3;
+}
+
+/**
+ * Selects the device behind fd for the calling thread.
+ */
+static void select_device (int fd)
+{
+  assert (fd >= 0 && fd < FAKE_MAX_FDS && NULL != fd_device[fd]);
+
+  device = fd_device[fd];
+}
+
+void fake_device_queue (int fd, const uint8_t *data, unsigned int len)
+{
+  select_device (fd);
+  queue_response (data, len);
+}
+
+static void queue_status (enum STATUS_RESPONSE status)
+{
+  uint8_t s = status;
+
+  queue_response (&s, sizeof (s));
+}
+
+/**
+ * Returns the zone selected by param1, NULL if it is not one.
+ */
+static uint8_t* zone_of (uint8_t param1, unsigned int *len)
+{
+  switch (param1 & 0x03)
+    {
+    case 0:
+      *len = CONFIG_ZONE_LEN;
+      return device->config;
+    case 1:
+      *len = OTP_ZONE_LEN;
+      return device->otp;
+    case 2:
+      *len = DATA_ZONE_LEN;
+      return device->data;
+    default:
+      return NULL;
+    }
+}
+
+static void execute_read (uint8_t param1, uint16_t param2)
+{
+  unsigned int zone_len = 0;
+  uint8_t *zone = zone_of (param1, &zone_len);
+  unsigned int len = (param1 & 0x80) ? 32 : 4;
+  unsigned int offset = (param2 & 0xFF) * 4;
+
+  if (NULL == zone || offset + len > zone_len)
+    queue_status (RSP_PARSE_ERROR);
+  else
+    queue_response (zone + offset, len);
+}
+
+static void execute_write (uint8_t param1, uint16_t param2,
+                           const uint8_t *data, unsigned int data_len)
+{
+  unsigned int zone_len = 0;
+  uint8_t *zone = zone_of (param1, &zone_len);
+  unsigned int len = (param1 & 0x80) ? 32 : 4;
+  unsigned int offset = (param2 & 0xFF) * 4;
+  const unsigned int MAC_LEN = 32;
+
+  if (NULL == zone || offset + len > zone_len ||
+      (data_len != len && data_len != len + MAC_LEN))
+    queue_status (RSP_PARSE_ERROR);
+  else if ((zone == device->config &&
+            (is_locked (LOCK_CONFIG) || offset < 16)) ||
+           (zone == device->otp && is_locked (LOCK_VALUE)) ||
+           (zone == device->data && is_locked (LOCK_VALUE) &&
+            data_len != len + MAC_LEN) ||
+           (data_len == len + MAC_LEN && !device->temp_key_valid))
+    queue_status (RSP_EXECUTION_ERROR);
+  else
+    {
+      /* Encrypted writes are stored as sent, the input MAC is not
+         checked, but they use up TempKey */
+      if (data_len == len + MAC_LEN)
+        device->temp_key_valid = false;
+
+      memcpy (zone + offset, data, len);
+      queue_status (RSP_SUCCESS);
+    }
+}
+
+static void execute_lock (uint8_t param1, uint16_t param2)
+{
+  const bool data = param1 & 0x01;
+  const unsigned int lock_byte = data ? LOCK_VALUE : LOCK_CONFIG;
+  uint16_t crc;
+
+  if (data)
+    {
+      struct crc16_ctx ctx;
+
+      crc16_init (&ctx);
+      crc16_update (&ctx, device->data, DATA_ZONE_LEN);
+      crc16_update (&ctx, device->otp, OTP_ZONE_LEN);
+      crc = crc16_final (&ctx);
+    }
+  else
+    crc = calculate_crc16 (device->config, CONFIG_ZONE_LEN);
+
+  if (is_locked (lock_byte) || (data && !is_locked (LOCK_CONFIG)) ||
+      (!(param1 & 0x80) && crc != param2))
+    queue_status (RSP_EXECUTION_ERROR);
+  else
+    {
+      device->config[lock_byte] = 0x00;
+      queue_status (RSP_SUCCESS);
+    }
+}
+
+static void execute_nonce (uint8_t param1, const uint8_t *data,
+                           unsigned int data_len)
+{
+  const unsigned int PASS_THROUGH = 0x03;
+  uint8_t msg[32 + 20 + 3];
+
+  if ((param1 & 0x03) == PASS_THROUGH && 32 == data_len)
+    {
+      memcpy (device->temp_key, data, 32);
+      device->temp_key_valid = true;
+      queue_status (RSP_SUCCESS);
+    }
+  else if ((param1 & 0x03) < 2 && 20 == data_len)
+    {
+      random_bytes (msg, 32);
+      memcpy (msg + 32, data, 20);
+      msg[52] = COMMAND_NONCE;
+      msg[53] = param1;
+      msg[54] = 0;
+      gcry_md_hash_buffer (GCRY_MD_SHA256, device->temp_key, msg, sizeof (msg));
+      device->temp_key_valid = true;
+      queue_response (msg, 32);
+    }
+  else
+    queue_status (RSP_PARSE_ERROR);
+}
+
+/**
+ * Digests a data slot into TempKey, as temp_key_gen_dig_value does.
+ */
+static void execute_gen_dig (uint8_t param1, uint16_t param2)
+{
+  const unsigned int DATA = 0x02;
+  const unsigned int slot = param2 & 0x0F;
+
+  if (DATA != (param1 & 0x03) || param2 >= MAX_NUM_DATA_SLOTS)
+    queue_status (RSP_PARSE_ERROR);
+  else if (!device->temp_key_valid)
+    queue_status (RSP_EXECUTION_ERROR);
+  else
+    {
+      temp_key_gen_dig_value (device->temp_key, slot,
+                              device->data + slot * 32, device->temp_key);
+      queue_status (RSP_SUCCESS);
+    }
+}
+
+/**
+ * Computes the MAC or HMAC response with the host's implementation,
+ * which leaves the OTP and serial number fields zero.
+ */
+static void execute_mac (bool hmac, uint8_t param1, uint16_t param2,
+                         const uint8_t *data, unsigned int data_len)
+{
+  static uint8_t zeros[8];
+  const bool use_temp_key = hmac || (param1 & 0x01);
+  struct octet_buffer challenge = { (uint8_t *)data, data_len };
+  struct octet_buffer key = { device->data + (param2 & 0x0F) * 32, 32 };
+  struct octet_buffer otp8 = { zeros, 8 }, otp3 = { zeros, 3 };
+  struct octet_buffer sn4 = { zeros, 4 }, sn23 = { zeros, 2 };
+  struct octet_buffer rsp;
+
+  if (use_temp_key)
+    {
+      challenge.ptr = device->temp_key;
+      challenge.len = sizeof (device->temp_key);
+    }
+
+  if (use_temp_key && !device->temp_key_valid)
+    queue_status (RSP_EXECUTION_ERROR);
+  else if (32 != challenge.len)
+    queue_status (RSP_PARSE_ERROR);
+  else
+    {
+      rsp = hmac ?
+        perform_hmac_256 (challenge, key, param1, param2,
+                          otp8, otp3, sn4, sn23) :
+        perform_hash (challenge, key, param1, param2, otp8, otp3, sn4, sn23);
+
+      queue_response (rsp.ptr, rsp.len);
+      free_octet_buffer (rsp);
+    }
+}
+
+static void execute (const uint8_t *packet, unsigned int len)
+{
+  const uint8_t opcode = packet[2];
+  const uint8_t param1 = packet[3];
+  const uint8_t *data = packet + 6;
+  const unsigned int data_len = len - PACKET_OVERHEAD;
+  uint16_t param2;
+  uint8_t buf[32];
+
+  memcpy (&param2, packet + 4, sizeof (param2));
+
+  switch (opcode)
+    {
+    case COMMAND_READ:
+      execute_read (param1, param2);
+      break;
+    case COMMAND_WRITE:
+      execute_write (param1, param2, data, data_len);
+      break;
+    case COMMAND_LOCK:
+      execute_lock (param1, param2);
+      break;
+    case COMMAND_RANDOM:
+      if (is_locked (LOCK_CONFIG))
+        random_bytes (buf, sizeof (buf));
+      else
+        {
+          /* Until the configuration is locked, the device returns a
+             fixed pattern */
+          unsigned int x;
+          for (x = 0; x < sizeof (buf); x++)
+            buf[x] = (x % 4) < 2 ? 0xFF : 0x00;
+        }
+      queue_response (buf, sizeof (buf));
+      break;
+    case COMMAND_NONCE:
+      execute_nonce (param1, data, data_len);
+      break;
+    case COMMAND_MAC:
+      execute_mac (false, param1, param2, data, data_len);
+      break;
+    case COMMAND_HMAC:
+      execute_mac (true, param1, param2, data, data_len);
+      break;
+    case COMMAND_GEN_DIG:
+      execute_gen_dig (param1, param2);
+      break;
+    case COMMAND_CHECK_MAC:
+      /* The client's response isn't checked */
+      queue_status (RSP_SUCCESS);
+      break;
+    case COMMAND_DEV_REV:
+      memcpy (buf, device->config + 4, 4);
+      queue_response (buf, 4);
+      break;
+    default:
+      queue_status (RSP_PARSE_ERROR);
+    }
+}
+
+int i2c_setup (const char* bus)
+{
+  assert (NULL != bus);
+
+  /* A real descriptor, so the callers' checks work */
+  int fd = open ("/dev/null", O_RDWR);
+
+  if (fd >= FAKE_MAX_FDS)
+    {
+      close (fd);
+      fd = -1;
+    }
+
+  if (fd >= 0)
+    {
+      fd_bus[fd] = bus;
+      fd_device[fd] = NULL;
+    }
+
+  return fd;
+}
+
+bool i2c_acquire_bus (int fd, int addr)
+{
+  unsigned int x;
+
+  assert (fd >= 0 && fd < FAKE_MAX_FDS);
+
+  pthread_mutex_lock (&slots_lock);
+
+  for (x = 0; x < num_slots; x++)
+    if (addr == slots[x].addr &&
+        0 == strncmp (fd_bus[fd], slots[x].bus, sizeof (slots[x].bus) - 1))
+      break;
+
+  if (x == num_slots && num_slots < FAKE_MAX_DEVICES)
+    {
+      strncpy (slots[x].bus, fd_bus[fd], sizeof (slots[x].bus) - 1);
+      slots[x].addr = addr;
+      reset_device (&slots[x].device, x);
+      num_slots++;
+    }
+
+  if (x < num_slots)
+    fd_device[fd] = &slots[x].device;
+
+  pthread_mutex_unlock (&slots_lock);
+
+  return NULL != fd_device[fd];
+}
+
+bool wakeup (int fd)
+{
+  return true;
+}
+
+int sleep_device (int fd)
+{
+  select_device (fd);
+
+  device->temp_key_valid = false;
+  device->response_len = 0;
+
+  return 1;
+}
+
+ssize_t i2c_write (int fd, const unsigned char *buf, unsigned int len)
+{
+  assert (NULL != buf);
+
+  const unsigned int COMMAND_WORD_ADDRESS = 0x03;
+
+  select_device (fd);
+
+  if (len < PACKET_OVERHEAD || COMMAND_WORD_ADDRESS != buf[0] ||
+      buf[1] != len - 1)
+    queue_status (RSP_PARSE_ERROR);
+  else if (!is_crc_16_valid (buf + 1, len - 3, buf + len - 2))
+    queue_status (RSP_COMM_ERROR);
+  else
+    execute (buf, len);
+
+  return len;
+}
+
+ssize_t i2c_read (int fd, unsigned char *buf, unsigned int len)
+{
+  assert (NULL != buf);
+
+  select_device (fd);
+
+  /* Nothing to send: the device NAKs */
+  if (0 == device->response_len)
+    return -1;
+
+  memset (buf, 0, len);
+  memcpy (buf, device->response,
+          device->response_len < len ? device->response_len : len);
+  device->response_len = 0;
+
+  return len;
+}
+
+int hashlet_setup (const char *bus, unsigned int addr)
+{
+  int fd = i2c_setup (bus);
+
+  if (fd < 0)
+    return fd;
+
+  if (!i2c_acquire_bus (fd, addr) || !wakeup (fd))
+    {
+      close (fd);
+      return -1;
+    }
+
+  stats_register_device (fd, bus, addr);
+  temp_key_register_device (fd);
+  zone_cache_register_device (fd);
+
+  return fd;
+}
+
+void hashlet_teardown (int fd)
+{
+  sleep_device (fd);
+
+  stats_close_device (fd);
+  temp_key_close_device (fd);
+  zone_cache_close_device (fd);
+
+  close (fd);
+}
@@ -0,0 +1,59 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FAKE_DEVICE_H
+#define FAKE_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* An in-process ATSHA204 for the benchmarks.  It replaces i2c.c, so
+   the driver and CLI run unchanged down to i2c_write and i2c_read,
+   which parse the command packet and queue the device's response.
+   MAC and HMAC responses are computed as the device would, so the
+   offline commands verify them.  There is one device per bus and
+   address, each with its own serial number.  The execution time waits
+   are skipped and added up instead, see fake_device_wait_ns. */
+
+/**
+ * Puts every device back to its factory state: zones unlocked, the
+ * data zone blank and TempKey invalid.
+ */
+void fake_device_reset (void);
+
+/**
+ * Queues a response packet, framed with its count and CRC, as if the
+ * device had just executed a command.
+ *
+ * @param fd The device, from hashlet_setup
+ * @param data The response data
+ * @param len The length of data
+ */
+void fake_device_queue (int fd, const uint8_t *data, unsigned int len);
+
+/**
+ * Returns the total time the driver would have waited for the device
+ * to execute commands.
+ *
+ * @return Nanoseconds skipped since the program started
+ */
+uint64_t fake_device_wait_ns (void);
+
+#endif /* FAKE_DEVICE_H */
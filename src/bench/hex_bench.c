@@ -0,0 +1,148 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Microbenchmark for the hex codec.  Build with make hex_bench.  It
+   times encoding, decoding and validation against the byte at a time
+   code they replaced, for a key sized buffer and a bulk buffer. */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../driver/hex.h"
+
+static double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The replaced encoder: one formatted print per byte */
+static void encode_printf (char *hex, const uint8_t *bin, unsigned int len)
+{
+  unsigned int x;
+  char pair[3];
+
+  for (x = 0; x < len; x++)
+    {
+      snprintf (pair, sizeof (pair), "%02X", bin[x]);
+      memcpy (hex + 2 * x, pair, 2);
+    }
+}
+
+static unsigned int nibble (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+
+  return ~0u;
+}
+
+/* The replaced decoder: a nibble at a time with a branchy lookup */
+static int decode_nibbles (uint8_t *bin, const char *hex, unsigned int len)
+{
+  unsigned int x;
+
+  for (x = 0; x < len; x++)
+    {
+      unsigned int a = nibble (hex[x]);
+
+      if (~0u == a)
+        return 0;
+
+      if (x % 2 == 0)
+        bin[x / 2] = a << 4;
+      else
+        bin[x / 2] += a;
+    }
+
+  return 1;
+}
+
+static void run (unsigned int len, unsigned long iterations)
+{
+  uint8_t *bin = malloc (len);
+  uint8_t *out = malloc (len);
+  char *hex = malloc (HEX_LEN (len));
+  unsigned long x;
+  unsigned int i;
+  double t, mb = (double)len * iterations / 1e6;
+  volatile int sink = 0;
+
+  if (NULL == bin || NULL == out || NULL == hex)
+    exit (1);
+
+  for (i = 0; i < len; i++)
+    bin[i] = rand ();
+
+  t = now ();
+  for (x = 0; x < iterations; x++)
+    encode_printf (hex, bin, len);
+  printf ("%8u bytes  encode  printf  %9.1f MB/s\n", len, mb / (now () - t));
+
+  t = now ();
+  for (x = 0; x < iterations; x++)
+    hex_encode (hex, bin, len);
+  printf ("%8u bytes  encode  %-6s  %9.1f MB/s\n", len, hex_implementation (),
+          mb / (now () - t));
+
+  t = now ();
+  for (x = 0; x < iterations; x++)
+    sink += decode_nibbles (out, hex, HEX_LEN (len));
+  printf ("%8u bytes  decode  nibble  %9.1f MB/s\n", len, mb / (now () - t));
+
+  t = now ();
+  for (x = 0; x < iterations; x++)
+    sink += hex_decode (out, hex, HEX_LEN (len));
+  printf ("%8u bytes  decode  %-6s  %9.1f MB/s\n", len, hex_implementation (),
+          mb / (now () - t));
+
+  t = now ();
+  for (x = 0; x < iterations; x++)
+    sink += hex_validate (hex, HEX_LEN (len));
+  printf ("%8u bytes  valid.  %-6s  %9.1f MB/s\n", len, hex_implementation (),
+          mb / (now () - t));
+
+  if (0 != memcmp (bin, out, len))
+    {
+      fprintf (stderr, "round trip mismatch\n");
+      exit (1);
+    }
+
+  free (bin);
+  free (out);
+  free (hex);
+}
+
+int main (void)
+{
+  run (32, 2000000);
+  run (1024 * 1024, 40);
+
+  return 0;
+}
@@ -0,0 +1,397 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#if HAVE_GCRYPT_H
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gcrypt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "attest.h"
+#include "digest_cache.h"
+#include "hash.h"
+#include "hash_files.h"
+#include "pool.h"
+#include "tree_hash.h"
+
+#define DLEN 32
+
+struct attest_job
+{
+  const struct file_list *files;
+  struct digest_cache *cache;
+  uint8_t *digests;
+  struct stat *stats;           /**< Status of each file as hashed */
+  int *errors;
+  bool *hits;
+};
+
+static void attest_one (void *ctx, unsigned int index)
+{
+  struct attest_job *job = ctx;
+  struct stat *st = &job->stats[index];
+  uint8_t *digest = job->digests + (size_t)index * DLEN;
+  const uint8_t *cached;
+  struct octet_buffer d;
+  int fd;
+
+  if ((fd = open (job->files->paths[index], O_RDONLY)) < 0 ||
+      0 != fstat (fd, st))
+    {
+      job->errors[index] = errno;
+    }
+  else if (NULL != job->cache &&
+           (cached = lookup_digest_cache (job->cache, st)) != NULL)
+    {
+      memcpy (digest, cached, DLEN);
+      job->hits[index] = true;
+    }
+  else if ((d = sha256_fd (fd)).ptr == NULL)
+    {
+      job->errors[index] = errno ? errno : EIO;
+    }
+  else
+    {
+      memcpy (digest, d.ptr, DLEN);
+      free_octet_buffer (d);
+    }
+
+  if (fd >= 0)
+    close (fd);
+}
+
+struct manifest_entry
+{
+  char *path;
+  uint8_t *digest;
+};
+
+static int cmp_entries (const void *lhs, const void *rhs)
+{
+  const struct manifest_entry *l = lhs;
+  const struct manifest_entry *r = rhs;
+
+  return strcmp (l->path, r->path);
+}
+
+/* The walk sorts each directory by locale; the manifest is sorted
+   bytewise on the whole relative path so it doesn't depend on it */
+static void sort_manifest (struct manifest *manifest)
+{
+  struct manifest_entry *entries;
+  uint8_t *digests;
+  unsigned int x;
+
+  if (manifest->count < 2)
+    return;
+
+  entries = malloc (manifest->count * sizeof (struct manifest_entry));
+  digests = malloc ((size_t)manifest->count * DLEN);
+  assert (NULL != entries && NULL != digests);
+
+  for (x = 0; x < manifest->count; x++)
+    {
+      entries[x].path = manifest->paths[x];
+      entries[x].digest = manifest->digests + (size_t)x * DLEN;
+    }
+
+  qsort (entries, manifest->count, sizeof (struct manifest_entry),
+         cmp_entries);
+
+  for (x = 0; x < manifest->count; x++)
+    {
+      manifest->paths[x] = entries[x].path;
+      memcpy (digests + (size_t)x * DLEN, entries[x].digest, DLEN);
+    }
+
+  free (manifest->digests);
+  manifest->digests = digests;
+  free (entries);
+}
+
+bool build_manifest (const char *dir, unsigned int jobs,
+                     const char *cache_file, struct manifest *manifest)
+{
+  assert (NULL != dir);
+  assert (NULL != manifest);
+
+  struct file_list files;
+  struct digest_cache cache;
+  struct attest_job job;
+  char *paths[] = { (char *)dir };
+  size_t prefix = strlen (dir);
+  bool result = true;
+  unsigned int x;
+
+  /* collect_files joins names with a slash unless dir ends in one */
+  if (prefix > 0 && '/' != dir[prefix - 1])
+    prefix++;
+
+  collect_files (paths, 1, &files);
+
+  if (NULL != cache_file)
+    load_digest_cache (cache_file, &cache);
+
+  job.files = &files;
+  job.cache = (NULL != cache_file) ? &cache : NULL;
+  job.digests = malloc (((size_t)files.count + 1) * DLEN);
+  job.stats = calloc (files.count + 1, sizeof (struct stat));
+  job.errors = calloc (files.count + 1, sizeof (int));
+  job.hits = calloc (files.count + 1, sizeof (bool));
+  assert (NULL != job.digests && NULL != job.stats);
+  assert (NULL != job.errors && NULL != job.hits);
+
+  /* Initialize gcrypt before the workers start */
+  assert (NULL != gcry_check_version (NULL));
+
+  run_pool (files.count, jobs, attest_one, &job);
+
+  manifest->paths = malloc ((files.count + 1) * sizeof (char *));
+  assert (NULL != manifest->paths);
+  manifest->digests = job.digests;
+  manifest->count = files.count;
+
+  for (x = 0; x < files.count; x++)
+    {
+      if (0 != job.errors[x])
+        {
+          fprintf (stderr, "%s: %s\n", files.paths[x],
+                   strerror (job.errors[x]));
+          result = false;
+        }
+      else if (NULL != cache_file && !job.hits[x])
+        update_digest_cache (&cache, &job.stats[x],
+                             job.digests + (size_t)x * DLEN);
+
+      manifest->paths[x] = strdup (files.paths[x] + prefix);
+      assert (NULL != manifest->paths[x]);
+    }
+
+  if (NULL != cache_file)
+    {
+      if (result && !save_digest_cache (cache_file, &cache))
+        perror ("Failed to save the digest cache");
+      free_digest_cache (&cache);
+    }
+
+  sort_manifest (manifest);
+
+  free (job.stats);
+  free (job.errors);
+  free (job.hits);
+  free_file_list (&files);
+
+  if (!result)
+    free_manifest (manifest);
+
+  return result;
+}
+
+static void add_entry (struct manifest *manifest, unsigned int *capacity,
+                       char *path, const uint8_t *digest)
+{
+  if (manifest->count == *capacity)
+    {
+      *capacity = *capacity ? *capacity * 2 : 64;
+      manifest->paths = realloc (manifest->paths,
+                                 *capacity * sizeof (char *));
+      manifest->digests = realloc (manifest->digests,
+                                   (size_t)*capacity * DLEN);
+      assert (NULL != manifest->paths && NULL != manifest->digests);
+    }
+
+  manifest->paths[manifest->count] = path;
+  memcpy (manifest->digests + (size_t)manifest->count * DLEN, digest, DLEN);
+  manifest->count++;
+}
+
+/* Lines printed by print_mac_result and output_tree_layout */
+static bool is_result_line (const char *line)
+{
+  const char *sep = strstr (line, " : ");
+
+  return NULL != sep && sep - line < 12;
+}
+
+bool read_manifest (FILE *stream, struct manifest *manifest)
+{
+  assert (NULL != stream);
+  assert (NULL != manifest);
+
+  char *line = NULL;
+  size_t line_len = 0;
+  unsigned int capacity = 0;
+  unsigned int line_num = 0;
+  bool result = true;
+
+  manifest->paths = NULL;
+  manifest->digests = NULL;
+  manifest->count = 0;
+
+  while (result && getline (&line, &line_len, stream) != -1)
+    {
+      uint8_t digest[DLEN];
+      char *path;
+
+      line_num++;
+
+      if (parse_sha256sum_line (line, digest, &path))
+        add_entry (manifest, &capacity, path, digest);
+      else if ('\n' != line[0] && !is_result_line (line))
+        {
+          fprintf (stderr, "Manifest line %u is not valid\n", line_num);
+          result = false;
+        }
+    }
+
+  free (line);
+
+  if (result)
+    sort_manifest (manifest);
+  else
+    free_manifest (manifest);
+
+  return result;
+}
+
+void output_manifest (FILE *stream, const struct manifest *manifest)
+{
+  assert (NULL != stream);
+  assert (NULL != manifest);
+
+  unsigned int x;
+
+  for (x = 0; x < manifest->count; x++)
+    {
+      char *line = sha256sum_line (manifest->paths[x],
+                                   manifest->digests + (size_t)x * DLEN);
+      fprintf (stream, "%s\n", line);
+      free (line);
+    }
+}
+
+struct octet_buffer manifest_root (const struct manifest *manifest)
+{
+  assert (NULL != manifest);
+
+  unsigned int count = manifest->count ? manifest->count : 1;
+  uint8_t *leaves = malloc ((size_t)count * DLEN);
+  struct octet_buffer root;
+  unsigned int x;
+
+  assert (NULL != leaves);
+
+  if (0 == manifest->count)
+    {
+      const uint8_t prefix = TREE_LEAF_PREFIX;
+      gcry_md_hash_buffer (GCRY_MD_SHA256, leaves, &prefix, sizeof (prefix));
+    }
+
+  for (x = 0; x < manifest->count; x++)
+    {
+      char *line = sha256sum_line (manifest->paths[x],
+                                   manifest->digests + (size_t)x * DLEN);
+      size_t len = strlen (line);
+
+      /* The line is rewritten in place behind the leaf prefix */
+      line = realloc (line, len + 2);
+      assert (NULL != line);
+      memmove (line + 1, line, len + 1);
+      line[0] = TREE_LEAF_PREFIX;
+
+      gcry_md_hash_buffer (GCRY_MD_SHA256, leaves + (size_t)x * DLEN,
+                           line, len + 1);
+      free (line);
+    }
+
+  root = merkle_root (leaves, count);
+  free (leaves);
+
+  return root;
+}
+
+bool compare_manifests (const struct manifest *expected,
+                        const struct manifest *actual)
+{
+  assert (NULL != expected);
+  assert (NULL != actual);
+
+  unsigned int e = 0, a = 0;
+  bool result = true;
+
+  while (e < expected->count || a < actual->count)
+    {
+      int cmp;
+
+      if (e == expected->count)
+        cmp = 1;
+      else if (a == actual->count)
+        cmp = -1;
+      else
+        cmp = strcmp (expected->paths[e], actual->paths[a]);
+
+      if (cmp < 0)
+        {
+          printf ("%s: MISSING\n", expected->paths[e++]);
+          result = false;
+        }
+      else if (cmp > 0)
+        {
+          printf ("%s: NEW\n", actual->paths[a++]);
+          result = false;
+        }
+      else
+        {
+          if (0 != memcmp (expected->digests + (size_t)e * DLEN,
+                           actual->digests + (size_t)a * DLEN, DLEN))
+            {
+              printf ("%s: FAILED\n", expected->paths[e]);
+              result = false;
+            }
+          e++;
+          a++;
+        }
+    }
+
+  return result;
+}
+
+void free_manifest (struct manifest *manifest)
+{
+  assert (NULL != manifest);
+
+  unsigned int x;
+
+  for (x = 0; x < manifest->count; x++)
+    free (manifest->paths[x]);
+
+  free (manifest->paths);
+  free (manifest->digests);
+  manifest->paths = NULL;
+  manifest->digests = NULL;
+  manifest->count = 0;
+}
+
+#endif
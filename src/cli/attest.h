@@ -0,0 +1,106 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ATTEST_H
+#define ATTEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../driver/util.h"
+
+/* A manifest lists every file below a directory, in sha256sum format
+   and sorted bytewise by path relative to the directory.  The root
+   that is MAC'd is the tree hash of the manifest, where each leaf is
+   SHA256 (0x00 | line) of one line without its newline and the nodes
+   are combined as in tree_hash.h.  An empty manifest is a single
+   empty leaf. */
+
+struct manifest
+{
+  char **paths;                 /**< Relative paths, sorted */
+  uint8_t *digests;             /**< count 32 byte digests */
+  unsigned int count;
+};
+
+/**
+ * Walks a directory and hashes every file in it concurrently.
+ *
+ * @param dir The directory
+ * @param jobs The number of workers, 0 for the default
+ * @param cache_file The digest cache to consult and update, or NULL
+ * to hash every file
+ * @param manifest Filled in on success.  Free with free_manifest.
+ *
+ * @return True if every file was hashed, otherwise the failures are
+ * printed to stderr.
+ */
+bool build_manifest (const char *dir, unsigned int jobs,
+                     const char *cache_file, struct manifest *manifest);
+
+/**
+ * Reads a manifest printed by output_manifest.  The result lines
+ * printed by the attest command ("mac       : ...") are skipped, so
+ * its entire output may be given.
+ *
+ * @param stream The input stream
+ * @param manifest Filled in on success.  Free with free_manifest.
+ *
+ * @return True if the manifest parsed
+ */
+bool read_manifest (FILE *stream, struct manifest *manifest);
+
+/**
+ * Prints the manifest, one sha256sum line per file.
+ *
+ * @param stream The output stream
+ * @param manifest The manifest
+ */
+void output_manifest (FILE *stream, const struct manifest *manifest);
+
+/**
+ * Computes the root of the manifest.
+ *
+ * @param manifest The manifest
+ *
+ * @return The malloc'd 32 byte root
+ */
+struct octet_buffer manifest_root (const struct manifest *manifest);
+
+/**
+ * Compares the expected manifest with one freshly built, printing
+ * each file that is FAILED, MISSING or NEW to stdout.
+ *
+ * @param expected The manifest that was attested
+ * @param actual The manifest of the directory as it is
+ *
+ * @return True if they are the same
+ */
+bool compare_manifests (const struct manifest *expected,
+                        const struct manifest *actual);
+
+/**
+ * Frees the manifest.
+ *
+ * @param manifest The manifest
+ */
+void free_manifest (struct manifest *manifest);
+
+#endif /* ATTEST_H */
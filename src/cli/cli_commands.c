@@ -21,14 +21,29 @@
 
 #include <assert.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cli_commands.h"
 #include "config.h"
+#include "dump.h"
 #include "../parser/hashlet_parser.h"
 #include "../driver/personalize.h"
+#include "../driver/fleet_store.h"
+#include "../driver/hex.h"
+#include "../driver/key_store.h"
+#include "../driver/slot_write.h"
+#include "../driver/stats.h"
+#include "../driver/temp_key.h"
 
 #if HAVE_GCRYPT_H
+#include "attest.h"
+#include "digest_cache.h"
 #include "hash.h"
+#include "hash_files.h"
+#include "key_schedule.h"
+#include "provision.h"
+#include "tree_hash.h"
 #else
 #define NO_GCRYPT "Rebuild with libgcrypt to enable this feature"
 #endif
@@ -65,6 +80,18 @@ void set_defaults (struct arguments *args)
   args->address = 0b1100100;
   args->bus = "/dev/i2c-1";
 
+  args->files = NULL;
+  args->num_files = 0;
+  args->jobs = 0;
+  args->tree_chunk = 0;
+  args->use_cache = true;
+  args->serial = NULL;
+  args->fleet_file = NULL;
+  args->log_file = NULL;
+  args->use_syslog = false;
+  args->host_rng = false;
+  args->write_slots = false;
+
 
 }
 void output_hex (FILE *stream, struct octet_buffer buf)
@@ -76,14 +103,27 @@ void output_hex (FILE *stream, struct octet_buffer buf)
     printf ("Command failed\n");
   else
     {
+      /* Bulk random output can be large, so encode in chunks */
+      const unsigned int CHUNK = 2048;
+      char hex[HEX_LEN (CHUNK) + 1];
       unsigned int i = 0;
 
-      for (i = 0; i < buf.len; i++)
+      for (i = 0; i < buf.len; i += CHUNK)
         {
-          fprintf (stream, "%02X", buf.ptr[i]);
+          unsigned int len = buf.len - i < CHUNK ? buf.len - i : CHUNK;
+          unsigned int hex_len = HEX_LEN (len);
+
+          hex_encode (hex, buf.ptr + i, len);
+
+          /* The newline rides along with the last chunk */
+          if (i + len == buf.len)
+            hex[hex_len++] = '\n';
+
+          fwrite (hex, 1, hex_len, stream);
         }
 
-      fprintf (stream, "\n");
+      if (0 == buf.len)
+        fprintf (stream, "\n");
     }
 
 }
@@ -118,11 +158,12 @@ void init_cli (struct arguments *args)
   static const struct command state_cmd = {"state", cli_get_state };
   static const struct command config_cmd = {"get-config", cli_get_config_zone };
   static const struct command otp_cmd = {"get-otp", cli_get_otp_zone };
+  static const struct command dump_cmd = {"dump", cli_dump };
   static const struct command hash_cmd = {CMD_HASH, cli_hash };
   static const struct command personalize_cmd = {"personalize",
                                                  cli_personalize };
   static const struct command mac_cmd = {"mac", cli_mac };
-  static const struct command print_keys_cmd = {"print-keys", cli_print_keys };
+  static const struct command print_keys_cmd = {CMD_PRINT_KEYS, cli_print_keys };
   static const struct command offline_verify_cmd =
     {CMD_OFFLINE_VERIFY, cli_verify_mac };
   static const struct command offline_hmac_verify_cmd =
@@ -132,6 +173,12 @@ void init_cli (struct arguments *args)
   static const struct command read_key_cmd = {"read", cli_read_key_slot };
   static const struct command nonce_cmd = {"nonce", cli_get_nonce };
   static const struct command hmac_cmd = {"hmac", cli_hmac};
+  static const struct command attest_cmd = {CMD_ATTEST, cli_attest };
+  static const struct command offline_attest_cmd =
+    {CMD_OFFLINE_ATTEST, cli_verify_attest };
+  static const struct command fleet_add_cmd = {CMD_FLEET_ADD, cli_fleet_add };
+  static const struct command stats_cmd = {CMD_STATS, cli_stats };
+  static const struct command provision_cmd = {CMD_PROVISION, cli_provision };
 
   int x = 0;
 
@@ -140,6 +187,7 @@ void init_cli (struct arguments *args)
   x = add_command (state_cmd, x);
   x = add_command (config_cmd, x);
   x = add_command (otp_cmd, x);
+  x = add_command (dump_cmd, x);
   x = add_command (hash_cmd, x);
   x = add_command (personalize_cmd, x);
   x = add_command (mac_cmd, x);
@@ -151,6 +199,11 @@ void init_cli (struct arguments *args)
   x = add_command (read_key_cmd, x);
   x = add_command (nonce_cmd, x);
   x = add_command (hmac_cmd, x);
+  x = add_command (attest_cmd, x);
+  x = add_command (offline_attest_cmd, x);
+  x = add_command (fleet_add_cmd, x);
+  x = add_command (stats_cmd, x);
+  x = add_command (provision_cmd, x);
 
   set_defaults (args);
 
@@ -176,10 +229,31 @@ bool offline_cmd (const char *command)
     is_offline = true;
   else if (cmp_commands (command, CMD_HASH))
     is_offline = true;
+  else if (cmp_commands (command, CMD_OFFLINE_ATTEST))
+    is_offline = true;
+  else if (cmp_commands (command, CMD_PRINT_KEYS))
+    is_offline = true;
+  else if (cmp_commands (command, CMD_FLEET_ADD))
+    is_offline = true;
+  else if (cmp_commands (command, CMD_STATS))
+    is_offline = true;
+  /* Opens each of the devices it is given itself */
+  else if (cmp_commands (command, CMD_PROVISION))
+    is_offline = true;
 
   return is_offline;
 }
 
+bool accepts_files (const char *command)
+{
+  assert (NULL != command);
+
+  return cmp_commands (command, CMD_HASH) ||
+    cmp_commands (command, CMD_ATTEST) ||
+    cmp_commands (command, CMD_OFFLINE_ATTEST) ||
+    cmp_commands (command, CMD_PROVISION);
+}
+
 int dispatch (const char *command, struct arguments *args)
 {
 
@@ -190,6 +264,8 @@ int dispatch (const char *command, struct arguments *args)
 
   if ((cmd = find_command (command)) == NULL)
     printf ("%s", "Command not found.  Try --help\n");
+  else if (args->num_files > 0 && !accepts_files (command))
+    fprintf (stderr, "%s", "Too many arguments.  Try --help\n");
   else
     {
       assert (NULL != cmd->func);
@@ -247,6 +323,39 @@ void close_input_file (struct arguments *args, FILE *f)
     }
 }
 
+#if HAVE_GCRYPT_H
+/**
+ * Reduces the input to the 32 byte challenge used by the MAC
+ * commands: the SHA256 of the input or, with --tree, the root of its
+ * tree hash.
+ *
+ * @param args The arguments
+ * @param f The open input stream
+ * @param tree If not NULL, filled in with the tree details.  leaves is
+ * zero when the plain SHA256 was used.
+ *
+ * @return The malloc'd digest, buf.ptr is NULL on error
+ */
+struct octet_buffer digest_input (struct arguments *args, FILE *f,
+                                  struct tree_hash *tree)
+{
+  assert (NULL != args);
+  assert (NULL != f);
+
+  struct tree_hash result = { .root = {0,0}, .chunk_size = 0, .leaves = 0 };
+
+  if (0 == args->tree_chunk)
+    result.root = sha256 (f);
+  else
+    result = tree_hash_fd (fileno (f), args->tree_chunk, args->jobs);
+
+  if (NULL != tree)
+    *tree = result;
+
+  return result.root;
+}
+#endif
+
 bool is_expected_len (const char* arg, unsigned int len)
 {
   assert (NULL != arg);
@@ -351,6 +460,32 @@ int cli_get_config_zone (int fd, struct arguments *args)
 
 }
 
+int cli_dump (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  FILE *out = stdout;
+  assert (NULL != args);
+
+  if (0 != strcmp ("-", args->output_file) &&
+      (out = fopen (args->output_file, "w")) == NULL)
+    perror ("Failed to open output file");
+  else
+    {
+      if (dump_device (fd, out))
+        result = HASHLET_COMMAND_SUCCESS;
+      else
+        fprintf (stderr, "%s\n", "Not everything readable could be read");
+
+      if (stdout != out && 0 != fclose (out))
+        {
+          perror ("Failed to write the dump");
+          result = HASHLET_COMMAND_FAIL;
+        }
+    }
+
+  return result;
+}
+
 int cli_get_otp_zone (int fd, struct arguments *args)
 {
   struct octet_buffer response;
@@ -378,6 +513,37 @@ int cli_get_otp_zone (int fd, struct arguments *args)
 
 }
 
+#if HAVE_GCRYPT_H
+int cli_hash_files (struct arguments *args)
+{
+  int result = HASHLET_COMMAND_SUCCESS;
+  struct file_list list;
+  struct file_digest *digests;
+  unsigned int x;
+
+  collect_files (args->files, args->num_files, &list);
+
+  digests = hash_files (&list, args->jobs);
+
+  for (x = 0; x < list.count; x++)
+    {
+      if (NULL != digests[x].digest.ptr)
+        output_sha256sum (stdout, list.paths[x], digests[x].digest);
+      else
+        {
+          fprintf (stderr, "%s: %s\n", list.paths[x],
+                   strerror (digests[x].error));
+          result = HASHLET_COMMAND_FAIL;
+        }
+    }
+
+  free_file_digests (digests, list.count);
+  free_file_list (&list);
+
+  return result;
+}
+#endif
+
 int cli_hash (int fd, struct arguments *args)
 {
 
@@ -387,16 +553,24 @@ int cli_hash (int fd, struct arguments *args)
 
 #if HAVE_GCRYPT_H
   FILE *f;
-  if ((f = get_input_file (args)) == NULL)
+  if (args->num_files > 0)
+    {
+      result = cli_hash_files (args);
+    }
+  else if ((f = get_input_file (args)) == NULL)
     {
       perror ("Failed to open file");
     }
   else
     {
-      response = sha256 (f);
+      struct tree_hash tree;
+
+      response = digest_input (args, f, &tree);
       if (NULL != response.ptr)
         {
           output_hex (stdout, response);
+          if (tree.leaves > 0)
+            output_tree_layout (stdout, tree);
           free_octet_buffer (response);
           result = HASHLET_COMMAND_SUCCESS;
         }
@@ -461,6 +635,7 @@ int cli_mac (int fd, struct arguments *args)
 #if HAVE_GCRYPT_H
   struct mac_response rsp;
   struct octet_buffer challenge;
+  struct tree_hash tree;
   FILE *f;
   if ((f = get_input_file (args)) == NULL)
     {
@@ -468,7 +643,7 @@ int cli_mac (int fd, struct arguments *args)
     }
   else
     {
-      challenge = sha256 (f);
+      challenge = digest_input (args, f, &tree);
       if (NULL != challenge.ptr)
         {
           rsp = perform_mac (fd, args->mac_mode,
@@ -477,6 +652,8 @@ int cli_mac (int fd, struct arguments *args)
           if (rsp.status)
             {
               print_mac_result (stdout, challenge, rsp.mac, rsp.meta);
+              if (tree.leaves > 0)
+                output_tree_layout (stdout, tree);
 
               free_octet_buffer (rsp.mac);
               free_octet_buffer (rsp.meta);
@@ -501,97 +678,155 @@ int cli_print_keys (int fd, struct arguments *args)
   assert (NULL != args);
 
   FILE *fp;
+  struct parsed_key keys[KEY_FILE_SLOTS];
+  struct key_file_error error;
 
-  if (NULL == args->input_file)
-    fp = stdin;
-  else
-    fp = fopen (args->input_file, "r");
-
-  if (NULL != fp && 0 == parse_file (fp))
+  if ((fp = get_input_file (args)) == NULL)
+    perror ("Failed to open file");
+  else if (0 == parse_key_file (fp, keys, &error))
     {
       int x = 0;
 
-      for (x=0; x < 16; x++)
+      for (x=0; x < KEY_FILE_SLOTS; x++)
         {
-          const char *key;
-          if ((key = get_key (x)) != NULL)
+          if (keys[x].present)
             {
-              printf ("Key %d: %s\n", x, key);
-              struct octet_buffer bkey;
-              bkey = ascii_hex_2_bin (key, 64);
-              print_hex_string ("Binary Key", bkey.ptr, bkey.len);
-              free_octet_buffer (bkey);
+              struct octet_buffer bkey = { keys[x].key, KEY_FILE_KEY_LEN };
+              printf ("Key %d: ", x);
+              output_hex (stdout, bkey);
             }
         }
 
-      close_input_file (args, fp);
+      wipe_parsed_keys (keys);
 
       result = HASHLET_COMMAND_SUCCESS;
     }
   else
     {
-      fprintf (stderr, "%s", "Invalid file or file failed to parse\n");
+      fprintf (stderr, "%s:%u:%u: %s\n",
+               NULL == args->input_file ? "-" : args->input_file,
+               error.line, error.column, error.message);
     }
 
+  if (NULL != fp)
+    close_input_file (args, fp);
 
   return result;
 
 }
-const char* get_key_from_store (unsigned int slot)
+#if HAVE_GCRYPT_H
+/**
+ * Loads the keys used by the offline commands into a key schedule, so
+ * the verifications that follow don't repeat the per key work.  With
+ * --serial, the keys are those of that device in the fleet store,
+ * otherwise the user's key store is used.
+ *
+ * @param args The args
+ *
+ * @return The schedule, or NULL if there is no valid key store or the
+ * device isn't in the fleet.  Free with free_key_schedule.
+ */
+struct key_schedule* get_key_schedule (struct arguments *args)
 {
-  FILE *fp;
-  const char *key = NULL;
-  const char *filename = get_key_store_name ();
-  assert (NULL != filename);
+  assert (NULL != args);
 
-  fp = fopen (filename, "r");
+  struct key_schedule *schedule = NULL;
+  struct key_store *store = NULL;
+  struct fleet_store *fleet = NULL;
+  const struct fleet_record *record = NULL;
+  unsigned int x;
 
-  if (NULL != fp)
+  if (NULL != args->serial)
+    {
+      char *filename = (NULL == args->fleet_file) ?
+        home_file_name (FLEET_STORE) : strdup (args->fleet_file);
+      struct octet_buffer serial = ascii_hex_2_bin (args->serial,
+                                                    2 * FLEET_SERIAL_LEN);
+
+      if ((fleet = open_fleet_store (filename, false)) == NULL)
+        fprintf (stderr, "%s: %s\n", filename, "Invalid fleet store");
+      else if (NULL == serial.ptr ||
+               (record = fleet_lookup (fleet, serial.ptr)) == NULL)
+        fprintf (stderr, "%s: %s\n", args->serial, "Device not in fleet");
+
+      if (NULL != serial.ptr)
+        free_octet_buffer (serial);
+      free (filename);
+    }
+  else
+    store = load_key_store ();
+
+  if (NULL != store || NULL != record)
     {
-      if (0 == parse_file (fp))
+      schedule = new_key_schedule ();
+
+      for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
         {
-          key = get_key (slot);
+          const uint8_t *key = (NULL != store) ?
+            key_store_slot (store, x) : fleet_record_slot (record, x);
+
+          if (NULL != key)
+            {
+              struct octet_buffer key_buf = { (uint8_t *)key,
+                                              KEY_STORE_KEY_LEN };
+              add_schedule_key (schedule, x, key_buf);
+            }
         }
-      fclose (fp);
     }
 
-  free ((char *)filename);
-
-  return key;
+  if (NULL != store)
+    close_key_store (store);
+  if (NULL != fleet)
+    close_fleet_store (fleet);
 
+  return schedule;
 }
+#endif
 
 int cli_verify_mac (int fd, struct arguments *args)
 {
   int result = HASHLET_COMMAND_FAIL;
   assert (NULL != args);
 #if HAVE_GCRYPT_H
-  const char* key;
-  struct octet_buffer challenge;
+  struct key_schedule *keys = NULL;
+  struct octet_buffer challenge = {0,0};
   struct octet_buffer challenge_rsp;
-  struct octet_buffer key_buf;
   const unsigned int SIZE_OF_256_BITS_ASCII = 64;
 
+  /* Without a challenge, it is recomputed from the input file */
+  bool digest_file = (NULL == args->challenge &&
+                      (NULL != args->input_file || 0 != args->tree_chunk));
+
   if (NULL == args->challenge_rsp)
     fprintf (stderr, "%s\n", "Challenge Response is blank");
-  else if (NULL == args->challenge)
-    fprintf (stderr, "%s\n", "Challenge is blank");
-  else if (NULL == args->challenge && NULL == args->input_file)
+  else if (NULL == args->challenge && !digest_file)
     fprintf (stderr, "%s\n", "No challenge specified on command line or file");
-  else if ((key = get_key_from_store (args->key_slot)) == NULL)
+  else if ((keys = get_key_schedule (args)) == NULL ||
+           !schedule_has_key (keys, args->key_slot))
     fprintf (stderr, "%s\n", "Invalid file or file failed to parse");
   else
     {
-      challenge = ascii_hex_2_bin (args->challenge, SIZE_OF_256_BITS_ASCII);
+      if (digest_file)
+        {
+          FILE *f;
+          if ((f = get_input_file (args)) == NULL)
+            perror ("Failed to open file");
+          else
+            {
+              challenge = digest_input (args, f, NULL);
+              close_input_file (args, f);
+            }
+        }
+      else
+        challenge = ascii_hex_2_bin (args->challenge, SIZE_OF_256_BITS_ASCII);
+
       challenge_rsp = ascii_hex_2_bin
         (args->challenge_rsp, SIZE_OF_256_BITS_ASCII);
-      key_buf = ascii_hex_2_bin (key, SIZE_OF_256_BITS_ASCII);
 
-      if (challenge.ptr != NULL && challenge_rsp.ptr != NULL &&
-          key_buf.ptr != NULL)
+      if (challenge.ptr != NULL && challenge_rsp.ptr != NULL)
         {
-          if (verify_hash_defaults (challenge, challenge_rsp, key_buf,
-              args->key_slot))
+          if (verify_mac_scheduled (keys, challenge, challenge_rsp,
+                                    args->key_slot))
             {
               result = HASHLET_COMMAND_SUCCESS;
             }
@@ -599,11 +834,14 @@ int cli_verify_mac (int fd, struct arguments *args)
             fprintf (stderr, "%s\n", "Verify MAC failed");
         }
 
-      free_octet_buffer (challenge);
-      free_octet_buffer (challenge_rsp);
-      free_octet_buffer (key_buf);
-      free_parsed_keys ();
+      if (NULL != challenge.ptr)
+        free_octet_buffer (challenge);
+      if (NULL != challenge_rsp.ptr)
+        free_octet_buffer (challenge_rsp);
     }
+
+  if (NULL != keys)
+    free_key_schedule (keys);
 #else
   printf ("%s\n", NO_GCRYPT);
 #endif
@@ -657,50 +895,157 @@ struct encrypted_write cli_mac_write (int fd, struct octet_buffer data,
                                    unsigned int slot, const char *ascii_key)
 {
 
-  struct encrypted_write result;
+  struct encrypted_write result = {{0,0}, {0,0}};
 
   struct octet_buffer key = {0,0};
+  struct slot_write w = { .slot = slot };
+  uint8_t payload[SLOT_WRITE_PAYLOAD_LEN];
+
+  assert (NULL != data.ptr && sizeof (w.data) == data.len);
 
   if (NULL != ascii_key)
     {
       key = ascii_hex_2_bin (ascii_key, 64);
     }
-  else
+
+  if (NULL == key.ptr || sizeof (w.key) != key.len)
     {
       CTX_LOG (DEBUG, "Previous key value not provided");
+      if (NULL != key.ptr)
+        free_octet_buffer (key);
       return result;
     }
 
+  memcpy (w.data, data.ptr, sizeof (w.data));
+  memcpy (w.key, key.ptr, sizeof (w.key));
 
-  struct octet_buffer otp = get_otp_zone (fd);
+  /* Only the Nonce and GenDig TempKey doesn't already hold are sent */
+  if (prepare_slot_write (fd, &w, payload))
+    {
+      result.encrypted = make_buffer (sizeof (w.data));
+      memcpy (result.encrypted.ptr, payload, sizeof (w.data));
 
-  struct octet_buffer nonce = get_nonce (fd);
+      result.mac = make_buffer (sizeof (payload) - sizeof (w.data));
+      memcpy (result.mac.ptr, payload + sizeof (w.data), result.mac.len);
 
-  struct octet_buffer nonce_temp_key = gen_temp_key_from_nonce (fd, nonce, otp);
+      wipe (payload, sizeof (payload));
+    }
 
-  assert (gen_digest (fd, DATA_ZONE, slot));
+  wipe ((uint8_t *)&w, sizeof (w));
+  free_octet_buffer (key);
 
-  struct octet_buffer temp_key = gen_temp_key_from_digest (fd, nonce_temp_key,
-                                                           slot, key);
+  return result;
 
-  result.encrypted = xor_buffers (temp_key, key);
+}
 
-  const uint8_t opcode = 0x12;
-  const uint8_t param1 = 0b10000010;
-  uint8_t param2[2] = {0};
+/**
+ * Parses a line of write --slots input: the slot, its new contents
+ * and its current contents, the last two in hex.
+ *
+ * @param line The line, which is modified
+ * @param w Filled in with the write
+ *
+ * @return True if the line is valid
+ */
+static bool parse_slot_write (char *line, struct slot_write *w)
+{
+  const char *SEPARATORS = " \t\r\n";
+  const unsigned int ASCII_KEY_SIZE = 64;
+  char *save = NULL;
+  char *slot = strtok_r (line, SEPARATORS, &save);
+  char *data = strtok_r (NULL, SEPARATORS, &save);
+  char *key = strtok_r (NULL, SEPARATORS, &save);
+  char *end = NULL;
+  unsigned long n;
+
+  if (NULL == key || NULL != strtok_r (NULL, SEPARATORS, &save))
+    return false;
 
-  param2[0] = slot_to_addr (DATA_ZONE, slot);
-  result.mac = mac_write (temp_key, opcode, param1, param2, data);
+  n = strtoul (slot, &end, 10);
 
-  print_hex_string ("OTP", otp.ptr, otp.len);
+  if ('\0' != *end || n >= MAX_NUM_DATA_SLOTS ||
+      !is_hex_arg (data, ASCII_KEY_SIZE) || !is_hex_arg (key, ASCII_KEY_SIZE))
+    return false;
 
-  free_octet_buffer (otp);
-  free_octet_buffer (nonce);
-  free_octet_buffer (nonce_temp_key);
-  free_octet_buffer (temp_key);
+  w->slot = n;
+  w->written = false;
 
-  return result;
+  return hex_decode (w->data, data, ASCII_KEY_SIZE) &&
+    hex_decode (w->key, key, ASCII_KEY_SIZE);
+}
+
+/**
+ * Writes every slot listed in the input, in one session, and reports
+ * each slot's result.
+ *
+ * @param fd The open file descriptor
+ * @param args The args
+ *
+ * @return The exit code, success only if every slot was written
+ */
+static int write_slot_list (int fd, struct arguments *args)
+{
+  struct slot_write writes[MAX_NUM_DATA_SLOTS];
+  unsigned int num_writes = 0;
+  unsigned int line_num = 0;
+  unsigned int written = 0;
+  unsigned int x;
+  /* The lines hold keys, so they are read into one buffer that is
+     wiped, rather than one getline may move around the heap.  A
+     valid line is much shorter. */
+  char line[256];
+  bool valid = true;
+  FILE *f;
+
+  if ((f = get_input_file (args)) == NULL)
+    {
+      perror ("Failed to open file");
+      return HASHLET_COMMAND_FAIL;
+    }
+
+  while (valid && NULL != fgets (line, sizeof (line), f))
+    {
+      size_t len = strlen (line);
+
+      line_num++;
+
+      if (sizeof (line) - 1 == len && '\n' != line[len - 1] && !feof (f))
+        {
+          fprintf (stderr, "Line %u is too long\n", line_num);
+          valid = false;
+        }
+      else if ('#' == line[0] || strspn (line, " \t\r\n") == len)
+        continue;
+      else if (MAX_NUM_DATA_SLOTS == num_writes)
+        {
+          fprintf (stderr, "At most %u slots may be written at once\n",
+                   MAX_NUM_DATA_SLOTS);
+          valid = false;
+        }
+      else if (!parse_slot_write (line, &writes[num_writes++]))
+        {
+          fprintf (stderr, "Line %u is not SLOT DATA KEY\n", line_num);
+          valid = false;
+        }
+    }
+
+  wipe ((uint8_t *)line, sizeof (line));
+
+  close_input_file (args, f);
+
+  if (valid)
+    {
+      written = write_slots (fd, writes, num_writes);
+
+      for (x = 0; x < num_writes; x++)
+        printf ("%2u %s\n", writes[x].slot,
+                writes[x].written ? "written" : "failed");
+    }
 
+  wipe ((uint8_t *)writes, sizeof (writes));
+
+  return valid && written == num_writes ?
+    HASHLET_COMMAND_SUCCESS : HASHLET_COMMAND_FAIL;
 }
 
 int cli_write_to_key_slot (int fd, struct arguments *args)
@@ -713,6 +1058,9 @@ int cli_write_to_key_slot (int fd, struct arguments *args)
 
   struct octet_buffer key = {0,0};
 
+  if (args->write_slots)
+    return write_slot_list (fd, args);
+
   if (NULL == args->write_data)
     fprintf (stderr, "%s\n" ,"Pass the key slot data in the -w option");
 
@@ -817,7 +1165,8 @@ int cli_hmac (int fd, struct arguments *args)
     {
       /* Digest the file then proceed */
       struct octet_buffer file_digest = {0,0};
-      file_digest = sha256 (f);
+      struct tree_hash tree;
+      file_digest = digest_input (args, f, &tree);
       close_input_file (args, f);
 
       print_hex_string ("HMAC file digest", file_digest.ptr, file_digest.len);
@@ -834,6 +1183,8 @@ int cli_hmac (int fd, struct arguments *args)
               if (NULL != rsp.ptr)
                 {
                   output_hex (stdout, rsp);
+                  if (tree.leaves > 0)
+                    output_tree_layout (stdout, tree);
                   free_octet_buffer (rsp);
                   result = HASHLET_COMMAND_SUCCESS;
                 }
@@ -857,15 +1208,15 @@ int cli_verify_hmac (int fd, struct arguments *args)
 {
   int result = HASHLET_COMMAND_FAIL;
   assert (NULL != args);
-  const char* key;
+  struct key_schedule *keys = NULL;
   struct octet_buffer challenge = {0,0};
   struct octet_buffer challenge_rsp = {0,0};
-  struct octet_buffer key_buf = {0,0};
   const unsigned int SIZE_OF_256_BITS_ASCII = 64;
 
   if (NULL == args->challenge_rsp)
     fprintf (stderr, "%s\n", "Challenge Response is blank");
-  else if ((key = get_key_from_store (args->key_slot)) == NULL)
+  else if ((keys = get_key_schedule (args)) == NULL ||
+           !schedule_has_key (keys, args->key_slot))
     fprintf (stderr, "%s\n", "Invalid file or file failed to parse");
   else
     {
@@ -878,13 +1229,14 @@ int cli_verify_hmac (int fd, struct arguments *args)
             }
           else
             {
-              challenge = sha256 (f);
+              challenge = digest_input (args, f, NULL);
+              close_input_file (args, f);
             }
         }
       else
         {
           //read the challenge from stdin
-          challenge = sha256 (stdin);
+          challenge = digest_input (args, stdin, NULL);
         }
 
       if (NULL == challenge.ptr)
@@ -895,28 +1247,356 @@ int cli_verify_hmac (int fd, struct arguments *args)
         {
           challenge_rsp = ascii_hex_2_bin
             (args->challenge_rsp, SIZE_OF_256_BITS_ASCII);
-          key_buf = ascii_hex_2_bin (key, SIZE_OF_256_BITS_ASCII);
 
-          if (challenge.ptr != NULL && challenge_rsp.ptr != NULL &&
-              key_buf.ptr != NULL)
+          if (challenge_rsp.ptr != NULL)
             {
-              if (verify_hmac_defaults (challenge, challenge_rsp, key_buf,
-                                        args->key_slot))
+              if (verify_hmac_scheduled (keys, challenge, challenge_rsp,
+                                         args->key_slot))
                 {
                   result = HASHLET_COMMAND_SUCCESS;
                   CTX_LOG (DEBUG, "HMAC PASSED");
                 }
               else
                 fprintf (stderr, "%s\n", "Verify MAC failed");
+
+              free_octet_buffer (challenge_rsp);
             }
 
           free_octet_buffer (challenge);
-          free_octet_buffer (challenge_rsp);
-          free_octet_buffer (key_buf);
-          free_parsed_keys ();
         }
     }
 
+  if (NULL != keys)
+    free_key_schedule (keys);
+
+  return result;
+
+}
+
+#if HAVE_GCRYPT_H
+/**
+ * Returns the directory given to the attest commands.
+ *
+ * @param args The args
+ *
+ * @return The directory or NULL, after printing why, if there isn't
+ * exactly one.
+ */
+const char* get_attest_dir (struct arguments *args)
+{
+  assert (NULL != args);
+
+  struct stat st;
+
+  if (1 != args->num_files)
+    fprintf (stderr, "%s\n", "Give one directory to attest");
+  else if (0 != stat (args->files[0], &st))
+    perror (args->files[0]);
+  else if (!S_ISDIR (st.st_mode))
+    fprintf (stderr, "%s: %s\n", args->files[0], "Not a directory");
+  else
+    return args->files[0];
+
+  return NULL;
+}
+#endif
+
+int cli_attest (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  assert (NULL != args);
+
+#if HAVE_GCRYPT_H
+  const char *dir;
+  char *cache = NULL;
+  struct manifest manifest;
+  struct octet_buffer root;
+  struct mac_response rsp;
+  bool to_stdout = (0 == strcmp ("-", args->output_file));
+  FILE *out;
+
+  if ((dir = get_attest_dir (args)) == NULL)
+    return result;
+
+  if (args->use_cache)
+    cache = get_digest_cache_name ();
+
+  if (!build_manifest (dir, args->jobs, cache, &manifest))
+    fprintf (stderr, "%s\n", "Failed to hash the directory");
+  else
+    {
+      root = manifest_root (&manifest);
+      rsp = perform_mac (fd, args->mac_mode, args->key_slot, root);
+
+      if (!rsp.status)
+        fprintf (stderr, "%s\n", "MAC Command failed.");
+      else if ((out = to_stdout ? stdout :
+                fopen (args->output_file, "w")) == NULL)
+        perror ("Failed to open output file");
+      else
+        {
+          output_manifest (out, &manifest);
+          if (!to_stdout && 0 != fclose (out))
+            perror ("Failed to close output file");
+          else
+            result = HASHLET_COMMAND_SUCCESS;
+
+          print_mac_result (stdout, root, rsp.mac, rsp.meta);
+        }
+
+      if (rsp.status)
+        {
+          free_octet_buffer (rsp.mac);
+          free_octet_buffer (rsp.meta);
+        }
+
+      free_octet_buffer (root);
+      free_manifest (&manifest);
+    }
+
+  free (cache);
+#else
+  printf ("%s\n", NO_GCRYPT);
+#endif
+
+  return result;
+}
+
+int cli_verify_attest (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  assert (NULL != args);
+
+#if HAVE_GCRYPT_H
+  const char *dir;
+  struct key_schedule *keys = NULL;
+  struct manifest expected, actual;
+  const unsigned int SIZE_OF_256_BITS_ASCII = 64;
+  bool parsed = false;
+  FILE *f;
+
+  if ((dir = get_attest_dir (args)) == NULL)
+    return result;
+
+  if (NULL == args->challenge_rsp)
+    fprintf (stderr, "%s\n", "Challenge Response is blank");
+  else if ((keys = get_key_schedule (args)) == NULL ||
+           !schedule_has_key (keys, args->key_slot))
+    fprintf (stderr, "%s\n", "Invalid file or file failed to parse");
+  else if ((f = get_input_file (args)) == NULL)
+    perror ("Failed to open file");
+  else
+    {
+      parsed = read_manifest (f, &expected);
+      close_input_file (args, f);
+    }
+
+  if (parsed)
+    {
+      struct octet_buffer root = manifest_root (&expected);
+      struct octet_buffer challenge_rsp =
+        ascii_hex_2_bin (args->challenge_rsp, SIZE_OF_256_BITS_ASCII);
+      bool mac_ok = false;
+      bool files_ok = false;
+
+      if (NULL != challenge_rsp.ptr)
+        mac_ok = verify_mac_scheduled (keys, root, challenge_rsp,
+                                       args->key_slot);
+
+      if (!mac_ok)
+        fprintf (stderr, "%s\n", "Verify MAC failed");
+      else if (build_manifest (dir, args->jobs, NULL, &actual))
+        {
+          files_ok = compare_manifests (&expected, &actual);
+          free_manifest (&actual);
+        }
+
+      if (mac_ok && !files_ok)
+        fprintf (stderr, "%s\n", "Directory does not match the manifest");
+      else if (mac_ok)
+        result = HASHLET_COMMAND_SUCCESS;
+
+      free_octet_buffer (root);
+      if (NULL != challenge_rsp.ptr)
+        free_octet_buffer (challenge_rsp);
+      free_manifest (&expected);
+    }
+
+  if (NULL != keys)
+    free_key_schedule (keys);
+#else
+  printf ("%s\n", NO_GCRYPT);
+#endif
+
   return result;
+}
+
+int cli_fleet_add (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  assert (NULL != args);
+
+  struct key_container *keys = NULL;
+  struct octet_buffer serial = {0,0};
+  struct fleet_store *fleet = NULL;
+  char *filename;
+
+  if (NULL == args->serial)
+    {
+      fprintf (stderr, "%s\n", "Give the device's serial number with --serial");
+      return result;
+    }
+
+  if (NULL == args->input_file)
+    {
+      fprintf (stderr, "%s\n", "Give the device's key file with -f");
+      return result;
+    }
+
+  filename = (NULL == args->fleet_file) ?
+    home_file_name (FLEET_STORE) : strdup (args->fleet_file);
+
+  if ((keys = import_keys (args->input_file)) == NULL)
+    fprintf (stderr, "%s\n", "Failed to import key file");
+  else if ((serial = ascii_hex_2_bin (args->serial,
+                                      2 * FLEET_SERIAL_LEN)).ptr == NULL)
+    fprintf (stderr, "%s\n", "Invalid serial number");
+  else if ((fleet = open_fleet_store (filename, true)) == NULL)
+    fprintf (stderr, "%s: %s\n", filename, "Invalid fleet store");
+  else if (!fleet_add (fleet, serial.ptr, keys))
+    perror ("Failed to add the device");
+  else
+    result = HASHLET_COMMAND_SUCCESS;
+
+  if (NULL != fleet)
+    close_fleet_store (fleet);
+  if (NULL != serial.ptr)
+    free_octet_buffer (serial);
+  if (NULL != keys)
+    free_key_container (keys);
+  free (filename);
+
+  return result;
+}
+
+int cli_stats (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  assert (NULL != args);
 
+  struct device_stats *devices = NULL;
+  unsigned int count = 0;
+  char *filename = home_file_name (STATS_FILE);
+  char *tmp = NULL;
+  FILE *out;
+
+  if (!load_stats (filename, &devices, &count))
+    fprintf (stderr, "%s: %s\n", filename, "No statistics recorded");
+  else if (0 == strcmp ("-", args->output_file))
+    {
+      output_stats (stdout, devices, count);
+      result = HASHLET_COMMAND_SUCCESS;
+    }
+  /* The textfile collector may read at any time, so write a
+     temporary file and rename it into place. */
+  else if ((tmp = malloc (strlen (args->output_file) + 5)) == NULL)
+    perror ("Failed to allocate");
+  else if ((out = fopen (strcat (strcpy (tmp, args->output_file), ".tmp"),
+                         "w")) == NULL)
+    perror ("Failed to open output file");
+  else
+    {
+      output_prometheus (out, devices, count);
+
+      if (0 != fclose (out) || 0 != rename (tmp, args->output_file))
+        {
+          perror ("Failed to write output file");
+          unlink (tmp);
+        }
+      else
+        result = HASHLET_COMMAND_SUCCESS;
+    }
+
+  free (tmp);
+  free (devices);
+  free (filename);
+
+  return result;
+}
+
+int cli_provision (int fd, struct arguments *args)
+{
+  int result = HASHLET_COMMAND_FAIL;
+  assert (NULL != args);
+
+#if HAVE_GCRYPT_H
+  unsigned int count = (0 == args->num_files) ? 1 : args->num_files;
+  struct provision_target *targets = calloc (count, sizeof (*targets));
+  struct provision_result *results = calloc (count, sizeof (*results));
+  struct fleet_store *fleet = NULL;
+  struct timespec start, end;
+  char *filename;
+  FILE *out = stdout;
+  unsigned int x;
+  bool ok = true;
+
+  assert (NULL != targets && NULL != results);
+
+  filename = (NULL == args->fleet_file) ?
+    home_file_name (FLEET_STORE) : strdup (args->fleet_file);
+
+  /* Without devices on the command line, provision the one given by
+     -b and -a */
+  targets[0].bus = args->bus;
+  targets[0].address = args->address;
+
+  for (x = 0; x < args->num_files && ok; x++)
+    if (!(ok = parse_provision_target (args->files[x], args->bus,
+                                       &targets[x])))
+      fprintf (stderr, "%s: %s\n", args->files[x], "Invalid device");
+
+  if (!ok)
+    fprintf (stderr, "%s\n", "Give devices as BUS:ADDRESS or ADDRESS, in hex");
+  else if ((fleet = open_fleet_store (filename, true)) == NULL)
+    fprintf (stderr, "%s: %s\n", filename, "Invalid fleet store");
+  else if (0 != strcmp ("-", args->output_file) &&
+           (out = fopen (args->output_file, "w")) == NULL)
+    perror ("Failed to open output file");
+  else
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      provision_devices (targets, count, args->jobs, args->host_rng, fleet,
+                         NULL, results);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      output_provision_report (out, results, count,
+                               (end.tv_sec - start.tv_sec) * 1000000ULL +
+                               (end.tv_nsec - start.tv_nsec) / 1000);
+
+      result = HASHLET_COMMAND_SUCCESS;
+      for (x = 0; x < count; x++)
+        if (PROVISION_OK != results[x].status &&
+            PROVISION_SKIPPED != results[x].status)
+          result = HASHLET_COMMAND_FAIL;
+
+      if (stdout != out && 0 != fclose (out))
+        {
+          perror ("Failed to write the report");
+          result = HASHLET_COMMAND_FAIL;
+        }
+    }
+
+  if (NULL != fleet)
+    close_fleet_store (fleet);
+  for (x = 0; x < count; x++)
+    if (targets[x].bus != args->bus)
+      free ((char *)targets[x].bus);
+  free (filename);
+  free (results);
+  free (targets);
+#else
+  printf ("%s\n", NO_GCRYPT);
+#endif
+
+  return result;
 }
@@ -36,6 +36,12 @@
 #define CMD_OFFLINE_VERIFY "offline-verify"
 #define CMD_OFFLINE_HMAC_VERIFY "offline-hmac"
 #define CMD_HASH "hash"
+#define CMD_PRINT_KEYS "print-keys"
+#define CMD_FLEET_ADD "fleet-add"
+#define CMD_ATTEST "attest"
+#define CMD_OFFLINE_ATTEST "offline-attest"
+#define CMD_STATS "stats"
+#define CMD_PROVISION "provision"
 
 /* Used by main to communicate with parse_opt. */
 struct arguments
@@ -55,6 +61,17 @@ struct arguments
   const char *meta;
   const char *write_data;
   const char *bus;
+  char **files;                 /**< Positional args after the command */
+  unsigned int num_files;
+  unsigned int jobs;            /**< Worker threads, 0 for one per core */
+  uint64_t tree_chunk;          /**< Tree hash chunk size, 0 if disabled */
+  bool use_cache;               /**< Use the attest digest cache */
+  const char *serial;           /**< Device serial number, in hex */
+  const char *fleet_file;       /**< Fleet store, NULL for the default */
+  const char *log_file;         /**< Log file, NULL for stderr */
+  bool use_syslog;              /**< Log to syslog */
+  bool host_rng;                /**< Generate keys on the host */
+  bool write_slots;             /**< write takes its slots from the input */
 };
 
 struct command
@@ -88,7 +105,7 @@ int dispatch (const char *command, struct arguments *args);
  */
 void init_cli (struct arguments * args);
 
-#define NUM_CLI_COMMANDS 16
+#define NUM_CLI_COMMANDS 22
 
 /**
  * Gets random from the device
@@ -131,6 +148,18 @@ int cli_get_state (int fd, struct arguments *args);
  */
 int cli_get_config_zone (int fd, struct arguments *args);
 
+/**
+ * Reads the configuration and OTP zones and every data slot that can
+ * be read in the clear, in one session, and writes them as JSON to
+ * the output file.
+ *
+ * @param fd The open file descriptor
+ * @param args The arguments
+ *
+ * @return the exit code
+ */
+int cli_dump (int fd, struct arguments *args);
+
 /**
  * Retrieves the entire OTP Zone
  *
@@ -141,7 +170,10 @@ int cli_get_config_zone (int fd, struct arguments *args);
  */
 int cli_get_otp_zone (int fd, struct arguments *args);
 /**
- * Performs a straight SHA256 of data, meant for testing purposes
+ * Performs a straight SHA256 of data.  With no file arguments, the
+ * input file or stdin is hashed.  Otherwise every file, and every file
+ * below any directory, is hashed concurrently and printed in
+ * sha256sum format.
  *
  * @param fd The open file descriptor
  * @param args The argument structure
@@ -216,6 +248,8 @@ int cli_check_mac (int fd, struct arguments *args);
 
 /**
  * Attempts to write to the key slot specified by the key slot option.
+ * With --slots, writes each slot listed in the input instead, as
+ * lines of the slot, its new contents and its current contents.
  *
  * @param fd The open file descriptor.
  * @param args The args
@@ -281,4 +315,67 @@ struct encrypted_write cli_mac_write (int fd, struct octet_buffer data,
  */
 int cli_hmac (int fd, struct arguments *args);
 
+/**
+ * Attests a directory.  Every file below it is hashed concurrently,
+ * reusing the digests of unchanged files from the digest cache, and
+ * the root of the resulting manifest is MAC'd by the device.  The
+ * manifest is written to the output file, the MAC result to stdout.
+ *
+ * @param fd The open file descriptor
+ * @param args The args
+ *
+ * @return the exit code
+ */
+int cli_attest (int fd, struct arguments *args);
+
+/**
+ * Verifies an attested directory without the device.  The directory
+ * is hashed again and compared with the manifest read from the input
+ * file, and the MAC of the manifest root is checked with the key
+ * file.
+ *
+ * @param fd The open file descriptor
+ * @param args The args
+ *
+ * @return the exit code
+ */
+int cli_verify_attest (int fd, struct arguments *args);
+
+/**
+ * Adds a device's keys, imported from a key file, to the fleet store
+ * under its serial number.  The offline commands find them again with
+ * --serial.
+ *
+ * @param fd The open file descriptor
+ * @param args The args
+ *
+ * @return the exit code
+ */
+int cli_fleet_add (int fd, struct arguments *args);
+
+/**
+ * Prints the command counts and latencies recorded in
+ * ~/.hashlet_stats, or with -o writes them in the Prometheus text
+ * format to the given file.
+ *
+ * @param fd The open file descriptor
+ * @param args The args
+ *
+ * @return the exit code
+ */
+int cli_stats (int fd, struct arguments *args);
+
+/**
+ * Personalizes every device given as BUS:ADDRESS or ADDRESS, or the
+ * one given by -b and -a, with one worker per bus.  The keys are
+ * recorded in the fleet store and a report of each device and stage
+ * is printed.
+ *
+ * @param fd Unused, the command opens the devices itself
+ * @param args The args
+ *
+ * @return the exit code, failure if any device wasn't provisioned
+ */
+int cli_provision (int fd, struct arguments *args);
+
 #endif /* CLI_COMMANDS_H */
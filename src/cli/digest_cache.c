@@ -0,0 +1,239 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "digest_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../driver/personalize.h"
+
+static const char CACHE_MAGIC[4] = { 'H', 'L', 'D', 'C' };
+static const uint32_t CACHE_VERSION = 1;
+
+struct cache_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t entry_size;
+};
+
+char* get_digest_cache_name (void)
+{
+  return home_file_name (DIGEST_CACHE);
+}
+
+static int cmp_entry (const void *lhs, const void *rhs)
+{
+  const struct digest_cache_entry *l = lhs;
+  const struct digest_cache_entry *r = rhs;
+
+  if (l->dev != r->dev)
+    return l->dev < r->dev ? -1 : 1;
+  if (l->ino != r->ino)
+    return l->ino < r->ino ? -1 : 1;
+
+  return 0;
+}
+
+static struct digest_cache_entry* find_entry (const struct digest_cache *cache,
+                                              const struct stat *st)
+{
+  struct digest_cache_entry key = { .dev = st->st_dev, .ino = st->st_ino };
+
+  return bsearch (&key, cache->entries, cache->sorted,
+                  sizeof (struct digest_cache_entry), cmp_entry);
+}
+
+void load_digest_cache (const char *filename, struct digest_cache *cache)
+{
+  assert (NULL != filename);
+  assert (NULL != cache);
+
+  struct cache_header header;
+  FILE *f;
+
+  cache->entries = NULL;
+  cache->used = NULL;
+  cache->count = 0;
+  cache->sorted = 0;
+  cache->capacity = 0;
+
+  if ((f = fopen (filename, "r")) == NULL)
+    return;
+
+  if (1 == fread (&header, sizeof (header), 1, f) &&
+      0 == memcmp (header.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC)) &&
+      CACHE_VERSION == header.version &&
+      sizeof (struct digest_cache_entry) == header.entry_size &&
+      header.count > 0)
+    {
+      cache->entries = malloc (header.count *
+                               sizeof (struct digest_cache_entry));
+      assert (NULL != cache->entries);
+
+      if (header.count == fread (cache->entries,
+                                 sizeof (struct digest_cache_entry),
+                                 header.count, f))
+        {
+          cache->used = calloc (header.count, sizeof (uint8_t));
+          assert (NULL != cache->used);
+          cache->count = cache->sorted = cache->capacity = header.count;
+          qsort (cache->entries, cache->count,
+                 sizeof (struct digest_cache_entry), cmp_entry);
+        }
+      else
+        {
+          free (cache->entries);
+          cache->entries = NULL;
+        }
+    }
+
+  fclose (f);
+}
+
+const uint8_t* lookup_digest_cache (struct digest_cache *cache,
+                                    const struct stat *st)
+{
+  assert (NULL != cache);
+  assert (NULL != st);
+
+  const struct digest_cache_entry *e = find_entry (cache, st);
+
+  if (NULL != e &&
+      e->size == (uint64_t)st->st_size &&
+      e->mtime_sec == st->st_mtim.tv_sec &&
+      e->mtime_nsec == st->st_mtim.tv_nsec)
+    {
+      /* Hard links to one file may be looked up concurrently */
+      __atomic_store_n (&cache->used[e - cache->entries], 1,
+                        __ATOMIC_RELAXED);
+      return e->digest;
+    }
+
+  return NULL;
+}
+
+void update_digest_cache (struct digest_cache *cache, const struct stat *st,
+                          const uint8_t *digest)
+{
+  assert (NULL != cache);
+  assert (NULL != st);
+  assert (NULL != digest);
+
+  const time_t RACY_WINDOW = 2;
+  struct digest_cache_entry *e;
+
+  if (st->st_mtim.tv_sec + RACY_WINDOW >= time (NULL))
+    return;
+
+  if ((e = find_entry (cache, st)) == NULL)
+    {
+      if (cache->count == cache->capacity)
+        {
+          cache->capacity = cache->capacity ? cache->capacity * 2 : 256;
+          cache->entries = realloc (cache->entries, cache->capacity *
+                                    sizeof (struct digest_cache_entry));
+          cache->used = realloc (cache->used, cache->capacity);
+          assert (NULL != cache->entries && NULL != cache->used);
+        }
+
+      /* New entries go unsorted at the end until the cache is saved */
+      e = &cache->entries[cache->count++];
+      e->dev = st->st_dev;
+      e->ino = st->st_ino;
+    }
+
+  cache->used[e - cache->entries] = 1;
+  e->size = st->st_size;
+  e->mtime_sec = st->st_mtim.tv_sec;
+  e->mtime_nsec = st->st_mtim.tv_nsec;
+  memcpy (e->digest, digest, sizeof (e->digest));
+}
+
+bool save_digest_cache (const char *filename, struct digest_cache *cache)
+{
+  assert (NULL != filename);
+  assert (NULL != cache);
+
+  struct cache_header header;
+  bool result = false;
+  unsigned int x, kept = 0;
+  FILE *f;
+
+  size_t tmp_len = strlen (filename) + 5;
+  char *tmp = malloc (tmp_len);
+  assert (NULL != tmp);
+  snprintf (tmp, tmp_len, "%s.tmp", filename);
+
+  /* Drop the entries of files that weren't seen this run */
+  for (x = 0; x < cache->count; x++)
+    if (cache->used[x])
+      {
+        cache->entries[kept] = cache->entries[x];
+        cache->used[kept++] = 1;
+      }
+
+  cache->count = kept;
+
+  qsort (cache->entries, cache->count,
+         sizeof (struct digest_cache_entry), cmp_entry);
+  cache->sorted = cache->count;
+
+  memcpy (header.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  header.count = cache->count;
+  header.entry_size = sizeof (struct digest_cache_entry);
+
+  if ((f = fopen (tmp, "w")) != NULL)
+    {
+      result = (1 == fwrite (&header, sizeof (header), 1, f) &&
+                cache->count == fwrite (cache->entries,
+                                        sizeof (struct digest_cache_entry),
+                                        cache->count, f));
+
+      if (0 != fclose (f))
+        result = false;
+
+      if (result)
+        result = (0 == rename (tmp, filename));
+      else
+        unlink (tmp);
+    }
+
+  free (tmp);
+
+  return result;
+}
+
+void free_digest_cache (struct digest_cache *cache)
+{
+  assert (NULL != cache);
+
+  free (cache->entries);
+  free (cache->used);
+  cache->entries = NULL;
+  cache->used = NULL;
+  cache->count = cache->sorted = cache->capacity = 0;
+}
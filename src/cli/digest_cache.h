@@ -0,0 +1,112 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DIGEST_CACHE_H
+#define DIGEST_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define DIGEST_CACHE "/.hashlet_cache"
+
+/* One cached digest.  Entries are keyed by (dev, ino) and only used
+   while size and mtime still match. */
+struct digest_cache_entry
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint8_t digest[32];
+};
+
+struct digest_cache
+{
+  struct digest_cache_entry *entries;
+  uint8_t *used;                /**< Set for entries hit or updated this run */
+  unsigned int count;           /**< Number of entries */
+  unsigned int sorted;          /**< Entries below this index are sorted */
+  unsigned int capacity;        /**< Allocated entries */
+};
+
+/**
+ * Returns the default cache file, in the user's home directory.
+ *
+ * @return The malloc'd file name
+ */
+char* get_digest_cache_name (void);
+
+/**
+ * Loads the cache file.  A missing or unrecognized file gives an empty
+ * cache.
+ *
+ * @param filename The cache file
+ * @param cache The cache to fill in.  Free with free_digest_cache.
+ */
+void load_digest_cache (const char *filename, struct digest_cache *cache);
+
+/**
+ * Looks up the digest of the file described by st.  A hit marks the
+ * entry as used, so it is kept when the cache is saved.  Safe to call
+ * from several threads at once.
+ *
+ * @param cache The loaded cache
+ * @param st The file's status, from fstat on the open file
+ *
+ * @return A pointer to the 32 byte digest, or NULL if not cached or
+ * the file changed.
+ */
+const uint8_t* lookup_digest_cache (struct digest_cache *cache,
+                                    const struct stat *st);
+
+/**
+ * Records the digest of a file.  Files modified within the last two
+ * seconds are not recorded, as a later change within the same mtime
+ * tick would go unnoticed.
+ *
+ * @param cache The cache
+ * @param st The file's status when it was hashed
+ * @param digest The 32 byte digest
+ */
+void update_digest_cache (struct digest_cache *cache, const struct stat *st,
+                          const uint8_t *digest);
+
+/**
+ * Writes the cache file, replacing it atomically.  Entries that were
+ * neither hit nor updated since the cache was loaded are dropped, so
+ * deleted and replaced files don't accumulate.
+ *
+ * @param filename The cache file
+ * @param cache The cache
+ *
+ * @return True if written
+ */
+bool save_digest_cache (const char *filename, struct digest_cache *cache);
+
+/**
+ * Frees the cache entries.
+ *
+ * @param cache The cache
+ */
+void free_digest_cache (struct digest_cache *cache);
+
+#endif /* DIGEST_CACHE_H */
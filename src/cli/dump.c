@@ -0,0 +1,157 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "dump.h"
+#include <assert.h>
+#include <string.h>
+#include "../driver/command.h"
+#include "../driver/command_adaptation.h"
+#include "../driver/config_zone.h"
+#include "../driver/hex.h"
+
+#define SLOT_LEN 32
+
+/**
+ * Writes a JSON string of hex, or null if there is no data.
+ *
+ * @param out The stream
+ * @param bin The data, NULL for none
+ * @param len The length of data
+ */
+static void output_hex_value (FILE *out, const uint8_t *bin, unsigned int len)
+{
+  char hex[HEX_LEN (CONFIG_ZONE_LEN) + 1];
+
+  assert (len <= CONFIG_ZONE_LEN);
+
+  if (NULL == bin)
+    {
+      fprintf (out, "null");
+      return;
+    }
+
+  hex_encode (hex, bin, len);
+  hex[HEX_LEN (len)] = '\0';
+
+  fprintf (out, "\"%s\"", hex);
+}
+
+/**
+ * Returns the first slot from start on that can be read in the clear.
+ *
+ * @param readable Which slots can be read
+ * @param start The first slot to consider
+ *
+ * @return The slot, MAX_NUM_DATA_SLOTS if there is none
+ */
+static unsigned int next_readable (const bool *readable, unsigned int start)
+{
+  while (start < MAX_NUM_DATA_SLOTS && !readable[start])
+    start++;
+
+  return start;
+}
+
+bool dump_device (int fd, FILE *out)
+{
+  uint8_t config[CONFIG_ZONE_LEN];
+  uint8_t otp[OTP_ZONE_LEN];
+  uint8_t slot[SLOT_LEN];
+  uint8_t serial[9];
+  bool readable[MAX_NUM_DATA_SLOTS];
+  bool otp_read = false;
+  bool config_locked, data_locked;
+  const char *state;
+  struct pending_command p;
+  unsigned int x, next;
+  bool result;
+
+  assert (NULL != out);
+
+  if (RSP_SUCCESS != get_config_zone_into (fd, ARRAY_BUFFER (config)))
+    return false;
+
+  config_locked = UNLOCKED != config[LOCK_CONFIG];
+  data_locked = UNLOCKED != config[LOCK_VALUE];
+
+  if (config_locked && data_locked)
+    state = "Personalized";
+  else if (config_locked)
+    state = "Initialized";
+  else
+    state = "Factory";
+
+  /* Neither the OTP zone nor the data slots can be read until the
+     data zone is locked */
+  if (data_locked)
+    otp_read = RSP_SUCCESS == get_otp_zone_into (fd, ARRAY_BUFFER (otp));
+
+  result = otp_read || !data_locked;
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      struct slot_config s =
+        parse_slot_config (config + SLOT_CONFIG_OFFSET + x * SLOT_CONFIG_LEN);
+
+      readable[x] = data_locked && !s.is_secret && !s.encrypted_read;
+    }
+
+  memcpy (serial, config, 4);
+  memcpy (serial + 4, config + 8, 5);
+
+  fprintf (out, "{\n  \"serial\": ");
+  output_hex_value (out, serial, sizeof (serial));
+  fprintf (out, ",\n  \"state\": \"%s\",\n  \"config\": ", state);
+  output_hex_value (out, config, sizeof (config));
+  fprintf (out, ",\n  \"otp\": ");
+  output_hex_value (out, otp_read ? otp : NULL, sizeof (otp));
+  fprintf (out, ",\n  \"slots\": [\n");
+
+  if ((next = next_readable (readable, 0)) < MAX_NUM_DATA_SLOTS)
+    read32_issue (fd, DATA_ZONE, slot_to_addr (DATA_ZONE, next), &p);
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      bool read = false;
+
+      if (readable[x])
+        {
+          read = RSP_SUCCESS == read32_complete (fd, &p, ARRAY_BUFFER (slot));
+          result = result && read;
+
+          /* The next read runs while this slot is written out */
+          if ((next = next_readable (readable, x + 1)) < MAX_NUM_DATA_SLOTS)
+            read32_issue (fd, DATA_ZONE, slot_to_addr (DATA_ZONE, next), &p);
+        }
+
+      fprintf (out, "    {\"slot\": %u, \"readable\": %s, \"data\": ", x,
+               readable[x] ? "true" : "false");
+      output_hex_value (out, read ? slot : NULL, sizeof (slot));
+      fprintf (out, "}%s\n", x + 1 < MAX_NUM_DATA_SLOTS ? "," : "");
+    }
+
+  fprintf (out, "  ]\n}\n");
+
+  wipe (slot, sizeof (slot));
+  wipe (otp, sizeof (otp));
+
+  return result;
+}
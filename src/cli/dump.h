@@ -18,20 +18,25 @@
  *
  */
 
-%{
-#include "string.h"
-#include "hashlet_bison.h"
-%}
+#ifndef DUMP_H
+#define DUMP_H
 
-%option noyywrap
-%option nounput
-%option noinput
+#include <stdbool.h>
+#include <stdio.h>
 
-%%
-[ \t\n] ;    /* ignore whitespace */
-^[#]+.*$      {  } /* ignore comments */
-"key_slot_"   { return KEYSLOT; }
-[0-9][0-9]    { yylval.num = atoi (yytext); return KEY_NUMBER; }
-[A-Fa-f0-9]+  { yylval.hex = strdup (yytext); return HEX; }
-.    return yytext[0];
-%%
+/**
+ * Reads the configuration zone, the OTP zone and every data slot that
+ * can be read in the clear, in one session, and writes them as a JSON
+ * report.  Which slots can be read comes from the slot configurations
+ * in the configuration zone.  The reads of the slots are sent back to
+ * back, each one's result being written while the device executes
+ * the next.
+ *
+ * @param fd The open file descriptor
+ * @param out The stream for the report
+ *
+ * @return True if everything readable was read
+ */
+bool dump_device (int fd, FILE *out);
+
+#endif /* DUMP_H */
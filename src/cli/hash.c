@@ -21,46 +21,291 @@
 
 #if HAVE_GCRYPT_H
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <gcrypt.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "hash.h"
 #include "../driver/defs.h"
 
-struct octet_buffer sha256 (FILE *fp)
+/* Size of each read () when the input can't be mapped (pipes, stdin) */
+#define HASH_READ_CHUNK (1024 * 1024)
+
+/* Regular files are mapped in windows of this size so that very large
+   inputs don't exhaust the address space on 32 bit boards */
+#define HASH_MMAP_WINDOW (64 * 1024 * 1024)
+
+/* Mapped data is copied out in pieces of this size before it is
+   digested, so a SIGBUS never interrupts gcry_md_write () part way */
+#define HASH_COPY_CHUNK (64 * 1024)
+
+static pthread_once_t bus_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_bus;
+
+/* Set while this thread is copying out of a mapping */
+static __thread sigjmp_buf *bus_jump;
+
+/**
+ * SIGBUS handler.  A fault while copying out of a mapping means the
+ * file was truncated under us, so return to copy_mapped ().  Any
+ * other SIGBUS is handed back to the previous disposition: returning
+ * re-executes the faulting instruction, which faults again.
+ *
+ * @param sig The signal number
+ */
+static void on_sigbus (int sig)
 {
+  if (NULL != bus_jump)
+    siglongjmp (*bus_jump, 1);
 
-  struct octet_buffer digest;
+  sigaction (sig, &previous_bus, NULL);
+}
 
-  assert (NULL != fp);
+static void install_bus_handler (void)
+{
+  struct sigaction action;
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = on_sigbus;
+  /* Leave SIGBUS unblocked after the jump, since sigsetjmp () doesn't
+     save the mask */
+  action.sa_flags = SA_NODEFER;
+  sigemptyset (&action.sa_mask);
+
+  sigaction (SIGBUS, &action, &previous_bus);
+}
+
+/**
+ * Copy from a mapping of a file, surviving a truncation of the file.
+ *
+ * @param dst The destination buffer
+ * @param src The mapped source
+ * @param len The number of bytes to copy
+ *
+ * @return False if part of the source is no longer backed by the
+ * file, in which case dst holds nothing useful.
+ */
+static bool copy_mapped (uint8_t *dst, const uint8_t *src, size_t len)
+{
+  sigjmp_buf jump;
+
+  if (0 != sigsetjmp (jump, 0))
+    {
+      bus_jump = NULL;
+      return false;
+    }
+
+  bus_jump = &jump;
+  __atomic_signal_fence (__ATOMIC_SEQ_CST);
+  memcpy (dst, src, len);
+  __atomic_signal_fence (__ATOMIC_SEQ_CST);
+  bus_jump = NULL;
+
+  return true;
+}
+
+/**
+ * Feed part of a regular file into the digest by mapping it window by
+ * window.  If the file is truncated while mapped, hashing stops at the
+ * last piece that was still backed and the caller's read () then sees
+ * the new end of file, as it would have without the mapping.
+ *
+ * @param hd The open digest handle
+ * @param fd The open file descriptor
+ * @param pos The offset at which to start
+ * @param end The offset at which to stop
+ *
+ * @return The offset reached.  If less than end, the mapping failed
+ * or the file shrank, and the caller should continue with read ().
+ */
+static off_t digest_mapped (gcry_md_hd_t hd, int fd, off_t pos, off_t end)
+{
+  const off_t PAGE_SIZE = sysconf (_SC_PAGESIZE);
+  uint8_t chunk[HASH_COPY_CHUNK];
+  bool truncated = false;
+
+  pthread_once (&bus_once, install_bus_handler);
+
+  while (pos < end && !truncated)
+    {
+      off_t base = pos - (pos % PAGE_SIZE);
+      size_t window = end - base;
+      size_t off;
+
+      if (window > HASH_MMAP_WINDOW)
+        window = HASH_MMAP_WINDOW;
+
+      uint8_t *map = mmap (NULL, window, PROT_READ, MAP_PRIVATE, fd, base);
+
+      if (MAP_FAILED == map)
+        break;
+
+      madvise (map, window, MADV_SEQUENTIAL);
+
+      for (off = pos - base; off < window; off += HASH_COPY_CHUNK)
+        {
+          size_t len = window - off;
+
+          if (len > HASH_COPY_CHUNK)
+            len = HASH_COPY_CHUNK;
+
+          if (!copy_mapped (chunk, map + off, len))
+            {
+              truncated = true;
+              break;
+            }
+
+          gcry_md_write (hd, chunk, len);
+        }
+
+      munmap (map, window);
+
+      pos = base + (off < window ? off : window);
+    }
+
+  return pos;
+}
+
+bool sha256_write_range (gcry_md_hd_t hd, int fd, off_t offset, off_t length)
+{
+  assert (NULL != hd);
+  assert (offset >= 0 && length >= 0);
+
+  const off_t end = offset + length;
+  off_t pos = digest_mapped (hd, fd, offset, end);
+  uint8_t chunk[64 * 1024];
+
+  /* The mapping failed part way, so finish with pread () */
+  while (pos < end)
+    {
+      size_t want = end - pos < sizeof (chunk) ? end - pos : sizeof (chunk);
+      ssize_t got = pread (fd, chunk, want, pos);
+
+      if (got > 0)
+        {
+          gcry_md_write (hd, chunk, got);
+          pos += got;
+        }
+      else if (0 == got || EINTR != errno)
+        return false;
+    }
+
+  return true;
+}
+
+/**
+ * Feed the remainder of the stream into the digest with large reads.
+ *
+ * @param hd The open digest handle
+ * @param fd The open file descriptor
+ *
+ * @return True if the end of the stream was reached without error
+ */
+static bool digest_read (gcry_md_hd_t hd, int fd)
+{
+  void *chunk = NULL;
+  bool result = true;
+  ssize_t got;
+
+  if (0 != posix_memalign (&chunk, sysconf (_SC_PAGESIZE), HASH_READ_CHUNK))
+    return false;
+
+  while ((got = read (fd, chunk, HASH_READ_CHUNK)) != 0)
+    {
+      if (got > 0)
+        gcry_md_write (hd, chunk, got);
+      else if (EINTR != errno)
+        {
+          result = false;
+          break;
+        }
+    }
+
+  free (chunk);
+
+  return result;
+}
+
+struct octet_buffer sha256_fd (int fd)
+{
+  struct octet_buffer digest = {0,0};
+  struct stat st;
+  bool ok = true;
+
+  assert (fd >= 0);
   /* Init gcrypt */
   assert (NULL != gcry_check_version (NULL));
 
-  struct gcry_md_handle *hd;
-  struct gcry_md_handle **hd_ptr = &hd;
-
-  assert (GPG_ERR_NO_ERROR == gcry_md_open (hd_ptr, GCRY_MD_SHA256, 0));
+  gcry_md_hd_t hd;
 
-  int c;
+  assert (GPG_ERR_NO_ERROR == gcry_md_open (&hd, GCRY_MD_SHA256, 0));
 
-  /* Perform the hash */
-  while ((c = getc (fp)) != EOF)
+  /* Map regular files, stream everything else */
+  if (0 == fstat (fd, &st) && S_ISREG (st.st_mode))
     {
-      gcry_md_putc (hd, c);
+      off_t pos = lseek (fd, 0, SEEK_CUR);
+
+      if (pos >= 0)
+        {
+          pos = digest_mapped (hd, fd, pos, st.st_size);
+          ok = (pos == lseek (fd, pos, SEEK_SET));
+        }
     }
 
-  unsigned char *result;
+  if (ok)
+    ok = digest_read (hd, fd);
 
-  assert ((result = gcry_md_read (hd, GCRY_MD_SHA256)) != NULL);
+  if (ok)
+    {
+      unsigned char *result;
 
-  /* copy over to the digest */
-  const unsigned int DLEN = gcry_md_get_algo_dlen (GCRY_MD_SHA256);
-  digest = make_buffer (DLEN);
-  memcpy (digest.ptr, result, DLEN);
+      assert ((result = gcry_md_read (hd, GCRY_MD_SHA256)) != NULL);
+
+      /* copy over to the digest */
+      const unsigned int DLEN = gcry_md_get_algo_dlen (GCRY_MD_SHA256);
+      digest = make_buffer (DLEN);
+      memcpy (digest.ptr, result, DLEN);
+    }
 
   gcry_md_close (hd);
 
   return digest;
 }
 
+struct octet_buffer sha256 (FILE *fp)
+{
+  assert (NULL != fp);
+
+  return sha256_fd (fileno (fp));
+}
+
+struct octet_buffer sha256_file (const char *path)
+{
+  struct octet_buffer digest = {0,0};
+  int fd;
+
+  assert (NULL != path);
+
+  if ((fd = open (path, O_RDONLY)) >= 0)
+    {
+      digest = sha256_fd (fd);
+
+      int saved = errno;
+      close (fd);
+      errno = saved;
+    }
+
+  return digest;
+}
+
 struct octet_buffer sha256_buffer (struct octet_buffer data)
 {
   struct octet_buffer digest;
@@ -112,198 +357,241 @@ struct octet_buffer hmac_buffer (struct octet_buffer data_to_hash,
   return digest;
 }
 
-unsigned int copy_over(uint8_t *dst, const uint8_t *src, unsigned int src_len,
-                       unsigned int offset)
-{
-  memcpy(dst + offset, src, src_len);
-  return offset + src_len;
-}
-
+/* Length of the message digested by the MAC and HMAC commands in
+   their default modes */
+#define DEFAULT_MESSAGE_LEN 88
 
-struct octet_buffer perform_hash(struct octet_buffer challenge,
-                                 struct octet_buffer key,
-                                 uint8_t mode, uint16_t param2,
-                                 struct octet_buffer otp8,
-                                 struct octet_buffer otp3,
-                                 struct octet_buffer sn4,
-                                 struct octet_buffer sn23)
+/**
+ * Builds the default MAC or HMAC message in place: the key (or
+ * zeros for HMAC), the challenge, then the command parameters and the
+ * OTP and serial number fields.
+ *
+ * @param msg The destination, DEFAULT_MESSAGE_LEN bytes
+ * @param first The 32 bytes that lead the message
+ * @param challenge The 32 byte challenge
+ * @param opcode The command opcode
+ * @param mode The command mode
+ * @param param2 The command's param2, copied in host order
+ * @param otp8 8 bytes of the OTP zone
+ * @param otp3 3 bytes of the OTP zone
+ * @param sn4 4 bytes of the serial number
+ * @param sn23 2 bytes of the serial number
+ *
+ * @return The length of the message
+ */
+static unsigned int build_default_message (struct octet_buffer msg,
+                                           struct octet_buffer first,
+                                           struct octet_buffer challenge,
+                                           uint8_t opcode, uint8_t mode,
+                                           uint16_t param2,
+                                           struct octet_buffer otp8,
+                                           struct octet_buffer otp3,
+                                           struct octet_buffer sn4,
+                                           struct octet_buffer sn23)
 {
-
   assert (NULL != challenge.ptr); assert (32 == challenge.len);
-  assert (NULL != key.ptr); assert (32 == key.len);
+  assert (NULL != first.ptr); assert (32 == first.len);
   assert (NULL != otp8.ptr); assert (8 == otp8.len);
   assert (NULL != otp3.ptr); assert (3 == otp3.len);
   assert (NULL != sn4.ptr); assert (4 == sn4.len);
   assert (NULL != sn23.ptr); assert (2 == sn23.len);
 
-  const uint8_t opcode = {0x08};
   const uint8_t sn = 0xEE;
   const uint8_t sn2[] ={0x01, 0x23};
 
-  unsigned int len = challenge.len + key.len + sizeof(opcode) + sizeof(mode)
-    + sizeof(param2) + otp8.len + otp3.len + sizeof(sn)  + sn4.len
-    + sizeof(sn2) + sn23.len;
-
-  uint8_t *buf = malloc_wipe(len);
-
   unsigned int offset = 0;
-  offset = copy_over(buf, key.ptr, key.len, offset);
-  offset = copy_over(buf, challenge.ptr, challenge.len, offset);
-  offset = copy_over(buf, &opcode, sizeof(opcode), offset);
-  offset = copy_over(buf, &mode, sizeof(mode), offset);
-  offset = copy_over(buf, (uint8_t *)&param2, sizeof(param2), offset);
-  offset = copy_over(buf, otp8.ptr, otp8.len, offset);
-  offset = copy_over(buf, otp3.ptr, otp3.len, offset);
-  offset = copy_over(buf, &sn, sizeof(sn), offset);
-  offset = copy_over(buf, sn4.ptr, sn4.len, offset);
-  offset = copy_over(buf, sn2, sizeof (sn2), offset);
-  offset = copy_over(buf, sn23.ptr, sn23.len, offset);
-
-  print_hex_string("Data to hash", buf, len);
-  struct octet_buffer data_to_hash = {buf, len};
-  struct octet_buffer digest;
-  digest = sha256_buffer (data_to_hash);
-
-  print_hex_string("Result hash", digest.ptr, digest.len);
-
-  free(buf);
-
-  return digest;
+  offset = copy_buffer (msg, offset, first);
+  offset = copy_buffer (msg, offset, challenge);
+  offset = copy_byte_to_buffer (msg, offset, opcode);
+  offset = copy_byte_to_buffer (msg, offset, mode);
+  offset = copy_to_buffer (msg, offset, (uint8_t *)&param2, sizeof (param2));
+  offset = copy_buffer (msg, offset, otp8);
+  offset = copy_buffer (msg, offset, otp3);
+  offset = copy_byte_to_buffer (msg, offset, sn);
+  offset = copy_buffer (msg, offset, sn4);
+  offset = copy_to_buffer (msg, offset, sn2, sizeof (sn2));
+  offset = copy_buffer (msg, offset, sn23);
+
+  assert (DEFAULT_MESSAGE_LEN == offset);
+
+  return offset;
 }
 
-
-struct octet_buffer perform_hmac_256(struct octet_buffer challenge,
-                                     struct octet_buffer key,
-                                     uint8_t mode, uint16_t param2,
-                                     struct octet_buffer otp8,
-                                     struct octet_buffer otp3,
-                                     struct octet_buffer sn4,
-                                     struct octet_buffer sn23)
+/**
+ * HMAC-SHA256 of a short key and message, computed from the pads on
+ * the stack.  Unlike a gcrypt HMAC handle this needs no allocation.
+ *
+ * @param digest Receives the 32 byte result
+ * @param key The key, at most one block
+ * @param msg The message
+ * @param len The message length
+ */
+static void hmac_sha256_stack (uint8_t *digest, struct octet_buffer key,
+                               const uint8_t *msg, unsigned int len)
 {
+  const unsigned int BLOCK = 64;
+  uint8_t pad[64];
+  uint8_t inner[32];
+  gcry_buffer_t iov[2] = {};
+  unsigned int x;
 
-  assert (NULL != challenge.ptr); assert (32 == challenge.len);
-  assert (NULL != key.ptr); assert (32 == key.len);
-  assert (NULL != otp8.ptr); assert (8 == otp8.len);
-  assert (NULL != otp3.ptr); assert (3 == otp3.len);
-  assert (NULL != sn4.ptr); assert (4 == sn4.len);
-  assert (NULL != sn23.ptr); assert (2 == sn23.len);
+  assert (NULL != key.ptr); assert (key.len <= BLOCK);
 
-  struct octet_buffer zeros = make_buffer (32);
+  memset (pad, 0x36, BLOCK);
+  for (x = 0; x < key.len; x++)
+    pad[x] ^= key.ptr[x];
 
-  const uint8_t opcode = {0x11};
-  const uint8_t sn = 0xEE;
-  const uint8_t sn2[] ={0x01, 0x23};
+  iov[0].data = pad; iov[0].len = BLOCK;
+  iov[1].data = (void *)msg; iov[1].len = len;
+  assert (GPG_ERR_NO_ERROR ==
+          gcry_md_hash_buffers (GCRY_MD_SHA256, 0, inner, iov, 2));
 
-  unsigned int len = zeros.len +
-    challenge.len +
-    sizeof(opcode) +
-    sizeof(mode) +
-    sizeof(param2) +
-    otp8.len +
-    otp3.len +
-    sizeof(sn) +
-    sn4.len +
-    sizeof(sn2) +
-    sn23.len;
+  /* Turn the inner pad into the outer pad */
+  for (x = 0; x < BLOCK; x++)
+    pad[x] ^= 0x36 ^ 0x5c;
 
-  assert (88 == len);
+  iov[1].data = inner; iov[1].len = sizeof (inner);
+  assert (GPG_ERR_NO_ERROR ==
+          gcry_md_hash_buffers (GCRY_MD_SHA256, 0, digest, iov, 2));
 
-  uint8_t *buf = malloc_wipe(len);
+  wipe (pad, sizeof (pad));
+  wipe (inner, sizeof (inner));
+}
 
-  unsigned int offset = 0;
-  offset = copy_over(buf, zeros.ptr, zeros.len, offset);
-  offset = copy_over(buf, challenge.ptr, challenge.len, offset);
-  offset = copy_over(buf, &opcode, sizeof(opcode), offset);
-  offset = copy_over(buf, &mode, sizeof(mode), offset);
-  offset = copy_over(buf, (uint8_t *)&param2, sizeof(param2), offset);
-  offset = copy_over(buf, otp8.ptr, otp8.len, offset);
-  offset = copy_over(buf, otp3.ptr, otp3.len, offset);
-  offset = copy_over(buf, &sn, sizeof(sn), offset);
-  offset = copy_over(buf, sn4.ptr, sn4.len, offset);
-  offset = copy_over(buf, sn2, sizeof (sn2), offset);
-  offset = copy_over(buf, sn23.ptr, sn23.len, offset);
-
-  print_hex_string("Data to hmac", buf, len);
-  struct octet_buffer data_to_hash = {buf, len};
-  struct octet_buffer digest;
-  digest = hmac_buffer (data_to_hash, key);
+/**
+ * Computes the default MAC or HMAC response into a fixed buffer.
+ *
+ * @param digest Receives the 32 byte response
+ * @param hmac True for the HMAC command, false for MAC
+ *
+ * The remaining parameters are those of perform_hash.
+ */
+static void default_response (struct fixed_buffer *digest, bool hmac,
+                              struct octet_buffer challenge,
+                              struct octet_buffer key,
+                              uint8_t mode, uint16_t param2,
+                              struct octet_buffer otp8,
+                              struct octet_buffer otp3,
+                              struct octet_buffer sn4,
+                              struct octet_buffer sn23)
+{
+  assert (NULL != key.ptr); assert (32 == key.len);
 
-  print_hex_string("Result hash", digest.ptr, digest.len);
+  uint8_t buf[DEFAULT_MESSAGE_LEN];
+  struct octet_buffer msg = ARRAY_BUFFER (buf);
+  struct fixed_buffer zeros = make_fixed_buffer (32);
 
-  free(buf);
+  *digest = make_fixed_buffer (32);
 
-  return digest;
-}
+  if (hmac)
+    {
+      build_default_message (msg, fixed_buffer_view (&zeros), challenge,
+                             0x11, mode, param2, otp8, otp3, sn4, sn23);
+      print_hex_string ("Data to hmac", buf, msg.len);
+      hmac_sha256_stack (digest->data, key, buf, msg.len);
+    }
+  else
+    {
+      build_default_message (msg, key, challenge,
+                             0x08, mode, param2, otp8, otp3, sn4, sn23);
+      /* The message starts with the key, which isn't logged */
+      print_hex_string ("Data to hash after the key", buf + key.len,
+                        msg.len - key.len);
+      gcry_md_hash_buffer (GCRY_MD_SHA256, digest->data, buf, msg.len);
+    }
 
+  print_hex_string ("Result hash", digest->data, digest->len);
 
-bool verify_hash_defaults (struct octet_buffer challenge,
-                           struct octet_buffer challenge_rsp,
-                           struct octet_buffer key, unsigned int key_slot)
-{
+  wipe (buf, sizeof (buf));
+}
 
-  bool result = false;
+struct octet_buffer perform_hash(struct octet_buffer challenge,
+                                 struct octet_buffer key,
+                                 uint8_t mode, uint16_t param2,
+                                 struct octet_buffer otp8,
+                                 struct octet_buffer otp3,
+                                 struct octet_buffer sn4,
+                                 struct octet_buffer sn23)
+{
+  struct fixed_buffer digest;
+  struct octet_buffer result = make_buffer (32);
 
-  struct octet_buffer otp8 = make_buffer (8);
-  struct octet_buffer otp3 = make_buffer (3);
-  struct octet_buffer sn4 = make_buffer (4);
-  struct octet_buffer sn23 = make_buffer (2);
-  uint8_t mode = 0;
-  uint16_t param2 = 0;
+  default_response (&digest, false, challenge, key, mode, param2,
+                    otp8, otp3, sn4, sn23);
 
-  uint8_t *p = (uint8_t *)&param2;
-  assert (key_slot < MAX_NUM_DATA_SLOTS);
-  *p = key_slot;
+  copy_buffer (result, 0, fixed_buffer_view (&digest));
+  wipe_fixed_buffer (&digest);
 
+  return result;
+}
 
-  struct octet_buffer digest;
-  digest = perform_hash (challenge, key, mode, param2, otp8, otp3, sn4, sn23);
 
-  free_octet_buffer (otp8);
-  free_octet_buffer (otp3);
-  free_octet_buffer (sn4);
-  free_octet_buffer (sn23);
+struct octet_buffer perform_hmac_256(struct octet_buffer challenge,
+                                     struct octet_buffer key,
+                                     uint8_t mode, uint16_t param2,
+                                     struct octet_buffer otp8,
+                                     struct octet_buffer otp3,
+                                     struct octet_buffer sn4,
+                                     struct octet_buffer sn23)
+{
+  struct fixed_buffer digest;
+  struct octet_buffer result = make_buffer (32);
 
-  result = memcmp_octet_buffer (digest, challenge_rsp);
+  default_response (&digest, true, challenge, key, mode, param2,
+                    otp8, otp3, sn4, sn23);
 
-  free_octet_buffer (digest);
+  copy_buffer (result, 0, fixed_buffer_view (&digest));
+  wipe_fixed_buffer (&digest);
 
   return result;
-
 }
 
-bool verify_hmac_defaults (struct octet_buffer challenge,
-                           struct octet_buffer challenge_rsp,
-                           struct octet_buffer key, unsigned int key_slot)
+/**
+ * Verifies a default MAC or HMAC response without touching the heap.
+ * The OTP and serial number fields are zero.
+ */
+static bool verify_defaults (bool hmac, uint8_t mode,
+                             struct octet_buffer challenge,
+                             struct octet_buffer challenge_rsp,
+                             struct octet_buffer key, unsigned int key_slot)
 {
-
   bool result = false;
 
-  struct octet_buffer otp8 = make_buffer (8);
-  struct octet_buffer otp3 = make_buffer (3);
-  struct octet_buffer sn4 = make_buffer (4);
-  struct octet_buffer sn23 = make_buffer (2);
-  uint8_t mode = 0x04;
+  struct fixed_buffer otp8 = make_fixed_buffer (8);
+  struct fixed_buffer otp3 = make_fixed_buffer (3);
+  struct fixed_buffer sn4 = make_fixed_buffer (4);
+  struct fixed_buffer sn23 = make_fixed_buffer (2);
+  struct fixed_buffer digest;
   uint16_t param2 = 0;
 
   uint8_t *p = (uint8_t *)&param2;
   assert (key_slot < MAX_NUM_DATA_SLOTS);
   *p = key_slot;
 
+  default_response (&digest, hmac, challenge, key, mode, param2,
+                    fixed_buffer_view (&otp8), fixed_buffer_view (&otp3),
+                    fixed_buffer_view (&sn4), fixed_buffer_view (&sn23));
 
-  struct octet_buffer digest;
-  digest = perform_hmac_256 (challenge, key, mode, param2, otp8, otp3, sn4, sn23);
-
-  free_octet_buffer (otp8);
-  free_octet_buffer (otp3);
-  free_octet_buffer (sn4);
-  free_octet_buffer (sn23);
+  result = memcmp_octet_buffer (fixed_buffer_view (&digest), challenge_rsp);
 
-  result = memcmp_octet_buffer (digest, challenge_rsp);
-
-  free_octet_buffer (digest);
+  wipe_fixed_buffer (&digest);
 
   return result;
+}
+
+bool verify_hash_defaults (struct octet_buffer challenge,
+                           struct octet_buffer challenge_rsp,
+                           struct octet_buffer key, unsigned int key_slot)
+{
+  return verify_defaults (false, 0, challenge, challenge_rsp, key, key_slot);
+}
 
+bool verify_hmac_defaults (struct octet_buffer challenge,
+                           struct octet_buffer challenge_rsp,
+                           struct octet_buffer key, unsigned int key_slot)
+{
+  return verify_defaults (true, 0x04, challenge, challenge_rsp, key,
+                          key_slot);
 }
 
 #endif
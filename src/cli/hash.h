@@ -22,10 +22,14 @@
 #define HASH_H
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <gcrypt.h>
 #include "../driver/util.h"
 
 /**
- * Perform a SHA256 Digest on a file stream
+ * Perform a SHA256 Digest on a file stream.  The stream must not have
+ * been read through stdio yet, as the digest is taken from the
+ * underlying file descriptor.
  *
  * @param fp The file pointer to hash
  *
@@ -34,6 +38,44 @@
  */
 struct octet_buffer sha256 (FILE *fp);
 
+/**
+ * Perform a SHA256 Digest on an open file descriptor, from its current
+ * offset to the end.  Regular files are memory mapped, anything else
+ * (pipes, terminals) is read in large chunks.  If the file is truncated
+ * while it is hashed, the digest covers what was left, as with read ().
+ *
+ * @param fd The open file descriptor
+ *
+ * @return A malloc'd buffer of 32 bytes containing the digest.
+ * buf.ptr will be null on error
+ */
+struct octet_buffer sha256_fd (int fd);
+
+/**
+ * Perform a SHA256 Digest on the named file.
+ *
+ * @param path The file to hash
+ *
+ * @return A malloc'd buffer of 32 bytes containing the digest.
+ * buf.ptr will be null on error and errno will be set.
+ */
+struct octet_buffer sha256_file (const char *path);
+
+/**
+ * Feeds part of a regular file into an open digest.  The file is
+ * mapped when possible.  The file offset is not changed, so this may
+ * be called from several threads on the same descriptor.
+ *
+ * @param hd The open digest handle
+ * @param fd The open file descriptor
+ * @param offset The offset of the first byte
+ * @param length The number of bytes
+ *
+ * @return True if all length bytes were read
+ */
+bool sha256_write_range (gcry_md_hd_t hd, int fd, off_t offset,
+                         off_t length);
+
 /**
  * Perform a SHA 256 on a fixed data block
  *
@@ -43,6 +85,44 @@ struct octet_buffer sha256 (FILE *fp);
  */
 struct octet_buffer sha256_buffer (struct octet_buffer data);
 
+/**
+ * Computes the response of the MAC command as the device would.
+ *
+ * @param challenge The 32 Byte challenge
+ * @param key The 32 byte key
+ * @param mode The MAC command's mode
+ * @param param2 The MAC command's param2, the key slot in host order
+ * @param otp8 8 bytes of the OTP zone, zeros unless the mode includes it
+ * @param otp3 3 bytes of the OTP zone, zeros unless the mode includes it
+ * @param sn4 4 bytes of the serial number, zeros unless the mode
+ * includes it
+ * @param sn23 2 bytes of the serial number, zeros unless the mode
+ * includes it
+ *
+ * @return A malloc'd buffer with the 32 byte response
+ */
+struct octet_buffer perform_hash (struct octet_buffer challenge,
+                                  struct octet_buffer key,
+                                  uint8_t mode, uint16_t param2,
+                                  struct octet_buffer otp8,
+                                  struct octet_buffer otp3,
+                                  struct octet_buffer sn4,
+                                  struct octet_buffer sn23);
+
+/**
+ * Computes the response of the HMAC command as the device would.  The
+ * parameters are those of perform_hash, with TempKey as the challenge.
+ *
+ * @return A malloc'd buffer with the 32 byte response
+ */
+struct octet_buffer perform_hmac_256 (struct octet_buffer challenge,
+                                      struct octet_buffer key,
+                                      uint8_t mode, uint16_t param2,
+                                      struct octet_buffer otp8,
+                                      struct octet_buffer otp3,
+                                      struct octet_buffer sn4,
+                                      struct octet_buffer sn23);
+
 /**
  * Performs an offline verification of a MAC using the default settings.
  *
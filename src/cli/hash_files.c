@@ -0,0 +1,337 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#if HAVE_GCRYPT_H
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <gcrypt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "hash_files.h"
+#include "hash.h"
+#include "pool.h"
+
+static bool is_stdin (const char *path)
+{
+  return 0 == strcmp ("-", path);
+}
+
+static void add_path (struct file_list *list, char *path)
+{
+  assert (NULL != path);
+
+  if (list->count == list->capacity)
+    {
+      list->capacity = list->capacity ? list->capacity * 2 : 64;
+      list->paths = realloc (list->paths, list->capacity * sizeof (char *));
+      assert (NULL != list->paths);
+    }
+
+  list->paths[list->count++] = path;
+}
+
+static char* join_path (const char *dir, const char *name)
+{
+  size_t dir_len = strlen (dir);
+  size_t len = dir_len + strlen (name) + 2;
+  char *path = malloc (len);
+  assert (NULL != path);
+
+  if (dir_len > 0 && '/' == dir[dir_len - 1])
+    snprintf (path, len, "%s%s", dir, name);
+  else
+    snprintf (path, len, "%s/%s", dir, name);
+
+  return path;
+}
+
+static int skip_dots (const struct dirent *d)
+{
+  return 0 != strcmp (d->d_name, ".") && 0 != strcmp (d->d_name, "..");
+}
+
+static void walk_dir (struct file_list *list, const char *dir)
+{
+  struct dirent **entries;
+  int n = scandir (dir, &entries, skip_dots, alphasort);
+  int x;
+
+  if (n < 0)
+    {
+      /* Let the hash report why the directory can't be read */
+      add_path (list, strdup (dir));
+      return;
+    }
+
+  for (x = 0; x < n; x++)
+    {
+      char *path = join_path (dir, entries[x]->d_name);
+      struct stat st;
+
+      free (entries[x]);
+
+      if (0 != lstat (path, &st))
+        add_path (list, path);
+      else if (S_ISDIR (st.st_mode))
+        {
+          walk_dir (list, path);
+          free (path);
+        }
+      else if (S_ISLNK (st.st_mode) &&
+               0 == stat (path, &st) && S_ISDIR (st.st_mode))
+        free (path);
+      else if (S_ISREG (st.st_mode) || S_ISLNK (st.st_mode))
+        add_path (list, path);
+      else
+        free (path);            /* Devices, fifos and sockets */
+    }
+
+  free (entries);
+}
+
+void collect_files (char **paths, unsigned int num_paths,
+                    struct file_list *list)
+{
+  assert (NULL != list);
+  assert (NULL != paths || 0 == num_paths);
+
+  unsigned int x;
+
+  list->paths = NULL;
+  list->count = 0;
+  list->capacity = 0;
+
+  for (x = 0; x < num_paths; x++)
+    {
+      struct stat st;
+
+      if (!is_stdin (paths[x]) &&
+          0 == stat (paths[x], &st) && S_ISDIR (st.st_mode))
+        walk_dir (list, paths[x]);
+      else
+        add_path (list, strdup (paths[x]));
+    }
+}
+
+void free_file_list (struct file_list *list)
+{
+  assert (NULL != list);
+
+  unsigned int x;
+
+  for (x = 0; x < list->count; x++)
+    free (list->paths[x]);
+
+  free (list->paths);
+  list->paths = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+struct hash_job
+{
+  const struct file_list *list;
+  struct file_digest *digests;
+};
+
+static void hash_path (const char *path, struct file_digest *d)
+{
+  if (is_stdin (path))
+    d->digest = sha256_fd (STDIN_FILENO);
+  else
+    d->digest = sha256_file (path);
+
+  d->error = (NULL == d->digest.ptr) ? errno : 0;
+}
+
+static void hash_one (void *ctx, unsigned int index)
+{
+  struct hash_job *job = ctx;
+  const char *path = job->list->paths[index];
+
+  /* stdin was hashed by hash_files */
+  if (!is_stdin (path))
+    hash_path (path, &job->digests[index]);
+}
+
+struct file_digest* hash_files (const struct file_list *list,
+                                unsigned int jobs)
+{
+  assert (NULL != list);
+
+  struct hash_job job;
+  unsigned int x;
+
+  job.list = list;
+  job.digests = calloc (list->count ? list->count : 1,
+                        sizeof (struct file_digest));
+  assert (NULL != job.digests);
+
+  /* Initialize gcrypt before the workers start */
+  assert (NULL != gcry_check_version (NULL));
+
+  /* Two workers must not read stdin at once, so each "-" is read
+     here, in order, before the files */
+  for (x = 0; x < list->count; x++)
+    {
+      if (is_stdin (list->paths[x]))
+        hash_path (list->paths[x], &job.digests[x]);
+    }
+
+  run_pool (list->count, jobs, hash_one, &job);
+
+  return job.digests;
+}
+
+void free_file_digests (struct file_digest *digests, unsigned int count)
+{
+  unsigned int x;
+
+  for (x = 0; x < count; x++)
+    {
+      if (NULL != digests[x].digest.ptr)
+        free_octet_buffer (digests[x].digest);
+    }
+
+  free (digests);
+}
+
+char* sha256sum_line (const char *path, const uint8_t *digest)
+{
+  assert (NULL != path);
+  assert (NULL != digest);
+
+  const unsigned int DLEN = 32;
+  bool escape = (NULL != strpbrk (path, "\\\n"));
+  char *line = malloc (1 + 2 * DLEN + 2 + 2 * strlen (path) + 1);
+  char *p = line;
+  unsigned int i;
+
+  assert (NULL != line);
+
+  /* Like sha256sum, names with a backslash or newline are escaped and
+     the line is flagged with a leading backslash */
+  if (escape)
+    *p++ = '\\';
+
+  for (i = 0; i < DLEN; i++)
+    p += sprintf (p, "%02x", digest[i]);
+
+  *p++ = ' ';
+  *p++ = ' ';
+
+  for (; *path; path++)
+    {
+      if (escape && '\\' == *path)
+        {
+          *p++ = '\\';
+          *p++ = '\\';
+        }
+      else if (escape && '\n' == *path)
+        {
+          *p++ = '\\';
+          *p++ = 'n';
+        }
+      else
+        *p++ = *path;
+    }
+
+  *p = '\0';
+
+  return line;
+}
+
+bool parse_sha256sum_line (const char *line, uint8_t *digest, char **path)
+{
+  assert (NULL != line);
+  assert (NULL != digest);
+  assert (NULL != path);
+
+  const unsigned int DLEN = 32;
+  bool escape = ('\\' == *line);
+  unsigned int i;
+
+  if (escape)
+    line++;
+
+  for (i = 0; i < DLEN; i++)
+    {
+      unsigned int byte;
+
+      if (!isxdigit ((unsigned char)line[0]) ||
+          !isxdigit ((unsigned char)line[1]) ||
+          1 != sscanf (line, "%2x", &byte))
+        return false;
+
+      digest[i] = byte;
+      line += 2;
+    }
+
+  /* Text mode uses two spaces, binary mode a space and a star */
+  if (' ' != line[0] || (' ' != line[1] && '*' != line[1]) || '\0' == line[2])
+    return false;
+
+  line += 2;
+
+  char *p = *path = malloc (strlen (line) + 1);
+  assert (NULL != p);
+
+  for (; *line && '\n' != *line; line++)
+    {
+      if (escape && '\\' == line[0] && 'n' == line[1])
+        {
+          *p++ = '\n';
+          line++;
+        }
+      else if (escape && '\\' == line[0] && '\\' == line[1])
+        {
+          *p++ = '\\';
+          line++;
+        }
+      else
+        *p++ = *line;
+    }
+
+  *p = '\0';
+
+  return true;
+}
+
+void output_sha256sum (FILE *stream, const char *path,
+                       struct octet_buffer digest)
+{
+  assert (NULL != stream);
+  assert (NULL != digest.ptr);
+
+  char *line = sha256sum_line (path, digest.ptr);
+
+  fprintf (stream, "%s\n", line);
+
+  free (line);
+}
+
+#endif
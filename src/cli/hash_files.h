@@ -0,0 +1,119 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HASH_FILES_H
+#define HASH_FILES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../driver/util.h"
+
+/* The list of files to hash, in output order */
+struct file_list
+{
+  char **paths;                 /**< malloc'd paths */
+  unsigned int count;           /**< Number of paths */
+  unsigned int capacity;        /**< Allocated size of paths */
+};
+
+struct file_digest
+{
+  struct octet_buffer digest;   /**< The SHA256, ptr is NULL on error */
+  int error;                    /**< errno if the file failed to hash */
+};
+
+/**
+ * Expands the given paths into a list of files.  Directories are
+ * walked recursively with their entries sorted, so the order is
+ * deterministic.  Symbolic links to directories found while walking
+ * are not followed.  Anything else named explicitly, including "-"
+ * for stdin, is added as is.
+ *
+ * @param paths The paths from the command line
+ * @param num_paths The number of paths
+ * @param list The list to fill in.  Free with free_file_list.
+ */
+void collect_files (char **paths, unsigned int num_paths,
+                    struct file_list *list);
+
+/**
+ * Frees the paths held by the list.
+ *
+ * @param list The list filled in by collect_files
+ */
+void free_file_list (struct file_list *list);
+
+/**
+ * Hashes every file in the list concurrently.  stdin is read first,
+ * on the calling thread: as with sha256sum, a "-" given more than
+ * once hashes what is left of it, which is nothing.
+ *
+ * @param list The files to hash
+ * @param jobs The number of workers, 0 for the default
+ *
+ * @return A malloc'd array of list->count digests, in list order.
+ * Free with free_file_digests.
+ */
+struct file_digest* hash_files (const struct file_list *list,
+                                unsigned int jobs);
+
+/**
+ * Frees the digests returned by hash_files.
+ *
+ * @param digests The digest array
+ * @param count The number of entries
+ */
+void free_file_digests (struct file_digest *digests, unsigned int count);
+
+/**
+ * Formats a digest as a line of sha256sum output, without the
+ * trailing newline.
+ *
+ * @param path The file name
+ * @param digest The 32 byte digest
+ *
+ * @return The malloc'd line
+ */
+char* sha256sum_line (const char *path, const uint8_t *digest);
+
+/**
+ * Parses a line of sha256sum output.
+ *
+ * @param line The line, with or without the trailing newline
+ * @param digest Filled in with the 32 byte digest
+ * @param path Set to the malloc'd, unescaped, file name on success
+ *
+ * @return True if the line was well formed
+ */
+bool parse_sha256sum_line (const char *line, uint8_t *digest, char **path);
+
+/**
+ * Prints a digest in the format used by sha256sum, so the output can
+ * be checked with sha256sum -c.
+ *
+ * @param stream The output stream
+ * @param path The file name
+ * @param digest The 32 byte digest
+ */
+void output_sha256sum (FILE *stream, const char *path,
+                       struct octet_buffer digest);
+
+#endif /* HASH_FILES_H */
@@ -0,0 +1,173 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#if HAVE_GCRYPT_H
+#include <assert.h>
+#include <string.h>
+#include "key_schedule.h"
+
+#define KEY_LEN 32
+#define CHALLENGE_OFFSET 32
+#define DLEN 32
+
+#define MAC_OPCODE 0x08
+#define MAC_MODE 0x00
+#define HMAC_OPCODE 0x11
+#define HMAC_MODE 0x04
+
+/**
+ * Fills in the bytes that follow the challenge, as perform_hash and
+ * perform_hmac_256 lay them out with zero OTP and serial number
+ * bytes.
+ *
+ * @param tail The 24 bytes after the challenge
+ * @param opcode The command opcode
+ * @param mode The command mode
+ * @param slot The key slot, the low byte of param2
+ */
+static void fill_tail (uint8_t *tail, uint8_t opcode, uint8_t mode,
+                       unsigned int slot)
+{
+  memset (tail, 0, MAC_MESSAGE_LEN - CHALLENGE_OFFSET - DLEN);
+
+  tail[0] = opcode;
+  tail[1] = mode;
+  tail[2] = slot;               /* param2, little endian */
+  tail[3] = 0;
+  /* otp8 and otp3 are zero */
+  tail[15] = 0xEE;
+  /* sn4 is zero */
+  tail[20] = 0x01;
+  tail[21] = 0x23;
+  /* sn23 is zero */
+}
+
+struct key_schedule* new_key_schedule (void)
+{
+  struct key_schedule *schedule =
+    (struct key_schedule *)malloc_wipe (sizeof (struct key_schedule));
+
+  /* Init gcrypt */
+  assert (NULL != gcry_check_version (NULL));
+
+  return schedule;
+}
+
+void add_schedule_key (struct key_schedule *schedule, unsigned int slot,
+                       struct octet_buffer key)
+{
+  assert (NULL != schedule);
+  assert (slot < MAX_NUM_DATA_SLOTS);
+  assert (NULL != key.ptr); assert (KEY_LEN == key.len);
+
+  struct slot_key *s = &schedule->slots[slot];
+
+  if (s->present)
+    gcry_md_close (s->hmac);
+
+  memcpy (s->mac_message, key.ptr, KEY_LEN);
+  fill_tail (s->mac_message + CHALLENGE_OFFSET + DLEN,
+             MAC_OPCODE, MAC_MODE, slot);
+
+  memset (s->hmac_message, 0, CHALLENGE_OFFSET);
+  fill_tail (s->hmac_message + CHALLENGE_OFFSET + DLEN,
+             HMAC_OPCODE, HMAC_MODE, slot);
+
+  assert (GPG_ERR_NO_ERROR == gcry_md_open (&s->hmac, GCRY_MD_SHA256,
+                                            GCRY_MD_FLAG_HMAC));
+  assert (GPG_ERR_NO_ERROR == gcry_md_setkey (s->hmac, key.ptr, key.len));
+
+  s->present = true;
+}
+
+bool schedule_has_key (const struct key_schedule *schedule,
+                       unsigned int slot)
+{
+  assert (NULL != schedule);
+
+  return slot < MAX_NUM_DATA_SLOTS && schedule->slots[slot].present;
+}
+
+bool verify_mac_scheduled (struct key_schedule *schedule,
+                           struct octet_buffer challenge,
+                           struct octet_buffer challenge_rsp,
+                           unsigned int key_slot)
+{
+  assert (schedule_has_key (schedule, key_slot));
+  assert (NULL != challenge.ptr); assert (DLEN == challenge.len);
+  assert (NULL != challenge_rsp.ptr);
+
+  struct slot_key *s = &schedule->slots[key_slot];
+  uint8_t digest[DLEN];
+
+  if (DLEN != challenge_rsp.len)
+    return false;
+
+  memcpy (s->mac_message + CHALLENGE_OFFSET, challenge.ptr, DLEN);
+  gcry_md_hash_buffer (GCRY_MD_SHA256, digest, s->mac_message,
+                       MAC_MESSAGE_LEN);
+
+  return 0 == memcmp (digest, challenge_rsp.ptr, DLEN);
+}
+
+bool verify_hmac_scheduled (struct key_schedule *schedule,
+                            struct octet_buffer challenge,
+                            struct octet_buffer challenge_rsp,
+                            unsigned int key_slot)
+{
+  assert (schedule_has_key (schedule, key_slot));
+  assert (NULL != challenge.ptr); assert (DLEN == challenge.len);
+  assert (NULL != challenge_rsp.ptr);
+
+  struct slot_key *s = &schedule->slots[key_slot];
+  const unsigned char *digest;
+
+  if (DLEN != challenge_rsp.len)
+    return false;
+
+  memcpy (s->hmac_message + CHALLENGE_OFFSET, challenge.ptr, DLEN);
+
+  gcry_md_reset (s->hmac);
+  gcry_md_write (s->hmac, s->hmac_message, MAC_MESSAGE_LEN);
+
+  digest = gcry_md_read (s->hmac, GCRY_MD_SHA256);
+  assert (NULL != digest);
+
+  return 0 == memcmp (digest, challenge_rsp.ptr, DLEN);
+}
+
+void free_key_schedule (struct key_schedule *schedule)
+{
+  assert (NULL != schedule);
+
+  unsigned int x;
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (schedule->slots[x].present)
+        gcry_md_close (schedule->slots[x].hmac);
+    }
+
+  free_wipe ((uint8_t *)schedule, sizeof (struct key_schedule));
+}
+
+#endif
@@ -0,0 +1,127 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEY_SCHEDULE_H
+#define KEY_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gcrypt.h>
+#include "../driver/defs.h"
+#include "../driver/util.h"
+
+/* Length of the message digested by the MAC command in its default
+   mode: key, challenge, then the fixed opcode, mode, param2, OTP and
+   serial number bytes. */
+#define MAC_MESSAGE_LEN 88
+
+/* Everything about a slot key that does not depend on the challenge,
+   prepared once so verifying a response only digests the challenge
+   dependent blocks. */
+struct slot_key
+{
+  bool present;
+  /** The MAC message with the key and fixed bytes in place.  Only the
+      challenge is copied in for each verification.  The key shares
+      the first SHA256 block with the challenge, so there is no
+      midstate to keep. */
+  uint8_t mac_message[MAC_MESSAGE_LEN];
+  /** The HMAC message, with its fixed bytes in place */
+  uint8_t hmac_message[MAC_MESSAGE_LEN];
+  /** Keyed HMAC handle.  libgcrypt keeps the inner and outer pad
+      midstates and gcry_md_reset restores them, so each HMAC costs
+      only the compression of the message. */
+  gcry_md_hd_t hmac;
+};
+
+struct key_schedule
+{
+  struct slot_key slots[MAX_NUM_DATA_SLOTS];
+};
+
+/**
+ * Allocates an empty key schedule.
+ *
+ * @return The schedule.  Free with free_key_schedule.
+ */
+struct key_schedule* new_key_schedule (void);
+
+/**
+ * Prepares a slot key.
+ *
+ * @param schedule The key schedule
+ * @param slot The key slot
+ * @param key The 32 byte key
+ */
+void add_schedule_key (struct key_schedule *schedule, unsigned int slot,
+                       struct octet_buffer key);
+
+/**
+ * Returns true if a key was added for the slot.
+ *
+ * @param schedule The key schedule
+ * @param slot The key slot
+ *
+ * @return True if the key is present
+ */
+bool schedule_has_key (const struct key_schedule *schedule,
+                       unsigned int slot);
+
+/**
+ * Performs an offline verification of a MAC using the default
+ * settings.  Equivalent to verify_hash_defaults.
+ *
+ * @param schedule The key schedule
+ * @param challenge The 32 Byte challenge
+ * @param challenge_rsp The 32 Byte challenge response
+ * @param key_slot The key slot used, which must be present
+ *
+ * @return True if matched, otherwise false
+ */
+bool verify_mac_scheduled (struct key_schedule *schedule,
+                           struct octet_buffer challenge,
+                           struct octet_buffer challenge_rsp,
+                           unsigned int key_slot);
+
+/**
+ * Performs an offline verification of a HMAC using the default
+ * settings.  Equivalent to verify_hmac_defaults.  The slot's handle is
+ * reused, so a slot must not be verified from two threads at once.
+ *
+ * @param schedule The key schedule
+ * @param challenge The 32 Byte challenge
+ * @param challenge_rsp The 32 Byte challenge response
+ * @param key_slot The key slot used, which must be present
+ *
+ * @return True if matched, otherwise false
+ */
+bool verify_hmac_scheduled (struct key_schedule *schedule,
+                            struct octet_buffer challenge,
+                            struct octet_buffer challenge_rsp,
+                            unsigned int key_slot);
+
+/**
+ * Wipes and frees the key schedule.
+ *
+ * @param schedule The key schedule
+ */
+void free_key_schedule (struct key_schedule *schedule);
+
+#endif /* KEY_SCHEDULE_H */
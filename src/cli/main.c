@@ -31,9 +31,12 @@
 
 #include <argp.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include "cli_commands.h"
 #include "config.h"
 #include <string.h>
+#include "tree_hash.h"
 
 
 const char *argp_program_version = PACKAGE_VERSION;
@@ -46,14 +49,21 @@ static char doc[] =
   "Currently implemented Commands:\n\n"
   "personalize   --  You should run this command first upon receiving your\n"
   "                  Hashlet.  It will load your keys and save them to\n"
-  "                  ~/.hashlet as a backup\n"
+  "                  ~/.hashlet as a backup.  Run it again to resume\n"
+  "                  after an interruption.\n"
   "random        --  Retrieves X bytes of random data from the device, where\n"
   "                  X is defaulted to 32 and can be specified with the -B flag.\n"
   "serial-num    --  Retrieves the device's serial number.\n"
 #if HAVE_GCRYPT_H
+  "hash          --  Calculates the SHA-256 digest of the input, which does\n"
+  "                  not need the device.  Given FILE arguments, every file\n"
+  "                  and every file below a directory is hashed in parallel\n"
+  "                  (see -j) and printed in sha256sum format.\n"
   "mac           --  Calculates a SHA-256 digest of your input data and then\n"
   "                  sends that digest to the device to be mac'ed with a key\n"
-  "                  other internal data\n"
+  "                  other internal data.  With --tree, large inputs are\n"
+  "                  reduced with a tree hash on all cores and the tree\n"
+  "                  layout is printed with the result.\n"
   "check-mac     --  Compares a MAC.  Required \"options\" are -r, -c, and -m\n"
   "                  Specify an optional key-slot with -k, this will return an\n"
   "                  exit code of 0 on success otherwise, an error\n"
@@ -65,6 +75,8 @@ static char doc[] =
   "                  an error.\n"
   "                  The example incantation is:\n"
   "                  hashlet offline-verify -c XXX... -r XXX...\n"
+  "                  The challenge may instead be recomputed from the input\n"
+  "                  with -f FILE, and --tree if the mac used it.\n"
   "offline-hmac --   Offline hmac will verify a hmac produced by a Hashlet.\n"
   "                  Similar to offline-verify, the key file is needed.\n"
   "                  It compares the challenge response and computes the HMAC\n"
@@ -73,8 +85,32 @@ static char doc[] =
   "                  an error.\n"
   "                  The example incantation is:\n"
   "                  hashlet offline-verify -r XXX... -f hmac_me.txt\n"
+  "attest        --  Hashes every file below a directory in parallel and\n"
+  "                  MACs the root of the resulting manifest.  The manifest\n"
+  "                  is written to -o FILE, or stdout.  Digests of unchanged\n"
+  "                  files are kept in ~/.hashlet_cache.\n"
+  "                  hashlet attest -o manifest.txt DIR\n"
+  "offline-attest -- Verifies an attested directory against its manifest\n"
+  "                  (-f) and MAC (-r) with the key file, printing the\n"
+  "                  files that changed.\n"
+  "                  hashlet offline-attest -f manifest.txt -r XXX... DIR\n"
 #endif
+  "fleet-add     --  Adds the keys of a device, from the key file given with\n"
+  "                  -f, to the fleet store under its --serial number.  The\n"
+  "                  offline commands then take --serial to verify with\n"
+  "                  that device's keys.\n"
+  "stats         --  Prints the counts and latencies of the commands sent\n"
+  "                  to each device, kept in ~/.hashlet_stats.  With -o,\n"
+  "                  writes them for the Prometheus textfile collector.\n"
+  "provision     --  Personalizes many devices at once, given as BUS:ADDRESS\n"
+  "                  or ADDRESS arguments, with one worker per bus.  Their\n"
+  "                  keys go to the fleet store, from the device's RNG or\n"
+  "                  with --host-rng the host's, and the time of each\n"
+  "                  stage and devices/hour are reported.\n"
   "get-config    --  Dumps the configuration zone\n"
+  "dump          --  Reads the configuration and OTP zones and every data\n"
+  "                  slot that can be read in the clear, in one session,\n"
+  "                  and writes them as JSON to -o FILE, or stdout.\n"
   "state         --  Returns the device's state.\n"
   "                  Factory -- Random will produced a fixed 0xFFFF0000\n"
   "                  Initialized -- Configuration is locked, keys may be \n"
@@ -85,6 +121,9 @@ static char doc[] =
   "                  zero is assumed.  NOTE: not all slots may be written and\n"
   "                  this command may result in an error.  Check the\n"
   "                  documentation for which slots may be written.\n"
+  "                  With --slots, writes each slot listed in the input\n"
+  "                  (-f or stdin) as SLOT DATA KEY lines, KEY being the\n"
+  "                  slot's current contents, in one session.\n"
   "read          --  Reads one of the sixteen key slots, specified by\n"
   "                  the option -k.  The default slot is 0.  Some slots can\n"
   "                  not be read, in which case this command will return an\n"
@@ -95,9 +134,17 @@ static char doc[] =
 
 
 /* A description of the arguments we accept. */
-static char args_doc[] = "command";
+static char args_doc[] = "command [FILE...]";
 
 #define OPT_UPDATE_SEED 300
+#define OPT_TREE 301
+#define OPT_NO_CACHE 302
+#define OPT_SERIAL 303
+#define OPT_FLEET 304
+#define OPT_LOG_FILE 305
+#define OPT_SYSLOG 306
+#define OPT_HOST_RNG 307
+#define OPT_SLOTS 308
 
 
 /* The options we understand. */
@@ -110,10 +157,20 @@ static struct argp_option options[] = {
   {"Bytes",      'B', "Bytes",  0,  "number of bytes to return"},
   {"address",  'a', "ADDRESS",      0,  "i2c address for the device (in hex)"},
   {"file",     'f', "FILE",         0,  "Read from FILE vs. stdin"},
+  {"output",   'o', "FILE",         0,  "Write to FILE vs. stdout"},
+  {"jobs",     'j', "JOBS",         0,
+   "Number of files to hash at once: defaults to one per core"},
+  {"tree",     OPT_TREE, "CHUNK", OPTION_ARG_OPTIONAL,
+   "Reduce the input with a parallel tree hash of CHUNK byte leaves "
+   "(K, M and G suffixes allowed, default 1M) instead of a single SHA256"},
+  {"no-cache", OPT_NO_CACHE, 0, 0,
+   "Hash every file for attest, ignoring the digest cache"},
   { 0, 0, 0, 0, "Key related command options:", 3},
   {"key-slot", 'k', "SLOT",      0,  "The internal key slot to use."},
   {"write", 'w', "WRITE",      0,
    "The 32 byte data to write to a slot (64 bytes of ASCII Hex)"},
+  {"slots", OPT_SLOTS, 0, 0,
+   "Write the slots listed in the input, one \"SLOT DATA KEY\" line each"},
   { 0, 0, 0, 0, "Check and Offline-Verify Mac Options:", 4},
   {"challenge", 'c', "CHALLENGE",      0,
    "The 32 byte challenge (64 bytes of ASCII Hex)"},
@@ -121,10 +178,61 @@ static struct argp_option options[] = {
    "The 32 byte challenge response (64 bytes of ASCII Hex)"},
   {"meta-data", 'm', "META",      0,
    "The 13 byte meta data associated with the mac (26 bytes of ASCII Hex)"},
+  {"serial", OPT_SERIAL, "SERIAL", 0,
+   "Use the keys of the device with this 9 byte serial number (18 bytes "
+   "of ASCII Hex) from the fleet store"},
+  {"fleet", OPT_FLEET, "FILE", 0,
+   "The fleet store: defaults to ~/.hashlet_fleet"},
+  {"log-file", OPT_LOG_FILE, "FILE", 0,
+   "Append log messages to FILE instead of stderr"},
+  {"syslog", OPT_SYSLOG, 0, 0, "Send log messages to syslog"},
+  {"host-rng", OPT_HOST_RNG, 0, 0,
+   "Generate provisioned keys with the host's RNG instead of the device's"},
   { 0 }
 };
 
 
+/**
+ * Parses a size with an optional K, M or G suffix.
+ *
+ * @param arg The string to parse
+ *
+ * @return The size in bytes, 0 if invalid
+ */
+static uint64_t parse_size (const char *arg)
+{
+  char *end = NULL;
+  unsigned long long size;
+  unsigned int shift = 0;
+
+  errno = 0;
+  size = strtoull (arg, &end, 10);
+
+  /* strtoull () would quietly negate a minus sign */
+  if (end == arg || ERANGE == errno || NULL != strchr (arg, '-'))
+    return 0;
+
+  switch (*end)
+    {
+    case 'G': case 'g':
+      shift += 10;
+      /* fall through */
+    case 'M': case 'm':
+      shift += 10;
+      /* fall through */
+    case 'K': case 'k':
+      shift += 10;
+      end++;
+      break;
+    }
+
+  /* Too large once the suffix is applied */
+  if (size > (ULLONG_MAX >> shift))
+    return 0;
+
+  return ('\0' == *end) ? size << shift : 0;
+}
+
 /* Parse a single option. */
 static error_t
 parse_opt (int key, char *arg, struct argp_state *state)
@@ -144,7 +252,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
       if (0 != address_arg)
         {
           arguments->address = address_arg;
-          CTX_LOG (DEBUG, "Using address %u", address_arg);
+          CTX_LOG (DEBUG, "Using address %ld", address_arg);
         }
       else
         CTX_LOG (INFO, "Address not recognized, using default");
@@ -166,9 +274,30 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'f':
       arguments->input_file = arg;
       break;
+    case 'o':
+      arguments->output_file = arg;
+      break;
+    case OPT_NO_CACHE:
+      arguments->use_cache = false;
+      break;
+    case 'j':
+      if (atoi (arg) < 1)
+        argp_usage (state);
+
+      arguments->jobs = atoi (arg);
+      break;
     case OPT_UPDATE_SEED:
       arguments->update_seed = true;
       break;
+    case OPT_TREE:
+      if (NULL == arg)
+        arguments->tree_chunk = TREE_DEFAULT_CHUNK;
+      else if ((arguments->tree_chunk = parse_size (arg)) == 0)
+        {
+          fprintf (stderr, "%s\n", "Invalid tree chunk size.");
+          argp_usage (state);
+        }
+      break;
     case 'k':
       slot = atoi (arg);
       if (slot < 0 || slot > 15)
@@ -185,6 +314,30 @@ parse_opt (int key, char *arg, struct argp_state *state)
       else
         arguments->challenge = arg;
       break;
+    case OPT_SERIAL:
+      if (!is_hex_arg (arg, 18))
+        {
+          fprintf (stderr, "%s\n", "Invalid Serial Number.");
+          argp_usage (state);
+        }
+      else
+        arguments->serial = arg;
+      break;
+    case OPT_FLEET:
+      arguments->fleet_file = arg;
+      break;
+    case OPT_LOG_FILE:
+      arguments->log_file = arg;
+      break;
+    case OPT_SYSLOG:
+      arguments->use_syslog = true;
+      break;
+    case OPT_HOST_RNG:
+      arguments->host_rng = true;
+      break;
+    case OPT_SLOTS:
+      arguments->write_slots = true;
+      break;
     case 'w':
       if (!is_hex_arg (arg, 64))
         {
@@ -213,15 +366,13 @@ parse_opt (int key, char *arg, struct argp_state *state)
         arguments->meta = arg;
       break;
     case ARGP_KEY_ARG:
-      if (state->arg_num > NUM_ARGS)
-        {
-          /* Too many arguments. */
-          argp_usage (state);
-        }
-      else
-        {
-          arguments->args[state->arg_num] = arg;
-        }
+      arguments->args[state->arg_num] = arg;
+
+      /* Everything after the command is handed to it, the dispatcher
+         rejects them for commands that take no files. */
+      arguments->files = &state->argv[state->next];
+      arguments->num_files = state->argc - state->next;
+      state->next = state->argc;
 
       break;
 
@@ -251,6 +402,11 @@ int main (int argc, char **argv)
      be reflected in arguments. */
   argp_parse (&argp, argc, argv, 0, 0, &arguments);
 
+  if (arguments.use_syslog)
+    set_log_sink (LOG_SINK_SYSLOG, NULL);
+  else if (NULL != arguments.log_file)
+    set_log_sink (LOG_SINK_FILE, arguments.log_file);
+
   exit (dispatch (arguments.args[0], &arguments));
 
 }
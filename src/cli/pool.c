@@ -0,0 +1,105 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct pool
+{
+  pthread_mutex_t lock;
+  unsigned int next;
+  unsigned int count;
+  pool_work_fn work;
+  void *ctx;
+};
+
+unsigned int default_jobs (void)
+{
+  long cores = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (cores < 1)
+    cores = 1;
+  if (cores > POOL_MAX_JOBS)
+    cores = POOL_MAX_JOBS;
+
+  return cores;
+}
+
+static void* pool_worker (void *arg)
+{
+  struct pool *p = arg;
+
+  for (;;)
+    {
+      unsigned int index;
+
+      pthread_mutex_lock (&p->lock);
+      index = p->next;
+      if (p->next < p->count)
+        p->next++;
+      pthread_mutex_unlock (&p->lock);
+
+      if (index >= p->count)
+        break;
+
+      p->work (p->ctx, index);
+    }
+
+  return NULL;
+}
+
+void run_pool (unsigned int count, unsigned int jobs,
+               pool_work_fn work, void *ctx)
+{
+  assert (NULL != work);
+
+  struct pool p = { .next = 0, .count = count, .work = work, .ctx = ctx };
+  pthread_t threads[POOL_MAX_JOBS];
+  unsigned int started = 0;
+  unsigned int x;
+
+  if (0 == jobs)
+    jobs = default_jobs ();
+  if (jobs > POOL_MAX_JOBS)
+    jobs = POOL_MAX_JOBS;
+  if (jobs > count)
+    jobs = count;
+
+  pthread_mutex_init (&p.lock, NULL);
+
+  /* The calling thread is always one of the workers */
+  for (x = 1; x < jobs; x++)
+    {
+      if (0 != pthread_create (&threads[started], NULL, pool_worker, &p))
+        break;
+      started++;
+    }
+
+  pool_worker (&p);
+
+  for (x = 0; x < started; x++)
+    pthread_join (threads[x], NULL);
+
+  pthread_mutex_destroy (&p.lock);
+}
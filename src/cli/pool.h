@@ -0,0 +1,59 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+/* Upper bound on concurrent workers.  Hashing is I/O bound long before
+   this many streams are in flight on the storage the Hashlet is
+   usually paired with. */
+#define POOL_MAX_JOBS 16
+
+/**
+ * Signature of the work performed on each item.
+ *
+ * @param ctx The caller's context, shared by all workers
+ * @param index The index of the item to process
+ */
+typedef void (*pool_work_fn) (void *ctx, unsigned int index);
+
+/**
+ * Returns the default number of workers: the number of online cores,
+ * capped at POOL_MAX_JOBS.
+ *
+ * @return The number of workers to use
+ */
+unsigned int default_jobs (void);
+
+/**
+ * Runs work on every index in [0, count) using up to jobs threads.
+ * Items are handed out in order, but may complete in any order, so
+ * work should store its result by index.  Returns when all items are
+ * done.
+ *
+ * @param count The number of items
+ * @param jobs The number of workers, 0 selects default_jobs ()
+ * @param work The function to run on each item
+ * @param ctx Passed through to work
+ */
+void run_pool (unsigned int count, unsigned int jobs,
+               pool_work_fn work, void *ctx);
+
+#endif /* POOL_H */
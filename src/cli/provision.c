@@ -0,0 +1,352 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "provision.h"
+#include <assert.h>
+#include <gcrypt.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+#include "pool.h"
+#include "../driver/command.h"
+#include "../driver/hashlet.h"
+#include "../driver/hex.h"
+#include "../driver/log.h"
+#include "../driver/personalize.h"
+
+#define KEY_LEN 32
+
+/* The slot verified after locking, a keyed hash slot */
+#define VERIFY_SLOT 0
+
+static const char *STAGE_NAMES[PROVISION_NUM_STAGES] =
+  { "config", "lock-cfg", "otp", "keys", "lock-data", "verify" };
+
+struct provision_ctx
+{
+  const struct provision_target *targets;
+  unsigned int count;
+  const char **buses;           /**< The distinct buses */
+  bool host_rng;
+  struct fleet_store *fleet;
+  pthread_mutex_t fleet_lock;   /**< The store isn't thread safe */
+  const char *checkpoint_file;
+  struct key_sink sink;
+  struct provision_result *results;
+};
+
+bool parse_provision_target (const char *arg, const char *default_bus,
+                             struct provision_target *target)
+{
+  assert (NULL != arg);
+  assert (NULL != target);
+
+  const char *colon = strrchr (arg, ':');
+  const char *addr = (NULL == colon) ? arg : colon + 1;
+  char *end = NULL;
+  long address = strtol (addr, &end, 16);
+
+  if (end == addr || '\0' != *end || address < 1 || address > 0x7F ||
+      colon == arg)
+    return false;
+
+  target->address = address;
+  target->bus = (NULL == colon) ? default_bus : strndup (arg, colon - arg);
+
+  return NULL != target->bus;
+}
+
+static void start_stage (struct timespec *start)
+{
+  clock_gettime (CLOCK_MONOTONIC, start);
+}
+
+static uint64_t usec_since (const struct timespec *start)
+{
+  struct timespec end;
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  return (end.tv_sec - start->tv_sec) * 1000000ULL +
+    (end.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * MACs a random challenge with the key that was written, so a device
+ * that stored something else is caught before it leaves the line.
+ */
+static bool verify_key (int fd, const uint8_t *key)
+{
+  uint8_t challenge[32];
+  uint8_t mac[32];
+  uint8_t meta[13];
+  struct mac_mode_encoding m = {0};
+  struct octet_buffer c = ARRAY_BUFFER (challenge);
+  struct octet_buffer k = { (uint8_t *)key, KEY_LEN };
+
+  gcry_create_nonce (challenge, sizeof (challenge));
+
+  return RSP_SUCCESS == perform_mac_into (fd, m, VERIFY_SLOT, c,
+                                          ARRAY_BUFFER (mac),
+                                          ARRAY_BUFFER (meta)) &&
+    verify_hash_defaults (c, ARRAY_BUFFER (mac), k, VERIFY_SLOT);
+}
+
+/* fleet_add syncs the record before returning, so the keys are safe
+   on disk before personalize checkpoints them and writes the device */
+static bool record_fleet_keys (void *arg, const uint8_t *serial,
+                               struct key_container *keys)
+{
+  struct provision_ctx *ctx = arg;
+  bool ok;
+
+  pthread_mutex_lock (&ctx->fleet_lock);
+  ok = fleet_add (ctx->fleet, serial, keys);
+  pthread_mutex_unlock (&ctx->fleet_lock);
+
+  return ok;
+}
+
+static struct key_container* recall_fleet_keys (void *arg,
+                                                const uint8_t *serial)
+{
+  struct provision_ctx *ctx = arg;
+  const struct fleet_record *record;
+  struct key_container *keys = NULL;
+
+  pthread_mutex_lock (&ctx->fleet_lock);
+  if ((record = fleet_lookup (ctx->fleet, serial)) != NULL)
+    keys = fleet_record_keys (record);
+  pthread_mutex_unlock (&ctx->fleet_lock);
+
+  return keys;
+}
+
+/**
+ * Personalizes one device, picking up where an earlier, interrupted
+ * run stopped, then checks it holds the keys that were recorded.
+ */
+static void provision_device (struct provision_ctx *ctx, int fd,
+                              struct provision_result *r)
+{
+  struct personalize_run run = { .host_rng = ctx->host_rng,
+                                 .sink = &ctx->sink,
+                                 .checkpoint_file = ctx->checkpoint_file };
+  enum DEVICE_STATE state;
+  struct timespec start;
+
+  state = personalize_device (fd, STATE_PERSONALIZED, &run);
+
+  memcpy (r->stage_us, run.stage_us, sizeof (run.stage_us));
+  r->skipped = run.skipped;
+
+  if ((r->has_serial = run.has_serial))
+    memcpy (r->serial, run.serial, FLEET_SERIAL_LEN);
+
+  if (!run.has_serial)
+    r->status = PROVISION_NO_DEVICE;
+  else if (STATE_PERSONALIZED != state)
+    {
+      r->status = PROVISION_FAILED;
+      r->failed_stage = run.failed;
+    }
+  else if (!run.has_keys)
+    r->status = PROVISION_SKIPPED;
+  else
+    {
+      /* Only a device this run finished has its keys to hand */
+      start_stage (&start);
+      r->status = verify_key (fd, run.data_zone + VERIFY_SLOT * KEY_LEN) ?
+        PROVISION_OK : PROVISION_FAILED;
+      r->stage_us[PROVISION_VERIFY] = usec_since (&start);
+      r->failed_stage = PROVISION_VERIFY;
+    }
+
+  wipe (run.data_zone, sizeof (run.data_zone));
+}
+
+static void provision_bus (void *arg, unsigned int index)
+{
+  struct provision_ctx *ctx = arg;
+  unsigned int x;
+
+  for (x = 0; x < ctx->count; x++)
+    {
+      const struct provision_target *t = &ctx->targets[x];
+      struct provision_result *r = &ctx->results[x];
+      struct timespec start;
+      int fd;
+
+      if (0 != strcmp (t->bus, ctx->buses[index]))
+        continue;
+
+      start_stage (&start);
+
+      if ((fd = hashlet_setup (t->bus, t->address)) < 0)
+        r->status = PROVISION_NO_DEVICE;
+      else
+        {
+          provision_device (ctx, fd, r);
+          hashlet_teardown (fd);
+        }
+
+      r->total_us = usec_since (&start);
+
+      CTX_LOG (DEBUG, "%s:%02X: %s", t->bus, t->address,
+               PROVISION_OK == r->status ? "provisioned" : "not provisioned");
+    }
+}
+
+void provision_devices (const struct provision_target *targets,
+                        unsigned int count, unsigned int jobs, bool host_rng,
+                        struct fleet_store *fleet,
+                        const char *checkpoint_file,
+                        struct provision_result *results)
+{
+  assert (NULL != targets);
+  assert (NULL != fleet);
+  assert (NULL != results);
+
+  struct provision_ctx ctx = { .targets = targets, .count = count,
+                               .host_rng = host_rng, .fleet = fleet,
+                               .checkpoint_file = checkpoint_file,
+                               .results = results };
+  unsigned int num_buses = 0;
+  unsigned int x, y;
+
+  ctx.buses = malloc (count * sizeof (*ctx.buses));
+  assert (NULL != ctx.buses || 0 == count);
+
+  for (x = 0; x < count; x++)
+    {
+      memset (&results[x], 0, sizeof (results[x]));
+      results[x].target = targets[x];
+
+      for (y = 0; y < num_buses; y++)
+        if (0 == strcmp (targets[x].bus, ctx.buses[y]))
+          break;
+
+      if (y == num_buses)
+        ctx.buses[num_buses++] = targets[x].bus;
+    }
+
+  if (0 == jobs || jobs > num_buses)
+    jobs = num_buses;
+
+  ctx.sink.record = record_fleet_keys;
+  ctx.sink.recall = recall_fleet_keys;
+  ctx.sink.ctx = &ctx;
+
+  pthread_mutex_init (&ctx.fleet_lock, NULL);
+
+  run_pool (num_buses, jobs, provision_bus, &ctx);
+
+  pthread_mutex_destroy (&ctx.fleet_lock);
+  free (ctx.buses);
+}
+
+static const char* status_name (const struct provision_result *r)
+{
+  switch (r->status)
+    {
+    case PROVISION_OK:
+      return "ok";
+    case PROVISION_SKIPPED:
+      return "skipped";
+    case PROVISION_FAILED:
+      return STAGE_NAMES[r->failed_stage];
+    case PROVISION_NO_DEVICE:
+      return "no-device";
+    default:
+      assert (false);
+    }
+
+  return NULL;
+}
+
+void output_provision_report (FILE *fp,
+                              const struct provision_result *results,
+                              unsigned int count, uint64_t elapsed_us)
+{
+  assert (NULL != fp);
+  assert (NULL != results || 0 == count);
+
+  uint64_t stage_total[PROVISION_NUM_STAGES] = {0};
+  unsigned int stage_count[PROVISION_NUM_STAGES] = {0};
+  unsigned int by_status[PROVISION_NO_DEVICE + 1] = {0};
+  unsigned int x, s;
+
+  fprintf (fp, "%-18s  %-16s %4s  %-9s", "serial", "bus", "addr", "result");
+  for (s = 0; s < PROVISION_NUM_STAGES; s++)
+    fprintf (fp, " %9s", STAGE_NAMES[s]);
+  fprintf (fp, " %9s\n", "total ms");
+
+  for (x = 0; x < count; x++)
+    {
+      const struct provision_result *r = &results[x];
+      char serial[HEX_LEN (FLEET_SERIAL_LEN) + 1] = "-";
+
+      if (r->has_serial)
+        {
+          hex_encode (serial, r->serial, FLEET_SERIAL_LEN);
+          serial[HEX_LEN (FLEET_SERIAL_LEN)] = '\0';
+        }
+
+      by_status[r->status]++;
+
+      fprintf (fp, "%-18s  %-16s 0x%02X  %-9s", serial, r->target.bus,
+               r->target.address, status_name (r));
+
+      for (s = 0; s < PROVISION_NUM_STAGES; s++)
+        {
+          /* Stages an earlier run finished */
+          if (r->skipped & 1u << s)
+            fprintf (fp, " %9s", "-");
+          else
+            fprintf (fp, " %9.1f", r->stage_us[s] / 1000.0);
+
+          if (r->stage_us[s] > 0)
+            {
+              stage_total[s] += r->stage_us[s];
+              stage_count[s]++;
+            }
+        }
+
+      fprintf (fp, " %9.1f\n", r->total_us / 1000.0);
+    }
+
+  fprintf (fp, "\n%u provisioned, %u skipped, %u failed, %u missing "
+           "in %.1f s: %.0f devices/hour\n",
+           by_status[PROVISION_OK], by_status[PROVISION_SKIPPED],
+           by_status[PROVISION_FAILED], by_status[PROVISION_NO_DEVICE],
+           elapsed_us / 1e6,
+           0 == elapsed_us ? 0.0 :
+           by_status[PROVISION_OK] * 3600e6 / elapsed_us);
+
+  fprintf (fp, "mean ms:");
+  for (s = 0; s < PROVISION_NUM_STAGES; s++)
+    fprintf (fp, " %s %.1f", STAGE_NAMES[s],
+             0 == stage_count[s] ? 0.0 :
+             stage_total[s] / 1000.0 / stage_count[s]);
+  fprintf (fp, "\n");
+}
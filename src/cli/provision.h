@@ -0,0 +1,116 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROVISION_H
+#define PROVISION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../driver/fleet_store.h"
+#include "../driver/personalize.h"
+
+/* Factory provisioning: many devices are personalized at once, one
+   worker per I2C bus, since commands to devices on the same bus can't
+   overlap.  Each device goes through the personalize stages, then is
+   verified, every stage timed.  A device that fails a stage is
+   reported and left for the next run, which resumes it from its
+   checkpoint, rather than stopping the others. */
+
+enum provision_stage
+  {
+    /* The personalize stages come first */
+    PROVISION_VERIFY = PERSONALIZE_NUM_STAGES, /**< MAC a challenge */
+    PROVISION_NUM_STAGES
+  };
+
+enum provision_status
+  {
+    PROVISION_OK,               /**< The device was personalized */
+    PROVISION_SKIPPED,          /**< It already was */
+    PROVISION_FAILED,           /**< A stage failed */
+    PROVISION_NO_DEVICE         /**< The device didn't answer */
+  };
+
+struct provision_target
+{
+  const char *bus;
+  uint8_t address;
+};
+
+struct provision_result
+{
+  struct provision_target target;
+  enum provision_status status;
+  unsigned int failed_stage;    /**< If status is PROVISION_FAILED */
+  bool has_serial;
+  uint8_t serial[FLEET_SERIAL_LEN];
+  uint64_t stage_us[PROVISION_NUM_STAGES]; /**< 0 for skipped stages */
+  uint32_t skipped;             /**< Bit x is set if stage x was done */
+  uint64_t total_us;
+};
+
+/**
+ * Parses a device given on the command line, either BUS:ADDRESS or
+ * just the ADDRESS, in hex.
+ *
+ * @param arg The argument
+ * @param default_bus The bus of devices given by address alone
+ * @param target Filled in on success.  Its bus is default_bus or a
+ * malloc'd copy of the one in arg.
+ *
+ * @return True if arg is valid
+ */
+bool parse_provision_target (const char *arg, const char *default_bus,
+                             struct provision_target *target);
+
+/**
+ * Provisions the devices.  Devices on different buses are provisioned
+ * concurrently and those on the same bus in order.
+ *
+ * @param targets The devices
+ * @param count The number of devices
+ * @param jobs The most buses to work on at once, 0 for all of them
+ * @param host_rng Generate the keys with the host's RNG instead of
+ * each device's
+ * @param fleet The fleet store, opened writable, to record the keys in
+ * @param checkpoint_file The checkpoint file, NULL for the default
+ * @param results count results, in the order of targets
+ */
+void provision_devices (const struct provision_target *targets,
+                        unsigned int count, unsigned int jobs, bool host_rng,
+                        struct fleet_store *fleet,
+                        const char *checkpoint_file,
+                        struct provision_result *results);
+
+/**
+ * Prints a line per device, then the throughput and the mean time of
+ * each stage.
+ *
+ * @param fp The stream to print to
+ * @param results The results of provision_devices
+ * @param count The number of results
+ * @param elapsed_us The wall clock time of the run
+ */
+void output_provision_report (FILE *fp,
+                              const struct provision_result *results,
+                              unsigned int count, uint64_t elapsed_us);
+
+#endif /* PROVISION_H */
@@ -0,0 +1,250 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#if HAVE_GCRYPT_H
+#include <assert.h>
+#include <errno.h>
+#include <gcrypt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tree_hash.h"
+#include "hash.h"
+#include "pool.h"
+
+#define NODE_LEN 32
+
+struct leaf_job
+{
+  int fd;
+  off_t start;
+  off_t size;
+  uint64_t chunk_size;
+  uint8_t *leaves;
+  bool failed;
+};
+
+static void hash_leaf (void *ctx, unsigned int index)
+{
+  struct leaf_job *job = ctx;
+  const uint8_t prefix = TREE_LEAF_PREFIX;
+  off_t offset = job->start + (off_t)index * job->chunk_size;
+  off_t length = job->size - offset;
+  gcry_md_hd_t hd;
+
+  if (length > job->chunk_size)
+    length = job->chunk_size;
+
+  assert (GPG_ERR_NO_ERROR == gcry_md_open (&hd, GCRY_MD_SHA256, 0));
+
+  gcry_md_write (hd, &prefix, sizeof (prefix));
+
+  if (sha256_write_range (hd, job->fd, offset, length))
+    memcpy (job->leaves + (uint64_t)index * NODE_LEN,
+            gcry_md_read (hd, GCRY_MD_SHA256), NODE_LEN);
+  else
+    job->failed = true;
+
+  gcry_md_close (hd);
+}
+
+/* Size of each read () when streaming leaves */
+#define STREAM_READ_CHUNK (64 * 1024)
+
+/**
+ * Hash the leaves of a stream that can't be mapped, in order.  Each
+ * leaf is fed to the digest read by read, so memory use doesn't grow
+ * with the leaf size.
+ *
+ * @param fd The open file descriptor
+ * @param chunk_size The leaf size
+ * @param count Filled in with the number of leaves
+ *
+ * @return The malloc'd leaves or NULL on a read error
+ */
+static uint8_t* stream_leaves (int fd, uint64_t chunk_size, uint64_t *count)
+{
+  const uint8_t prefix = TREE_LEAF_PREFIX;
+  uint8_t chunk[STREAM_READ_CHUNK];
+  uint8_t *leaves = NULL;
+  uint64_t capacity = 0;
+  bool done = false;
+  gcry_md_hd_t hd;
+
+  assert (GPG_ERR_NO_ERROR == gcry_md_open (&hd, GCRY_MD_SHA256, 0));
+
+  *count = 0;
+
+  while (!done)
+    {
+      uint64_t filled = 0;
+
+      gcry_md_reset (hd);
+      gcry_md_write (hd, &prefix, sizeof (prefix));
+
+      while (filled < chunk_size)
+        {
+          size_t want = chunk_size - filled < sizeof (chunk) ?
+            chunk_size - filled : sizeof (chunk);
+          ssize_t got = read (fd, chunk, want);
+
+          if (got > 0)
+            {
+              gcry_md_write (hd, chunk, got);
+              filled += got;
+            }
+          else if (0 == got)
+            {
+              done = true;
+              break;
+            }
+          else if (EINTR != errno)
+            {
+              gcry_md_close (hd);
+              free (leaves);
+              return NULL;
+            }
+        }
+
+      /* A trailing empty chunk is only a leaf if it is the only one */
+      if (0 == filled && *count > 0)
+        break;
+
+      if (*count == capacity)
+        {
+          capacity = capacity ? capacity * 2 : 64;
+          leaves = realloc (leaves, capacity * NODE_LEN);
+          assert (NULL != leaves);
+        }
+
+      memcpy (leaves + *count * NODE_LEN, gcry_md_read (hd, GCRY_MD_SHA256),
+              NODE_LEN);
+      (*count)++;
+    }
+
+  gcry_md_close (hd);
+
+  return leaves;
+}
+
+struct tree_hash tree_hash_fd (int fd, uint64_t chunk_size, unsigned int jobs)
+{
+  struct tree_hash tree = { .root = {0,0}, .chunk_size = chunk_size,
+                            .leaves = 0 };
+  uint8_t *leaves = NULL;
+  struct stat st;
+  off_t start;
+
+  assert (fd >= 0);
+  assert (chunk_size > 0);
+
+  /* Initialize gcrypt before the workers start */
+  assert (NULL != gcry_check_version (NULL));
+
+  if (0 == fstat (fd, &st) && S_ISREG (st.st_mode) &&
+      (start = lseek (fd, 0, SEEK_CUR)) >= 0)
+    {
+      struct leaf_job job = { .fd = fd, .start = start, .size = st.st_size,
+                              .chunk_size = chunk_size, .failed = false };
+      off_t length = st.st_size > start ? st.st_size - start : 0;
+
+      tree.leaves = (length + chunk_size - 1) / chunk_size;
+      if (0 == tree.leaves)
+        tree.leaves = 1;
+
+      /* The pool indexes leaves with an unsigned int */
+      if (tree.leaves > UINT32_MAX)
+        return tree;
+
+      leaves = malloc (tree.leaves * NODE_LEN);
+      assert (NULL != leaves);
+      job.leaves = leaves;
+
+      run_pool (tree.leaves, jobs, hash_leaf, &job);
+
+      if (job.failed)
+        {
+          free (leaves);
+          leaves = NULL;
+        }
+    }
+  else
+    leaves = stream_leaves (fd, chunk_size, &tree.leaves);
+
+  if (NULL != leaves)
+    {
+      tree.root = merkle_root (leaves, tree.leaves);
+      free (leaves);
+    }
+
+  return tree;
+}
+
+struct octet_buffer merkle_root (uint8_t *nodes, uint64_t count)
+{
+  assert (NULL != nodes);
+  assert (count > 0);
+
+  uint8_t pair[1 + 2 * NODE_LEN];
+
+  pair[0] = TREE_NODE_PREFIX;
+
+  while (count > 1)
+    {
+      uint64_t x;
+      uint64_t parents = 0;
+
+      for (x = 0; x + 1 < count; x += 2)
+        {
+          memcpy (pair + 1, nodes + x * NODE_LEN, 2 * NODE_LEN);
+          gcry_md_hash_buffer (GCRY_MD_SHA256, nodes + parents * NODE_LEN,
+                               pair, sizeof (pair));
+          parents++;
+        }
+
+      /* Carry an unpaired node up a level */
+      if (x < count)
+        {
+          memmove (nodes + parents * NODE_LEN, nodes + x * NODE_LEN, NODE_LEN);
+          parents++;
+        }
+
+      count = parents;
+    }
+
+  struct octet_buffer root = make_buffer (NODE_LEN);
+  memcpy (root.ptr, nodes, NODE_LEN);
+
+  return root;
+}
+
+void output_tree_layout (FILE *stream, struct tree_hash tree)
+{
+  assert (NULL != stream);
+
+  fprintf (stream, "%s : %s chunk=%" PRIu64 " leaves=%" PRIu64 "\n",
+           "tree     ", TREE_LAYOUT, tree.chunk_size, tree.leaves);
+}
+
+#endif
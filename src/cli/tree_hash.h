@@ -0,0 +1,84 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TREE_HASH_H
+#define TREE_HASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../driver/util.h"
+
+/* Name of the tree layout, printed with every tree hash so a verifier
+   knows how to rebuild the root.  The layout is that of RFC 6962:
+
+     leaf = SHA256 (0x00 | chunk)
+     node = SHA256 (0x01 | left | right)
+
+   Nodes are paired left to right, level by level, and an unpaired
+   last node is carried up unchanged.  An empty input is a single
+   empty chunk. */
+#define TREE_LAYOUT "rfc6962"
+
+#define TREE_DEFAULT_CHUNK (1024 * 1024)
+
+#define TREE_LEAF_PREFIX 0x00
+#define TREE_NODE_PREFIX 0x01
+
+struct tree_hash
+{
+  struct octet_buffer root;     /**< The 32 byte root, ptr NULL on error */
+  uint64_t chunk_size;          /**< Bytes per leaf */
+  uint64_t leaves;              /**< Number of leaves */
+};
+
+/**
+ * Computes the tree hash of an open file descriptor, from its current
+ * offset to the end.  The leaves of a regular file are hashed
+ * concurrently, anything else is read and hashed in order.
+ *
+ * @param fd The open file descriptor
+ * @param chunk_size The number of bytes in each leaf
+ * @param jobs The number of workers, 0 for the default
+ *
+ * @return The tree hash.  root.ptr is NULL on error.
+ */
+struct tree_hash tree_hash_fd (int fd, uint64_t chunk_size, unsigned int jobs);
+
+/**
+ * Reduces an array of 32 byte nodes to the Merkle root.  The array is
+ * overwritten in the process.
+ *
+ * @param nodes count consecutive 32 byte digests
+ * @param count The number of nodes, at least one
+ *
+ * @return The malloc'd 32 byte root
+ */
+struct octet_buffer merkle_root (uint8_t *nodes, uint64_t count);
+
+/**
+ * Prints the line describing the tree, which must be given back to a
+ * verifier: "tree      : rfc6962 chunk=CHUNK leaves=LEAVES"
+ *
+ * @param stream The output stream
+ * @param tree The tree hash
+ */
+void output_tree_layout (FILE *stream, struct tree_hash tree);
+
+#endif /* TREE_HASH_H */
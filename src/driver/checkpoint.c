@@ -0,0 +1,121 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "checkpoint.h"
+#include "crc.h"
+
+static const struct record_format CHECKPOINT_FORMAT =
+  {
+    .magic = { 'H', 'L', 'C', 'P' },
+    .version = CHECKPOINT_VERSION,
+    .record_size = sizeof (struct checkpoint_record),
+    .min_slots = 64,
+    .sync = true
+  };
+
+static uint16_t record_crc (const struct checkpoint_record *r)
+{
+  struct crc16_ctx ctx;
+
+  crc16_init (&ctx);
+  crc16_update (&ctx, r->serial, sizeof (r->serial));
+  crc16_update (&ctx, &r->reserved, sizeof (r->reserved));
+  crc16_update (&ctx, (const uint8_t *)&r->done, sizeof (r->done));
+  crc16_update (&ctx, r->otp, sizeof (r->otp));
+
+  return crc16_final (&ctx);
+}
+
+uint32_t load_checkpoint (const char *filename, const uint8_t *serial,
+                          uint8_t *otp)
+{
+  assert (NULL != filename);
+  assert (NULL != serial);
+
+  struct record_file f;
+  struct checkpoint_record record;
+  uint32_t done = 0;
+
+  if (NULL != otp)
+    memset (otp, 0, OTP_ZONE_LEN);
+
+  if (!open_record_file (&f, filename, &CHECKPOINT_FORMAT, false))
+    return 0;
+
+  if (read_record (&f, serial, &record) && record_crc (&record) == record.crc)
+    {
+      done = record.done;
+
+      if (NULL != otp)
+        memcpy (otp, record.otp, OTP_ZONE_LEN);
+    }
+
+  close_record_file (&f);
+
+  return done;
+}
+
+bool save_checkpoint (const char *filename, const uint8_t *serial,
+                      uint32_t done, const uint8_t *otp)
+{
+  assert (NULL != filename);
+  assert (NULL != serial);
+
+  struct record_file f;
+  struct checkpoint_record record;
+  bool result;
+
+  if (!open_record_file (&f, filename, &CHECKPOINT_FORMAT, true))
+    return false;
+
+  memset (&record, 0, sizeof (record));
+  memcpy (record.serial, serial, CHECKPOINT_SERIAL_LEN);
+  record.done = done;
+  if (NULL != otp)
+    memcpy (record.otp, otp, OTP_ZONE_LEN);
+  record.crc = record_crc (&record);
+
+  result = write_record (&f, &record);
+
+  close_record_file (&f);
+
+  return result;
+}
+
+bool clear_checkpoint (const char *filename, const uint8_t *serial)
+{
+  assert (NULL != filename);
+  assert (NULL != serial);
+
+  struct record_file f;
+  bool result;
+
+  if (!open_record_file (&f, filename, &CHECKPOINT_FORMAT, true))
+    return false;
+
+  result = delete_record (&f, serial);
+
+  close_record_file (&f);
+
+  return result;
+}
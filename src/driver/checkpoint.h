@@ -0,0 +1,96 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "defs.h"
+#include "record_file.h"
+
+/* Personalization checkpoints.  Each stage of personalize that the
+   device can't report itself, such as the OTP zone having been
+   written, is recorded here under the device's serial number as soon
+   as it completes, so a run that was interrupted picks up where it
+   stopped.  The file is a record file, see record_file.h, each change
+   synced before the next stage starts.  A device's record is removed
+   once it is personalized, so the file only holds devices part way
+   through.
+
+   The OTP zone can't be read back until the data zone is locked, yet
+   the lock's CRC covers it, so the image written is kept with the
+   stages: a resumed run locks what is on the device even if it is a
+   later version of hashlet that would write a different image. */
+
+#define CHECKPOINT_FILE "/.hashlet_checkpoints"
+
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_SERIAL_LEN RECORD_SERIAL_LEN
+
+struct checkpoint_record
+{
+  uint8_t serial[CHECKPOINT_SERIAL_LEN];
+  uint8_t reserved;
+  uint16_t crc;                 /**< CRC16 of every other field */
+  uint32_t done;                /**< Bit x is set if stage x completed */
+  uint8_t otp[OTP_ZONE_LEN];    /**< The OTP zone as written, or zeros */
+};
+
+/**
+ * Returns the stages a device has completed.
+ *
+ * @param filename The checkpoint file
+ * @param serial The 9 byte serial number
+ * @param otp Filled in with the OTP_ZONE_LEN byte image saved with the
+ * stages, zeros if there is none.  May be NULL.
+ *
+ * @return The stages as a bit mask, 0 if the device has no valid
+ * checkpoint
+ */
+uint32_t load_checkpoint (const char *filename, const uint8_t *serial,
+                          uint8_t *otp);
+
+/**
+ * Records the stages a device has completed, creating the file if
+ * needed.  Returns once the record is on disk.
+ *
+ * @param filename The checkpoint file
+ * @param serial The 9 byte serial number
+ * @param done The stages as a bit mask, replacing the last ones
+ * @param otp The OTP_ZONE_LEN byte image written to the OTP zone, NULL
+ * if it hasn't been
+ *
+ * @return True if recorded
+ */
+bool save_checkpoint (const char *filename, const uint8_t *serial,
+                      uint32_t done, const uint8_t *otp);
+
+/**
+ * Removes a device's checkpoint, once its locks show what was done.
+ *
+ * @param filename The checkpoint file
+ * @param serial The 9 byte serial number
+ *
+ * @return True if the device has no checkpoint left on disk
+ */
+bool clear_checkpoint (const char *filename, const uint8_t *serial);
+
+#endif /* CHECKPOINT_H */
@@ -29,7 +29,10 @@
 #include <string.h>
 #include "i2c.h"
 #include "command_adaptation.h"
+#include "command_table.h"
 #include "log.h"
+#include "temp_key.h"
+#include "zone_cache.h"
 #include "config.h"
 #include "../cli/hash.h"
 
@@ -76,84 +79,31 @@ void set_data (struct Command_ATSHA204 *c, uint8_t *data, uint8_t len)
     }
   else
     {
-      c->data = malloc (len);
-      assert (NULL != c->data);
-      memcpy (c->data, data, len);
+      /* The command only borrows data, which must outlive it */
+      c->data = data;
       c->data_len = len;
     }
 }
 
-void set_execution_time (struct Command_ATSHA204 *c, unsigned int sec,
-                         unsigned long nano)
-{
-  assert (NULL != c);
-  c->exec_time.tv_sec = sec;
-  c->exec_time.tv_nsec = nano;
-}
-
 void print_command (struct Command_ATSHA204 *c)
 {
   assert (NULL != c);
 
-  const char* opcode = NULL;
+  const struct command_descriptor *d = command_descriptor (c->opcode);
+
+  assert (NULL != d);
 
   CTX_LOG (DEBUG, "*** Printing Command ***");
   CTX_LOG (DEBUG, "Command: 0x%02X", c->command);
   CTX_LOG (DEBUG, "Count: 0x%02X", c->count);
   CTX_LOG (DEBUG, "OpCode: 0x%02X", c->opcode);
-
-  switch (c->opcode)
-    {
-    case COMMAND_DERIVE_KEY:
-      opcode = "Command Derive Key";
-      break;
-    case COMMAND_DEV_REV:
-      opcode = "Command Dev Rev";
-      break;
-    case COMMAND_GEN_DIG:
-      opcode = "Command Generate Digest";
-      break;
-    case COMMAND_HMAC:
-      opcode = "Command HMAC";
-      break;
-    case COMMAND_CHECK_MAC:
-      opcode = "Command Check MAC";
-      break;
-    case COMMAND_LOCK:
-      opcode = "Command Lock";
-      break;
-    case COMMAND_MAC:
-      opcode = "Command MAC";
-      break;
-    case COMMAND_NONCE:
-      opcode = "Command NONCE";
-      break;
-    case COMMAND_PAUSE:
-      opcode = "Command Pause";
-      break;
-    case COMMAND_RANDOM:
-      opcode = "Command Random";
-      break;
-    case COMMAND_READ:
-      opcode = "Command Read";
-      break;
-    case COMMAND_UPDATE_EXTRA:
-      opcode = "Command Update Extra";
-      break;
-    case COMMAND_WRITE:
-      opcode = "Command Write";
-      break;
-    default:
-      assert (false);
-    }
-  CTX_LOG (DEBUG,"%s", opcode);
+  CTX_LOG (DEBUG,"Command %s", d->name);
   CTX_LOG (DEBUG,"param1: 0x%02X", c->param1);
   CTX_LOG (DEBUG,"param2: 0x%02X 0x%02X", c->param2[0], c->param2[1]);
-  if (c->data_len > 0)
+  /* A Write's data may be a key in the clear */
+  if (c->data_len > 0 && COMMAND_WRITE != c->opcode)
     print_hex_string ("Data", c->data, c->data_len);
   CTX_LOG (DEBUG,"CRC: 0x%02X 0x%02X", c->checksum[0], c->checksum[1]);
-  CTX_LOG (DEBUG,"Wait time: %ld seconds %lu nanoseconds",
-           c->exec_time.tv_sec, c->exec_time.tv_nsec);
 }
 
 enum STATUS_RESPONSE get_status_response(const uint8_t *rsp)
@@ -181,49 +131,60 @@ struct octet_buffer get_random (int fd, bool update_seed)
 
 struct octet_buffer get_random_bytes (int fd, bool update_seed, int bytes)
 {
-  uint8_t *random = NULL;
-  uint8_t param2[2] = {0};
-  uint8_t param1 = update_seed ? 0 : 1;
-  int i = 0;
-  int rc = 0;
-  int orig_bytes = bytes;
   struct octet_buffer buf = {};
-  struct Command_ATSHA204 c = make_command ();
 
-  bytes -= 32;
-  if (bytes < 0) bytes = 0;
+  assert (bytes >= 0);
+
+  buf = make_buffer (bytes);
+
+  if (RSP_SUCCESS != get_random_into (fd, update_seed, buf))
+    {
+      free_octet_buffer (buf);
+      buf.ptr = NULL;
+      buf.len = 0;
+    }
+
+  return buf;
+}
 
-  random = malloc_wipe (orig_bytes + RANDOM_RSP_LENGTH);
+enum STATUS_RESPONSE get_random_into (int fd, bool update_seed,
+                                      struct octet_buffer out)
+{
+  uint8_t random[RANDOM_RSP_LENGTH];
+  uint8_t param2[2] = {0};
+  unsigned int offset = 0;
+  enum STATUS_RESPONSE rc = RSP_SUCCESS;
+  struct Command_ATSHA204 c = make_command ();
+
+  assert (NULL != out.ptr || 0 == out.len);
 
   set_opcode (&c, COMMAND_RANDOM);
-  set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, RANDOM_AVG_EXEC);
-
 
-  while (RSP_SUCCESS == \
-         (rc = process_command (fd, &c, &random[i], RANDOM_RSP_LENGTH)))
+  while (offset < out.len)
     {
-      i += RANDOM_RSP_LENGTH;
-      if( i - (RANDOM_RSP_LENGTH-1) > bytes) break;
-      update_seed = 0; /* No need to keep updating */
-    }
+      unsigned int len = out.len - offset;
 
-  if (rc == RSP_SUCCESS)
-    {
-      buf.ptr = random;
-      buf.len = orig_bytes;
-    }
-  else
-    {
-      free_wipe (random, orig_bytes + RANDOM_RSP_LENGTH);
-      CTX_LOG (DEBUG, "Random bytes command failed");
-    }
+      /* Only the first block needs to update the seed */
+      set_param1 (&c, (update_seed && 0 == offset) ? 0 : 1);
 
-  return buf;
+      if (RSP_SUCCESS != (rc = process_command (fd, &c, random,
+                                                RANDOM_RSP_LENGTH)))
+        {
+          CTX_LOG (DEBUG, "Random bytes command failed");
+          break;
+        }
+
+      if (len > RANDOM_RSP_LENGTH)
+        len = RANDOM_RSP_LENGTH;
 
+      offset = copy_to_buffer (out, offset, random, len);
+    }
 
+  wipe (random, sizeof (random));
+
+  return rc;
 }
 
 uint8_t set_zone_bits (enum DATA_ZONE zone)
@@ -257,6 +218,17 @@ bool read4 (int fd, enum DATA_ZONE zone, uint8_t addr, uint32_t *buf)
 
   assert (NULL != buf);
 
+  if (CONFIG_ZONE == zone && addr < CONFIG_ZONE_WORDS)
+    {
+      const struct command_descriptor *d = command_descriptor (COMMAND_READ);
+
+      return RSP_SUCCESS == send_and_receive (fd, config_read4_frame (addr),
+                                              READ4_FRAME_LEN,
+                                              (uint8_t *)buf,
+                                              sizeof (uint32_t),
+                                              &d->avg_exec);
+    }
+
   param2[0] = addr;
 
   struct Command_ATSHA204 c = make_command ();
@@ -265,7 +237,6 @@ bool read4 (int fd, enum DATA_ZONE zone, uint8_t addr, uint32_t *buf)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, 1000000);
 
 
   if (RSP_SUCCESS == \
@@ -278,12 +249,45 @@ bool read4 (int fd, enum DATA_ZONE zone, uint8_t addr, uint32_t *buf)
 }
 
 struct octet_buffer read32 (int fd, enum DATA_ZONE zone, uint8_t addr)
+{
+  const unsigned int LENGTH_OF_RESPONSE = 32;
+  struct octet_buffer buf = make_buffer (LENGTH_OF_RESPONSE);
+
+  if (RSP_SUCCESS != read32_into (fd, zone, addr, buf))
+    {
+      free_wipe (buf.ptr, LENGTH_OF_RESPONSE);
+      buf.ptr = NULL;
+      buf.len = 0;
+    }
+
+  return buf;
+}
+
+enum STATUS_RESPONSE read32_into (int fd, enum DATA_ZONE zone, uint8_t addr,
+                                  struct octet_buffer out)
+{
+  struct pending_command p;
+
+  const unsigned int LENGTH_OF_RESPONSE = 32;
+
+  if (NULL == out.ptr || out.len < LENGTH_OF_RESPONSE)
+    return RSP_BUFFER_TOO_SMALL;
+
+  read32_issue (fd, zone, addr, &p);
+
+  return read32_complete (fd, &p, out);
+}
+
+void read32_issue (int fd, enum DATA_ZONE zone, uint8_t addr,
+                   struct pending_command *p)
 {
   uint8_t param2[2] = {0};
   uint8_t param1 = set_zone_bits (zone);
 
   uint8_t READ_32_MASK = 0b10000000;
 
+  assert (NULL != p);
+
   param1 |= READ_32_MASK;
 
   param2[0] = addr;
@@ -294,19 +298,18 @@ struct octet_buffer read32 (int fd, enum DATA_ZONE zone, uint8_t addr)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, READ_AVG_EXEC);
 
+  issue_command (fd, &c, p);
+}
+
+enum STATUS_RESPONSE read32_complete (int fd, struct pending_command *p,
+                                      struct octet_buffer out)
+{
   const unsigned int LENGTH_OF_RESPONSE = 32;
-  struct octet_buffer buf = make_buffer (LENGTH_OF_RESPONSE);
 
-  if (RSP_SUCCESS != process_command (fd, &c, buf.ptr, LENGTH_OF_RESPONSE))
-    {
-      free_wipe (buf.ptr, LENGTH_OF_RESPONSE);
-      buf.ptr = NULL;
-      buf.len = 0;
-    }
+  assert (NULL != out.ptr && out.len >= LENGTH_OF_RESPONSE);
 
-  return buf;
+  return complete_command (fd, p, out.ptr, LENGTH_OF_RESPONSE);
 }
 
 
@@ -326,7 +329,6 @@ bool write4 (int fd, enum DATA_ZONE zone, uint8_t addr, uint32_t buf)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, (uint8_t *)&buf, sizeof (buf));
-  set_execution_time (&c, 0, 4000000);
 
   if (RSP_SUCCESS == process_command (fd, &c, &recv, sizeof (recv)))
     {
@@ -375,7 +377,6 @@ bool write32 (int fd, enum DATA_ZONE zone, uint8_t addr,
   set_param2 (&c, param2);
   set_data (&c, data.ptr, data.len);
 
-  set_execution_time (&c, 0, WRITE_AVG_EXEC);
 
   if (RSP_SUCCESS == process_command (fd, &c, &recv, sizeof (recv)))
     {
@@ -445,21 +446,111 @@ struct mac_response perform_mac (int fd, struct mac_mode_encoding m,
                                  struct octet_buffer challenge)
 {
   const unsigned int recv_len = 32;
+  const unsigned int META_LEN = 13;
   struct mac_response rsp = {0};
-  rsp.status = false;
+
+  rsp.mac = make_buffer (recv_len);
+  rsp.meta = make_buffer (META_LEN);
+
+  enum STATUS_RESPONSE rc =
+    perform_mac_into (fd, m, data_slot, challenge, rsp.mac, rsp.meta);
+
+  if (RSP_SUCCESS == rc || RSP_CHECKMAC_MISCOMPARE == rc)
+    {
+      rsp.status = (RSP_SUCCESS == rc);
+    }
+  else
+    {
+      free_octet_buffer (rsp.mac);
+      free_octet_buffer (rsp.meta);
+      rsp.mac.ptr = rsp.meta.ptr = NULL;
+      rsp.mac.len = rsp.meta.len = 0;
+    }
+
+  return rsp;
+}
+
+/**
+ * Builds the 13 bytes of check mac meta data into the caller's
+ * buffer.
+ *
+ * @param fd The open file descriptor
+ * @param m The MAC mode the response was made with
+ * @param data_slot The data slot used
+ * @param out At least 13 bytes
+ *
+ * @return RSP_SUCCESS if the OTP zone and serial number were read
+ */
+static enum STATUS_RESPONSE check_mac_meta_data_into (int fd,
+                                                      struct mac_mode_encoding m,
+                                                      unsigned int data_slot,
+                                                      struct octet_buffer out)
+{
+  const unsigned int DLEN = 13;
+  const unsigned int OTP_8_10_LEN = 3;
+  const unsigned int SN_4_7_LEN = 4;
+  const unsigned int SN_2_3_LEN = 2;
+  const uint8_t SERIAL_PART1_ADDR = 0x00;
+  const uint8_t SERIAL_PART2_ADDR = 0x02;
+  uint8_t otp_zone[64] = {0};
+  uint32_t serial[2] = {0};     /* SN[0:3] then SN[4:7] */
+  enum STATUS_RESPONSE rc = RSP_SUCCESS;
+  unsigned int offset = 0;
+
+  if (NULL == out.ptr || out.len < DLEN)
+    return RSP_BUFFER_TOO_SMALL;
+
+  /* Unused fields are sent as zeros, but are read regardless so a
+     missing device is noticed */
+  if (RSP_SUCCESS != (rc = get_otp_zone_into (fd, ARRAY_BUFFER (otp_zone))))
+    return rc;
+  if (!read4 (fd, CONFIG_ZONE, SERIAL_PART1_ADDR, &serial[0]) ||
+      !read4 (fd, CONFIG_ZONE, SERIAL_PART2_ADDR, &serial[1]))
+    return RSP_COMM_ERROR;
+
+  if (!m.use_serial_num)
+    memset (serial, 0, sizeof (serial));
+
+  if (!m.use_otp_0_10)
+    wipe (otp_zone, sizeof (otp_zone));
+
+  offset = copy_byte_to_buffer (out, offset, COMMAND_MAC);
+  offset = copy_byte_to_buffer (out, offset, serialize_mac_mode (m));
+  offset = copy_byte_to_buffer (out, offset, data_slot);
+  offset = copy_byte_to_buffer (out, offset, 0);
+  offset = copy_to_buffer (out, offset, &otp_zone[8], OTP_8_10_LEN);
+  offset = copy_to_buffer (out, offset, (uint8_t *)&serial[1], SN_4_7_LEN);
+  offset = copy_to_buffer (out, offset, (uint8_t *)serial + 2, SN_2_3_LEN);
+
+  assert (DLEN == offset);
+
+  return RSP_SUCCESS;
+}
+
+enum STATUS_RESPONSE perform_mac_into (int fd, struct mac_mode_encoding m,
+                                       unsigned int data_slot,
+                                       struct octet_buffer challenge,
+                                       struct octet_buffer mac,
+                                       struct octet_buffer meta)
+{
+  const unsigned int recv_len = 32;
+  const unsigned int META_LEN = 13;
   uint8_t param1 = serialize_mac_mode (m);
   uint8_t param2[2] = {0};
+  enum STATUS_RESPONSE rc;
 
   assert (data_slot <= MAX_NUM_DATA_SLOTS);
   if (!m.use_second_32_temp_key)
     assert (NULL != challenge.ptr && recv_len == challenge.len);
 
+  if (NULL == mac.ptr || mac.len < recv_len ||
+      NULL == meta.ptr || meta.len < META_LEN)
+    return RSP_BUFFER_TOO_SMALL;
+
   /* Param 2 is guaranteed to be less than 15 (check above) */
   param2[0] = data_slot;
   param2[1] = 0;
 
-  rsp.mac = make_buffer (recv_len);
-
   struct Command_ATSHA204 c = make_command ();
 
   set_opcode (&c, COMMAND_MAC);
@@ -467,25 +558,23 @@ struct mac_response perform_mac (int fd, struct mac_mode_encoding m,
   set_param2 (&c, param2);
   /* TODO Fix for situations not sending the challlenge */
   set_data (&c, challenge.ptr, challenge.len);
-  set_execution_time (&c, 0, MAC_AVG_EXEC);
 
-  if (RSP_SUCCESS == process_command (fd, &c, rsp.mac.ptr, recv_len))
-    {
-      /* Perform a check mac to ensure we have the data correct */
-      rsp.meta = get_check_mac_meta_data (fd, m, data_slot);
-      struct check_mac_encoding cm = {0};
+  if (RSP_SUCCESS != (rc = process_command (fd, &c, mac.ptr, recv_len)))
+    return rc;
 
-      rsp.status = \
-        check_mac (fd,  cm, data_slot, challenge, rsp.mac, rsp.meta);
+  /* Perform a check mac to ensure we have the data correct */
+  if (RSP_SUCCESS != (rc = check_mac_meta_data_into (fd, m, data_slot,
+                                                     meta)))
+    return rc;
 
-    }
-  else
-    {
-      free_octet_buffer (rsp.mac);
+  struct check_mac_encoding cm = {0};
+  struct octet_buffer mac_view = {mac.ptr, recv_len};
+  struct octet_buffer meta_view = {meta.ptr, META_LEN};
 
-    }
+  if (!check_mac (fd, cm, data_slot, challenge, mac_view, meta_view))
+    return RSP_CHECKMAC_MISCOMPARE;
 
-  return rsp;
+  return RSP_SUCCESS;
 }
 
 struct octet_buffer get_check_mac_meta_data (int fd,
@@ -494,51 +583,13 @@ struct octet_buffer get_check_mac_meta_data (int fd,
 {
   const unsigned int DLEN = 13;
   struct octet_buffer result = make_buffer (DLEN);
-  uint8_t *p = result.ptr;
-
-  *p++ = COMMAND_MAC;
-  *p++ = serialize_mac_mode (m);
-  *p++ = data_slot;
-  *p++ = 0;
-
-  struct octet_buffer otp_zone = get_otp_zone (fd);
-  struct octet_buffer serial = get_serial_num (fd);
-
-  if (!m.use_serial_num)
-    {
-      unsigned int len = serial.len;
-      free_octet_buffer (serial);
-      serial = make_buffer (len);
-    }
-
-  if (!m.use_otp_0_10)
-    {
-      unsigned int len = otp_zone.len;
-      free_octet_buffer (otp_zone);
-      otp_zone = make_buffer (len);
-    }
-
-  const unsigned int OTP_8_10_LEN = 3;
-  const unsigned int SN_4_7_LEN = 4;
-  const unsigned int SN_2_3_LEN = 2;
 
-  if (NULL != otp_zone.ptr && NULL != serial.ptr)
-    {
-      memcpy (p, &otp_zone.ptr[8], OTP_8_10_LEN);
-      p += OTP_8_10_LEN;
-      memcpy (p, &serial.ptr[4], SN_4_7_LEN);
-      p += SN_4_7_LEN;
-      memcpy (p, &serial.ptr[2], SN_2_3_LEN);
-    }
-  else
+  if (RSP_SUCCESS != check_mac_meta_data_into (fd, m, data_slot, result))
     {
       free_octet_buffer (result);
       result.ptr = NULL;
     }
 
-  free_octet_buffer (otp_zone);
-  free_octet_buffer (serial);
-
   return result;
 }
 
@@ -564,15 +615,15 @@ bool check_mac (int fd, struct check_mac_encoding cm,
   assert (OTHER_DATA_SIZE == other_data.len);
   assert (data_slot <= MAX_NUM_DATA_SLOTS);
 
-  const unsigned int DATA_LEN = CHALLENGE_SIZE * 2 + OTHER_DATA_SIZE;
+  uint8_t buf[32 * 2 + 13];
+  struct octet_buffer data = ARRAY_BUFFER (buf);
+  unsigned int offset = 0;
 
-  struct octet_buffer data;
-  data = make_buffer(DATA_LEN);
+  offset = copy_buffer (data, offset, challenge);
+  offset = copy_buffer (data, offset, challenge_response);
+  offset = copy_buffer (data, offset, other_data);
 
-  memcpy (data.ptr, challenge.ptr, CHALLENGE_SIZE);
-  memcpy (data.ptr + CHALLENGE_SIZE,
-          challenge_response.ptr, CHALLENGE_SIZE);
-  memcpy (data.ptr + CHALLENGE_SIZE * 2, other_data.ptr, OTHER_DATA_SIZE);
+  assert (CHALLENGE_SIZE * 2 + OTHER_DATA_SIZE == offset);
 
 
   /* Param 2 is guaranteed to be less than 15 (check above) */
@@ -586,7 +637,6 @@ bool check_mac (int fd, struct check_mac_encoding cm,
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, data.ptr, data.len);
-  set_execution_time (&c, 0, CHECK_MAC_AVG_EXEC);
 
   if (RSP_SUCCESS == process_command (fd, &c, &response, sizeof(response)))
     {
@@ -645,59 +695,105 @@ bool is_data_locked (int fd)
 }
 
 
-struct octet_buffer get_config_zone (fd)
+struct octet_buffer get_config_zone (int fd)
 {
   const unsigned int SIZE_OF_CONFIG_ZONE = 88;
-  const unsigned int NUM_OF_WORDS = SIZE_OF_CONFIG_ZONE / 4;
 
   struct octet_buffer buf = make_buffer (SIZE_OF_CONFIG_ZONE);
-  uint8_t *write_loc = buf.ptr;
 
-  unsigned int addr = 0;
-  unsigned int word = 0;
+  if (RSP_SUCCESS != get_config_zone_into (fd, buf))
+    {
+      free_octet_buffer (buf);
+      buf.ptr = NULL;
+      buf.len = 0;
+    }
+
+  return buf;
+}
+
+enum STATUS_RESPONSE get_config_zone_into (int fd, struct octet_buffer out)
+{
+  const unsigned int SIZE_OF_CONFIG_ZONE = 88;
+  const unsigned int NUM_OF_WORDS = SIZE_OF_CONFIG_ZONE / 4;
+
+  struct octet_buffer head = {out.ptr, ZONE_CACHE_IDENTIFY_LEN};
+  unsigned int word = ZONE_CACHE_IDENTIFY_LEN / 4;
+  enum STATUS_RESPONSE rc;
+
+  if (NULL == out.ptr || out.len < SIZE_OF_CONFIG_ZONE)
+    return RSP_BUFFER_TOO_SMALL;
+
+  /* The first block holds the serial number, which the zone cache
+     needs before it can answer */
+  if (RSP_SUCCESS != (rc = read32_into (fd, CONFIG_ZONE, 0, head)))
+    return rc;
+
+  zone_cache_offer (fd, CONFIG_ZONE, out.ptr, ZONE_CACHE_IDENTIFY_LEN);
+
+  /* Once locked, only the last word, with the lock bytes, is read */
+  if (zone_cache_lookup (fd, CONFIG_ZONE, out.ptr))
+    word = ZONE_CACHE_CONFIG_LEN / 4;
 
   while (word < NUM_OF_WORDS)
     {
-      addr = word * 4;
-      read4 (fd, CONFIG_ZONE, word, (uint32_t*)(write_loc+addr));
+      uint32_t value;
+
+      if (!read4 (fd, CONFIG_ZONE, word, &value))
+        return RSP_COMM_ERROR;
+
+      copy_to_buffer (out, word * 4, (uint8_t *)&value, sizeof (value));
       word++;
     }
 
+  zone_cache_offer (fd, CONFIG_ZONE, out.ptr, SIZE_OF_CONFIG_ZONE);
+
+  return RSP_SUCCESS;
+}
+
+struct octet_buffer get_otp_zone (int fd)
+{
+  const unsigned int SIZE_OF_OTP_ZONE = 64;
+
+  struct octet_buffer buf = make_buffer (SIZE_OF_OTP_ZONE);
+
+  if (RSP_SUCCESS != get_otp_zone_into (fd, buf))
+    {
+      free_octet_buffer (buf);
+      buf.ptr = NULL;
+    }
+
   return buf;
 }
 
-struct octet_buffer get_otp_zone (fd)
+enum STATUS_RESPONSE get_otp_zone_into (int fd, struct octet_buffer out)
 {
   const unsigned int SIZE_OF_OTP_ZONE = 64;
   const unsigned int SIZE_OF_READ = 32;
   const unsigned int SIZE_OF_WORD = 4;
   const unsigned int SECOND_WORD = (SIZE_OF_READ / SIZE_OF_WORD);
 
-  struct octet_buffer buf = make_buffer (SIZE_OF_OTP_ZONE);
-  struct octet_buffer half;
-
+  enum STATUS_RESPONSE rc = RSP_SUCCESS;
   int x = 0;
 
-  for (x=0; x < 2; x++ )
+  if (NULL == out.ptr || out.len < SIZE_OF_OTP_ZONE)
+    return RSP_BUFFER_TOO_SMALL;
+
+  if (zone_cache_lookup (fd, OTP_ZONE, out.ptr))
+    return RSP_SUCCESS;
+
+  for (x=0; x < 2 && RSP_SUCCESS == rc; x++ )
     {
       int addr = x * SECOND_WORD;
       int offset = x * SIZE_OF_READ;
+      struct octet_buffer half = {out.ptr + offset, SIZE_OF_READ};
 
-      half = read32 (fd, OTP_ZONE, addr);
-      if (NULL != half.ptr)
-        {
-          memcpy (buf.ptr + offset, half.ptr, SIZE_OF_READ);
-          free_octet_buffer (half);
-        }
-      else
-        {
-          free_octet_buffer (buf);
-          buf.ptr = NULL;
-          return buf;
-        }
+      rc = read32_into (fd, OTP_ZONE, addr, half);
     }
 
-  return buf;
+  if (RSP_SUCCESS == rc)
+    zone_cache_offer (fd, OTP_ZONE, out.ptr, SIZE_OF_OTP_ZONE);
+
+  return rc;
 }
 
 bool lock (int fd, enum DATA_ZONE zone, uint16_t crc)
@@ -734,7 +830,6 @@ bool lock (int fd, enum DATA_ZONE zone, uint16_t crc)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, LOCK_AVG_EXEC);
 
   if (RSP_SUCCESS == process_command (fd, &c, &response, sizeof (response)))
     {
@@ -758,7 +853,12 @@ bool is_otp_read_only_mode (int fd)
 {
   const uint8_t ADDR = 0x04;
   uint32_t word = 0;
-  assert (read4 (fd, CONFIG_ZONE, ADDR, &word));
+
+  if (!read4 (fd, CONFIG_ZONE, ADDR, &word))
+    {
+      CTX_LOG (INFO, "Failed to read the OTP mode");
+      return false;
+    }
 
   uint8_t * byte = (uint8_t *)&word;
 
@@ -769,6 +869,23 @@ bool is_otp_read_only_mode (int fd)
 }
 
 
+void otp_zone_image (uint8_t *otp)
+{
+  const unsigned int SIZE_OF_WRITE = 32;
+
+  assert (NULL != otp);
+
+  /* Simple check to make sure PACKAGE_VERSION isn't too long */
+  assert (strlen (PACKAGE_VERSION) < 10);
+
+  wipe (otp, OTP_ZONE_LEN);
+
+  /* Setup the fixed OTP data zone */
+  sprintf ((char *)otp, "CRYPTOTRONIX HASHLET REV: A");
+  sprintf ((char *)otp + SIZE_OF_WRITE, "SOFTWARE VERSION: %s",
+           PACKAGE_VERSION);
+}
+
 bool set_otp_zone (int fd, struct octet_buffer *otp_zone)
 {
 
@@ -778,24 +895,19 @@ bool set_otp_zone (int fd, struct octet_buffer *otp_zone)
   /* The device must be using an OTP read only mode */
 
   if (!is_otp_read_only_mode (fd))
-    assert (false);
+    {
+      CTX_LOG (INFO, "The OTP zone is not in read only mode");
+      return false;
+    }
 
   /* The writes must be done in 32 bytes blocks */
 
   uint8_t nulls[SIZE_OF_WRITE];
-  uint8_t part1[SIZE_OF_WRITE];
-  uint8_t part2[SIZE_OF_WRITE];
+  uint8_t otp[OTP_ZONE_LEN];
   struct octet_buffer buf ={};
   wipe (nulls, SIZE_OF_WRITE);
-  wipe (part1, SIZE_OF_WRITE);
-  wipe (part2, SIZE_OF_WRITE);
-
-  /* Simple check to make sure PACKAGE_VERSION isn't too long */
-  assert (strlen (PACKAGE_VERSION) < 10);
 
-  /* Setup the fixed OTP data zone */
-  sprintf ((char *)part1, "CRYPTOTRONIX HASHLET REV: A");
-  sprintf ((char *)part2, "SOFTWARE VERSION: %s", PACKAGE_VERSION);
+  otp_zone_image (otp);
 
   bool success = true;
 
@@ -810,11 +922,11 @@ bool set_otp_zone (int fd, struct octet_buffer *otp_zone)
                        buf, NULL);
 
   /* Fill in the data */
-  buf.ptr = part1;
+  buf.ptr = otp;
   CTX_LOG (DEBUG, "Writing: %s", buf.ptr);
   if (success)
     success = write32 (fd, OTP_ZONE, 0, buf, NULL);
-  buf.ptr = part2;
+  buf.ptr = otp + SIZE_OF_WRITE;
   CTX_LOG (DEBUG, "Writing: %s", buf.ptr);
   if (success)
     success = write32 (fd, OTP_ZONE, SIZE_OF_WRITE / sizeof (uint32_t),
@@ -824,10 +936,9 @@ bool set_otp_zone (int fd, struct octet_buffer *otp_zone)
      Ironically, the OTP can't be read while unlocked. */
   if (success)
     {
-      otp_zone->len = SIZE_OF_WRITE * 2;
+      otp_zone->len = OTP_ZONE_LEN;
       otp_zone->ptr = malloc_wipe (otp_zone->len);
-      memcpy (otp_zone->ptr, part1, SIZE_OF_WRITE);
-      memcpy (otp_zone->ptr + SIZE_OF_WRITE, part2, SIZE_OF_WRITE);
+      memcpy (otp_zone->ptr, otp, OTP_ZONE_LEN);
     }
   return success;
 }
@@ -911,6 +1022,28 @@ uint8_t slot_to_addr (enum DATA_ZONE zone, uint8_t slot)
 }
 
 struct octet_buffer gen_nonce (int fd, struct octet_buffer data)
+{
+  const unsigned int EXTERNAL_INPUT_LEN = 32;
+  const unsigned int PASS_THROUGH_RSP_LENGTH = 1;
+  const unsigned int RSP_LENGTH = 32;
+
+  assert (NULL != data.ptr);
+
+  struct octet_buffer buf = make_buffer (EXTERNAL_INPUT_LEN == data.len ?
+                                         PASS_THROUGH_RSP_LENGTH :
+                                         RSP_LENGTH);
+
+  if (RSP_SUCCESS != gen_nonce_into (fd, data, buf))
+    {
+      free_octet_buffer (buf);
+      buf.ptr = NULL;
+    }
+
+  return buf;
+}
+
+enum STATUS_RESPONSE gen_nonce_into (int fd, struct octet_buffer data,
+                                     struct octet_buffer out)
 {
   const unsigned int EXTERNAL_INPUT_LEN = 32;
   const unsigned int NEW_NONCE_LEN = 20;
@@ -920,6 +1053,7 @@ struct octet_buffer gen_nonce (int fd, struct octet_buffer data)
 
   uint8_t param2[2] = {0};
   uint8_t param1 = 0;
+  enum STATUS_RESPONSE rc;
 
   unsigned int rsp_len = 0;
 
@@ -938,7 +1072,8 @@ struct octet_buffer gen_nonce (int fd, struct octet_buffer data)
       rsp_len = RSP_LENGTH;
     }
 
-  struct octet_buffer buf = make_buffer (rsp_len);
+  if (NULL == out.ptr || out.len < rsp_len)
+    return RSP_BUFFER_TOO_SMALL;
 
   struct Command_ATSHA204 c = make_command ();
 
@@ -946,47 +1081,66 @@ struct octet_buffer gen_nonce (int fd, struct octet_buffer data)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, data.ptr, data.len);
-  set_execution_time (&c, 0, NONCE_AVG_EXEC);
 
-  if (RSP_SUCCESS != process_command (fd, &c, buf.ptr, buf.len))
+  if (RSP_SUCCESS != (rc = process_command (fd, &c, out.ptr, rsp_len)))
+    CTX_LOG (DEBUG, "Nonce command failed");
+  else
     {
-      CTX_LOG (DEBUG, "Nonce command failed");
-      free_octet_buffer (buf);
-      buf.ptr = NULL;
+      struct temp_key tk = { .source = TEMP_KEY_INPUT };
+
+      if (EXTERNAL_INPUT_LEN == data.len)
+        memcpy (tk.value, data.ptr, TEMP_KEY_LEN);
+      else
+        {
+          tk.source = TEMP_KEY_RANDOM;
+          temp_key_nonce_value (out.ptr, data.ptr, param1, tk.value);
+        }
+
+      temp_key_set (fd, &tk);
+      wipe ((uint8_t *)&tk, sizeof (tk));
     }
 
-  return buf;
+  return rc;
 }
 
 struct octet_buffer get_nonce (int fd)
 {
-  struct octet_buffer otp;
-  struct octet_buffer nonce = {0, 0};
-  const unsigned int MIX_DATA_LEN = 20;
-
-  otp = get_otp_zone (fd);
-  unsigned int otp_len = otp.len;
+  const unsigned int NONCE_LEN = 32;
+  struct octet_buffer nonce = make_buffer (NONCE_LEN);
 
-  if (otp.len > MIX_DATA_LEN && otp.ptr != NULL)
+  if (RSP_SUCCESS != get_nonce_into (fd, nonce))
     {
-      otp.len = MIX_DATA_LEN;
-      nonce = gen_nonce (fd, otp);
-      otp.len = otp_len;
-
+      free_octet_buffer (nonce);
+      nonce.ptr = NULL;
+      nonce.len = 0;
     }
 
-  free_octet_buffer (otp);
-
   return nonce;
 }
 
+enum STATUS_RESPONSE get_nonce_into (int fd, struct octet_buffer out)
+{
+  const unsigned int MIX_DATA_LEN = 20;
+  uint8_t otp[64];
+  enum STATUS_RESPONSE rc;
+
+  if (RSP_SUCCESS == (rc = get_otp_zone_into (fd, ARRAY_BUFFER (otp))))
+    {
+      struct octet_buffer mix = {otp, MIX_DATA_LEN};
+      rc = gen_nonce_into (fd, mix, out);
+    }
+
+  return rc;
+}
+
 bool load_nonce (int fd, struct octet_buffer data)
 {
   assert (data.ptr != NULL && data.len == 32);
 
-  struct octet_buffer rsp = gen_nonce (fd, data);
+  uint8_t rsp = 0xFF;
+  struct octet_buffer out = {&rsp, sizeof (rsp)};
 
-  if (NULL == rsp.ptr || *rsp.ptr != 0)
+  if (RSP_SUCCESS != gen_nonce_into (fd, data, out) || rsp != 0)
     return false;
   else
     return true;
@@ -1002,41 +1156,12 @@ struct octet_buffer gen_temp_key_from_nonce (int fd,
   struct octet_buffer result = {0,0};
 
   const unsigned int MIX_DATA_LEN = 20;
-  const uint8_t OPCODE = 0x16;
   const uint8_t MODE = 0;
-  const uint8_t PARAM2 = 0; /* only the LSB are used */
-
-  const unsigned int data_len = random.len + MIX_DATA_LEN +
-    sizeof (OPCODE) + sizeof (MODE) + sizeof (PARAM2);
-
 
   if (otp.len > MIX_DATA_LEN && otp.ptr != NULL)
     {
-      struct octet_buffer data_to_hash = make_buffer (data_len);
-
-      unsigned int offset = 0;
-
-      offset = copy_buffer (data_to_hash, offset, random);
-
-      offset = copy_to_buffer (data_to_hash, offset, otp.ptr, MIX_DATA_LEN);
-
-      data_to_hash.ptr[offset] = OPCODE;
-      offset += 1;
-
-      data_to_hash.ptr[offset] = MODE;
-      offset += 1;
-
-      data_to_hash.ptr[offset] = PARAM2;
-      offset += 1;
-
-      assert (offset == data_len);
-
-
-      print_hex_string ("Nonce data to hash", data_to_hash.ptr,
-                        data_to_hash.len);
-
-
-      result = sha256_buffer (data_to_hash);
+      result = make_buffer (TEMP_KEY_LEN);
+      temp_key_nonce_value (random.ptr, otp.ptr, MODE, result.ptr);
 
       print_hex_string ("Nonce temp key", result.ptr,
                         result.len);
@@ -1054,61 +1179,9 @@ struct octet_buffer gen_temp_key_from_digest (int fd,
   assert (NULL != key.ptr && 32 == key.len);
   assert (slot <= 15);
 
-  struct octet_buffer result = {0,0};
-
-  const uint8_t OPCODE = COMMAND_GEN_DIG;
-  const uint8_t PARAM1 = 0x02;
-  uint8_t PARAM2[2] = {0};
-  PARAM2[1] = slot;
-
-  const uint8_t sn8 = 0xEE;
-  const uint8_t sn0 = 0x01;
-  const uint8_t sn1 = 0x23;
-  const unsigned int ZERO_25 = 25;
-
-  unsigned int len = key.len + sizeof (OPCODE) + sizeof (PARAM1) +
-    sizeof (PARAM2) + sizeof (sn8) + sizeof (sn0) + sizeof (sn1) + ZERO_25 +
-    prev_temp_key.len;
-
-  struct octet_buffer data_to_hash = make_buffer (len);
-
-  unsigned int offset = 0;
+  struct octet_buffer result = make_buffer (TEMP_KEY_LEN);
 
-  offset = copy_buffer (data_to_hash, offset, key);
-
-  data_to_hash.ptr[offset] = OPCODE;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = PARAM1;
-  offset += 1;
-
-  offset = copy_to_buffer (data_to_hash, offset, PARAM2, 2);
-
-  data_to_hash.ptr[offset] = sn8;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = sn0;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = sn1;
-  offset += 1;
-
-  struct octet_buffer zeros = make_buffer (ZERO_25);
-
-  offset = copy_buffer (data_to_hash, offset, zeros);
-
-  offset = copy_buffer (data_to_hash, offset, prev_temp_key);
-
-  assert (offset == len);
-
-  print_hex_string ("Temp Key data to hash",
-                    data_to_hash.ptr, data_to_hash.len);
-
-  result = sha256_buffer (data_to_hash);
-
-  print_hex_string ("Temp Key", result.ptr, result.len);
-
-  free_octet_buffer (zeros);
+  temp_key_gen_dig_value (prev_temp_key.ptr, slot, key.ptr, result.ptr);
 
   return result;
 }
@@ -1130,43 +1203,33 @@ struct octet_buffer mac_write (const struct octet_buffer temp_key,
   unsigned int len = temp_key.len + sizeof (opcode) + sizeof (param1) + 2 +
     sizeof (sn8) + sizeof (sn0) + sizeof (sn1) + ZERO_25 + data.len;
 
-  struct octet_buffer data_to_hash = make_buffer (len);
+  uint8_t buf[32 + 4 + 3 + 25 + 32];
+  struct octet_buffer data_to_hash = ARRAY_BUFFER (buf);
+
+  assert (len == data_to_hash.len);
 
   unsigned int offset = 0;
 
   offset = copy_buffer (data_to_hash, offset, temp_key);
 
-  data_to_hash.ptr[offset] = opcode;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = param1;
-  offset += 1;
+  offset = copy_byte_to_buffer (data_to_hash, offset, opcode);
+  offset = copy_byte_to_buffer (data_to_hash, offset, param1);
 
   offset = copy_to_buffer (data_to_hash, offset, param2, 2);
 
-  data_to_hash.ptr[offset] = sn8;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = sn0;
-  offset += 1;
-
-  data_to_hash.ptr[offset] = sn1;
-  offset += 1;
+  offset = copy_byte_to_buffer (data_to_hash, offset, sn8);
+  offset = copy_byte_to_buffer (data_to_hash, offset, sn0);
+  offset = copy_byte_to_buffer (data_to_hash, offset, sn1);
 
-  struct octet_buffer zeros = make_buffer (ZERO_25);
-
-  offset = copy_buffer (data_to_hash, offset, zeros);
+  offset = zero_fill_buffer (data_to_hash, offset, ZERO_25);
 
   offset = copy_buffer (data_to_hash, offset, data);
 
   assert (offset == len);
 
-  print_hex_string ("Write mac data to hash", data_to_hash.ptr,
-                    data_to_hash.len);
-
   struct octet_buffer mac = sha256_buffer (data_to_hash);
 
-  free_octet_buffer (zeros);
+  wipe (buf, sizeof (buf));
 
   print_hex_string ("Mac'd write", mac.ptr, mac.len);
 
@@ -1175,7 +1238,17 @@ struct octet_buffer mac_write (const struct octet_buffer temp_key,
 
 bool gen_digest (int fd, enum DATA_ZONE zone, unsigned int slot)
 {
-  bool result = false;
+  struct pending_command p;
+
+  gen_digest_issue (fd, zone, slot, &p);
+
+  return gen_digest_complete (fd, &p);
+}
+
+void gen_digest_issue (int fd, enum DATA_ZONE zone, unsigned int slot,
+                       struct pending_command *p)
+{
+  assert (NULL != p);
 
   if (DATA_ZONE == zone)
     assert (slot <= 15);
@@ -1200,10 +1273,7 @@ bool gen_digest (int fd, enum DATA_ZONE zone, unsigned int slot)
       assert (false);
     }
 
-  param2[1] = slot;
-
-
-  uint8_t rsp = 0;
+  param2[0] = slot;
 
   struct Command_ATSHA204 c = make_command ();
 
@@ -1211,14 +1281,15 @@ bool gen_digest (int fd, enum DATA_ZONE zone, unsigned int slot)
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, GEN_DIG_AVG_EXEC);
 
-  if (RSP_SUCCESS == process_command (fd, &c, &rsp, sizeof (rsp)))
-    {
-      result = true;
-    }
+  issue_command (fd, &c, p);
+}
 
-  return result;
+bool gen_digest_complete (int fd, struct pending_command *p)
+{
+  uint8_t rsp = 0;
+
+  return RSP_SUCCESS == complete_command (fd, p, &rsp, sizeof (rsp));
 }
 
 uint8_t serialize_hmac_mode (struct hmac_mode_encoding hm)
@@ -1239,29 +1310,39 @@ struct octet_buffer perform_hmac (int fd, struct hmac_mode_encoding hm,
 
   const int RSP_LENGTH = 32;
 
+  struct octet_buffer rsp = make_buffer (RSP_LENGTH);
+
+  if (RSP_SUCCESS != perform_hmac_into (fd, hm, data_slot, rsp))
+    {
+      free_wipe (rsp.ptr, RSP_LENGTH);
+      rsp.ptr = NULL;
+      rsp.len = 0;
+    }
+
+  return rsp;
+
+}
+
+enum STATUS_RESPONSE perform_hmac_into (int fd, struct hmac_mode_encoding hm,
+                                        unsigned int data_slot,
+                                        struct octet_buffer out)
+{
+  const unsigned int RSP_LENGTH = 32;
+
   assert (data_slot <= MAX_NUM_DATA_SLOTS);
 
+  if (NULL == out.ptr || out.len < RSP_LENGTH)
+    return RSP_BUFFER_TOO_SMALL;
+
   uint8_t param1 = serialize_hmac_mode (hm);
   uint8_t param2[2] = {data_slot, 0};
 
-  struct octet_buffer rsp = make_buffer (RSP_LENGTH);
-
   struct Command_ATSHA204 c = make_command ();
 
   set_opcode (&c, COMMAND_HMAC);
   set_param1 (&c, param1);
   set_param2 (&c, param2);
   set_data (&c, NULL, 0);
-  set_execution_time (&c, 0, HMAC_AVG_EXEC);
-
-
-  if (RSP_SUCCESS != process_command (fd, &c, rsp.ptr, rsp.len))
-    {
-      free_wipe (rsp.ptr, RSP_LENGTH);
-      rsp.ptr = NULL;
-      rsp.len = 0;
-    }
-
-  return rsp;
 
+  return process_command (fd, &c, out.ptr, RSP_LENGTH);
 }
@@ -57,7 +57,6 @@ struct Command_ATSHA204
   uint8_t *data;
   unsigned int data_len;
   uint8_t checksum[2];
-  struct timespec exec_time;
 };
 
 enum STATUS_RESPONSE
@@ -73,8 +72,31 @@ enum STATUS_RESPONSE
     RSP_COMM_ERROR = 0xFF,       /**< Command was not received properly
                                    */
     RSP_NAK = 0xAA,     /**< Response was NAKed and a retry should occur */
+    RSP_BUFFER_TOO_SMALL = 0xFE, /**< Host side: the caller's output
+                                    buffer is too short.  Nothing was
+                                    sent to the device. */
   };
 
+/**
+ * Returns an empty command, to be filled in with the set_ functions.
+ *
+ * @return The command
+ */
+struct Command_ATSHA204 make_command ();
+
+void set_opcode (struct Command_ATSHA204 *c, uint8_t opcode);
+void set_param1 (struct Command_ATSHA204 *c, uint8_t param1);
+void set_param2 (struct Command_ATSHA204 *c, uint8_t *param2);
+
+/**
+ * Sets the command's data.  The command only borrows it.
+ *
+ * @param c The command
+ * @param data The data, NULL for none
+ * @param len The length of the data
+ */
+void set_data (struct Command_ATSHA204 *c, uint8_t *data, uint8_t len);
+
 enum STATUS_RESPONSE get_status_response (const uint8_t *rsp);
 
 /* Random Commands */
@@ -99,6 +121,23 @@ struct octet_buffer get_random (int fd, bool update_seed);
  */
 struct octet_buffer get_random_bytes(int fd, bool update_seed, int bytes);
 
+/* Caller buffer variants.  The functions named *_into write their
+   result into a buffer the caller owns, usually on the stack, and
+   return the status of the command instead of allocating.  The
+   allocating functions are wrappers around them. */
+
+/**
+ * Fills the caller's buffer with random data from the device.
+ *
+ * @param fd The open file descriptor
+ * @param update_seed True updates the seed before the first 32 bytes.
+ * @param out The buffer to fill, of any length
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE get_random_into (int fd, bool update_seed,
+                                      struct octet_buffer out);
+
 /**
  * Read four bytes from the device.
  *
@@ -156,6 +195,19 @@ bool write32 (int fd, enum DATA_ZONE zone, uint8_t addr,
  */
 struct octet_buffer gen_nonce (int fd, struct octet_buffer data);
 
+/**
+ * Runs the nonce command into the caller's buffer.
+ *
+ * @param fd The open file descriptor.
+ * @param data 32 bytes to pass through, or 20 bytes to combine
+ * @param out At least 1 byte for pass through, otherwise at least 32
+ * bytes
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE gen_nonce_into (int fd, struct octet_buffer data,
+                                     struct octet_buffer out);
+
 /**
  * Generates a new nonce from the device.  This will combine the OTP
  * zone with a random number to generate the nonce.
@@ -166,6 +218,16 @@ struct octet_buffer gen_nonce (int fd, struct octet_buffer data);
  */
 struct octet_buffer get_nonce (int fd);
 
+/**
+ * Generates a new nonce into the caller's buffer.
+ *
+ * @param fd The open file descriptor.
+ * @param out At least 32 bytes
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE get_nonce_into (int fd, struct octet_buffer out);
+
 /**
  * Loads a 32 byte value into tempkey.
  *
@@ -179,13 +241,23 @@ bool load_nonce (int fd, struct octet_buffer data);
 /**
  * Set the configuration zone based.  This function will setup the
  * configuration zone, and thus the device, to a fixed configuration.
+ * Only the words that differ from it are written.
  *
  * @param fd The open file descriptor.
  *
- * @return True if succesful, otherwise false
+ * @return True if succesful, otherwise false, including when the zone
+ * is locked with a different configuration.
  */
 bool set_config_zone (int fd);
 
+/**
+ * Fills in the fixed data that set_otp_zone programs, which is needed
+ * to lock the zone.
+ *
+ * @param otp OTP_ZONE_LEN bytes
+ */
+void otp_zone_image (uint8_t *otp);
+
 /**
  * Programs the OTP zone with fixed data
  *
@@ -284,6 +356,27 @@ struct mac_response perform_mac (int fd, struct mac_mode_encoding m,
                                  unsigned int data_slot,
                                  struct octet_buffer challenge);
 
+/**
+ * Performs a MAC into the caller's buffers, then checks it on the
+ * device as perform_mac does.
+ *
+ * @param fd The file descriptor to which to write.
+ * @param m The MAC command mode options.
+ * @param data_slot The data slot (0-15) to be used in the MAC.
+ * @param challenge The 32 byte challenge
+ * @param mac At least 32 bytes for the MAC
+ * @param meta At least 13 bytes for the check mac meta data
+ *
+ * @return RSP_SUCCESS if the MAC was computed and checked,
+ * RSP_CHECKMAC_MISCOMPARE if the device did not accept it, otherwise
+ * the failing status
+ */
+enum STATUS_RESPONSE perform_mac_into (int fd, struct mac_mode_encoding m,
+                                       unsigned int data_slot,
+                                       struct octet_buffer challenge,
+                                       struct octet_buffer mac,
+                                       struct octet_buffer meta);
+
 /**
  *
  *
@@ -303,6 +396,17 @@ bool is_config_locked (int fd);
  */
 struct octet_buffer get_config_zone (int fd);
 
+/**
+ * Reads the entire configuration zone into the caller's buffer.
+ *
+ * @param fd The open file descriptor
+ * @param out At least 88 bytes
+ *
+ * @return RSP_SUCCESS if every word was read, otherwise the failing
+ * status
+ */
+enum STATUS_RESPONSE get_config_zone_into (int fd, struct octet_buffer out);
+
 /**
  * Returns the entire OTP zone.
  *
@@ -312,6 +416,17 @@ struct octet_buffer get_config_zone (int fd);
  */
 struct octet_buffer get_otp_zone (int fd);
 
+/**
+ * Reads the entire OTP zone into the caller's buffer.
+ *
+ * @param fd The open file descriptor.
+ * @param out At least 64 bytes
+ *
+ * @return RSP_SUCCESS if the zone was read, otherwise the failing
+ * status
+ */
+enum STATUS_RESPONSE get_otp_zone_into (int fd, struct octet_buffer out);
+
 /**
  * Locks the specified zone.
  *
@@ -351,6 +466,47 @@ struct octet_buffer get_serial_num (int fd);
  */
 struct octet_buffer read32 (int fd, enum DATA_ZONE zone, uint8_t addr);
 
+/**
+ * Reads 32 Bytes from the address into the caller's buffer.
+ *
+ * @param fd The open file descriptor
+ * @param zone The zone to read from
+ * @param addr The address to read from
+ * @param out At least 32 bytes
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE read32_into (int fd, enum DATA_ZONE zone, uint8_t addr,
+                                  struct octet_buffer out);
+
+/* A command sent to the device, see command_adaptation.h */
+struct pending_command;
+
+/**
+ * Sends a 32 byte read without waiting for the response, so the host
+ * can work while the device executes it.  Nothing else may be sent
+ * until read32_complete collects the response.
+ *
+ * @param fd The open file descriptor
+ * @param zone The zone to read from
+ * @param addr The address to read from
+ * @param p Filled in with the read in flight
+ */
+void read32_issue (int fd, enum DATA_ZONE zone, uint8_t addr,
+                   struct pending_command *p);
+
+/**
+ * Collects the response of a read sent with read32_issue.
+ *
+ * @param fd The open file descriptor
+ * @param p The read in flight
+ * @param out At least 32 bytes
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE read32_complete (int fd, struct pending_command *p,
+                                      struct octet_buffer out);
+
 
 enum DEVICE_STATE
 {
@@ -457,6 +613,29 @@ struct octet_buffer mac_write (const struct octet_buffer temp_key,
  */
 bool gen_digest (int fd, enum DATA_ZONE zone, unsigned int slot);
 
+/**
+ * Sends a GenDig without waiting for the response, so the host can
+ * work out the digest while the device does.  Nothing else may be
+ * sent until gen_digest_complete collects the response.
+ *
+ * @param fd The open file descriptor
+ * @param zone The zone, as for gen_digest
+ * @param slot The slot according to the zone
+ * @param p Filled in with the GenDig in flight
+ */
+void gen_digest_issue (int fd, enum DATA_ZONE zone, unsigned int slot,
+                       struct pending_command *p);
+
+/**
+ * Collects the response of a GenDig sent with gen_digest_issue.
+ *
+ * @param fd The open file descriptor
+ * @param p The GenDig in flight
+ *
+ * @return true if the digest is set in temp_key
+ */
+bool gen_digest_complete (int fd, struct pending_command *p);
+
 /**
  * Calculates the value of temp key from the gendig command.
  *
@@ -502,4 +681,18 @@ uint8_t serialize_hmac_mode (struct hmac_mode_encoding hm);
 struct octet_buffer perform_hmac (int fd, struct hmac_mode_encoding hm,
                                   unsigned int data_slot);
 
+/**
+ * Performs HMAC into the caller's buffer.
+ *
+ * @param fd The open file descriptor.
+ * @param hm The encoded hmac options
+ * @param data_slot The key to use
+ * @param out At least 32 bytes
+ *
+ * @return RSP_SUCCESS if out was filled, otherwise the failing status
+ */
+enum STATUS_RESPONSE perform_hmac_into (int fd, struct hmac_mode_encoding hm,
+                                        unsigned int data_slot,
+                                        struct octet_buffer out);
+
 #endif /* COMMAND_H */
@@ -28,6 +28,9 @@
 #include <assert.h>
 #include "util.h"
 #include "log.h"
+#include "stats.h"
+#include "command_table.h"
+#include "temp_key.h"
 
 const char* status_to_string (enum STATUS_RESPONSE rsp)
 {
@@ -68,88 +71,235 @@ const char* status_to_string (enum STATUS_RESPONSE rsp)
 enum STATUS_RESPONSE process_command (int fd, struct Command_ATSHA204 *c,
                                       uint8_t* rec_buf, unsigned int recv_len)
 {
-  unsigned int c_len = 0;
-  uint8_t *serialized = NULL;
+  struct pending_command p;
 
-  assert (NULL != c);
-  assert (NULL != rec_buf);
+  issue_command (fd, c, &p);
 
-  c_len = serialize_command (c, &serialized);
+  return complete_command (fd, &p, rec_buf, recv_len);
+}
 
-  enum STATUS_RESPONSE rsp = send_and_receive (fd, serialized,
-                                               c_len,
-                                               rec_buf,
-                                               recv_len,
-                                               &c->exec_time);
+/**
+ * Sends, or sends again, the frame of a command in flight.
+ *
+ * @param fd The open file descriptor
+ * @param p The command
+ *
+ * @return False if the frame could not be sent
+ */
+static bool send_frame (int fd, struct pending_command *p)
+{
+  /* A Write's data may be a key in the clear, so only its header is
+     logged */
+  print_hex_string ("Sending", p->frame, COMMAND_WRITE == p->frame[2] ?
+                    COMMAND_FRAME_OVERHEAD - CRC_16_LEN : p->len);
 
-  free (serialized);
+  if (i2c_write (fd, p->frame, p->len) <= 1)
+    {
+      CTX_LOG (INFO, "Failed to send command 0x%02X", p->frame[2]);
+      return false;
+    }
 
-  return rsp;
+  stats_record_bytes (fd, p->frame[2], p->len, 0);
+  clock_gettime (CLOCK_MONOTONIC, &p->sent);
 
+  return true;
 }
 
-enum STATUS_RESPONSE send_and_receive (int fd, uint8_t *send_buf,
-                                       unsigned int send_buf_len,
-                                       uint8_t *recv_buf,
-                                       unsigned int recv_buf_len,
-                                       struct timespec *wait_time)
+/**
+ * Sleeps for whatever is left of the command's execution time, since
+ * the host may have been busy while the device worked.
+ *
+ * @param p The command in flight
+ */
+static void wait_for_device (const struct pending_command *p)
+{
+  struct timespec now, left, tim_rem;
+  int64_t ns;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  ns = (p->wait->tv_sec - (now.tv_sec - p->sent.tv_sec)) * 1000000000LL +
+    p->wait->tv_nsec - (now.tv_nsec - p->sent.tv_nsec);
+
+  if (ns > 0)
+    {
+      left.tv_sec = ns / 1000000000LL;
+      left.tv_nsec = ns % 1000000000LL;
+      nanosleep (&left, &tim_rem);
+    }
+}
+
+/**
+ * Reads the response of a command that has been sent.
+ *
+ * @param fd The open file descriptor
+ * @param p The command in flight
+ * @param recv_buf The response buffer
+ * @param recv_buf_len The length of the response
+ *
+ * @return The status of the command
+ */
+static enum STATUS_RESPONSE receive_frame (int fd, struct pending_command *p,
+                                           uint8_t *recv_buf,
+                                           unsigned int recv_buf_len)
 {
-  struct timespec tim_rem;
+  struct timespec end;
   enum STATUS_RESPONSE rsp = RSP_AWAKE;
   const unsigned int NUM_RETRIES = 10;
+  /* Each NAK waits the typical execution time again.  No command's
+     maximum is more than about ten times its typical time, so a
+     device still NAKing after this many is gone or stuck. */
+  const unsigned int MAX_NAKS = 20;
+  const unsigned int FRAMING_LEN = 3;
+  const uint8_t opcode = p->frame[2];
   unsigned int x = 0;
-  ssize_t result = 0;
+  unsigned int naks;
 
-  assert (NULL != send_buf);
-  assert (NULL != recv_buf);
-  assert (NULL != wait_time);
-
-  /* Send the data at first.  During a read, if the device responds
-  with an "I'm Awake" flag, we've lost synchronization, so send the
-  data again in that case only.  Arbitrarily retry this procedure
-  NUM_RETRIES times */
+  /* During a read, if the device responds with an "I'm Awake" flag,
+  we've lost synchronization, so send the data again in that case
+  only.  Arbitrarily retry this procedure NUM_RETRIES times */
   for (x=0; x < NUM_RETRIES && rsp == RSP_AWAKE; x++)
     {
-      print_hex_string ("Sending", send_buf, send_buf_len);
-
-      result = i2c_write (fd,send_buf,send_buf_len);
-
-      if (result > 1)
+      if (x > 0)
         {
-          do
+          stats_record_event (fd, opcode, STATS_RETRY);
+          if (!send_frame (fd, p))
             {
-              nanosleep (wait_time , &tim_rem);
+              rsp = RSP_COMM_ERROR;
+              break;
             }
-          while ((rsp = read_and_validate (fd, recv_buf, recv_buf_len))
-                 == RSP_NAK);
-          CTX_LOG (DEBUG, "Command Response: %s", status_to_string (rsp));
         }
-      else
+
+      naks = 0;
+      do
         {
-          perror ("Send failed\n");
-          exit (1);
+          wait_for_device (p);
+          rsp = read_and_validate (fd, recv_buf, recv_buf_len);
+
+          if (RSP_NAK == rsp)
+            {
+              stats_record_event (fd, opcode, STATS_NAK);
+              /* Still busy, give it the whole execution time again */
+              clock_gettime (CLOCK_MONOTONIC, &p->sent);
+            }
+          else
+            stats_record_bytes (fd, opcode, 0,
+                                recv_buf_len + FRAMING_LEN);
         }
+      while (rsp == RSP_NAK && ++naks < MAX_NAKS);
 
+      if (RSP_NAK == rsp)
+        CTX_LOG (INFO, "No response to command 0x%02X", opcode);
 
+      if (RSP_AWAKE == rsp)
+        stats_record_event (fd, opcode, STATS_AWAKE);
+      else if (RSP_COMM_ERROR == rsp)
+        stats_record_event (fd, opcode, STATS_CRC_ERROR);
+
+      CTX_LOG (DEBUG, "Command Response: %s", status_to_string (rsp));
     }
 
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  stats_record_command (fd, opcode,
+                        (end.tv_sec - p->start.tv_sec) * 1000000ULL +
+                        (end.tv_nsec - p->start.tv_nsec) / 1000,
+                        RSP_SUCCESS == rsp);
+
   return rsp;
 }
 
-unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized)
+void issue_command (int fd, struct Command_ATSHA204 *c,
+                    struct pending_command *p)
+{
+  const struct command_descriptor *d;
+
+  assert (NULL != c);
+  assert (NULL != p);
+
+  d = command_descriptor (c->opcode);
+  assert (NULL != d);
+  assert (command_is_valid (d, c->param1, c->data_len));
+
+  p->len = serialize_command (c, p->frame);
+  p->data_len = c->data_len;
+  p->wait = &d->avg_exec;
+
+  clock_gettime (CLOCK_MONOTONIC, &p->start);
+  p->sent_ok = send_frame (fd, p);
+}
+
+enum STATUS_RESPONSE complete_command (int fd, struct pending_command *p,
+                                       uint8_t* rec_buf,
+                                       unsigned int recv_len)
+{
+  assert (NULL != p);
+  assert (NULL != rec_buf);
+
+  const uint8_t opcode = p->frame[2];
+
+  assert (recv_len == command_response_len (command_descriptor (opcode),
+                                            p->frame[3]));
+
+  enum STATUS_RESPONSE rsp = RSP_COMM_ERROR;
+
+  if (p->sent_ok)
+    rsp = receive_frame (fd, p, rec_buf, recv_len);
+  else
+    stats_record_command (fd, opcode, 0, false);
+
+  wipe (p->frame, p->len);
+
+  temp_key_after_command (fd, opcode, p->data_len, RSP_SUCCESS == rsp);
+
+  return rsp;
+}
+
+enum STATUS_RESPONSE send_and_receive (int fd, const uint8_t *send_buf,
+                                       unsigned int send_buf_len,
+                                       uint8_t *recv_buf,
+                                       unsigned int recv_buf_len,
+                                       const struct timespec *wait_time)
+{
+  struct pending_command p;
+  enum STATUS_RESPONSE rsp;
+
+  assert (NULL != send_buf);
+  assert (NULL != recv_buf);
+  assert (NULL != wait_time);
+  assert (send_buf_len > 2 && send_buf_len <= sizeof (p.frame));
+
+  memcpy (p.frame, send_buf, send_buf_len);
+  p.len = send_buf_len;
+  p.data_len = 0;
+  p.wait = wait_time;
+
+  clock_gettime (CLOCK_MONOTONIC, &p.start);
+
+  if (send_frame (fd, &p))
+    rsp = receive_frame (fd, &p, recv_buf, recv_buf_len);
+  else
+    {
+      stats_record_command (fd, p.frame[2], 0, false);
+      rsp = RSP_COMM_ERROR;
+    }
+
+  wipe (p.frame, p.len);
+
+  return rsp;
+}
+
+unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t *frame)
 {
   unsigned int total_len = 0;
   unsigned int crc_len = 0;
   unsigned int crc_offset = 0;
-  uint8_t *data;
-  uint16_t *crc;
-
+  uint16_t crc;
 
   assert (NULL != c);
-  assert (NULL != serialized);
+  assert (NULL != frame);
+  assert (c->data_len <= MAX_COMMAND_DATA_LEN);
 
-  total_len = sizeof (c->command) + sizeof (c->count) +sizeof (c->opcode) +
-    sizeof (c->param1) + sizeof (c->param2) + c->data_len + sizeof (c->checksum);
+  total_len = COMMAND_FRAME_LEN (c->data_len);
 
   crc_len = total_len - sizeof (c->command) - sizeof (c->checksum);
 
@@ -157,10 +307,6 @@ unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized
 
   c->count = total_len - sizeof (c->command);
 
-  data = (uint8_t*)malloc (total_len);
-
-  assert (NULL != data);
-
   print_command (c);
 
   CTX_LOG (DEBUG,
@@ -168,19 +314,17 @@ unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized
            total_len, c->count, crc_len, crc_offset);
 
   /* copy over the command */
-  data[0] = c->command;
-  data[1] = c->count;
-  data[2] = c->opcode;
-  data[3] = c->param1;
-  data[4] = c->param2[0];
-  data[5] = c->param2[1];
+  frame[0] = c->command;
+  frame[1] = c->count;
+  frame[2] = c->opcode;
+  frame[3] = c->param1;
+  frame[4] = c->param2[0];
+  frame[5] = c->param2[1];
   if (c->data_len > 0)
-    memcpy (&data[6], c->data, c->data_len);
-
-  crc = (uint16_t *)&data[crc_offset];
-  *crc = calculate_crc16 (&data[1], crc_len);
+    memcpy (&frame[6], c->data, c->data_len);
 
-  *serialized = data;
+  crc = calculate_crc16 (&frame[1], crc_len);
+  memcpy (&frame[crc_offset], &crc, sizeof (crc));
 
   return total_len;
 
@@ -189,7 +333,7 @@ unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized
 enum STATUS_RESPONSE read_and_validate (int fd, uint8_t *buf, unsigned int len)
 {
 
-  uint8_t* tmp = NULL;
+  uint8_t tmp[MAX_RESPONSE_FRAME_LEN];
   const int PAYLOAD_LEN_SIZE = 1;
   const int CRC_SIZE = 2;
   enum STATUS_RESPONSE status = RSP_COMM_ERROR;
@@ -200,6 +344,7 @@ enum STATUS_RESPONSE read_and_validate (int fd, uint8_t *buf, unsigned int len)
   const unsigned int STATUS_RSP = 4;
 
   assert (NULL != buf);
+  assert (len <= MAX_RESPONSE_LEN);
 
   recv_buf_len = len + PAYLOAD_LEN_SIZE + CRC_SIZE;
 
@@ -207,7 +352,7 @@ enum STATUS_RESPONSE read_and_validate (int fd, uint8_t *buf, unsigned int len)
 
   /* The buffer that comes back has a length byte at the front and a
    * two byte crc at the end. */
-  tmp = malloc_wipe (recv_buf_len);
+  wipe (tmp, recv_buf_len);
 
   read_bytes = i2c_read (fd, tmp, recv_buf_len);
 
@@ -248,7 +393,7 @@ enum STATUS_RESPONSE read_and_validate (int fd, uint8_t *buf, unsigned int len)
 
     }
 
-  free_wipe (tmp, recv_buf_len);
+  wipe (tmp, recv_buf_len);
 
   return status;
 }
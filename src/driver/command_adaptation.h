@@ -23,19 +23,64 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include "command.h"
+#include "command_table.h"
+
+/* A command sent to the device whose response hasn't been read yet.
+   The device executes it for a while, and the host is free to do
+   other work until it collects the response. */
+struct pending_command
+{
+  uint8_t frame[MAX_COMMAND_FRAME_LEN];
+  unsigned int len;
+  unsigned int data_len;        /**< The command's data length */
+  const struct timespec *wait;  /**< Typical execution time */
+  struct timespec start;        /**< When the frame was first sent */
+  struct timespec sent;         /**< When the device last started on it */
+  bool sent_ok;                 /**< False if the frame couldn't be sent */
+};
 
 enum STATUS_RESPONSE process_command (int fd, struct Command_ATSHA204 *c,
                                       uint8_t* rec_buf, unsigned int recv_len);
 
-enum STATUS_RESPONSE send_and_receive (int fd, uint8_t *send_buf,
+/**
+ * Sends a command without waiting for its response.
+ *
+ * @param fd The open file descriptor
+ * @param c The command
+ * @param p Filled in with the command in flight, pass it to
+ * complete_command
+ */
+void issue_command (int fd, struct Command_ATSHA204 *c,
+                    struct pending_command *p);
+
+/**
+ * Collects the response of an issued command.  Only the part of the
+ * execution time not already spent since it was sent is waited for.
+ * A command that couldn't be sent, or that the device keeps NAKing,
+ * fails with RSP_COMM_ERROR or RSP_NAK.
+ *
+ * @param fd The open file descriptor
+ * @param p The command in flight, wiped on return
+ * @param rec_buf The response buffer
+ * @param recv_len The length of the response
+ *
+ * @return The status of the command
+ */
+enum STATUS_RESPONSE complete_command (int fd, struct pending_command *p,
+                                       uint8_t* rec_buf,
+                                       unsigned int recv_len);
+
+enum STATUS_RESPONSE send_and_receive (int fd, const uint8_t *send_buf,
                                        unsigned int send_buf_len,
                                        uint8_t *recv_buf,
                                        unsigned int recv_buf_len,
-                                       struct timespec *wait_time);
+                                       const struct timespec *wait_time);
 
-unsigned int serialize_command (struct Command_ATSHA204 *c,
-                                uint8_t **serialized);
+/* Frames c into frame, which must hold COMMAND_FRAME_LEN (c->data_len)
+   bytes, and returns the frame's length */
+unsigned int serialize_command (struct Command_ATSHA204 *c, uint8_t *frame);
 
 enum STATUS_RESPONSE read_and_validate (int fd, uint8_t *buf, unsigned int len);
 
@@ -0,0 +1,197 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include "command_table.h"
+#include "crc.h"
+
+#define NS(ns) { (ns) / 1000000000, (ns) % 1000000000 }
+
+static const struct command_descriptor COMMANDS[COMMAND_TABLE_LEN] =
+  {
+    [COMMAND_DERIVE_KEY] =
+    {
+      .name = "DeriveKey",
+      .avg_exec = NS (DERIVE_KEY_AVG_EXEC), .max_exec = NS (DERIVE_KEY_MAX_EXEC),
+      .param1_mask = 0x04, .num_data_lens = 2, .data_lens = { 0, 32 },
+      .rsp_len = 1
+    },
+    [COMMAND_DEV_REV] =
+    {
+      .name = "DevRev",
+      .avg_exec = NS (DEV_REV_AVG_EXEC), .max_exec = NS (DEV_REV_MAX_EXEC),
+      .param1_mask = 0x00, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = 4
+    },
+    [COMMAND_GEN_DIG] =
+    {
+      .name = "GenDig",
+      .avg_exec = NS (GEN_DIG_AVG_EXEC), .max_exec = NS (GEN_DIG_MAX_EXEC),
+      .param1_mask = 0x03, .num_data_lens = 2, .data_lens = { 0, 4 },
+      .rsp_len = 1
+    },
+    [COMMAND_HMAC] =
+    {
+      .name = "HMAC",
+      .avg_exec = NS (HMAC_AVG_EXEC), .max_exec = NS (HMAC_MAX_EXEC),
+      .param1_mask = 0x74, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = 32
+    },
+    [COMMAND_CHECK_MAC] =
+    {
+      .name = "CheckMac",
+      .avg_exec = NS (CHECK_MAC_AVG_EXEC), .max_exec = NS (CHECK_MAC_MAX_EXEC),
+      .param1_mask = 0x27, .num_data_lens = 1, .data_lens = { 77 },
+      .rsp_len = 1
+    },
+    [COMMAND_LOCK] =
+    {
+      .name = "Lock",
+      .avg_exec = NS (LOCK_AVG_EXEC), .max_exec = NS (LOCK_MAX_EXEC),
+      .param1_mask = 0x81, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = 1
+    },
+    [COMMAND_MAC] =
+    {
+      .name = "MAC",
+      .avg_exec = NS (MAC_AVG_EXEC), .max_exec = NS (MAC_MAX_EXEC),
+      .param1_mask = 0x77, .num_data_lens = 2, .data_lens = { 0, 32 },
+      .rsp_len = 32
+    },
+    [COMMAND_NONCE] =
+    {
+      .name = "Nonce",
+      .avg_exec = NS (NONCE_AVG_EXEC), .max_exec = NS (NONCE_MAX_EXEC),
+      .param1_mask = 0x03, .num_data_lens = 2, .data_lens = { 20, 32 },
+      /* Pass-through mode only loads TempKey */
+      .rsp_len = 32, .alt_rsp_mask = 0x03, .alt_rsp_match = 0x03,
+      .alt_rsp_len = 1
+    },
+    [COMMAND_PAUSE] =
+    {
+      .name = "Pause",
+      .avg_exec = NS (PAUSE_AVG_EXEC), .max_exec = NS (PAUSE_MAX_EXEC),
+      .param1_mask = 0xFF, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = 1
+    },
+    [COMMAND_RANDOM] =
+    {
+      .name = "Random",
+      .avg_exec = NS (RANDOM_AVG_EXEC), .max_exec = NS (RANDOM_MAX_EXEC),
+      .param1_mask = 0x01, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = RANDOM_RSP_LENGTH
+    },
+    [COMMAND_READ] =
+    {
+      .name = "Read",
+      .avg_exec = NS (READ_AVG_EXEC), .max_exec = NS (READ_MAX_EXEC),
+      .param1_mask = 0x83, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = READ4_LENGTH, .alt_rsp_mask = 0x80, .alt_rsp_match = 0x80,
+      .alt_rsp_len = READ32_LENGTH
+    },
+    [COMMAND_UPDATE_EXTRA] =
+    {
+      .name = "UpdateExtra",
+      .avg_exec = NS (UPDATE_EXTRA_AVG_EXEC),
+      .max_exec = NS (UPDATE_EXTRA_MAX_EXEC),
+      .param1_mask = 0x01, .num_data_lens = 1, .data_lens = { 0 },
+      .rsp_len = 1
+    },
+    [COMMAND_WRITE] =
+    {
+      .name = "Write",
+      .avg_exec = NS (WRITE_AVG_EXEC), .max_exec = NS (WRITE_MAX_EXEC),
+      /* 4 or 32 bytes, either followed by the input MAC */
+      .param1_mask = 0xC3, .num_data_lens = 4, .data_lens = { 4, 32, 36, 64 },
+      .rsp_len = 1
+    }
+  };
+
+const struct command_descriptor* command_descriptor (uint8_t opcode)
+{
+  if (opcode >= COMMAND_TABLE_LEN || NULL == COMMANDS[opcode].name)
+    return NULL;
+
+  return &COMMANDS[opcode];
+}
+
+bool command_is_valid (const struct command_descriptor *d, uint8_t param1,
+                       unsigned int data_len)
+{
+  unsigned int x;
+
+  assert (NULL != d);
+
+  if (0 != (param1 & ~d->param1_mask))
+    return false;
+
+  for (x = 0; x < d->num_data_lens; x++)
+    if (d->data_lens[x] == data_len)
+      return true;
+
+  return false;
+}
+
+unsigned int command_response_len (const struct command_descriptor *d,
+                                   uint8_t param1)
+{
+  assert (NULL != d);
+
+  if (0 != d->alt_rsp_mask && (param1 & d->alt_rsp_mask) == d->alt_rsp_match)
+    return d->alt_rsp_len;
+
+  return d->rsp_len;
+}
+
+static uint8_t config_frames[CONFIG_ZONE_WORDS][READ4_FRAME_LEN];
+static pthread_once_t config_frames_once = PTHREAD_ONCE_INIT;
+
+static void build_config_frames (void)
+{
+  unsigned int addr;
+
+  for (addr = 0; addr < CONFIG_ZONE_WORDS; addr++)
+    {
+      uint8_t *f = config_frames[addr];
+      uint16_t crc;
+
+      f[0] = 0x03;
+      f[1] = READ4_FRAME_LEN - 1;
+      f[2] = COMMAND_READ;
+      f[3] = 0x00;
+      f[4] = addr;
+      f[5] = 0x00;
+      crc = calculate_crc16 (&f[1], READ4_FRAME_LEN - 3);
+      memcpy (&f[6], &crc, sizeof (crc));
+    }
+}
+
+const uint8_t* config_read4_frame (uint8_t addr)
+{
+  assert (addr < CONFIG_ZONE_WORDS);
+
+  pthread_once (&config_frames_once, build_config_frames);
+
+  return config_frames[addr];
+}
@@ -0,0 +1,112 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "defs.h"
+
+/* What the driver knows about each ATSHA204 command, in one table
+   indexed by opcode: how long to wait for it, which param1 bits and
+   data lengths it takes and how long its response is.  process_command
+   checks every command against it and frames it on the stack. */
+
+/* Word address, count, opcode, param1, param2 and the CRC */
+#define COMMAND_FRAME_OVERHEAD 8
+#define COMMAND_FRAME_LEN(data_len) ((data_len) + COMMAND_FRAME_OVERHEAD)
+
+/* CheckMac's client challenge, response and other data */
+#define MAX_COMMAND_DATA_LEN 77
+#define MAX_COMMAND_FRAME_LEN COMMAND_FRAME_LEN (MAX_COMMAND_DATA_LEN)
+
+/* Count and CRC around the response */
+#define RESPONSE_FRAME_OVERHEAD 3
+#define MAX_RESPONSE_LEN 32
+#define MAX_RESPONSE_FRAME_LEN (MAX_RESPONSE_LEN + RESPONSE_FRAME_OVERHEAD)
+
+#define COMMAND_TABLE_LEN (COMMAND_DEV_REV + 1)
+
+/* Words in the configuration zone */
+#define CONFIG_ZONE_WORDS 22
+
+struct command_descriptor
+{
+  const char *name;
+  struct timespec avg_exec;     /**< Typical execution time */
+  struct timespec max_exec;     /**< Worst case execution time */
+  uint8_t param1_mask;          /**< The param1 bits the command defines */
+  uint8_t num_data_lens;
+  uint8_t data_lens[4];         /**< The data lengths it accepts */
+  uint8_t rsp_len;              /**< Response length, 1 for a status */
+  uint8_t alt_rsp_mask;         /**< If not 0, the param1 bits that... */
+  uint8_t alt_rsp_match;        /**< ...when equal to this... */
+  uint8_t alt_rsp_len;          /**< ...select this response length */
+};
+
+/**
+ * Looks up a command.
+ *
+ * @param opcode The opcode
+ *
+ * @return The descriptor, NULL if the opcode isn't an ATSHA204 command
+ */
+const struct command_descriptor* command_descriptor (uint8_t opcode);
+
+/**
+ * Checks a command's parameters against its descriptor.
+ *
+ * @param d The descriptor
+ * @param param1 The command's param1
+ * @param data_len The length of the command's data
+ *
+ * @return True if the device would accept them
+ */
+bool command_is_valid (const struct command_descriptor *d, uint8_t param1,
+                       unsigned int data_len);
+
+/**
+ * Returns the length of a command's response.
+ *
+ * @param d The descriptor
+ * @param param1 The command's param1, which selects the length of Read
+ * and Nonce responses
+ *
+ * @return The response length, without its count and CRC
+ */
+unsigned int command_response_len (const struct command_descriptor *d,
+                                   uint8_t param1);
+
+#define READ4_FRAME_LEN COMMAND_FRAME_LEN (0)
+
+/**
+ * Returns the frame of a 4 byte Read of a configuration zone word.
+ * These are the most frequent commands and never change, so they are
+ * framed once.
+ *
+ * @param addr The word address, less than CONFIG_ZONE_WORDS
+ *
+ * @return READ4_FRAME_LEN bytes ready to send
+ */
+const uint8_t* config_read4_frame (uint8_t addr);
+
+#endif /* COMMAND_TABLE_H */
@@ -275,140 +275,138 @@ bool write_slot_configs (int fd, enum config_slots slot,
 
 }
 
-struct slot_config** build_slot_configs (void)
+#ifndef SLOT_LAYOUT_FILE
+#define SLOT_LAYOUT_FILE "slot_layout.def"
+#endif
+
+const uint8_t SLOT_LAYOUT[MAX_NUM_DATA_SLOTS][SLOT_CONFIG_LEN] =
+  {
+#define SLOT(slot, ...) [slot] = SLOT_CONFIG_BYTES (__VA_ARGS__),
+#include SLOT_LAYOUT_FILE
+#undef SLOT
+  };
+
+/* Every slot must be in the layout, once */
+#define SLOT(slot, ...) | (1 << (slot))
+_Static_assert ((0
+#include SLOT_LAYOUT_FILE
+                 ) == (1 << MAX_NUM_DATA_SLOTS) - 1,
+                "SLOT_LAYOUT_FILE is missing a slot");
+#undef SLOT
+
+#define SLOT(slot, ...) + 1
+_Static_assert ((0
+#include SLOT_LAYOUT_FILE
+                 ) == MAX_NUM_DATA_SLOTS,
+                "SLOT_LAYOUT_FILE defines a slot twice");
+#undef SLOT
+
+bool slot_config_in_layout (const uint8_t *raw, unsigned int slot)
 {
-  const unsigned int NUM_SLOTS = 16;
-
-  struct slot_config **config = (struct slot_config **)
-    malloc_wipe (NUM_SLOTS * sizeof(struct slot_config *));
-
-  int x = 0;
-
-  for (x=0; x<NUM_SLOTS; x++)
-    {
-      config[x] = (struct slot_config *)
-        malloc_wipe (sizeof (struct slot_config));
-    }
-
-  /* Set up each slot */
-
-  /* Slots 0 -7 should be used for keyed hashed applications */
-  *config[0] =  make_slot_config (0,     /* Slot for Encrypted Reads */
-                                  false, /* Check Only */
-                                  false, /* Single Use */
-                                  false, /* Encrypted Read */
-                                  true,  /* Is secret */
-                                  0,     /* Slot for encrypted writes*/
-                                  false, /* Derive Key */
-                                  NEVER);/* Write configuration */
-
-  *config[1] =  make_slot_config (0, false, false, false,
-                                  true, 0, true, NEVER);
-
-  *config[2] =  make_slot_config (0, false, false, false,
-                                  true, 0, false, NEVER);
-
-  *config[3] =  make_slot_config (0, false, false, false,
-                                  true, 0, true, NEVER);
-
-  *config[4] =  make_slot_config (0, false, false, false,
-                                  true, 0, false, NEVER);
-
-  *config[5] =  make_slot_config (0, false, false, false,
-                                  true, 0, true, NEVER);
+  assert (NULL != raw);
+  assert (slot < MAX_NUM_DATA_SLOTS);
 
-  /* Slots 6 -7 are key slots, to which the user can write and change
-   *the key. */
-  *config[6] =  make_slot_config (0, false, false, false,
-                                  true, 6, false, ENCRYPT);
+  return 0 == memcmp (raw, SLOT_LAYOUT[slot], SLOT_CONFIG_LEN);
+}
 
-  *config[7] =  make_slot_config (0, false, false, false,
-                                  true, 7, false, ENCRYPT);
+void build_config_image (uint8_t *config)
+{
+  assert (NULL != config);
 
-  /* Slots 8 - 11 Are reserved for password checking */
-  *config[8] =  make_slot_config (0, false, false, false,
-                                  true, 0, false, NEVER);
+  const uint8_t I2C_ADDR_OTP_MODE_SELECTOR_MODE [] =
+    { 0xC8, 0x00, 0xAA, 0x00 };
+  uint8_t *word = config + CONFIG_PLAN_FIRST_WORD * sizeof (uint32_t);
 
-  *config[9] =  make_slot_config (0, false, false, false,
-                                  true, 0, false, NEVER);
+  memcpy (word, I2C_ADDR_OTP_MODE_SELECTOR_MODE,
+          sizeof (I2C_ADDR_OTP_MODE_SELECTOR_MODE));
 
-  *config[10] =  make_slot_config (0, false, false, false,
-                                   true, 0, false, NEVER);
+  /* Slot configurations start at the next word, two to a word */
+  memcpy (word + sizeof (uint32_t), SLOT_LAYOUT, sizeof (SLOT_LAYOUT));
+}
 
-  *config[11] =  make_slot_config (0, false, false, false,
-                                   true, 0, false, NEVER);
+bool plan_config_zone (const uint8_t *current, struct config_plan *plan)
+{
+  assert (NULL != current);
+  assert (NULL != plan);
 
-  /* Slots 12 - 13 should be used for user storage */
-  *config[12] =  make_slot_config (0, false, false, false,
-                                   false, 0, false, ALWAYS);
+  uint8_t target[CONFIG_ZONE_LEN];
+  unsigned int x;
 
-  *config[13] =  make_slot_config (0, false, false, false,
-                                   false, 0, false, ALWAYS);
+  build_config_image (target);
 
-  /* Slots 14 and 15 are fixed test keys */
-  *config[14] =  make_slot_config (0, false, false, false,
-                                   false, 0, false, NEVER);
+  plan->num_writes = 0;
 
-  *config[15] =  make_slot_config (0, false, false, false,
-                                   false, 0, false, NEVER);
+  for (x = CONFIG_PLAN_FIRST_WORD; x <= CONFIG_PLAN_LAST_WORD; x++)
+    {
+      const unsigned int offset = x * sizeof (uint32_t);
+
+      if (0 != memcmp (current + offset, target + offset, sizeof (uint32_t)))
+        {
+          plan->addr[plan->num_writes] = x;
+          memcpy (&plan->value[plan->num_writes], target + offset,
+                  sizeof (uint32_t));
+          plan->num_writes++;
+        }
+    }
 
-  return config;
+  CTX_LOG (DEBUG, "Config zone needs %u of %u words written",
+           plan->num_writes, CONFIG_PLAN_MAX_WRITES);
 
+  if (plan->num_writes > 0 && UNLOCKED != current[LOCK_CONFIG])
+    {
+      CTX_LOG (INFO, "The config zone is locked with a different layout");
+      return false;
+    }
 
+  return true;
 }
 
-void free_slot_configs (struct slot_config **slots)
+bool apply_config_plan (int fd, const struct config_plan *plan,
+                        uint8_t *config)
 {
-  assert (NULL != slots);
+  assert (NULL != plan);
+  assert (plan->num_writes <= CONFIG_PLAN_MAX_WRITES);
 
-  const unsigned int NUM_SLOTS = 16;
-
-  int x = 0;
+  bool result = true;
+  unsigned int x;
 
-  for (x=0; x<NUM_SLOTS; x++)
+  for (x = 0; x < plan->num_writes && result; x++)
     {
-      assert (NULL != slots[x]);
-      free (slots[x]);
+      result = write4 (fd, CONFIG_ZONE, plan->addr[x], plan->value[x]);
+
+      if (result && NULL != config)
+        memcpy (config + plan->addr[x] * sizeof (uint32_t), &plan->value[x],
+                sizeof (uint32_t));
     }
 
-  free (slots);
+  return result;
 }
 
-bool set_config_zone (int fd)
+static bool read_config_word (int fd, uint8_t *config, uint8_t addr)
 {
-  bool result = false;
-
-  if (is_config_locked (fd))
-    return true;
-
-  enum config_slots slots[CONFIG_SLOTS_NUM_SLOTS] = {slot0, slot2, slot4,
-                                                     slot6, slot8, slot10,
-                                                     slot12, slot14};
+  uint32_t word;
 
-  struct slot_config ** configs = build_slot_configs();
+  if (!read4 (fd, CONFIG_ZONE, addr, &word))
+    return false;
 
-  int x = 0;
+  memcpy (config + addr * sizeof (uint32_t), &word, sizeof (word));
 
-  const uint8_t I2C_ADDR_OTP_MODE_SELECTOR_MODE [] =
-    { 0xC8, 0x00, 0xAA, 0x00 };
-  const uint8_t I2C_ADDR_ETC_WORD = 0x04;
-
-  uint32_t to_send = 0;
-  memcpy (&to_send, &I2C_ADDR_OTP_MODE_SELECTOR_MODE, sizeof (to_send));
-
-  result = write4 (fd, CONFIG_ZONE, I2C_ADDR_ETC_WORD,to_send);
-
-  for (x=0; x < CONFIG_SLOTS_NUM_SLOTS && result; x++)
-    {
-      int slot = 2 * x;
-      result = write_slot_configs (fd, slots[x],
-                                   configs[slot], configs[slot+1]);
-    }
+  return true;
+}
 
-  free_slot_configs (configs);
+bool set_config_zone (int fd)
+{
+  uint8_t config[CONFIG_ZONE_LEN] = {0};
+  struct config_plan plan;
+  bool result = read_config_word (fd, config, CONFIG_LOCK_WORD);
+  unsigned int x;
 
-  return result;
+  /* Only the words the plan looks at are read */
+  for (x = CONFIG_PLAN_FIRST_WORD; x <= CONFIG_PLAN_LAST_WORD && result; x++)
+    result = read_config_word (fd, config, x);
 
+  return result && plan_config_zone (config, &plan) &&
+    apply_config_plan (fd, &plan, NULL);
 }
 
 struct slot_config get_slot_config (int fd, unsigned int slot)
@@ -167,21 +167,37 @@ void serialize_slot_config (struct slot_config *s, uint8_t *slot);
  */
 struct slot_config parse_slot_config (uint8_t *raw);
 
-/**
- * Build the slot config attributes
- *
- *
- * @return A malloc'd array of malloc'd slot config pointers, each set
- * appropriately.
- */
-struct slot_config** build_slot_configs (void);
+/* The two bytes of a slot configuration, as the device stores them */
+#define SLOT_CONFIG_LEN 2
+
+/* Where the slot configurations start in the configuration zone */
+#define SLOT_CONFIG_OFFSET 20
+
+/* Serializes a slot configuration at compile time, as
+   serialize_slot_config does at run time */
+#define SLOT_CONFIG_BYTES(read_key, check_only, single_use,             \
+                          encrypted_read, is_secret, write_key,         \
+                          derive_key, write_config)                     \
+  { (write_key) | ((derive_key) ? WRITE_CONFIG_DERIVEKEY_MASK : 0) |    \
+    WRITE_CONFIG_##write_config##_MASK,                                 \
+    (read_key) | ((check_only) ? CHECK_ONLY_MASK : 0) |                 \
+    ((single_use) ? SINGLE_USE_MASK : 0) |                              \
+    ((encrypted_read) ? ENCRYPTED_READ_MASK : 0) |                      \
+    ((is_secret) ? IS_SECRET_MASK : 0) }
+
+/* The slot layout personalize sets, from SLOT_LAYOUT_FILE */
+extern const uint8_t SLOT_LAYOUT[MAX_NUM_DATA_SLOTS][SLOT_CONFIG_LEN];
 
 /**
- * Frees the slot config array
+ * Returns true if a slot configuration, as read from the device, is
+ * the one in SLOT_LAYOUT.
+ *
+ * @param raw The two bytes of the slot configuration
+ * @param slot The slot (0 - 15)
  *
- * @param slots The malloc'd slot config array form build_slot_configs
+ * @return True if same
  */
-void free_slot_configs (struct slot_config **slots);
+bool slot_config_in_layout (const uint8_t *raw, unsigned int slot);
 
 /**
  * Returns true if the slot configs match
@@ -192,4 +208,63 @@ void free_slot_configs (struct slot_config **slots);
  * @return True if same
  */
 bool cmp_slot_config (struct slot_config lhs, struct slot_config rhs);
+
+/* The words of the configuration zone personalize sets: the I2C
+   address, OTP and selector mode word, then the slot configurations */
+#define CONFIG_PLAN_FIRST_WORD 4
+#define CONFIG_PLAN_LAST_WORD 12
+#define CONFIG_PLAN_MAX_WRITES                                  \
+  (CONFIG_PLAN_LAST_WORD - CONFIG_PLAN_FIRST_WORD + 1)
+
+/* The word holding the two lock bytes */
+#define CONFIG_LOCK_WORD 21
+
+/* The lock bytes' offsets in the configuration zone, and their value
+   until their zone is locked */
+#define LOCK_VALUE 86           /**< The data and OTP zones' lock */
+#define LOCK_CONFIG 87          /**< The configuration zone's lock */
+#define UNLOCKED 0x55
+
+/* The word writes that take a configuration zone to the target */
+struct config_plan
+{
+  unsigned int num_writes;
+  uint8_t addr[CONFIG_PLAN_MAX_WRITES]; /**< Word addresses, ascending */
+  uint32_t value[CONFIG_PLAN_MAX_WRITES]; /**< The words, as sent */
+};
+
+/**
+ * Fills in the words of the target configuration zone that
+ * personalize sets, leaving the rest of the image alone.
+ *
+ * @param config An 88 byte configuration zone image
+ */
+void build_config_image (uint8_t *config);
+
+/**
+ * Works out the fewest word writes that take the configuration zone
+ * from its current contents to the target.
+ *
+ * @param current The 88 byte configuration zone as read from the
+ * device.  Only the planned words and the lock word are used.
+ * @param plan Filled in with the writes, none if it already matches
+ *
+ * @return False if the target can't be reached: the zone is locked
+ * and differs from it.
+ */
+bool plan_config_zone (const uint8_t *current, struct config_plan *plan);
+
+/**
+ * Writes the words of a plan, in order, stopping at the first
+ * failure.
+ *
+ * @param fd The open file descriptor
+ * @param plan The plan from plan_config_zone
+ * @param config If not NULL, the image the plan was made from, kept
+ * up to date with each word written
+ *
+ * @return True if every write succeeded
+ */
+bool apply_config_plan (int fd, const struct config_plan *plan,
+                        uint8_t *config);
 #endif
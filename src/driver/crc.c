@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 #include "log.h"
 
 
@@ -88,23 +89,70 @@ uint16_t update_crc16_8005( uint16_t crc, char c )
   return update_crc16_reflected(crc_tab_8005_normal,crc,c);
 }
 
-uint16_t calculate_crc16(const uint8_t *p, unsigned int length)
+/* Slicing-by-8 tables: slice_tab[k][b] is the CRC of byte b followed
+   by k zero bytes, so eight bytes are folded in with eight lookups
+   instead of eight dependent steps.  slice_tab[0] is
+   crc_tab_8005_normal. */
+static uint16_t slice_tab[8][256];
+static pthread_once_t slice_once = PTHREAD_ONCE_INIT;
+
+static void init_slice_tab(void)
 {
-  uint16_t crc;
-  uint16_t hibyte;
-  uint16_t lobyte;
-  unsigned int i;
+  unsigned int b, k;
+
+  for (b = 0; b < 256; b++)
+    slice_tab[0][b] = crc_tab_8005_normal[b];
+
+  for (k = 1; k < 8; k++)
+    for (b = 0; b < 256; b++)
+      slice_tab[k][b] = (slice_tab[k - 1][b] >> 8) ^
+        crc_tab_8005_normal[slice_tab[k - 1][b] & 0xff];
+}
 
-  crc = 0;
+void crc16_init(struct crc16_ctx *ctx)
+{
+  assert(NULL != ctx);
+
+  ctx->crc = 0;
+}
 
-  for (i=0; i < length; i++)
+void crc16_update(struct crc16_ctx *ctx, const uint8_t *p, unsigned int length)
+{
+  assert(NULL != ctx);
+  assert(NULL != p || 0 == length);
+
+  uint16_t crc = ctx->crc;
+
+  if (length >= 8)
     {
-      crc = update_crc16_8005(crc,p[i]);
+      pthread_once(&slice_once, init_slice_tab);
+
+      for (; length >= 8; length -= 8, p += 8)
+        {
+          crc ^= p[0] | p[1] << 8;
+          crc = slice_tab[7][crc & 0xff] ^ slice_tab[6][crc >> 8] ^
+            slice_tab[5][p[2]] ^ slice_tab[4][p[3]] ^
+            slice_tab[3][p[4]] ^ slice_tab[2][p[5]] ^
+            slice_tab[1][p[6]] ^ slice_tab[0][p[7]];
+        }
     }
 
+  for (; length > 0; length--, p++)
+    crc = update_crc16_8005(crc, *p);
+
+  ctx->crc = crc;
+}
+
+uint16_t crc16_final(const struct crc16_ctx *ctx)
+{
+  uint16_t hibyte;
+  uint16_t lobyte;
+
+  assert(NULL != ctx);
+
   /* The ATSHA204 swaps the bytes */
-  hibyte = (crc & 0xFF00) >> 8;
-  lobyte = (crc & 0xFF);
+  hibyte = (ctx->crc & 0xFF00) >> 8;
+  lobyte = (ctx->crc & 0xFF);
 
   /* And the bits are swapped */
   hibyte = reverse_bits_in_byte(hibyte);
@@ -113,6 +161,16 @@ uint16_t calculate_crc16(const uint8_t *p, unsigned int length)
   return  lobyte << 8 | hibyte;
 }
 
+uint16_t calculate_crc16(const uint8_t *p, unsigned int length)
+{
+  struct crc16_ctx ctx;
+
+  crc16_init(&ctx);
+  crc16_update(&ctx, p, length);
+
+  return crc16_final(&ctx);
+}
+
 bool is_crc_16_valid(const uint8_t *data, unsigned int data_len,
                      const uint8_t *crc)
 {
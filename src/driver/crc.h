@@ -32,4 +32,42 @@ bool is_crc_16_valid (const uint8_t *data, unsigned int data_len,
 
 uint16_t calculate_crc16 (const uint8_t *p, unsigned int length);
 
+/* Adds one byte to a running CRC, as a crc16_ctx holds it */
+uint16_t update_crc16_8005 (uint16_t crc, char c);
+
+/* Incremental form of calculate_crc16, for data that isn't in one
+   buffer.  init, then update with each piece in order, then final
+   gives the same CRC as calculate_crc16 over the concatenation. */
+struct crc16_ctx
+{
+  uint16_t crc;                 /**< Running CRC, before the final swap */
+};
+
+/**
+ * Starts a CRC.
+ *
+ * @param ctx The context to initialize
+ */
+void crc16_init (struct crc16_ctx *ctx);
+
+/**
+ * Adds data to a CRC.
+ *
+ * @param ctx The context
+ * @param p The data
+ * @param length The length of p
+ */
+void crc16_update (struct crc16_ctx *ctx, const uint8_t *p,
+                   unsigned int length);
+
+/**
+ * Returns the CRC of the data added so far, in the device's byte
+ * order.  The context may be updated further.
+ *
+ * @param ctx The context
+ *
+ * @return The CRC, as calculate_crc16 returns it
+ */
+uint16_t crc16_final (const struct crc16_ctx *ctx);
+
 #endif /* CRC_H */
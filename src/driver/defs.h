@@ -46,6 +46,9 @@
 
 
 #define MAX_NUM_DATA_SLOTS      16
+#define CONFIG_ZONE_LEN         88
+#define OTP_ZONE_LEN            64
+#define DATA_ZONE_LEN           512
 
 /* Slot config definition */
 #define MAX_SLOTS 16
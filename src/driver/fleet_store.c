@@ -0,0 +1,484 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc.h"
+#include "fleet_store.h"
+#include "log.h"
+#include "record_file.h"
+
+static const uint8_t FLEET_MAGIC[4] = { 'H', 'L', 'F', 'S' };
+
+#define INITIAL_BUCKETS 1024
+#define INITIAL_SIZE (1024 * 1024)
+
+static struct fleet_header* header (const struct fleet_store *fleet)
+{
+  return (struct fleet_header *)fleet->map;
+}
+
+static struct fleet_bucket* table (const struct fleet_store *fleet)
+{
+  return (struct fleet_bucket *)(fleet->map + header (fleet)->table);
+}
+
+static uint16_t record_crc (const struct fleet_record *record)
+{
+  return calculate_crc16 ((const uint8_t *)record,
+                          offsetof (struct fleet_record, crc));
+}
+
+/**
+ * Maps the whole file, replacing any previous mapping.
+ *
+ * @param fleet The fleet store
+ * @param len The file length
+ *
+ * @return True if mapped
+ */
+static bool map_fleet (struct fleet_store *fleet, size_t len)
+{
+  int prot = fleet->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *map;
+
+  if (NULL != fleet->map)
+    munmap (fleet->map, fleet->map_len);
+
+  fleet->map = NULL;
+  fleet->map_len = 0;
+
+  if ((map = mmap (NULL, len, prot, MAP_SHARED, fleet->fd, 0)) == MAP_FAILED)
+    return false;
+
+  fleet->map = map;
+  fleet->map_len = len;
+
+  return true;
+}
+
+/**
+ * Writes part of the mapping to disk and waits for it.
+ *
+ * @param fleet The writable fleet store
+ * @param offset The first byte
+ * @param len The number of bytes
+ *
+ * @return True if synced
+ */
+static bool sync_range (struct fleet_store *fleet, uint64_t offset,
+                        uint64_t len)
+{
+  const uint64_t page = sysconf (_SC_PAGESIZE);
+  uint64_t start = offset & ~(page - 1);
+
+  return 0 == msync (fleet->map + start, offset + len - start, MS_SYNC);
+}
+
+/**
+ * Makes room for len more bytes at the end of the used area, growing
+ * the file geometrically.
+ *
+ * @param fleet The writable fleet store
+ * @param len The bytes needed
+ *
+ * @return The offset of the new space, 0 on error
+ */
+static uint64_t append_space (struct fleet_store *fleet, uint64_t len)
+{
+  uint64_t offset = header (fleet)->used;
+  size_t size = fleet->map_len;
+
+  if (offset + len > size)
+    {
+      while (offset + len > size)
+        size *= 2;
+
+      if (0 != ftruncate (fleet->fd, size) || !map_fleet (fleet, size))
+        return 0;
+    }
+
+  header (fleet)->used = offset + len;
+
+  return offset;
+}
+
+/**
+ * Inserts into a bucket table, replacing an entry with the same
+ * serial number.
+ *
+ * @param fleet The fleet store
+ * @param buckets The table
+ * @param count The number of buckets
+ * @param hash The serial number's hash
+ * @param offset The record offset
+ *
+ * @return True if a new bucket was used
+ */
+static bool insert_bucket (struct fleet_store *fleet,
+                           struct fleet_bucket *buckets, uint64_t count,
+                           uint64_t hash, uint64_t offset)
+{
+  const struct fleet_record *record =
+    (const struct fleet_record *)(fleet->map + offset);
+  uint64_t mask = count - 1;
+  uint64_t x;
+
+  for (x = hash & mask; 0 != buckets[x].offset; x = (x + 1) & mask)
+    {
+      const struct fleet_record *other =
+        (const struct fleet_record *)(fleet->map + buckets[x].offset);
+
+      if (hash == buckets[x].hash &&
+          0 == memcmp (other->serial, record->serial, FLEET_SERIAL_LEN))
+        {
+          buckets[x].offset = offset;
+          return false;
+        }
+    }
+
+  buckets[x].hash = hash;
+  buckets[x].offset = offset;
+
+  return true;
+}
+
+/**
+ * Appends a table twice the size of the current one and switches to
+ * it.
+ *
+ * @param fleet The writable fleet store
+ *
+ * @return True on success
+ */
+static bool grow_table (struct fleet_store *fleet)
+{
+  uint64_t count = header (fleet)->buckets * 2;
+  uint64_t offset;
+  struct fleet_bucket *old, *buckets;
+  uint64_t x;
+
+  offset = append_space (fleet, count * sizeof (struct fleet_bucket));
+  if (0 == offset)
+    return false;
+
+  old = table (fleet);
+  buckets = (struct fleet_bucket *)(fleet->map + offset);
+
+  /* The hashes are kept so no record needs to be read */
+  for (x = 0; x < header (fleet)->buckets; x++)
+    {
+      if (0 != old[x].offset)
+        {
+          uint64_t mask = count - 1;
+          uint64_t y;
+
+          for (y = old[x].hash & mask; 0 != buckets[y].offset;
+               y = (y + 1) & mask)
+            ;
+
+          buckets[y] = old[x];
+        }
+    }
+
+  /* The new table is on disk before the header points at it */
+  if (!sync_range (fleet, offset, count * sizeof (struct fleet_bucket)))
+    return false;
+
+  header (fleet)->table = offset;
+  header (fleet)->buckets = count;
+
+  return true;
+}
+
+static bool create_fleet (struct fleet_store *fleet)
+{
+  struct fleet_header *h;
+  uint64_t offset;
+
+  if (0 != ftruncate (fleet->fd, INITIAL_SIZE) ||
+      !map_fleet (fleet, INITIAL_SIZE))
+    return false;
+
+  h = header (fleet);
+  memcpy (h->magic, FLEET_MAGIC, sizeof (FLEET_MAGIC));
+  h->version = FLEET_STORE_VERSION;
+  h->used = sizeof (struct fleet_header);
+
+  offset = append_space (fleet, INITIAL_BUCKETS * sizeof (struct fleet_bucket));
+  assert (0 != offset);
+
+  h->table = offset;
+  h->buckets = INITIAL_BUCKETS;
+
+  return true;
+}
+
+/**
+ * Checks a header against the length of the mapping.
+ *
+ * @param h The header
+ * @param map_len The bytes mapped
+ *
+ * @return True if the header is valid and all it points to is mapped
+ */
+static bool valid_header (const struct fleet_header *h, size_t map_len)
+{
+  return 0 == memcmp (h->magic, FLEET_MAGIC, sizeof (FLEET_MAGIC)) &&
+    FLEET_STORE_VERSION == h->version &&
+    h->used <= map_len &&
+    h->buckets > 0 && 0 == (h->buckets & (h->buckets - 1)) &&
+    h->table >= sizeof (struct fleet_header) &&
+    h->table + h->buckets * sizeof (struct fleet_bucket) <= h->used;
+}
+
+/**
+ * Maps the store for reading.  The header is copied first: the file
+ * is at least as long as the header says, as a writer only moves
+ * used up after growing the file and only trims the file down to
+ * used.  Everything the copy points to is then mapped, whatever a
+ * writer does after.
+ *
+ * @param fleet The read only fleet store
+ *
+ * @return True if the store is valid
+ */
+static bool open_view (struct fleet_store *fleet)
+{
+  struct stat st;
+
+  if (sizeof (fleet->view) != pread (fleet->fd, &fleet->view,
+                                     sizeof (fleet->view), 0) ||
+      0 != fstat (fleet->fd, &st))
+    return false;
+
+  return map_fleet (fleet, st.st_size) &&
+    valid_header (&fleet->view, fleet->map_len);
+}
+
+struct fleet_store* open_fleet_store (const char *filename, bool writable)
+{
+  assert (NULL != filename);
+
+  struct fleet_store *fleet = malloc (sizeof (struct fleet_store));
+  bool ok = false;
+  struct stat st;
+
+  assert (NULL != fleet);
+
+  fleet->writable = writable;
+  fleet->map = NULL;
+  fleet->map_len = 0;
+
+  if (writable)
+    fleet->fd = open (filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  else
+    fleet->fd = open (filename, O_RDONLY);
+
+  if (fleet->fd < 0)
+    {
+      free (fleet);
+      return NULL;
+    }
+
+  if (!writable)
+    ok = open_view (fleet);
+  else if (0 == flock (fleet->fd, LOCK_EX) && 0 == fstat (fleet->fd, &st))
+    {
+      if (0 == st.st_size)
+        ok = create_fleet (fleet);
+      else
+        ok = st.st_size >= (off_t)sizeof (struct fleet_header) &&
+          map_fleet (fleet, st.st_size) &&
+          valid_header (header (fleet), fleet->map_len);
+    }
+
+  if (!ok)
+    {
+      CTX_LOG (INFO, "%s is not a valid fleet store", filename);
+
+      /* Leave an invalid file as it is */
+      if (NULL != fleet->map)
+        munmap (fleet->map, fleet->map_len);
+      fleet->map = NULL;
+
+      close_fleet_store (fleet);
+      fleet = NULL;
+    }
+
+  return fleet;
+}
+
+const struct fleet_record* fleet_lookup (const struct fleet_store *fleet,
+                                         const uint8_t *serial)
+{
+  assert (NULL != fleet);
+  assert (NULL != serial);
+
+  /* A reader only goes by its copy of the header, a writer may be
+     appending beyond it */
+  const struct fleet_header *h = fleet->writable ? header (fleet)
+    : &fleet->view;
+  const volatile struct fleet_bucket *buckets =
+    (const struct fleet_bucket *)(fleet->map + h->table);
+  uint64_t hash = serial_hash (serial);
+  uint64_t mask = h->buckets - 1;
+  uint64_t x, probes;
+
+  for (x = hash & mask, probes = 0; probes < h->buckets;
+       x = (x + 1) & mask, probes++)
+    {
+      const struct fleet_record *record;
+
+      /* Read the bucket once, a writer may be changing it */
+      uint64_t offset = buckets[x].offset;
+      uint64_t bucket_hash = buckets[x].hash;
+
+      if (0 == offset)
+        break;
+
+      if (hash != bucket_hash || offset < sizeof (struct fleet_header) ||
+          offset + sizeof (struct fleet_record) > h->used)
+        continue;
+
+      record = (const struct fleet_record *)(fleet->map + offset);
+
+      if (0 == memcmp (record->serial, serial, FLEET_SERIAL_LEN))
+        return (record_crc (record) == record->crc) ? record : NULL;
+    }
+
+  return NULL;
+}
+
+bool fleet_add (struct fleet_store *fleet, const uint8_t *serial,
+                struct key_container *keys)
+{
+  assert (NULL != fleet);
+  assert (fleet->writable);
+  assert (NULL != serial);
+  assert (NULL != keys);
+
+  struct fleet_record *record;
+  uint64_t offset;
+  unsigned int x;
+
+  if (2 * (header (fleet)->devices + 1) > header (fleet)->buckets &&
+      !grow_table (fleet))
+    return false;
+
+  if ((offset = append_space (fleet, sizeof (struct fleet_record))) == 0)
+    return false;
+
+  record = (struct fleet_record *)(fleet->map + offset);
+  memset (record, 0, sizeof (struct fleet_record));
+  memcpy (record->serial, serial, FLEET_SERIAL_LEN);
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (NULL != keys->keys[x].ptr && FLEET_KEY_LEN == keys->keys[x].len)
+        {
+          memcpy (record->keys[x], keys->keys[x].ptr, FLEET_KEY_LEN);
+          record->present |= 1 << x;
+        }
+    }
+
+  record->crc = record_crc (record);
+
+  /* The record is complete, and on disk, before any bucket points at
+     it */
+  if (!sync_range (fleet, offset, sizeof (struct fleet_record)))
+    return false;
+
+  if (insert_bucket (fleet, table (fleet), header (fleet)->buckets,
+                     serial_hash (serial), offset))
+    header (fleet)->devices++;
+
+  header (fleet)->records++;
+
+  /* Callers write the keys to a device next, so they must not be lost
+     to a crash: sync the bucket table and then the header */
+  return sync_range (fleet, header (fleet)->table,
+                     header (fleet)->buckets * sizeof (struct fleet_bucket)) &&
+    sync_range (fleet, 0, sizeof (struct fleet_header));
+}
+
+const uint8_t* fleet_record_slot (const struct fleet_record *record,
+                                  unsigned int slot)
+{
+  assert (NULL != record);
+
+  if (slot < MAX_NUM_DATA_SLOTS && (record->present & (1 << slot)))
+    return record->keys[slot];
+
+  return NULL;
+}
+
+struct key_container* fleet_record_keys (const struct fleet_record *record)
+{
+  assert (NULL != record);
+
+  struct key_container *keys = NULL;
+  unsigned int x;
+
+  if ((record->present & ((1 << MAX_NUM_DATA_SLOTS) - 1)) !=
+      (1 << MAX_NUM_DATA_SLOTS) - 1)
+    return NULL;
+
+  keys = make_key_container ();
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      keys->keys[x] = make_buffer (FLEET_KEY_LEN);
+      memcpy (keys->keys[x].ptr, record->keys[x], FLEET_KEY_LEN);
+    }
+
+  return keys;
+}
+
+void close_fleet_store (struct fleet_store *fleet)
+{
+  assert (NULL != fleet);
+
+  if (NULL != fleet->map)
+    {
+      uint64_t used = header (fleet)->used;
+
+      if (fleet->writable)
+        msync (fleet->map, fleet->map_len, MS_SYNC);
+
+      munmap (fleet->map, fleet->map_len);
+
+      /* Give back the space reserved beyond the last append */
+      if (fleet->writable && 0 != ftruncate (fleet->fd, used))
+        CTX_LOG (DEBUG, "Failed to trim the fleet store");
+    }
+
+  if (fleet->fd >= 0)
+    close (fleet->fd);
+
+  free (fleet);
+}
@@ -0,0 +1,150 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FLEET_STORE_H
+#define FLEET_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "defs.h"
+#include "personalize.h"
+
+/* The fleet store holds the keys of many devices, indexed by serial
+   number, in a single file under the home directory. */
+#define FLEET_STORE "/.hashlet_fleet"
+
+#define FLEET_STORE_VERSION 1
+#define FLEET_SERIAL_LEN 9
+#define FLEET_KEY_LEN 32
+
+/* The file is only ever appended to: a header, then device records
+   and bucket tables in the order they were written.  Adding a device
+   appends its record and then points a bucket at it, so a device
+   provisioned again simply gets a newer record.  When the table is
+   half full a table twice the size is appended and the header is
+   switched to it.  All fields are in host byte order. */
+
+struct fleet_header
+{
+  uint8_t magic[4];             /**< "HLFS" */
+  uint32_t version;             /**< FLEET_STORE_VERSION */
+  uint64_t used;                /**< Bytes in use, appends go here */
+  uint64_t table;               /**< Offset of the current bucket table */
+  uint64_t buckets;             /**< Buckets in the table, a power of 2 */
+  uint64_t devices;             /**< Distinct serial numbers */
+  uint64_t records;             /**< Records appended, including replaced */
+};
+
+/* Open addressing with linear probing.  The full hash is kept so that
+   probing and growing the table don't touch the records. */
+struct fleet_bucket
+{
+  uint64_t offset;              /**< Offset of the record, 0 if empty */
+  uint64_t hash;                /**< Hash of the serial number */
+};
+
+struct fleet_record
+{
+  uint8_t serial[FLEET_SERIAL_LEN];
+  uint8_t reserved;
+  uint16_t present;             /**< Bit x is set if slot x has a key */
+  uint8_t keys[MAX_NUM_DATA_SLOTS][FLEET_KEY_LEN];
+  uint16_t crc;                 /**< CRC16 of the bytes before it */
+  uint16_t pad;
+};
+
+struct fleet_store
+{
+  int fd;
+  bool writable;
+  uint8_t *map;                 /**< The whole file */
+  size_t map_len;
+  struct fleet_header view;     /**< A reader's copy of the header */
+};
+
+/**
+ * Opens a fleet store.  A writable store is created if missing and is
+ * locked against other writers until closed.  Readers don't lock:
+ * they keep a copy of the header and see the store as it was when
+ * they opened it, never reading past what that copy covers.  A device
+ * provisioned again after a reader opened the store may not be found
+ * by it.
+ *
+ * @param filename The fleet store
+ * @param writable True to add devices
+ *
+ * @return The fleet store or NULL on error.  Close with
+ * close_fleet_store.
+ */
+struct fleet_store* open_fleet_store (const char *filename, bool writable);
+
+/**
+ * Finds the record of a device.
+ *
+ * @param fleet The open fleet store
+ * @param serial The 9 byte serial number
+ *
+ * @return The most recent record for the device, or NULL if there is
+ * none or it is corrupt.  Valid until the next fleet_add or close.
+ */
+const struct fleet_record* fleet_lookup (const struct fleet_store *fleet,
+                                         const uint8_t *serial);
+
+/**
+ * Adds or replaces the keys of a device.
+ *
+ * @param fleet The fleet store, opened writable
+ * @param serial The 9 byte serial number
+ * @param keys The keys.  Slots without a 32 byte key are left out.
+ *
+ * @return True if added and synced to disk
+ */
+bool fleet_add (struct fleet_store *fleet, const uint8_t *serial,
+                struct key_container *keys);
+
+/**
+ * Returns the key of a slot in a record.
+ *
+ * @param record The device record
+ * @param slot The key slot
+ *
+ * @return A pointer to the 32 byte key or NULL if the slot has no key
+ */
+const uint8_t* fleet_record_slot (const struct fleet_record *record,
+                                  unsigned int slot);
+
+/**
+ * Copies the keys of a record into a key container.
+ *
+ * @param record The device record
+ *
+ * @return The malloc'd keys, or NULL if a slot has no key
+ */
+struct key_container* fleet_record_keys (const struct fleet_record *record);
+
+/**
+ * Closes the fleet store, syncing it if it was writable.
+ *
+ * @param fleet The fleet store
+ */
+void close_fleet_store (struct fleet_store *fleet);
+
+#endif /* FLEET_STORE_H */
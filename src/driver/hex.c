@@ -0,0 +1,497 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <stddef.h>
+#include "hex.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_SSE2 1
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HEX_AVX2 1
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HEX_NEON 1
+#endif
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+/* Value of each hex digit plus one, 0 for anything else */
+static const uint8_t HEX_VALUE[256] =
+  {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+  };
+
+static void encode_scalar (char *hex, const uint8_t *bin, unsigned int len)
+{
+  unsigned int x;
+
+  for (x = 0; x < len; x++)
+    {
+      hex[2 * x] = HEX_DIGITS[bin[x] >> 4];
+      hex[2 * x + 1] = HEX_DIGITS[bin[x] & 0x0F];
+    }
+}
+
+static bool decode_scalar (uint8_t *bin, const char *hex, unsigned int len)
+{
+  unsigned int x;
+  unsigned int bad = 0;
+
+  for (x = 0; x < len; x++)
+    {
+      unsigned int hi = HEX_VALUE[(unsigned char)hex[2 * x]];
+      unsigned int lo = HEX_VALUE[(unsigned char)hex[2 * x + 1]];
+
+      bad |= (0 == hi) | (0 == lo);
+      bin[x] = (hi - 1) << 4 | ((lo - 1) & 0x0F);
+    }
+
+  return 0 == bad;
+}
+
+static bool validate_scalar (const char *hex, unsigned int len)
+{
+  unsigned int x;
+
+  for (x = 0; x < len; x++)
+    if (0 == HEX_VALUE[(unsigned char)hex[x]])
+      return false;
+
+  return true;
+}
+
+#if HEX_SSE2
+
+/* Each of the encoders and decoders handles whole blocks only and
+   returns the number of bytes done, leaving the tail to the scalar
+   code. */
+
+static __m128i sse2_nibbles_to_ascii (__m128i n)
+{
+  /* '0' + n, plus 7 more to reach 'A' for n > 9 */
+  __m128i letter = _mm_and_si128 (_mm_cmpgt_epi8 (n, _mm_set1_epi8 (9)),
+                                  _mm_set1_epi8 ('A' - '0' - 10));
+
+  return _mm_add_epi8 (_mm_add_epi8 (n, _mm_set1_epi8 ('0')), letter);
+}
+
+static unsigned int encode_sse2 (char *hex, const uint8_t *bin,
+                                 unsigned int len)
+{
+  const __m128i LOW = _mm_set1_epi8 (0x0F);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *)(bin + x));
+      __m128i hi = _mm_and_si128 (_mm_srli_epi16 (v, 4), LOW);
+      __m128i lo = _mm_and_si128 (v, LOW);
+
+      _mm_storeu_si128 ((__m128i *)(hex + 2 * x),
+                        sse2_nibbles_to_ascii (_mm_unpacklo_epi8 (hi, lo)));
+      _mm_storeu_si128 ((__m128i *)(hex + 2 * x + 16),
+                        sse2_nibbles_to_ascii (_mm_unpackhi_epi8 (hi, lo)));
+    }
+
+  return x;
+}
+
+/**
+ * Converts 16 characters to nibbles.
+ *
+ * @param c The characters
+ * @param valid Set to all ones in each lane holding a hex digit
+ *
+ * @return The nibble values, garbage where not valid
+ */
+static __m128i sse2_ascii_to_nibbles (__m128i c, __m128i *valid)
+{
+  /* Bytes from 0x80 are negative, so fail both signed ranges */
+  __m128i digit = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('0' - 1)),
+                                 _mm_cmplt_epi8 (c, _mm_set1_epi8 ('9' + 1)));
+  __m128i lower = _mm_or_si128 (c, _mm_set1_epi8 (0x20));
+  __m128i alpha = _mm_and_si128
+    (_mm_cmpgt_epi8 (lower, _mm_set1_epi8 ('a' - 1)),
+     _mm_cmplt_epi8 (lower, _mm_set1_epi8 ('f' + 1)));
+
+  *valid = _mm_or_si128 (digit, alpha);
+
+  return _mm_or_si128
+    (_mm_and_si128 (digit, _mm_sub_epi8 (c, _mm_set1_epi8 ('0'))),
+     _mm_and_si128 (alpha, _mm_sub_epi8 (lower, _mm_set1_epi8 ('a' - 10))));
+}
+
+/* Joins the nibble pairs in each 16 bit lane into a byte, low lane
+   byte as the high nibble */
+static __m128i sse2_join_nibbles (__m128i n)
+{
+  return _mm_and_si128 (_mm_or_si128 (_mm_slli_epi16 (n, 4),
+                                      _mm_srli_epi16 (n, 8)),
+                        _mm_set1_epi16 (0x00FF));
+}
+
+static unsigned int decode_sse2 (uint8_t *bin, const char *hex,
+                                 unsigned int len, bool *ok)
+{
+  __m128i all = _mm_set1_epi8 (-1);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      __m128i v0, v1;
+      __m128i n0 = sse2_ascii_to_nibbles
+        (_mm_loadu_si128 ((const __m128i *)(hex + 2 * x)), &v0);
+      __m128i n1 = sse2_ascii_to_nibbles
+        (_mm_loadu_si128 ((const __m128i *)(hex + 2 * x + 16)), &v1);
+
+      all = _mm_and_si128 (all, _mm_and_si128 (v0, v1));
+
+      _mm_storeu_si128 ((__m128i *)(bin + x),
+                        _mm_packus_epi16 (sse2_join_nibbles (n0),
+                                          sse2_join_nibbles (n1)));
+    }
+
+  *ok = (0xFFFF == _mm_movemask_epi8 (all));
+
+  return x;
+}
+
+static unsigned int validate_sse2 (const char *hex, unsigned int len,
+                                   bool *ok)
+{
+  __m128i all = _mm_set1_epi8 (-1);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      __m128i valid;
+
+      sse2_ascii_to_nibbles (_mm_loadu_si128 ((const __m128i *)(hex + x)),
+                             &valid);
+      all = _mm_and_si128 (all, valid);
+    }
+
+  *ok = (0xFFFF == _mm_movemask_epi8 (all));
+
+  return x;
+}
+
+#endif /* HEX_SSE2 */
+
+#if HEX_AVX2
+
+/* The same algorithm 32 bytes at a time.  Built for AVX2 regardless
+   of the compiler flags and only called once the CPU is known to
+   support it. */
+
+#define AVX2 __attribute__ ((target ("avx2")))
+
+AVX2 static __m256i avx2_nibbles_to_ascii (__m256i n)
+{
+  __m256i letter = _mm256_and_si256
+    (_mm256_cmpgt_epi8 (n, _mm256_set1_epi8 (9)),
+     _mm256_set1_epi8 ('A' - '0' - 10));
+
+  return _mm256_add_epi8 (_mm256_add_epi8 (n, _mm256_set1_epi8 ('0')),
+                          letter);
+}
+
+AVX2 static unsigned int encode_avx2 (char *hex, const uint8_t *bin,
+                                      unsigned int len)
+{
+  const __m256i LOW = _mm256_set1_epi8 (0x0F);
+  unsigned int x;
+
+  for (x = 0; x + 32 <= len; x += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *)(bin + x));
+      __m256i hi = _mm256_and_si256 (_mm256_srli_epi16 (v, 4), LOW);
+      __m256i lo = _mm256_and_si256 (v, LOW);
+      /* Unpacking works within each 128 bit lane, so swap the middle
+         quarters back into order */
+      __m256i a = avx2_nibbles_to_ascii (_mm256_unpacklo_epi8 (hi, lo));
+      __m256i b = avx2_nibbles_to_ascii (_mm256_unpackhi_epi8 (hi, lo));
+
+      _mm256_storeu_si256 ((__m256i *)(hex + 2 * x),
+                           _mm256_permute2x128_si256 (a, b, 0x20));
+      _mm256_storeu_si256 ((__m256i *)(hex + 2 * x + 32),
+                           _mm256_permute2x128_si256 (a, b, 0x31));
+    }
+
+  return x;
+}
+
+AVX2 static __m256i avx2_ascii_to_nibbles (__m256i c, __m256i *valid)
+{
+  __m256i digit = _mm256_and_si256
+    (_mm256_cmpgt_epi8 (c, _mm256_set1_epi8 ('0' - 1)),
+     _mm256_cmpgt_epi8 (_mm256_set1_epi8 ('9' + 1), c));
+  __m256i lower = _mm256_or_si256 (c, _mm256_set1_epi8 (0x20));
+  __m256i alpha = _mm256_and_si256
+    (_mm256_cmpgt_epi8 (lower, _mm256_set1_epi8 ('a' - 1)),
+     _mm256_cmpgt_epi8 (_mm256_set1_epi8 ('f' + 1), lower));
+
+  *valid = _mm256_or_si256 (digit, alpha);
+
+  return _mm256_or_si256
+    (_mm256_and_si256 (digit, _mm256_sub_epi8 (c, _mm256_set1_epi8 ('0'))),
+     _mm256_and_si256 (alpha,
+                       _mm256_sub_epi8 (lower, _mm256_set1_epi8 ('a' - 10))));
+}
+
+AVX2 static __m256i avx2_join_nibbles (__m256i n)
+{
+  return _mm256_and_si256 (_mm256_or_si256 (_mm256_slli_epi16 (n, 4),
+                                            _mm256_srli_epi16 (n, 8)),
+                           _mm256_set1_epi16 (0x00FF));
+}
+
+AVX2 static unsigned int decode_avx2 (uint8_t *bin, const char *hex,
+                                      unsigned int len, bool *ok)
+{
+  __m256i all = _mm256_set1_epi8 (-1);
+  unsigned int x;
+
+  for (x = 0; x + 32 <= len; x += 32)
+    {
+      __m256i v0, v1;
+      __m256i n0 = avx2_ascii_to_nibbles
+        (_mm256_loadu_si256 ((const __m256i *)(hex + 2 * x)), &v0);
+      __m256i n1 = avx2_ascii_to_nibbles
+        (_mm256_loadu_si256 ((const __m256i *)(hex + 2 * x + 32)), &v1);
+      /* Packing also works per lane, leaving the quarters as n0 low,
+         n1 low, n0 high, n1 high */
+      __m256i packed = _mm256_packus_epi16 (avx2_join_nibbles (n0),
+                                            avx2_join_nibbles (n1));
+
+      all = _mm256_and_si256 (all, _mm256_and_si256 (v0, v1));
+
+      _mm256_storeu_si256 ((__m256i *)(bin + x),
+                           _mm256_permute4x64_epi64 (packed, 0xD8));
+    }
+
+  *ok = (-1 == _mm256_movemask_epi8 (all));
+
+  return x;
+}
+
+AVX2 static unsigned int validate_avx2 (const char *hex, unsigned int len,
+                                        bool *ok)
+{
+  __m256i all = _mm256_set1_epi8 (-1);
+  unsigned int x;
+
+  for (x = 0; x + 32 <= len; x += 32)
+    {
+      __m256i valid;
+
+      avx2_ascii_to_nibbles (_mm256_loadu_si256 ((const __m256i *)(hex + x)),
+                             &valid);
+      all = _mm256_and_si256 (all, valid);
+    }
+
+  *ok = (-1 == _mm256_movemask_epi8 (all));
+
+  return x;
+}
+
+static bool have_avx2 (void)
+{
+  static int avx2 = -1;
+
+  if (avx2 < 0)
+    {
+      __builtin_cpu_init ();
+      avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+
+  return avx2;
+}
+
+#endif /* HEX_AVX2 */
+
+#if HEX_NEON
+
+static unsigned int encode_neon (char *hex, const uint8_t *bin,
+                                 unsigned int len)
+{
+  const uint8x16_t DIGITS = vld1q_u8 ((const uint8_t *)HEX_DIGITS);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      uint8x16_t v = vld1q_u8 (bin + x);
+      uint8x16x2_t out;
+
+      out.val[0] = vqtbl1q_u8 (DIGITS, vshrq_n_u8 (v, 4));
+      out.val[1] = vqtbl1q_u8 (DIGITS, vandq_u8 (v, vdupq_n_u8 (0x0F)));
+
+      /* Stores the two vectors interleaved: high digit, low digit */
+      vst2q_u8 ((uint8_t *)hex + 2 * x, out);
+    }
+
+  return x;
+}
+
+static uint8x16_t neon_ascii_to_nibbles (uint8x16_t c, uint8x16_t *valid)
+{
+  uint8x16_t digit = vsubq_u8 (c, vdupq_n_u8 ('0'));
+  uint8x16_t alpha = vsubq_u8 (vorrq_u8 (c, vdupq_n_u8 (0x20)),
+                               vdupq_n_u8 ('a'));
+  uint8x16_t is_digit = vcltq_u8 (digit, vdupq_n_u8 (10));
+  uint8x16_t is_alpha = vcltq_u8 (alpha, vdupq_n_u8 (6));
+
+  *valid = vorrq_u8 (is_digit, is_alpha);
+
+  return vbslq_u8 (is_digit, digit, vaddq_u8 (alpha, vdupq_n_u8 (10)));
+}
+
+static unsigned int decode_neon (uint8_t *bin, const char *hex,
+                                 unsigned int len, bool *ok)
+{
+  uint8x16_t all = vdupq_n_u8 (0xFF);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      /* Loads the high digits into val[0] and the low into val[1] */
+      uint8x16x2_t c = vld2q_u8 ((const uint8_t *)hex + 2 * x);
+      uint8x16_t v0, v1;
+      uint8x16_t hi = neon_ascii_to_nibbles (c.val[0], &v0);
+      uint8x16_t lo = neon_ascii_to_nibbles (c.val[1], &v1);
+
+      all = vandq_u8 (all, vandq_u8 (v0, v1));
+
+      vst1q_u8 (bin + x, vorrq_u8 (vshlq_n_u8 (hi, 4), lo));
+    }
+
+  *ok = (0xFF == vminvq_u8 (all));
+
+  return x;
+}
+
+static unsigned int validate_neon (const char *hex, unsigned int len,
+                                   bool *ok)
+{
+  uint8x16_t all = vdupq_n_u8 (0xFF);
+  unsigned int x;
+
+  for (x = 0; x + 16 <= len; x += 16)
+    {
+      uint8x16_t valid;
+
+      neon_ascii_to_nibbles (vld1q_u8 ((const uint8_t *)hex + x), &valid);
+      all = vandq_u8 (all, valid);
+    }
+
+  *ok = (0xFF == vminvq_u8 (all));
+
+  return x;
+}
+
+#endif /* HEX_NEON */
+
+void hex_encode (char *hex, const uint8_t *bin, unsigned int len)
+{
+  unsigned int done = 0;
+
+#if HEX_AVX2
+  if (have_avx2 ())
+    done = encode_avx2 (hex, bin, len);
+#endif
+#if HEX_SSE2
+  done += encode_sse2 (hex + 2 * done, bin + done, len - done);
+#elif HEX_NEON
+  done = encode_neon (hex, bin, len);
+#endif
+
+  encode_scalar (hex + 2 * done, bin + done, len - done);
+}
+
+bool hex_decode (uint8_t *bin, const char *hex, unsigned int hex_len)
+{
+  unsigned int len = hex_len / 2;
+  unsigned int done = 0;
+  bool ok = true;
+
+  if (0 != hex_len % 2)
+    return false;
+
+#if HEX_AVX2
+  if (have_avx2 ())
+    done = decode_avx2 (bin, hex, len, &ok);
+#endif
+#if HEX_SSE2
+  if (ok)
+    {
+      unsigned int more = decode_sse2 (bin + done, hex + 2 * done,
+                                       len - done, &ok);
+      done += more;
+    }
+#elif HEX_NEON
+  done = decode_neon (bin, hex, len, &ok);
+#endif
+
+  return ok && decode_scalar (bin + done, hex + 2 * done, len - done);
+}
+
+bool hex_validate (const char *hex, unsigned int hex_len)
+{
+  unsigned int done = 0;
+  bool ok = true;
+
+#if HEX_AVX2
+  if (have_avx2 ())
+    done = validate_avx2 (hex, hex_len, &ok);
+#endif
+#if HEX_SSE2
+  if (ok)
+    {
+      unsigned int more = validate_sse2 (hex + done, hex_len - done, &ok);
+      done += more;
+    }
+#elif HEX_NEON
+  done = validate_neon (hex, hex_len, &ok);
+#endif
+
+  return ok && validate_scalar (hex + done, hex_len - done);
+}
+
+const char* hex_implementation (void)
+{
+#if HEX_AVX2
+  if (have_avx2 ())
+    return "avx2";
+#endif
+#if HEX_SSE2
+  return "sse2";
+#elif HEX_NEON
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,73 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HEX_H
+#define HEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Hex encoding and decoding into caller buffers.  Blocks of 16 or 32
+   bytes are handled with SSE2, AVX2 or NEON where the build and the
+   CPU support them, and the remainder one byte at a time. */
+
+/* Length of the hex encoding of len bytes, without a terminator */
+#define HEX_LEN(len) ((len) * 2)
+
+/**
+ * Encodes binary as upper case hex.  No terminator is written.
+ *
+ * @param hex Receives HEX_LEN (len) characters
+ * @param bin The binary data
+ * @param len The length of the binary data
+ */
+void hex_encode (char *hex, const uint8_t *bin, unsigned int len);
+
+/**
+ * Decodes hex of either case.
+ *
+ * @param bin Receives hex_len / 2 bytes.  On failure its contents are
+ * undefined.
+ * @param hex The hex characters, which need not be terminated
+ * @param hex_len The number of hex characters
+ *
+ * @return False if hex_len is odd or a character is not a hex digit
+ */
+bool hex_decode (uint8_t *bin, const char *hex, unsigned int hex_len);
+
+/**
+ * Checks that every character is a hex digit.
+ *
+ * @param hex The characters to check
+ * @param hex_len The number of characters
+ *
+ * @return True if all hex_len characters are hex digits
+ */
+bool hex_validate (const char *hex, unsigned int hex_len);
+
+/**
+ * Returns the name of the implementation in use, for benchmarks and
+ * debug logs.
+ *
+ * @return "avx2", "sse2", "neon" or "scalar"
+ */
+const char* hex_implementation (void);
+
+#endif /* HEX_H */
@@ -32,6 +32,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "log.h"
+#include "stats.h"
+#include "temp_key.h"
+#include "zone_cache.h"
 
 int i2c_setup(const char* bus)
 {
@@ -40,24 +43,23 @@ int i2c_setup(const char* bus)
   int fd;
 
   if ((fd = open(bus, O_RDWR)) < 0)
-    {
-      perror("Failed to open I2C bus; Try specifying the bus with -b\n");
-      exit(1);
-    }
+    perror("Failed to open I2C bus; Try specifying the bus with -b\n");
 
   return fd;
 
 }
 
-void i2c_acquire_bus(int fd, int addr)
+bool i2c_acquire_bus(int fd, int addr)
 {
   if (ioctl(fd, I2C_SLAVE, addr) < 0)
     {
       perror("Failed to acquire bus access and/or talk to slave.\n");
 
-      exit(1);
+      return false;
   }
 
+  return true;
+
 }
 
 
@@ -68,6 +70,9 @@ bool wakeup(int fd)
   uint32_t wakeup = 0;
   unsigned char buf[4] = {0};
   bool awake = false;
+  /* An absent device NAKs every wake up, don't wait forever for it */
+  const unsigned int MAX_ATTEMPTS = 100;
+  unsigned int x = 0;
 
   /* The assumption here that the fd is the i2c fd.  Of course, it may
    * not be, so this may loop for a while (read forever).  This should
@@ -80,7 +85,7 @@ bool wakeup(int fd)
   if(fcntl(fd, F_GETFD) < 0)
     perror("Invalid FD.\n");
 
-  while (!awake)
+  for (x = 0; x < MAX_ATTEMPTS && !awake; x++)
     {
       if (write(fd,&wakeup,sizeof(wakeup)) > 1)
         {
@@ -94,8 +99,7 @@ bool wakeup(int fd)
             }
           else
             {
-              assert(is_crc_16_valid(buf, 2, buf+2));
-              awake = true;
+              awake = is_crc_16_valid(buf, 2, buf+2);
             }
         }
     }
@@ -114,7 +118,7 @@ int sleep_device(int fd)
 
 }
 
-ssize_t i2c_write(int fd, unsigned char *buf, unsigned int len)
+ssize_t i2c_write(int fd, const unsigned char *buf, unsigned int len)
 {
   assert(NULL != buf);
 
@@ -135,9 +139,18 @@ int hashlet_setup(const char *bus, unsigned int addr)
 {
     int fd = i2c_setup(bus);
 
-    i2c_acquire_bus(fd, addr);
+    if (fd < 0)
+        return fd;
 
-    wakeup(fd);
+    if (!i2c_acquire_bus(fd, addr) || !wakeup(fd))
+      {
+        close(fd);
+        return -1;
+      }
+
+    stats_register_device(fd, bus, addr);
+    temp_key_register_device(fd);
+    zone_cache_register_device(fd);
 
     return fd;
 
@@ -147,6 +160,10 @@ void hashlet_teardown(int fd)
 {
     sleep_device(fd);
 
+    stats_close_device(fd);
+    temp_key_close_device(fd);
+    zone_cache_close_device(fd);
+
     close(fd);
 
 }
@@ -29,17 +29,32 @@
  *
  * @param bus The desired I2C bus.
  *
- * @return An open file descriptor or the program will exit.
+ * @return An open file descriptor or -1 on error
  */
 int i2c_setup(const char* bus);
 
-void i2c_acquire_bus(int fd, int addr);
+/**
+ * Addresses the device at addr on the bus
+ *
+ * @param fd The open bus
+ * @param addr The device's address
+ *
+ * @return True on success
+ */
+bool i2c_acquire_bus(int fd, int addr);
 
+/**
+ * Wakes the device up, giving up if it never answers
+ *
+ * @param fd The open file descriptor
+ *
+ * @return True if the device is awake
+ */
 bool wakeup(int fd);
 
 int sleep_device(int fd);
 
-ssize_t i2c_write(int fd, unsigned char *buf, unsigned int len);
+ssize_t i2c_write(int fd, const unsigned char *buf, unsigned int len);
 
 ssize_t i2c_read(int fd, unsigned char *buf, unsigned int len);
 
@@ -0,0 +1,322 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc.h"
+#include "key_store.h"
+#include "log.h"
+#include "../parser/hashlet_parser.h"
+
+static const uint8_t KEY_STORE_MAGIC[4] = { 'H', 'L', 'K', 'S' };
+
+static uint16_t key_store_crc (const struct key_store_file *file)
+{
+  return calculate_crc16 ((const uint8_t *)file,
+                          offsetof (struct key_store_file, crc));
+}
+
+/**
+ * Fills in a key store image.
+ *
+ * @param file The zeroed image
+ * @param keys The keys.  Slots without a 32 byte key are left out.
+ */
+static void fill_key_store (struct key_store_file *file,
+                            struct key_container *keys)
+{
+  unsigned int x;
+
+  memcpy (file->magic, KEY_STORE_MAGIC, sizeof (KEY_STORE_MAGIC));
+  file->version = KEY_STORE_VERSION;
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (NULL != keys->keys[x].ptr &&
+          KEY_STORE_KEY_LEN == keys->keys[x].len)
+        {
+          memcpy (file->keys[x], keys->keys[x].ptr, KEY_STORE_KEY_LEN);
+          file->present |= 1 << x;
+        }
+    }
+
+  file->crc = key_store_crc (file);
+}
+
+bool write_key_store (const char *filename, struct key_container *keys)
+{
+  assert (NULL != filename);
+  assert (NULL != keys);
+
+  struct key_store_file *file;
+  bool result = false;
+  int fd, error;
+
+  size_t tmp_len = strlen (filename) + 5;
+  char *tmp = malloc (tmp_len);
+  assert (NULL != tmp);
+  snprintf (tmp, tmp_len, "%s.tmp", filename);
+
+  file = (struct key_store_file *)malloc_wipe (sizeof (*file));
+  fill_key_store (file, keys);
+
+  if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) >= 0)
+    {
+      result = (sizeof (*file) == write (fd, file, sizeof (*file)));
+
+      if (0 != close (fd))
+        result = false;
+
+      if (result)
+        result = (0 == rename (tmp, filename));
+
+      error = errno;
+
+      if (!result)
+        unlink (tmp);
+    }
+  else
+    error = errno;
+
+  free_wipe ((uint8_t *)file, sizeof (*file));
+  free (tmp);
+
+  errno = error;
+
+  return result;
+}
+
+/**
+ * Wraps a mapped key store image, locking it in memory.
+ *
+ * @param map The sizeof (struct key_store_file) byte mapping
+ *
+ * @return The key store
+ */
+static struct key_store* make_key_store (void *map)
+{
+  struct key_store *store = malloc (sizeof (struct key_store));
+  assert (NULL != store);
+
+  store->file = map;
+
+  /* Keep the keys out of swap.  This fails without privileges once the
+     locked memory limit is reached, which is not fatal. */
+  store->locked = (0 == mlock (map, sizeof (struct key_store_file)));
+  if (!store->locked)
+    CTX_LOG (DEBUG, "Key store not locked in memory: %s", strerror (errno));
+
+  madvise (map, sizeof (struct key_store_file), MADV_DONTDUMP);
+
+  return store;
+}
+
+/**
+ * Builds a key store in anonymous memory, for keys that couldn't be
+ * written to the binary key store.
+ *
+ * @param keys The keys
+ *
+ * @return The key store or NULL.  Close with close_key_store.
+ */
+static struct key_store* memory_key_store (struct key_container *keys)
+{
+  struct key_store *store;
+  void *map = mmap (NULL, sizeof (struct key_store_file),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+
+  if (MAP_FAILED == map)
+    return NULL;
+
+  /* Locked before the keys are copied in */
+  store = make_key_store (map);
+  fill_key_store (map, keys);
+  mprotect (map, sizeof (struct key_store_file), PROT_READ);
+
+  return store;
+}
+
+struct key_store* open_key_store (const char *filename)
+{
+  assert (NULL != filename);
+
+  const struct key_store_file *file;
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ((fd = open (filename, O_RDONLY)) < 0)
+    return NULL;
+
+  if (0 != fstat (fd, &st) || sizeof (*file) != st.st_size)
+    {
+      CTX_LOG (INFO, "%s is not a key store", filename);
+      close (fd);
+      return NULL;
+    }
+
+  map = mmap (NULL, sizeof (*file), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (MAP_FAILED == map)
+    return NULL;
+
+  file = map;
+
+  if (0 != memcmp (file->magic, KEY_STORE_MAGIC, sizeof (KEY_STORE_MAGIC)) ||
+      KEY_STORE_VERSION != file->version ||
+      key_store_crc (file) != file->crc)
+    {
+      CTX_LOG (INFO, "%s is corrupt or from another version", filename);
+      munmap (map, sizeof (*file));
+      return NULL;
+    }
+
+  return make_key_store (map);
+}
+
+/**
+ * Reads the text key store.  Unlike import_keys, slots may be missing,
+ * as the offline commands only need the slot they verify.
+ *
+ * @param filename The text key store
+ *
+ * @return The malloc'd key container or NULL if it failed to parse
+ */
+static struct key_container* read_text_key_store (const char *filename)
+{
+  struct key_container *keys = NULL;
+  struct parsed_key parsed[KEY_FILE_SLOTS];
+  struct key_file_error error;
+  unsigned int x;
+  FILE *fp;
+
+  if ((fp = fopen (filename, "r")) == NULL)
+    return NULL;
+
+  if (0 == parse_key_file (fp, parsed, &error))
+    {
+      keys = make_key_container ();
+
+      for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+        {
+          if (parsed[x].present)
+            {
+              keys->keys[x] = make_buffer (KEY_FILE_KEY_LEN);
+              memcpy (keys->keys[x].ptr, parsed[x].key, KEY_FILE_KEY_LEN);
+            }
+        }
+
+      wipe_parsed_keys (parsed);
+    }
+  else
+    CTX_LOG (INFO, "%s:%u:%u: %s", filename, error.line, error.column,
+             error.message);
+
+  fclose (fp);
+
+  return keys;
+}
+
+/**
+ * Returns true if a file was modified after another.
+ */
+static bool newer (const struct stat *lhs, const struct stat *rhs)
+{
+  return lhs->st_mtim.tv_sec > rhs->st_mtim.tv_sec ||
+    (lhs->st_mtim.tv_sec == rhs->st_mtim.tv_sec &&
+     lhs->st_mtim.tv_nsec > rhs->st_mtim.tv_nsec);
+}
+
+struct key_store* load_key_store (void)
+{
+  char *filename = home_file_name (KEY_STORE_BIN);
+  const char *text = get_key_store_name ();
+  struct key_store *store = NULL;
+  struct stat text_st, bin_st;
+  bool have_bin = 0 == stat (filename, &bin_st);
+
+  /* The text key store may have been written by an older version, or
+     edited or restored by hand, since the binary one was made */
+  if (0 == stat (text, &text_st) && (!have_bin || newer (&text_st, &bin_st)))
+    {
+      struct key_container *keys = read_text_key_store (text);
+
+      if (NULL == keys)
+        CTX_LOG (INFO, "%s has changed but can't be read, not using %s",
+                 text, filename);
+      else
+        {
+          CTX_LOG (DEBUG, "Rebuilding %s from %s", filename, text);
+
+          if (write_key_store (filename, keys))
+            store = open_key_store (filename);
+          else
+            CTX_LOG (INFO, "Can't write %s: %s, using the keys in %s",
+                     filename, strerror (errno), text);
+
+          /* The keys just read are right even if the binary copy
+             can't be made, on a read only or full home directory */
+          if (NULL == store)
+            store = memory_key_store (keys);
+
+          free_key_container (keys);
+        }
+    }
+  else if (have_bin)
+    store = open_key_store (filename);
+
+  free ((char *)text);
+  free (filename);
+
+  return store;
+}
+
+const uint8_t* key_store_slot (const struct key_store *store,
+                               unsigned int slot)
+{
+  assert (NULL != store);
+
+  if (slot < MAX_NUM_DATA_SLOTS && (store->file->present & (1 << slot)))
+    return store->file->keys[slot];
+
+  return NULL;
+}
+
+void close_key_store (struct key_store *store)
+{
+  assert (NULL != store);
+
+  if (store->locked)
+    munlock (store->file, sizeof (struct key_store_file));
+
+  munmap ((void *)store->file, sizeof (struct key_store_file));
+  free (store);
+}
@@ -0,0 +1,111 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "defs.h"
+#include "personalize.h"
+
+/* The binary key store lives next to the text one.  The text file
+   remains the backup and import format, the binary file is what the
+   offline commands read. */
+#define KEY_STORE_BIN "/.hashlet.keys"
+
+#define KEY_STORE_VERSION 1
+#define KEY_STORE_KEY_LEN 32
+
+/* On disk layout, in host byte order.  All fields are naturally
+   aligned so the file can be used in place once mapped. */
+struct key_store_file
+{
+  uint8_t magic[4];             /**< "HLKS" */
+  uint16_t version;             /**< KEY_STORE_VERSION */
+  uint16_t present;             /**< Bit x is set if slot x has a key */
+  uint8_t keys[MAX_NUM_DATA_SLOTS][KEY_STORE_KEY_LEN];
+  uint16_t crc;                 /**< CRC16 of the bytes before it */
+  uint16_t reserved;
+};
+
+struct key_store
+{
+  const struct key_store_file *file; /**< The read only mapping, of the
+                                          file or of anonymous memory */
+  bool locked;                       /**< True if mlock succeeded */
+};
+
+/**
+ * Writes the keys to a binary key store, replacing it atomically.
+ * The file is only readable by the user.
+ *
+ * @param filename The binary key store
+ * @param keys The keys.  Slots without a 32 byte key are left out.
+ *
+ * @return True if written, else false with errno set by the call that
+ * failed
+ */
+bool write_key_store (const char *filename, struct key_container *keys);
+
+/**
+ * Maps a binary key store read only and locks it in memory.  The
+ * header and checksum are checked.
+ *
+ * @param filename The binary key store
+ *
+ * @return The key store or NULL if it is missing or invalid.  Close
+ * with close_key_store.
+ */
+struct key_store* open_key_store (const char *filename);
+
+/**
+ * Opens the user's binary key store.  It is rebuilt from the text key
+ * store first if that was modified after it, or if there is none yet,
+ * as with keys recorded by older versions.  If the rebuilt file can't
+ * be written, as on a read only or full home directory, the failure
+ * is logged and the keys read are used from memory instead.  A text
+ * key store that was modified but doesn't parse leaves no key store
+ * to use.
+ *
+ * @return The key store or NULL.  Close with close_key_store.
+ */
+struct key_store* load_key_store (void);
+
+/**
+ * Returns the key of a slot.
+ *
+ * @param store The open key store
+ * @param slot The key slot
+ *
+ * @return A pointer to the 32 byte key inside the mapping, or NULL if
+ * the slot has no key.  Valid until the store is closed.
+ */
+const uint8_t* key_store_slot (const struct key_store *store,
+                               unsigned int slot);
+
+/**
+ * Unmaps the key store.
+ *
+ * @param store The key store
+ */
+void close_key_store (struct key_store *store);
+
+#endif /* KEY_STORE_H */
@@ -18,52 +18,313 @@
  *
  */
 
+#include "config.h"
 #include "log.h"
 
-#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
 #include <time.h>
-#include <assert.h>
 
-static enum LOG_LEVEL CURRENT_LOG_LEVEL = INFO;
+/* Messages are formatted by the caller into a slot of a bounded ring
+   and written by a background thread, so logging never waits on the
+   sink.  The ring is a multi producer, single consumer queue: each
+   slot carries a sequence number saying whether it is free for the
+   producer claiming that position or full for the consumer.  A full
+   queue drops messages, except severe ones, which the caller writes
+   itself. */
+
+#define LOG_QUEUE_LEN 256        /* A power of two */
+#define LOG_RECORD_LEN 512       /* Longer messages are truncated */
+
+struct log_record
+{
+  unsigned long seq;
+  struct timespec time;
+  enum LOG_LEVEL level;
+  char text[LOG_RECORD_LEN];
+};
+
+struct log_queue
+{
+  struct log_record ring[LOG_QUEUE_LEN];
+  unsigned long enqueue_pos;    /**< Shared by the producers */
+  unsigned long dequeue_pos;    /**< Only used by the writer */
+  unsigned long dropped;        /**< Messages lost to a full queue */
+  sem_t ready;                  /**< Counts the queued messages */
+  pthread_t writer;
+  bool running;
+  bool stopping;
+};
+
+enum LOG_LEVEL log_level = INFO;
+
+static struct log_queue queue;
+static pthread_once_t queue_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void CTX_LOG(enum LOG_LEVEL lvl, const char *format, ...)
+static enum LOG_SINK log_sink = LOG_SINK_STDERR;
+static FILE *log_file = NULL;
+
+static const char *LEVEL_NAMES[] = { "SEVERE", "WARNING", "INFO", "DEBUG" };
+
+void set_log_level(enum LOG_LEVEL lvl)
 {
-  if (lvl <= CURRENT_LOG_LEVEL)
+  log_level = lvl;
+
+}
+
+bool set_log_sink (enum LOG_SINK sink, const char *path)
+{
+  log_sink = sink;
+
+  switch (sink)
     {
-      va_list args;
-      va_start(args, format);
-      vfprintf(stdout, format, args);
-      printf("\n");
-      va_end(args);
+    case LOG_SINK_FILE:
+      assert (NULL != path);
+      if (NULL == (log_file = fopen (path, "a")))
+        {
+          fprintf (stderr, "Can't open log file %s: %s\n", path,
+                   strerror (errno));
+          log_sink = LOG_SINK_STDERR;
+          return false;
+        }
+      break;
+    case LOG_SINK_SYSLOG:
+      openlog (PACKAGE_NAME, LOG_PID, LOG_USER);
+      break;
+    default:
+      break;
     }
+
+  return true;
 }
 
-void set_log_level(enum LOG_LEVEL lvl)
+/**
+ * Writes one message to the sink.  Called by the writer thread, and
+ * by callers under flush_lock for messages that can't be queued:
+ * stdio and syslog each take a whole message at a time, so these
+ * don't interleave with the writer's.
+ */
+static void write_record (const struct log_record *r)
+{
+  static const int PRIORITY[] = { LOG_ERR, LOG_WARNING, LOG_INFO,
+                                  LOG_DEBUG };
+
+  if (LOG_SINK_SYSLOG == log_sink)
+    {
+      syslog (PRIORITY[r->level], "%s", r->text);
+      return;
+    }
+
+  FILE *f = (LOG_SINK_FILE == log_sink) ? log_file : stderr;
+
+  fprintf (f, "[%5lld.%06ld] %s: %s\n", (long long)r->time.tv_sec,
+           r->time.tv_nsec / 1000, LEVEL_NAMES[r->level], r->text);
+}
+
+static void* log_writer (void *arg)
+{
+  struct log_queue *q = arg;
+  unsigned long reported = 0;
+
+  for (;;)
+    {
+      struct log_record *r = &q->ring[q->dequeue_pos % LOG_QUEUE_LEN];
+
+      while (0 != sem_wait (&q->ready) && EINTR == errno)
+        ;
+
+      /* Producers publish out of order, so the post may belong to a
+         later slot; wait for this one.  A post with nothing left to
+         write is the stop request.  These loads are sequentially
+         consistent with the producers' claims, see log_write. */
+      while (__atomic_load_n (&r->seq, __ATOMIC_ACQUIRE) != q->dequeue_pos + 1)
+        {
+          if (__atomic_load_n (&q->stopping, __ATOMIC_SEQ_CST) &&
+              __atomic_load_n (&q->enqueue_pos, __ATOMIC_SEQ_CST) ==
+              q->dequeue_pos)
+            goto done;
+
+          sched_yield ();
+        }
+
+      write_record (r);
+
+      __atomic_store_n (&r->seq, q->dequeue_pos + LOG_QUEUE_LEN,
+                        __ATOMIC_RELEASE);
+      q->dequeue_pos++;
+
+      unsigned long dropped = __atomic_load_n (&q->dropped, __ATOMIC_RELAXED);
+      if (dropped != reported)
+        {
+          struct log_record note = { .level = WARNING };
+
+          clock_gettime (CLOCK_MONOTONIC, &note.time);
+          snprintf (note.text, sizeof (note.text),
+                    "%lu log messages dropped", dropped - reported);
+          write_record (&note);
+          reported = dropped;
+        }
+    }
+
+ done:
+  if (LOG_SINK_FILE == log_sink)
+    fflush (log_file);
+
+  return NULL;
+}
+
+static void start_writer (void)
+{
+  unsigned long x;
+
+  for (x = 0; x < LOG_QUEUE_LEN; x++)
+    queue.ring[x].seq = x;
+
+  sem_init (&queue.ready, 0, 0);
+
+  if (0 == pthread_create (&queue.writer, NULL, log_writer, &queue))
+    {
+      queue.running = true;
+      atexit (log_flush);
+    }
+}
+
+/**
+ * Claims the next free slot.
+ *
+ * @return The slot, or NULL if the queue is full
+ */
+static struct log_record* claim_record (unsigned long *pos)
+{
+  unsigned long p = __atomic_load_n (&queue.enqueue_pos, __ATOMIC_RELAXED);
+
+  for (;;)
+    {
+      struct log_record *r = &queue.ring[p % LOG_QUEUE_LEN];
+      unsigned long seq = __atomic_load_n (&r->seq, __ATOMIC_ACQUIRE);
+      long diff = (long)(seq - p);
+
+      if (0 == diff)
+        {
+          if (__atomic_compare_exchange_n (&queue.enqueue_pos, &p, p + 1,
+                                           true, __ATOMIC_SEQ_CST,
+                                           __ATOMIC_RELAXED))
+            {
+              *pos = p;
+              return r;
+            }
+          /* p now holds the current position, try again */
+        }
+      else if (diff < 0)
+        return NULL;
+      else
+        p = __atomic_load_n (&queue.enqueue_pos, __ATOMIC_RELAXED);
+    }
+}
+
+void log_write (enum LOG_LEVEL lvl, const char *format, ...)
+{
+  struct log_record local;
+  struct log_record *r;
+  unsigned long pos = 0;
+  va_list args;
+
+  assert (lvl <= DEBUG);
+
+  pthread_once (&queue_once, start_writer);
+
+  bool queued = __atomic_load_n (&queue.running, __ATOMIC_ACQUIRE) &&
+    !__atomic_load_n (&queue.stopping, __ATOMIC_ACQUIRE);
+
+  if (queued && NULL == (r = claim_record (&pos)))
+    {
+      /* Only a severe message is worth waiting on the sink for */
+      if (SEVERE != lvl)
+        {
+          __atomic_add_fetch (&queue.dropped, 1, __ATOMIC_RELAXED);
+          return;
+        }
+
+      queued = false;
+    }
+
+  if (!queued)
+    r = &local;
+
+  clock_gettime (CLOCK_MONOTONIC, &r->time);
+  r->level = lvl;
+
+  va_start (args, format);
+  vsnprintf (r->text, sizeof (r->text), format, args);
+  va_end (args);
+
+  if (queued)
+    {
+      __atomic_store_n (&r->seq, pos + 1, __ATOMIC_RELEASE);
+      sem_post (&queue.ready);
+
+      /* The writer stops once it has seen stopping and caught up with
+         enqueue_pos.  If stopping is still clear after the claim, the
+         writer will see the claim and write the message.  Otherwise
+         it may already have gone: wait for log_flush to join it and
+         write the message here, unless it got to it first. */
+      if (!__atomic_load_n (&queue.stopping, __ATOMIC_SEQ_CST))
+        return;
+    }
+
+  pthread_mutex_lock (&flush_lock);
+
+  if (!queued || queue.dequeue_pos <= pos)
+    write_record (r);
+
+  pthread_mutex_unlock (&flush_lock);
+}
+
+void log_flush (void)
 {
-  CURRENT_LOG_LEVEL = lvl;
+  pthread_mutex_lock (&flush_lock);
 
+  if (queue.running && !queue.stopping)
+    {
+      __atomic_store_n (&queue.stopping, true, __ATOMIC_SEQ_CST);
+
+      sem_post (&queue.ready);
+      pthread_join (queue.writer, NULL);
+      queue.running = false;
+    }
+
+  pthread_mutex_unlock (&flush_lock);
 }
 
 void print_hex_string(const char *str, const uint8_t *hex, unsigned int len)
 {
 
-  if (CURRENT_LOG_LEVEL < DEBUG)
+  if (!LOG_ENABLED (DEBUG))
     return;
 
-  int i;
+  /* Five characters per byte, with a label, fills a record at about
+     100 bytes; longer buffers are truncated */
+  char line[LOG_RECORD_LEN];
+  unsigned int i;
+  int n;
 
   assert(NULL != str);
   assert(NULL != hex);
 
-  printf("%s : ", str);
+  n = snprintf (line, sizeof (line), "%s :", str);
 
-  for (i = 0; i < len; i++)
-    {
-      if (i > 0) printf(" ");
-      printf("0x%02X", hex[i]);
-    }
+  for (i = 0; i < len && n > 0 && n < sizeof (line); i++)
+    n += snprintf (line + n, sizeof (line) - n, " 0x%02X", hex[i]);
 
-  printf("\n");
+  log_write (DEBUG, "%s", line);
 
 }
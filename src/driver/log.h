@@ -32,8 +32,67 @@ enum LOG_LEVEL
     DEBUG
   };
 
+/* Messages above this level are compiled out, arguments and all.
+   Set it with ./configure --with-log-level. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL DEBUG
+#endif
+
+/* The run time level.  Use set_log_level to change it. */
+extern enum LOG_LEVEL log_level;
+
+/* True if a message at this level would be written */
+#define LOG_ENABLED(lvl) ((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= log_level)
+
+/* Logs a printf style message.  The arguments are only evaluated when
+   the level is enabled. */
+#define CTX_LOG(lvl, ...)                               \
+  do                                                    \
+    {                                                   \
+      if (LOG_ENABLED (lvl))                            \
+        log_write ((lvl), __VA_ARGS__);                 \
+    }                                                   \
+  while (0)
+
+enum LOG_SINK
+  {
+    LOG_SINK_STDERR = 0,
+    LOG_SINK_FILE,
+    LOG_SINK_SYSLOG
+  };
+
 void set_log_level(enum LOG_LEVEL lvl);
 
-void CTX_LOG(enum LOG_LEVEL, const char *format, ...);
+/**
+ * Chooses where log messages go.  Call before the first message; the
+ * default is stderr.
+ *
+ * @param sink The sink
+ * @param path The file to append to for LOG_SINK_FILE, otherwise
+ * ignored
+ *
+ * @return False if the file could not be opened, in which case
+ * messages still go to stderr
+ */
+bool set_log_sink (enum LOG_SINK sink, const char *path);
+
+/**
+ * Queues a message for the writer thread, which is started by the
+ * first message.  If the queue is full the message is dropped and
+ * counted, unless it is SEVERE: those are written by the caller,
+ * which then waits on the sink.  Use CTX_LOG rather than calling
+ * this.
+ *
+ * @param lvl The level of the message
+ * @param format The printf style format
+ */
+void log_write (enum LOG_LEVEL lvl, const char *format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+
+/**
+ * Writes every queued message and stops the writer thread.  Called at
+ * exit; later messages are written directly.
+ */
+void log_flush (void);
 
 #endif /* LOG_H */
@@ -27,12 +27,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <gcrypt.h>
+#include <time.h>
 #include "log.h"
 #include "config.h"
 #include "personalize.h"
 #include "crc.h"
 #include <pwd.h>
 #include "config_zone.h"
+#include "fleet_store.h"
+#include "hex.h"
+#include "key_store.h"
 #include "../parser/hashlet_parser.h"
 
 unsigned int get_max_keys ()
@@ -40,20 +45,33 @@ unsigned int get_max_keys ()
   return MAX_NUM_DATA_SLOTS;
 }
 
-const char* get_key_store_name ()
+char* home_file_name (const char *name)
 {
-  struct passwd *pw = getpwuid (getuid ());
-  assert (NULL != pw);
+  assert (NULL != name);
+
+  /* $HOME avoids a passwd lookup, which may go out to NSS */
+  const char *home = getenv ("HOME");
+
+  if (NULL == home || '\0' == *home)
+    {
+      struct passwd *pw = getpwuid (getuid ());
+      assert (NULL != pw);
+      home = pw->pw_dir;
+    }
 
-  const char *home = pw->pw_dir;
-  unsigned int filename_len = strlen (home) + strlen (KEY_STORE) + 1;
+  unsigned int filename_len = strlen (home) + strlen (name) + 1;
   char *filename = (char *)malloc_wipe (filename_len);
   strcpy (filename, home);
-  strcat (filename, KEY_STORE);
+  strcat (filename, name);
 
   return filename;
 }
 
+const char* get_key_store_name ()
+{
+  return home_file_name (KEY_STORE);
+}
+
 bool record_keys (struct key_container *keys)
 {
   assert (NULL != keys);
@@ -61,15 +79,8 @@ bool record_keys (struct key_container *keys)
   bool result = false;
   FILE *f = NULL;
 
-  struct passwd *pw = getpwuid (getuid ());
-  assert (NULL != pw);
-
-  const char *home = pw->pw_dir;
-  unsigned int filename_len = strlen (home) + strlen (KEY_STORE) + 1;
-  char *filename = (char *)malloc_wipe (filename_len);
-  strcpy (filename, home);
-  strcat (filename, KEY_STORE);
-
+  char *filename = home_file_name (KEY_STORE);
+  unsigned int filename_len = strlen (filename) + 1;
 
   if ((f = fopen (filename, "w")) != NULL)
     {
@@ -80,15 +91,15 @@ bool record_keys (struct key_container *keys)
       unsigned int x = 0;
       for (x=0; x< get_max_keys (); x++)
         {
-          fprintf (f, "key_slot_%02u    ",x);
+          char hex[HEX_LEN (32)];
 
-          unsigned int y = 0;
-          for (y=0; y < keys->keys[x].len; y++)
-            {
-              fprintf (f, "%02X", keys->keys[x].ptr[y]);
-            }
+          assert (keys->keys[x].len <= 32);
+          hex_encode (hex, keys->keys[x].ptr, keys->keys[x].len);
+
+          fprintf (f, "key_slot_%02u    %.*s\n", x,
+                   (int)HEX_LEN (keys->keys[x].len), hex);
 
-          fprintf (f, "%s", "\n");
+          wipe ((uint8_t *)hex, sizeof (hex));
         }
 
       fclose (f);
@@ -101,6 +112,20 @@ bool record_keys (struct key_container *keys)
     }
 
   free_wipe ((uint8_t *)filename, filename_len);
+
+  /* The text file is the backup and export format, verification reads
+     the binary store */
+  if (result)
+    {
+      filename = home_file_name (KEY_STORE_BIN);
+      filename_len = strlen (filename) + 1;
+
+      if (!write_key_store (filename, keys))
+        CTX_LOG (INFO, "Failed to write %s", filename);
+
+      free_wipe ((uint8_t *)filename, filename_len);
+    }
+
   return result;
 }
 
@@ -131,30 +156,40 @@ struct key_container* import_keys (const char* filename)
 {
   assert (NULL != filename);
   FILE *fp;
-  const char *key = NULL;
   struct key_container* keys = NULL;
-  const unsigned int SIZE_OF_256_BITS_ASCII = 64;
-  bool key_valid = true;
+  struct parsed_key parsed[KEY_FILE_SLOTS];
+  struct key_file_error error;
 
   fp = fopen (filename, "r");
 
   if (NULL != fp)
     {
-      if (0 == parse_file (fp))
+      if (0 == parse_key_file (fp, parsed, &error))
         {
           keys = make_key_container();
           int x = 0;
 
-          for (x = 0; x < MAX_NUM_DATA_SLOTS && key_valid; x++)
+          /* Every slot is written, so every key must be given */
+          for (x = 0; x < MAX_NUM_DATA_SLOTS && NULL != keys; x++)
             {
-              key = get_key (x);
-              keys->keys[x] = ascii_hex_2_bin (key, SIZE_OF_256_BITS_ASCII);
-              if (NULL == keys->keys[x].ptr || 32 != keys->keys[x].len)
-                key_valid = false;
+              if (parsed[x].present)
+                {
+                  keys->keys[x] = make_buffer (KEY_FILE_KEY_LEN);
+                  memcpy (keys->keys[x].ptr, parsed[x].key, KEY_FILE_KEY_LEN);
+                }
+              else
+                {
+                  CTX_LOG (INFO, "%s: no key for slot %d", filename, x);
+                  free_key_container (keys);
+                  keys = NULL;
+                }
             }
 
-          free_parsed_keys ();
+          wipe_parsed_keys (parsed);
         }
+      else
+        CTX_LOG (INFO, "%s:%u:%u: %s", filename, error.line, error.column,
+                 error.message);
 
       fclose (fp);
     }
@@ -164,145 +199,351 @@ struct key_container* import_keys (const char* filename)
 
 }
 
-bool write_keys (int fd, struct key_container *keys,
-                 struct octet_buffer *data_zone)
+/**
+ * Records the keys in ~/.hashlet and in the fleet store, under the
+ * device's serial number, so the device can be verified with
+ * --serial.
+ */
+static bool record_home_keys (void *ctx, const uint8_t *serial,
+                              struct key_container *keys)
+{
+  char *filename = home_file_name (FLEET_STORE);
+  struct fleet_store *fleet;
+  bool result = record_keys (keys);
+
+  if ((fleet = open_fleet_store (filename, true)) == NULL ||
+      !fleet_add (fleet, serial, keys))
+    {
+      CTX_LOG (INFO, "Failed to record the keys in %s", filename);
+      result = false;
+    }
+
+  if (NULL != fleet)
+    close_fleet_store (fleet);
+
+  free (filename);
+
+  return result;
+}
+
+/**
+ * Returns the keys recorded by record_home_keys.
+ */
+static struct key_container* recall_home_keys (void *ctx,
+                                               const uint8_t *serial)
 {
-  assert (NULL != data_zone);
-  assert (STATE_INITIALIZED == get_device_state (fd));
-  bool free_keys = false;
+  char *filename = home_file_name (FLEET_STORE);
+  struct fleet_store *fleet = open_fleet_store (filename, false);
+  const struct fleet_record *record;
+  struct key_container *keys = NULL;
+
+  if (NULL != fleet && (record = fleet_lookup (fleet, serial)) != NULL)
+    keys = fleet_record_keys (record);
+
+  if (NULL != fleet)
+    close_fleet_store (fleet);
+
+  free (filename);
+
+  return keys;
+}
+
+static const struct key_sink HOME_KEY_SINK =
+  { .record = record_home_keys, .recall = recall_home_keys, .ctx = NULL };
+
+/* Set in a checkpoint once the keys are recorded, before they are
+   written */
+#define KEYS_RECORDED (1u << PERSONALIZE_NUM_STAGES)
 
 #define KEY_LEN 32
+
+/**
+ * Creates new keys: random, except for the test keys (hard coded) in
+ * slots 14 and 15.  These slots should not be used in a security
+ * critical application.
+ */
+static struct key_container* generate_keys (int fd, bool host_rng)
+{
   const unsigned int TEST_KEY_1 = 14;
   const unsigned int TEST_KEY_2 = 15;
+  struct key_container *keys = make_key_container ();
+  unsigned int x;
 
-  struct octet_buffer test_key_14 = make_buffer (KEY_LEN);
-  memset(test_key_14.ptr, 0xAA, KEY_LEN);
-  struct octet_buffer test_key_15 = make_buffer (KEY_LEN);
-  memset(test_key_15.ptr, 0xBB, KEY_LEN);
-
-  int x = 0;
-  /* If there are no keys, which is the case when we are personalizing
-     a device from scratch, create some new keys */
-  if (NULL == keys)
+  for (x = 0; x < MAX_NUM_DATA_SLOTS && NULL != keys; x++)
     {
-      keys = make_key_container ();
-      for (x=0; x < get_max_keys (); x++)
+      keys->keys[x] = make_buffer (KEY_LEN);
+
+      if (TEST_KEY_1 == x)
+        memset (keys->keys[x].ptr, 0xAA, KEY_LEN);
+      else if (TEST_KEY_2 == x)
+        memset (keys->keys[x].ptr, 0xBB, KEY_LEN);
+      else if (host_rng)
+        gcry_randomize (keys->keys[x].ptr, KEY_LEN, GCRY_STRONG_RANDOM);
+      /* Only the first key needs to update the seed */
+      else if (RSP_SUCCESS != get_random_into (fd, 0 == x, keys->keys[x]))
         {
-          if (TEST_KEY_1 == x)
-            {
-              keys->keys[x] = test_key_14;
-            }
-          else if (TEST_KEY_2 == x)
-            {
-              keys->keys[x] = test_key_15;
-            }
-          else
-            {
-              keys->keys[x] = get_random (fd, true);
-            }
+          free_key_container (keys);
+          keys = NULL;
         }
-
-      free_keys = true;
     }
 
+  return keys;
+}
+
+static bool write_keys (int fd, const uint8_t *data_zone)
+{
   bool status = true;
+  unsigned int x;
 
-  for (x=0; x < get_max_keys () && status; x++)
+  for (x = 0; x < MAX_NUM_DATA_SLOTS && status; x++)
     {
       const unsigned int WORD_OFFSET = 8;
-      unsigned int addr = WORD_OFFSET * x;
-      status = write32 (fd, DATA_ZONE, addr, keys->keys[x], NULL);
+      struct octet_buffer key = { (uint8_t *)data_zone + x * KEY_LEN,
+                                  KEY_LEN };
+
+      CTX_LOG (DEBUG, "Writing key %u", x);
+      status = write32 (fd, DATA_ZONE, WORD_OFFSET * x, key, NULL);
     }
 
+  return status;
+}
+
+/**
+ * Finds the keys to write, records them and writes them, checkpointing
+ * in between along with the OTP image already written.  The keys end
+ * up in run->data_zone.
+ */
+static bool personalize_keys (int fd, struct personalize_run *run,
+                              const struct key_sink *sink,
+                              const char *checkpoint, const uint8_t *otp,
+                              uint32_t *done)
+{
+  struct key_container *keys = run->keys;
+  bool status = true;
+  unsigned int x;
+
+  /* Keys given by the caller are always written, as they may not be
+     the ones an earlier run recorded */
+  if (NULL == keys && (*done & KEYS_RECORDED))
+    status = (keys = sink->recall (sink->ctx, run->serial)) != NULL;
+  else if (NULL == keys)
+    status = (keys = generate_keys (fd, run->host_rng)) != NULL;
+
+  if (status)
+    for (x = 0; x < MAX_NUM_DATA_SLOTS && status; x++)
+      status = NULL != keys->keys[x].ptr && KEY_LEN == keys->keys[x].len;
+
   if (status)
     {
-      data_zone->len = get_max_keys () * keys->keys[0].len;
-      data_zone->ptr = malloc_wipe (data_zone->len);
+      for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+        memcpy (run->data_zone + x * KEY_LEN, keys->keys[x].ptr, KEY_LEN);
 
-      for (x=0; x < get_max_keys (); x++)
-        {
-          CTX_LOG(DEBUG, "Writing key %u", x);
-          unsigned int offset = x * keys->keys[x].len;
-          memcpy(data_zone->ptr + offset, keys->keys[x].ptr, keys->keys[x].len);
-        }
+      run->has_keys = true;
+    }
 
-      status = record_keys (keys);
+  if (status && (NULL != run->keys || !(*done & KEYS_RECORDED)))
+    {
+      *done = (*done | KEYS_RECORDED) & ~(1u << PERSONALIZE_KEYS);
 
+      status = sink->record (sink->ctx, run->serial, keys) &&
+        save_checkpoint (checkpoint, run->serial, *done, otp);
     }
 
+  if (status && (NULL != run->keys || !(*done & (1u << PERSONALIZE_KEYS))))
+    {
+      *done |= 1u << PERSONALIZE_KEYS;
 
-  if (free_keys)
+      status = write_keys (fd, run->data_zone) &&
+        save_checkpoint (checkpoint, run->serial, *done, otp);
+    }
+  else if (status)
+    run->skipped |= 1u << PERSONALIZE_KEYS;
+
+  if (NULL != keys && keys != run->keys)
     free_key_container (keys);
 
   return status;
-
 }
 
 uint16_t crc_data_otp_zone (struct octet_buffer data, struct octet_buffer otp)
 {
-  const unsigned int len = otp.len + data.len;
-  uint8_t *buf = malloc_wipe (len);
-
-  memcpy (buf, data.ptr, data.len);
-  memcpy (buf + data.len, otp.ptr, otp.len);
-
-  uint16_t crc = calculate_crc16 (buf, len);
+  struct crc16_ctx ctx;
 
-  free_wipe (buf, len);
+  crc16_init (&ctx);
+  crc16_update (&ctx, data.ptr, data.len);
+  crc16_update (&ctx, otp.ptr, otp.len);
 
-  return crc;
+  return crc16_final (&ctx);
 
 }
 
-bool lock_config_zone (int fd, enum DEVICE_STATE state)
+static void start_stage (struct timespec *start)
 {
+  clock_gettime (CLOCK_MONOTONIC, start);
+}
 
-  if (STATE_FACTORY != state)
-    return true;
+/**
+ * Records the time of a stage, and the stage as the failure if ok is
+ * false.
+ *
+ * @return ok
+ */
+static bool end_stage (struct personalize_run *run,
+                       enum personalize_stage stage,
+                       const struct timespec *start, bool ok)
+{
+  struct timespec end;
 
-  struct octet_buffer config = get_config_zone (fd);
+  clock_gettime (CLOCK_MONOTONIC, &end);
 
-  uint16_t crc = calculate_crc16 (config.ptr, config.len);
+  run->stage_us[stage] = (end.tv_sec - start->tv_sec) * 1000000ULL +
+    (end.tv_nsec - start->tv_nsec) / 1000;
 
-  return lock (fd, CONFIG_ZONE, crc);
+  if (!ok)
+    run->failed = stage;
 
+  return ok;
 }
 
-
-enum DEVICE_STATE personalize (int fd, enum DEVICE_STATE goal,
-                               struct key_container *keys)
+enum DEVICE_STATE personalize_device (int fd, enum DEVICE_STATE goal,
+                                      struct personalize_run *run)
 {
-  enum DEVICE_STATE state = get_device_state (fd);
+  assert (NULL != run);
+
+  const struct key_sink *sink = (NULL == run->sink) ?
+    &HOME_KEY_SINK : run->sink;
+  char *checkpoint = (NULL == run->checkpoint_file) ?
+    home_file_name (CHECKPOINT_FILE) : strdup (run->checkpoint_file);
+  enum DEVICE_STATE state = STATE_FACTORY;
+  uint8_t config[CONFIG_ZONE_LEN];
+  uint8_t otp[OTP_ZONE_LEN];
+  struct timespec start;
+  uint32_t done = 0;
+  bool ok = true;
+
+  run->has_serial = run->has_keys = false;
+  run->skipped = 0;
+  run->failed = PERSONALIZE_NUM_STAGES;
+  memset (run->stage_us, 0, sizeof (run->stage_us));
+
+  /* The only time the device's state is read: the configuration zone
+     holds the serial number and both lock bytes */
+  if (RSP_SUCCESS != get_config_zone_into (fd, ARRAY_BUFFER (config)))
+    {
+      free (checkpoint);
+      return state;
+    }
 
-  if (state >= goal)
-    return state;
+  memcpy (run->serial, config, 4);
+  memcpy (run->serial + 4, config + 8, 5);
+  run->has_serial = true;
 
-  if (set_config_zone (fd) && lock_config_zone (fd, state))
+  if (UNLOCKED != config[LOCK_CONFIG])
     {
       state = STATE_INITIALIZED;
-      assert (get_device_state (fd) == state);
+      done |= 1u << PERSONALIZE_CONFIG | 1u << PERSONALIZE_LOCK_CONFIG;
 
-      struct octet_buffer otp_zone;
-      if (set_otp_zone (fd, &otp_zone))
+      if (UNLOCKED != config[LOCK_VALUE])
         {
-          struct octet_buffer data_zone;
-          if (write_keys (fd, keys, &data_zone))
-            {
-              uint16_t crc = crc_data_otp_zone (data_zone, otp_zone);
+          state = STATE_PERSONALIZED;
+          done |= 1u << PERSONALIZE_OTP | 1u << PERSONALIZE_KEYS |
+            1u << PERSONALIZE_LOCK_DATA;
+        }
+      else
+        done |= load_checkpoint (checkpoint, run->serial, otp);
+    }
 
-              if (lock (fd, DATA_ZONE, crc))
-                {
-                  state = STATE_PERSONALIZED;
-                  assert (get_device_state (fd) == state);
-                }
+  run->skipped = done & ((1u << PERSONALIZE_NUM_STAGES) - 1);
+
+  if (state < goal && !(done & 1u << PERSONALIZE_CONFIG))
+    {
+      struct config_plan plan;
+
+      /* The zone is planned against what was just read, never taken
+         as done from a checkpoint, so the zone locked is always the
+         target.  Only the words that differ are written, and the
+         image follows them, so the lock's CRC needs no second read */
+      start_stage (&start);
+      done |= 1u << PERSONALIZE_CONFIG;
+      ok = end_stage (run, PERSONALIZE_CONFIG, &start,
+                      plan_config_zone (config, &plan) &&
+                      apply_config_plan (fd, &plan, config));
+    }
+
+  if (ok && state < goal && !(done & 1u << PERSONALIZE_LOCK_CONFIG))
+    {
+      start_stage (&start);
+      ok = end_stage (run, PERSONALIZE_LOCK_CONFIG, &start,
+                      lock (fd, CONFIG_ZONE,
+                            calculate_crc16 (config, sizeof (config))));
+      if (ok)
+        state = STATE_INITIALIZED;
+    }
+
+  if (ok && state < goal)
+    {
+      struct octet_buffer written = { NULL, 0 };
+
+      start_stage (&start);
 
-              free_octet_buffer (data_zone);
+      /* A resumed run has the image from the checkpoint: it is what
+         the device holds, whatever this version would write */
+      if (!(done & 1u << PERSONALIZE_OTP))
+        {
+          done |= 1u << PERSONALIZE_OTP;
+          ok = set_otp_zone (fd, &written);
+
+          if (NULL != written.ptr)
+            {
+              memcpy (otp, written.ptr, OTP_ZONE_LEN);
+              free_octet_buffer (written);
             }
 
-          free_octet_buffer (otp_zone);
+          ok = ok && save_checkpoint (checkpoint, run->serial, done, otp);
         }
+
+      if (!(run->skipped & 1u << PERSONALIZE_OTP))
+        end_stage (run, PERSONALIZE_OTP, &start, ok);
     }
 
+  if (ok && state < goal)
+    {
+      start_stage (&start);
+      ok = personalize_keys (fd, run, sink, checkpoint, otp, &done);
+      end_stage (run, PERSONALIZE_KEYS, &start, ok);
+    }
+
+  if (ok && state < goal)
+    {
+      struct octet_buffer data_zone = ARRAY_BUFFER (run->data_zone);
+      struct octet_buffer otp_zone = ARRAY_BUFFER (otp);
+
+      start_stage (&start);
+      ok = end_stage (run, PERSONALIZE_LOCK_DATA, &start,
+                      lock (fd, DATA_ZONE,
+                            crc_data_otp_zone (data_zone, otp_zone)));
+      if (ok)
+        state = STATE_PERSONALIZED;
+    }
+
+  /* The locks speak for the device from now on */
+  if (STATE_PERSONALIZED == state &&
+      !(run->skipped & 1u << PERSONALIZE_LOCK_DATA) &&
+      !clear_checkpoint (checkpoint, run->serial))
+    CTX_LOG (INFO, "Failed to clear the checkpoint in %s", checkpoint);
+
+  free (checkpoint);
+
   return state;
+}
 
+enum DEVICE_STATE personalize (int fd, enum DEVICE_STATE goal,
+                               struct key_container *keys)
+{
+  struct personalize_run run = { .keys = keys };
+  enum DEVICE_STATE state = personalize_device (fd, goal, &run);
+
+  wipe (run.data_zone, sizeof (run.data_zone));
+
+  return state;
 }
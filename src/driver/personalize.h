@@ -21,6 +21,9 @@
 #ifndef PERSONALIZE_H
 #define PERSONALIZE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "checkpoint.h"
 #include "defs.h"
 #include "command.h"
 #include "util.h"
@@ -48,35 +51,101 @@ struct key_container* make_key_container ();
  */
 void free_key_container (struct key_container *keys);
 
+/* personalize runs these stages in order.  A stage is skipped when
+   the device, or its checkpoint, shows it was done by an earlier run. */
+enum personalize_stage
+  {
+    PERSONALIZE_CONFIG,         /**< Write the configuration zone */
+    PERSONALIZE_LOCK_CONFIG,    /**< Lock it */
+    PERSONALIZE_OTP,            /**< Write the OTP zone */
+    PERSONALIZE_KEYS,           /**< Record, then write, the keys */
+    PERSONALIZE_LOCK_DATA,      /**< Lock the data and OTP zones */
+    PERSONALIZE_NUM_STAGES
+  };
+
+/* Where the keys of a device are kept.  They are recorded before they
+   are written, so a run that stops part way writes the same keys
+   again. */
+struct key_sink
+{
+  /** Records the keys of the device with the 9 byte serial number */
+  bool (*record) (void *ctx, const uint8_t *serial,
+                  struct key_container *keys);
+  /** Returns the malloc'd keys recorded for the device, or NULL */
+  struct key_container* (*recall) (void *ctx, const uint8_t *serial);
+  void *ctx;
+};
+
+struct personalize_run
+{
+  /* Set by the caller */
+  struct key_container *keys;   /**< Keys to load, NULL to generate */
+  bool host_rng;                /**< Generate them with the host's RNG */
+  const struct key_sink *sink;  /**< NULL for ~/.hashlet and the fleet */
+  const char *checkpoint_file;  /**< NULL for ~/.hashlet_checkpoints */
+
+  /* Filled in by personalize_device */
+  bool has_serial;              /**< False if the device couldn't be read */
+  uint8_t serial[CHECKPOINT_SERIAL_LEN];
+  uint32_t skipped;             /**< Bit x is set if stage x was done */
+  enum personalize_stage failed; /**< PERSONALIZE_NUM_STAGES if none */
+  uint64_t stage_us[PERSONALIZE_NUM_STAGES]; /**< 0 if skipped */
+  bool has_keys;                /**< True if data_zone holds the keys */
+  uint8_t data_zone[DATA_ZONE_LEN];
+};
+
+/**
+ * Personalizes the device in stages, recording each one that the
+ * device can't report itself in a checkpoint under its serial number.
+ * The device's state is read once, then only the stages that remain
+ * are run, so running it again after a failure or power loss finishes
+ * the job.
+ *
+ * @param fd The open file descriptor
+ * @param goal The desired device state
+ * @param run The keys and where to keep them, filled in with what was
+ * done.  Wipe data_zone after use.
+ *
+ * @return The state the device was left in
+ */
+enum DEVICE_STATE personalize_device (int fd, enum DEVICE_STATE goal,
+                                      struct personalize_run *run);
+
 /**
  * Personalize the device by setting the configuration zone, OTP zone,
- * and loading keys.  This can't be un-done.
+ * and loading keys.  This can't be un-done.  The keys are saved to
+ * ~/.hashlet and the fleet store, and an interrupted run resumes
+ * where it stopped.
  *
  * @param fd The open file descriptor
  * @param goal The desired device state
  * @param keys If keys are NULL, it will create random keys.
  * Otherwise burn in the keys provided.
  *
- * @return
+ * @return The state the device was left in
  */
 enum DEVICE_STATE personalize (int fd, enum DEVICE_STATE goal,
                                struct key_container *keys);
 
 /**
- * Writes random keys to the data slots.  Test keys (hard coded) are
- * written to slots 14 and 15.  These slots should not be used in a
- * security critical application.
+ * Computes the CRC that locking the data and OTP zones requires.
  *
- * @param fd The open file descriptor
- * @param keys If not null, load the keys passed in.  This is a way to
- * import keys and to clone a device
- * @param data_zone If return is true, this will point to a malloc'd
- * buffer containing the contents of the data zone.
+ * @param data The 512 byte image of the data zone
+ * @param otp The 64 byte image of the OTP zone
+ *
+ * @return The CRC of the two, data first
+ */
+uint16_t crc_data_otp_zone (struct octet_buffer data, struct octet_buffer otp);
+
+/**
+ * Returns the name of a file in the user's home directory, taken from
+ * $HOME or, if unset, the password database.
+ *
+ * @param name The file name, starting with a slash
  *
- * @return
+ * @return The malloc'd file name
  */
-bool write_keys (int fd, struct key_container *keys,
-                 struct octet_buffer *data_zone);
+char* home_file_name (const char *name);
 
 /**
  * Returns the filename of the key_store location
@@ -0,0 +1,430 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "record_file.h"
+#include "util.h"
+
+uint64_t serial_hash (const uint8_t *serial)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  unsigned int x;
+
+  assert (NULL != serial);
+
+  for (x = 0; x < RECORD_SERIAL_LEN; x++)
+    {
+      h ^= serial[x];
+      h *= 0x100000001b3ULL;
+    }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h ? h : 1;
+}
+
+static off_t slot_offset (const struct record_file *f, uint32_t slot)
+{
+  return sizeof (struct record_file_header) +
+    (off_t)slot * f->header.record_size;
+}
+
+static bool read_slot (const struct record_file *f, uint32_t slot,
+                       uint8_t *record)
+{
+  return f->header.record_size ==
+    pread (f->fd, record, f->header.record_size, slot_offset (f, slot));
+}
+
+static bool write_slot (const struct record_file *f, uint32_t slot,
+                        const uint8_t *record)
+{
+  return f->header.record_size ==
+    pwrite (f->fd, record, f->header.record_size, slot_offset (f, slot));
+}
+
+static bool write_header (const struct record_file *f)
+{
+  return sizeof (f->header) ==
+    pwrite (f->fd, &f->header, sizeof (f->header), 0);
+}
+
+static bool is_empty (const uint8_t *record)
+{
+  static const uint8_t NO_SERIAL[RECORD_SERIAL_LEN];
+
+  return 0 == memcmp (record, NO_SERIAL, RECORD_SERIAL_LEN);
+}
+
+static uint32_t home_slot (const struct record_file *f, const uint8_t *serial)
+{
+  return serial_hash (serial) & (f->header.slots - 1);
+}
+
+/**
+ * Finds the slot holding a device's record.
+ *
+ * @param f The open file
+ * @param serial The serial number
+ * @param record Scratch space for a record
+ * @param found Set if the device has a record
+ *
+ * @return The device's slot if found, else the empty slot its record
+ * would take, else header.slots if the table is full or can't be read
+ */
+static uint32_t find_slot (const struct record_file *f,
+                           const uint8_t *serial, uint8_t *record,
+                           bool *found)
+{
+  const uint32_t mask = f->header.slots - 1;
+  uint32_t x, probes;
+
+  *found = false;
+
+  for (x = home_slot (f, serial), probes = 0; probes < f->header.slots;
+       x = (x + 1) & mask, probes++)
+    {
+      if (!read_slot (f, x, record))
+        break;
+
+      if (is_empty (record))
+        return x;
+
+      if (0 == memcmp (record, serial, RECORD_SERIAL_LEN))
+        {
+          *found = true;
+          return x;
+        }
+    }
+
+  return f->header.slots;
+}
+
+/**
+ * Makes the file an empty table.
+ *
+ * @param f The writable file, its header filled in
+ *
+ * @return True on success
+ */
+static bool start_table (struct record_file *f)
+{
+  f->header.used = 0;
+
+  return 0 == ftruncate (f->fd, 0) &&
+    0 == ftruncate (f->fd, slot_offset (f, f->header.slots)) &&
+    write_header (f);
+}
+
+static bool valid_header (const struct record_file *f, off_t size)
+{
+  const struct record_file_header *h = &f->header;
+
+  return 0 == memcmp (h->magic, f->format->magic, sizeof (h->magic)) &&
+    f->format->version == h->version &&
+    f->format->record_size == h->record_size &&
+    h->slots > 0 && 0 == (h->slots & (h->slots - 1)) &&
+    h->used <= h->slots &&
+    slot_offset (f, h->slots) <= size;
+}
+
+/**
+ * Opens and locks the file, making sure the file locked is the one
+ * now under its name: it may have been replaced while waiting for the
+ * lock.
+ *
+ * @return The file descriptor, or -1
+ */
+static int open_locked (const char *filename, bool writable)
+{
+  struct stat held, named;
+  int fd;
+
+  for (;;)
+    {
+      if (writable)
+        fd = open (filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+      else
+        fd = open (filename, O_RDONLY);
+
+      if (fd < 0)
+        return -1;
+
+      if (0 != flock (fd, writable ? LOCK_EX : LOCK_SH) ||
+          0 != fstat (fd, &held))
+        {
+          close (fd);
+          return -1;
+        }
+
+      if (0 == stat (filename, &named) && held.st_dev == named.st_dev &&
+          held.st_ino == named.st_ino)
+        return fd;
+
+      close (fd);
+    }
+}
+
+bool open_record_file (struct record_file *f, const char *filename,
+                       const struct record_format *format, bool writable)
+{
+  struct stat st;
+  bool valid;
+
+  assert (NULL != f);
+  assert (NULL != filename);
+  assert (NULL != format);
+  assert (format->record_size > RECORD_SERIAL_LEN &&
+          format->record_size <= RECORD_MAX_SIZE);
+  assert (format->min_slots > 0 &&
+          0 == (format->min_slots & (format->min_slots - 1)));
+
+  f->writable = writable;
+  f->format = format;
+
+  if ((f->fd = open_locked (filename, writable)) < 0)
+    return false;
+
+  valid = 0 == fstat (f->fd, &st) &&
+    sizeof (f->header) == pread (f->fd, &f->header, sizeof (f->header), 0) &&
+    valid_header (f, st.st_size);
+
+  if (!valid && writable)
+    {
+      CTX_LOG (DEBUG, "Starting %s", filename);
+
+      memcpy (f->header.magic, format->magic, sizeof (f->header.magic));
+      f->header.version = format->version;
+      f->header.record_size = format->record_size;
+      f->header.slots = format->min_slots;
+
+      valid = start_table (f);
+    }
+
+  if (!valid)
+    {
+      close (f->fd);
+      return false;
+    }
+
+  f->filename = strdup (filename);
+  assert (NULL != f->filename);
+
+  return true;
+}
+
+bool read_record (struct record_file *f, const uint8_t *serial,
+                  void *record)
+{
+  bool found;
+
+  assert (NULL != f);
+  assert (NULL != serial);
+  assert (NULL != record);
+
+  find_slot (f, serial, record, &found);
+
+  return found;
+}
+
+/**
+ * Copies every record into a table twice the size, in a new file that
+ * then replaces this one.
+ *
+ * @param f The writable file
+ *
+ * @return True if f is now the new file
+ */
+static bool grow_table (struct record_file *f)
+{
+  struct record_file bigger = *f;
+  uint8_t record[RECORD_MAX_SIZE], scratch[RECORD_MAX_SIZE];
+  size_t name_len = strlen (f->filename) + sizeof (".new");
+  char *name = malloc (name_len);
+  bool ok;
+  uint32_t x;
+
+  assert (NULL != name);
+  snprintf (name, name_len, "%s.new", f->filename);
+
+  /* Nobody else opens the new file before it is renamed, as they'd
+     need the lock on this one first */
+  bigger.fd = open (name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  bigger.header.slots = f->header.slots * 2;
+
+  ok = bigger.fd >= 0 && 0 == flock (bigger.fd, LOCK_EX) &&
+    start_table (&bigger);
+
+  for (x = 0; x < f->header.slots && ok; x++)
+    {
+      bool found;
+      uint32_t slot;
+
+      if (!(ok = read_slot (f, x, record)) || is_empty (record))
+        continue;
+
+      slot = find_slot (&bigger, record, scratch, &found);
+
+      ok = slot < bigger.header.slots && write_slot (&bigger, slot, record);
+      bigger.header.used++;
+    }
+
+  ok = ok && write_header (&bigger) && 0 == fdatasync (bigger.fd) &&
+    0 == rename (name, f->filename);
+
+  if (ok)
+    {
+      close (f->fd);
+      f->fd = bigger.fd;
+      f->header = bigger.header;
+    }
+  else
+    {
+      CTX_LOG (DEBUG, "Failed to grow %s", f->filename);
+
+      if (bigger.fd >= 0)
+        close (bigger.fd);
+      unlink (name);
+    }
+
+  wipe (record, sizeof (record));
+  free (name);
+
+  return ok;
+}
+
+/**
+ * Syncs a change to disk, if the format asks for it.
+ */
+static bool sync_change (struct record_file *f)
+{
+  return !f->format->sync || 0 == fdatasync (f->fd);
+}
+
+bool write_record (struct record_file *f, const void *record)
+{
+  uint8_t scratch[RECORD_MAX_SIZE];
+  const uint8_t *serial = record;
+  const uint32_t max = f->format->max_slots;
+  bool found;
+  uint32_t slot;
+
+  assert (NULL != f);
+  assert (f->writable);
+  assert (NULL != record);
+  assert (!is_empty (serial));
+
+  slot = find_slot (f, serial, scratch, &found);
+
+  if (!found && (f->header.used + 1) * 4 > f->header.slots * 3 &&
+      (0 == max || f->header.slots < max))
+    {
+      if (!grow_table (f))
+        return false;
+
+      slot = find_slot (f, serial, scratch, &found);
+    }
+
+  /* A full table of limited size gives up the record in the slot the
+     new one hashes to */
+  if (!found && slot == f->header.slots && 0 != max &&
+      f->header.used == f->header.slots)
+    {
+      slot = home_slot (f, serial);
+      found = true;
+    }
+
+  if (slot == f->header.slots || !write_slot (f, slot, record))
+    return false;
+
+  if (!found)
+    {
+      f->header.used++;
+      if (!write_header (f))
+        return false;
+    }
+
+  return sync_change (f);
+}
+
+bool delete_record (struct record_file *f, const uint8_t *serial)
+{
+  const uint32_t mask = f->header.slots - 1;
+  uint8_t record[RECORD_MAX_SIZE];
+  uint32_t hole, x, probes;
+  bool found, ok = true;
+
+  assert (NULL != f);
+  assert (f->writable);
+  assert (NULL != serial);
+
+  hole = find_slot (f, serial, record, &found);
+
+  if (!found)
+    return true;
+
+  /* Move back any record after the hole that would no longer be found
+     past it: one whose slot isn't between the hole and where it is */
+  for (x = (hole + 1) & mask, probes = 1;
+       probes < f->header.slots && ok && read_slot (f, x, record) &&
+         !is_empty (record);
+       x = (x + 1) & mask, probes++)
+    {
+      uint32_t home = home_slot (f, record);
+
+      if (((x - home) & mask) >= ((x - hole) & mask))
+        {
+          ok = write_slot (f, hole, record);
+          hole = x;
+        }
+    }
+
+  memset (record, 0, f->header.record_size);
+  f->header.used--;
+
+  ok = ok && write_slot (f, hole, record) && write_header (f) &&
+    sync_change (f);
+
+  return ok;
+}
+
+void close_record_file (struct record_file *f)
+{
+  assert (NULL != f);
+
+  close (f->fd);
+  free (f->filename);
+
+  f->fd = -1;
+  f->filename = NULL;
+}
@@ -0,0 +1,142 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RECORD_FILE_H
+#define RECORD_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Small files of fixed size records kept under a device's serial
+   number, such as the personalization checkpoints and the zone cache.
+   A header is followed by a hash table of records, each starting with
+   the 9 byte serial number; a slot whose serial number is all zeros is
+   empty.  A record hashes to a slot and collisions take the slots
+   after it, so a lookup reads one or two records.  Files are created
+   readable by the user only and are changed under an exclusive lock.
+   A file that isn't valid is started over.
+
+   A table more than three quarters full is copied into one twice the
+   size, which then replaces the file.  A process that opened the old
+   file notices once it holds the lock, and opens the new one.  A file
+   may instead be given a maximum size: a full table then gives a new
+   record the slot its serial number hashes to. */
+
+#define RECORD_SERIAL_LEN 9
+
+/* The largest record */
+#define RECORD_MAX_SIZE 256
+
+struct record_format
+{
+  uint8_t magic[4];
+  uint32_t version;
+  uint32_t record_size;         /**< Including the leading serial number */
+  uint32_t min_slots;           /**< Slots in a new file, a power of 2 */
+  uint32_t max_slots;           /**< A power of 2, 0 for no limit */
+  bool sync;                    /**< Sync every change to disk */
+};
+
+struct record_file_header
+{
+  uint8_t magic[4];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t slots;               /**< A power of 2 */
+  uint32_t used;                /**< Slots holding a record */
+};
+
+struct record_file
+{
+  int fd;
+  bool writable;
+  char *filename;
+  const struct record_format *format;
+  struct record_file_header header;
+};
+
+/**
+ * Hashes a serial number.  Parts of the serial number are the same on
+ * every device, so FNV-1a is followed by a final mix to spread the
+ * rest over all the bits.
+ *
+ * @param serial The 9 byte serial number
+ *
+ * @return The hash, never 0
+ */
+uint64_t serial_hash (const uint8_t *serial);
+
+/**
+ * Opens and locks a record file, shared for reading and exclusive for
+ * writing.  A writable file is created, or started over, if it isn't
+ * valid.
+ *
+ * @param f Filled in with the open file
+ * @param filename The file
+ * @param format The records it holds
+ * @param writable True to change records
+ *
+ * @return True if open, in which case close with close_record_file.
+ * A missing or invalid file can't be opened for reading.
+ */
+bool open_record_file (struct record_file *f, const char *filename,
+                       const struct record_format *format, bool writable);
+
+/**
+ * Reads a device's record.
+ *
+ * @param f The open file
+ * @param serial The 9 byte serial number
+ * @param record Filled in with the record_size byte record
+ *
+ * @return True if the device has a record
+ */
+bool read_record (struct record_file *f, const uint8_t *serial,
+                  void *record);
+
+/**
+ * Adds or replaces a device's record.
+ *
+ * @param f The file, opened writable
+ * @param record The record_size byte record, starting with the serial
+ * number
+ *
+ * @return True if written, and synced if the format says so
+ */
+bool write_record (struct record_file *f, const void *record);
+
+/**
+ * Removes a device's record, if it has one.
+ *
+ * @param f The file, opened writable
+ * @param serial The 9 byte serial number
+ *
+ * @return True unless the file couldn't be changed
+ */
+bool delete_record (struct record_file *f, const uint8_t *serial);
+
+/**
+ * Unlocks and closes a record file.
+ *
+ * @param f The open file
+ */
+void close_record_file (struct record_file *f);
+
+#endif /* RECORD_FILE_H */
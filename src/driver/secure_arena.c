@@ -0,0 +1,181 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "secure_arena.h"
+
+enum slot_class
+  {
+    CLASS_NONE = 0,
+    CLASS_SMALL,
+    CLASS_LARGE,
+    NUM_CLASSES
+  };
+
+/* A free slot holds the pointer to the next free slot */
+struct free_slot
+{
+  struct free_slot *next;
+};
+
+struct arena
+{
+  uint8_t *base;                /**< The reservation, NULL if unavailable */
+  size_t page_size;
+  unsigned int pages;           /**< Pages in the reservation */
+  unsigned int committed;       /**< Pages handed out so far */
+  uint8_t page_class[ARENA_RESERVE / 4096]; /**< Slot class of each page */
+  struct free_slot *free[NUM_CLASSES];
+  pthread_mutex_t lock;
+};
+
+static struct arena arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+static void init_arena (void)
+{
+  void *base;
+
+  arena.page_size = sysconf (_SC_PAGESIZE);
+  if (arena.page_size < 4096 || 0 != ARENA_RESERVE % arena.page_size)
+    return;
+
+  base = mmap (NULL, ARENA_RESERVE, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (MAP_FAILED == base)
+    {
+      CTX_LOG (DEBUG, "Secure arena unavailable, using the heap");
+      return;
+    }
+
+  madvise (base, ARENA_RESERVE, MADV_DONTDUMP);
+
+  arena.base = base;
+  arena.pages = ARENA_RESERVE / arena.page_size;
+}
+
+static unsigned int slot_size (enum slot_class c)
+{
+  return (CLASS_SMALL == c) ? ARENA_SMALL_SLOT : ARENA_LARGE_SLOT;
+}
+
+/**
+ * Commits the next page of the reservation to a slot class and puts
+ * its slots on the free list.  Called with the lock held.
+ *
+ * @param c The slot class
+ *
+ * @return True if a page was added
+ */
+static bool add_page (enum slot_class c)
+{
+  uint8_t *page;
+  unsigned int size = slot_size (c);
+  unsigned int x;
+
+  if (arena.committed == arena.pages)
+    return false;
+
+  page = arena.base + (size_t)arena.committed * arena.page_size;
+
+  if (0 != mprotect (page, arena.page_size, PROT_READ | PROT_WRITE))
+    return false;
+
+  /* Without the privilege or the rlimit the page stays swappable, but
+     is still kept out of core dumps */
+  if (0 != mlock (page, arena.page_size))
+    CTX_LOG (DEBUG, "Secure arena page not locked");
+
+  arena.page_class[arena.committed++] = c;
+
+  for (x = arena.page_size / size; x > 0; x--)
+    {
+      struct free_slot *slot = (struct free_slot *)(page + (x - 1) * size);
+      slot->next = arena.free[c];
+      arena.free[c] = slot;
+    }
+
+  return true;
+}
+
+void* arena_alloc (unsigned int len)
+{
+  enum slot_class c;
+  struct free_slot *slot = NULL;
+
+  if (0 == len || len > ARENA_LARGE_SLOT)
+    return NULL;
+
+  pthread_once (&arena_once, init_arena);
+
+  if (NULL == arena.base)
+    return NULL;
+
+  c = (len <= ARENA_SMALL_SLOT) ? CLASS_SMALL : CLASS_LARGE;
+
+  pthread_mutex_lock (&arena.lock);
+
+  if (NULL != arena.free[c] || add_page (c))
+    {
+      slot = arena.free[c];
+      arena.free[c] = slot->next;
+      slot->next = NULL;
+    }
+
+  pthread_mutex_unlock (&arena.lock);
+
+  return slot;
+}
+
+bool arena_owns (const void *ptr)
+{
+  const uint8_t *p = ptr;
+
+  /* base is set once, before any slot can exist */
+  return NULL != arena.base && p >= arena.base &&
+    p < arena.base + ARENA_RESERVE;
+}
+
+void arena_free (void *ptr)
+{
+  assert (arena_owns (ptr));
+
+  size_t page = ((uint8_t *)ptr - arena.base) / arena.page_size;
+  enum slot_class c = arena.page_class[page];
+  struct free_slot *slot = ptr;
+
+  assert (CLASS_NONE != c);
+  assert (0 == ((uint8_t *)ptr - arena.base) % slot_size (c));
+
+  memset (ptr, 0, slot_size (c));
+
+  pthread_mutex_lock (&arena.lock);
+  slot->next = arena.free[c];
+  arena.free[c] = slot;
+  pthread_mutex_unlock (&arena.lock);
+}
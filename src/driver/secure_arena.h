@@ -0,0 +1,67 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <stdbool.h>
+
+/* Secrets (keys, temp keys, MACs and digests) are held in octet
+   buffers of at most 64 bytes.  These come from an arena of pages
+   that are locked in memory and left out of core dumps, carved into
+   32 and 64 byte slots.  Each slot size has a free list, so an
+   allocation or release is a pointer swap, and a slot is wiped as
+   soon as it is released. */
+
+#define ARENA_SMALL_SLOT 32
+#define ARENA_LARGE_SLOT 64
+
+/* Address space reserved for the arena.  Pages are only committed and
+   locked as they are needed. */
+#define ARENA_RESERVE (1024 * 1024)
+
+/**
+ * Allocates a zeroed slot from the arena.
+ *
+ * @param len The number of bytes needed
+ *
+ * @return The slot, or NULL if len is 0 or larger than
+ * ARENA_LARGE_SLOT, or the arena is exhausted or unavailable.  The
+ * caller should then use the heap.
+ */
+void* arena_alloc (unsigned int len);
+
+/**
+ * Returns true if the pointer is a slot from the arena.
+ *
+ * @param ptr The pointer
+ *
+ * @return True if it came from arena_alloc
+ */
+bool arena_owns (const void *ptr);
+
+/**
+ * Wipes a slot and returns it to the arena.
+ *
+ * @param ptr A slot from arena_alloc
+ */
+void arena_free (void *ptr);
+
+#endif /* SECURE_ARENA_H */
@@ -0,0 +1,146 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "slot_write.h"
+#include <assert.h>
+#include <string.h>
+#include "command.h"
+#include "defs.h"
+#include "i2c.h"
+#include "log.h"
+#include "temp_key.h"
+#include "util.h"
+
+/* The longest a slot's three commands can take */
+#define SLOT_WRITE_MAX_MS                                               \
+  ((NONCE_MAX_EXEC + GEN_DIG_MAX_EXEC + WRITE_MAX_EXEC) / 1000000)
+
+/**
+ * Puts the device to sleep and wakes it, if the watchdog might send
+ * it to sleep before the next slot is written.
+ *
+ * @param fd The open file descriptor
+ *
+ * @return False if the device didn't wake
+ */
+static bool ensure_awake (int fd)
+{
+  if (temp_key_watchdog_left (fd) >= SLOT_WRITE_MAX_MS)
+    return true;
+
+  CTX_LOG (DEBUG, "Waking the device again before its watchdog expires");
+
+  sleep_device (fd);
+  if (!wakeup (fd))
+    return false;
+
+  temp_key_device_woke (fd);
+
+  return true;
+}
+
+bool prepare_slot_write (int fd, const struct slot_write *w,
+                         uint8_t *payload)
+{
+  const uint8_t ENCRYPTED_WRITE_32 = 0b10000010;
+  struct temp_key_gen_dig g;
+  uint8_t param2[2] = {0};
+  bool result = false;
+  unsigned int x;
+
+  assert (NULL != w);
+  assert (NULL != payload);
+
+  if (!temp_key_start_gen_dig (fd, w->slot,
+                               (struct octet_buffer)
+                               { (uint8_t *)w->key, sizeof (w->key) }, &g))
+    return false;
+
+  /* The device may still be busy with GenDig: prepare the write with
+     what it will leave in TempKey */
+  for (x = 0; x < sizeof (w->data); x++)
+    payload[x] = g.tk.value[x] ^ w->data[x];
+
+  param2[0] = slot_to_addr (DATA_ZONE, w->slot);
+
+  struct octet_buffer mac = mac_write (ARRAY_BUFFER (g.tk.value), COMMAND_WRITE,
+                                       ENCRYPTED_WRITE_32, param2,
+                                       (struct octet_buffer)
+                                       { (uint8_t *)w->data,
+                                           sizeof (w->data) });
+  memcpy (payload + sizeof (w->data), mac.ptr, mac.len);
+  free_octet_buffer (mac);
+
+  result = temp_key_finish_gen_dig (fd, &g);
+
+  wipe ((uint8_t *)&g, sizeof (g));
+
+  if (!result)
+    wipe (payload, SLOT_WRITE_PAYLOAD_LEN);
+
+  return result;
+}
+
+/**
+ * Writes one slot.
+ *
+ * @param fd The open file descriptor
+ * @param w The slot to write
+ *
+ * @return True on success
+ */
+static bool write_slot (int fd, const struct slot_write *w)
+{
+  uint8_t payload[SLOT_WRITE_PAYLOAD_LEN];
+  struct octet_buffer mac = { payload + sizeof (w->data), 32 };
+  bool result;
+
+  result = prepare_slot_write (fd, w, payload) &&
+    write32 (fd, DATA_ZONE, slot_to_addr (DATA_ZONE, w->slot),
+             (struct octet_buffer) { payload, sizeof (w->data) }, &mac);
+
+  wipe (payload, sizeof (payload));
+
+  return result;
+}
+
+unsigned int write_slots (int fd, struct slot_write *writes,
+                          unsigned int num_writes)
+{
+  unsigned int written = 0;
+  unsigned int x;
+
+  assert (NULL != writes || 0 == num_writes);
+
+  for (x = 0; x < num_writes; x++)
+    {
+      assert (writes[x].slot < MAX_NUM_DATA_SLOTS);
+
+      writes[x].written = ensure_awake (fd) && write_slot (fd, &writes[x]);
+
+      if (writes[x].written)
+        written++;
+      else
+        CTX_LOG (DEBUG, "Slot %u can not be written", writes[x].slot);
+    }
+
+  return written;
+}
@@ -0,0 +1,72 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SLOT_WRITE_H
+#define SLOT_WRITE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Encrypted writes of several data slots in one session.  Each slot
+   takes a Nonce, a GenDig of the slot and the MAC'd Write.  GenDig
+   only needs the slot number, so it is sent first and the host works
+   out TempKey, the ciphertext and the MAC while the device executes
+   it.  If the device's watchdog could expire part way through a slot
+   it is put to sleep and woken again first.  A single encrypted write
+   goes through prepare_slot_write as well. */
+
+struct slot_write
+{
+  unsigned int slot;
+  uint8_t data[32];             /**< The new contents */
+  uint8_t key[32];              /**< The current contents */
+  bool written;                 /**< Set if the write succeeded */
+};
+
+/* The ciphertext of the new contents followed by its MAC */
+#define SLOT_WRITE_PAYLOAD_LEN (32 + 32)
+
+/**
+ * Leaves TempKey as the GenDig of the slot, and encrypts and MACs the
+ * slot's new contents with it for a Write.
+ *
+ * @param fd The open file descriptor
+ * @param w The slot to write
+ * @param payload Filled in with SLOT_WRITE_PAYLOAD_LEN bytes, the
+ * data of the Write.  Wipe it after use.
+ *
+ * @return True on success
+ */
+bool prepare_slot_write (int fd, const struct slot_write *w,
+                         uint8_t *payload);
+
+/**
+ * Writes data slots in turn, carrying on past slots that fail.
+ *
+ * @param fd The open file descriptor
+ * @param writes The slots to write, each one's written flag is set
+ * @param num_writes The number of slots
+ *
+ * @return The number of slots written
+ */
+unsigned int write_slots (int fd, struct slot_write *writes,
+                          unsigned int num_writes);
+
+#endif /* SLOT_WRITE_H */
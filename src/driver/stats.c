@@ -0,0 +1,540 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "defs.h"
+#include "log.h"
+#include "personalize.h"
+#include "stats.h"
+#include "util.h"
+
+#define STATS_MAGIC "HLST"
+#define STATS_VERSION 1
+
+/* Devices open at once; one per bus is plenty */
+#define STATS_MAX_OPEN 16
+
+struct stats_header
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t count;
+  uint32_t record_size;         /**< sizeof (struct device_stats) */
+};
+
+struct open_device
+{
+  int fd;
+  bool used;
+  struct device_stats stats;
+};
+
+static struct open_device open_devices[STATS_MAX_OPEN];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const uint8_t OPCODES[STATS_OPCODES - 1] =
+  {
+    COMMAND_DERIVE_KEY, COMMAND_DEV_REV, COMMAND_GEN_DIG, COMMAND_HMAC,
+    COMMAND_CHECK_MAC, COMMAND_LOCK, COMMAND_MAC, COMMAND_NONCE,
+    COMMAND_PAUSE, COMMAND_RANDOM, COMMAND_READ, COMMAND_UPDATE_EXTRA,
+    COMMAND_WRITE
+  };
+
+static const char *OPCODE_NAMES[STATS_OPCODES] =
+  {
+    "derive_key", "dev_rev", "gen_dig", "hmac", "check_mac", "lock", "mac",
+    "nonce", "pause", "random", "read", "update_extra", "write", "other"
+  };
+
+static const char *EVENT_NAMES[STATS_NUM_EVENTS] =
+  {
+    "retry", "nak", "crc_error", "awake", "failure"
+  };
+
+static unsigned int opcode_index (uint8_t opcode)
+{
+  unsigned int x;
+
+  for (x = 0; x < STATS_OPCODES - 1; x++)
+    if (OPCODES[x] == opcode)
+      return x;
+
+  return STATS_OPCODES - 1;
+}
+
+const char* stats_opcode_name (unsigned int index)
+{
+  assert (index < STATS_OPCODES);
+
+  return OPCODE_NAMES[index];
+}
+
+static unsigned int bucket_index (uint64_t us)
+{
+  if (us < STATS_SUB_BUCKETS)
+    return us;
+
+  unsigned int shift = 63 - __builtin_clzll (us) - 4;
+  unsigned int index = (shift + 1) * STATS_SUB_BUCKETS +
+    (us >> shift) - STATS_SUB_BUCKETS;
+
+  return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+/* The largest value that falls in the bucket */
+static uint64_t bucket_upper (unsigned int index)
+{
+  if (index < STATS_SUB_BUCKETS)
+    return index;
+
+  unsigned int shift = index / STATS_SUB_BUCKETS - 1;
+  uint64_t sub = index % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Finds the stats of an open device.  Called with the lock held.
+ *
+ * @return The device, NULL if it was not registered
+ */
+static struct device_stats* find_device (int fd)
+{
+  unsigned int x;
+
+  for (x = 0; x < STATS_MAX_OPEN; x++)
+    if (open_devices[x].used && open_devices[x].fd == fd)
+      return &open_devices[x].stats;
+
+  return NULL;
+}
+
+void stats_register_device (int fd, const char *bus, unsigned int address)
+{
+  unsigned int x;
+
+  assert (NULL != bus);
+
+  pthread_mutex_lock (&stats_lock);
+
+  for (x = 0; x < STATS_MAX_OPEN; x++)
+    if (!open_devices[x].used)
+      {
+        open_devices[x].used = true;
+        open_devices[x].fd = fd;
+        memset (&open_devices[x].stats, 0, sizeof (struct device_stats));
+        snprintf (open_devices[x].stats.name, STATS_DEVICE_NAME_LEN,
+                  "%s:0x%02X", bus, address);
+        break;
+      }
+
+  pthread_mutex_unlock (&stats_lock);
+
+  if (STATS_MAX_OPEN == x)
+    CTX_LOG (DEBUG, "Too many open devices, %s is not recorded", bus);
+}
+
+void stats_record_command (int fd, uint8_t opcode, uint64_t latency_us,
+                           bool success)
+{
+  struct device_stats *dev;
+
+  pthread_mutex_lock (&stats_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    {
+      struct opcode_stats *ops = &dev->ops[opcode_index (opcode)];
+
+      ops->count++;
+      ops->sum_us += latency_us;
+      if (latency_us > ops->max_us)
+        ops->max_us = latency_us;
+      ops->buckets[bucket_index (latency_us)]++;
+      if (!success)
+        ops->events[STATS_FAILURE]++;
+    }
+
+  pthread_mutex_unlock (&stats_lock);
+}
+
+void stats_record_event (int fd, uint8_t opcode, enum STATS_EVENT event)
+{
+  struct device_stats *dev;
+
+  assert (event < STATS_NUM_EVENTS);
+
+  pthread_mutex_lock (&stats_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    dev->ops[opcode_index (opcode)].events[event]++;
+
+  pthread_mutex_unlock (&stats_lock);
+}
+
+void stats_record_bytes (int fd, uint8_t opcode, unsigned int sent,
+                         unsigned int received)
+{
+  struct device_stats *dev;
+
+  pthread_mutex_lock (&stats_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    {
+      dev->ops[opcode_index (opcode)].bytes_sent += sent;
+      dev->ops[opcode_index (opcode)].bytes_received += received;
+    }
+
+  pthread_mutex_unlock (&stats_lock);
+}
+
+static void add_stats (struct device_stats *total,
+                       const struct device_stats *run)
+{
+  unsigned int x, y;
+
+  for (x = 0; x < STATS_OPCODES; x++)
+    {
+      struct opcode_stats *t = &total->ops[x];
+      const struct opcode_stats *r = &run->ops[x];
+
+      t->count += r->count;
+      for (y = 0; y < STATS_NUM_EVENTS; y++)
+        t->events[y] += r->events[y];
+      t->bytes_sent += r->bytes_sent;
+      t->bytes_received += r->bytes_received;
+      t->sum_us += r->sum_us;
+      if (r->max_us > t->max_us)
+        t->max_us = r->max_us;
+      for (y = 0; y < STATS_BUCKETS; y++)
+        t->buckets[y] += r->buckets[y];
+    }
+}
+
+/**
+ * Reads the devices from an open stats file.
+ *
+ * @return False if the file is not empty and not a valid stats file
+ */
+static bool read_stats (int fd, struct device_stats **devices,
+                        unsigned int *count)
+{
+  struct stats_header h;
+  struct stat st;
+  ssize_t len;
+
+  *devices = NULL;
+  *count = 0;
+
+  if (0 != fstat (fd, &st))
+    return false;
+
+  if (0 == st.st_size)
+    return true;
+
+  if (sizeof (h) != pread (fd, &h, sizeof (h), 0) ||
+      0 != memcmp (h.magic, STATS_MAGIC, sizeof (h.magic)) ||
+      STATS_VERSION != h.version ||
+      sizeof (struct device_stats) != h.record_size ||
+      st.st_size != sizeof (h) + (off_t)h.count * h.record_size)
+    return false;
+
+  len = (ssize_t)h.count * h.record_size;
+  *devices = malloc (len > 0 ? len : 1);
+  assert (NULL != *devices);
+
+  if (len != pread (fd, *devices, len, sizeof (h)))
+    {
+      free (*devices);
+      *devices = NULL;
+      return false;
+    }
+
+  *count = h.count;
+
+  return true;
+}
+
+/**
+ * Adds one run's counts to the stats file, under an exclusive lock so
+ * concurrent runs don't lose each other's counts.
+ */
+static bool save_stats (const char *filename, const struct device_stats *run)
+{
+  struct device_stats *devices = NULL;
+  unsigned int count = 0;
+  unsigned int x;
+  bool result = false;
+  int fd;
+
+  if ((fd = open (filename, O_RDWR | O_CREAT, 0644)) < 0)
+    return false;
+
+  if (0 == flock (fd, LOCK_EX))
+    {
+      if (!read_stats (fd, &devices, &count))
+        {
+          CTX_LOG (INFO, "%s is not a stats file, starting again", filename);
+          count = 0;
+        }
+
+      for (x = 0; x < count; x++)
+        if (0 == strncmp (devices[x].name, run->name, STATS_DEVICE_NAME_LEN))
+          break;
+
+      if (x == count)
+        {
+          devices = realloc (devices, (count + 1) * sizeof (*devices));
+          assert (NULL != devices);
+          memset (&devices[count], 0, sizeof (*devices));
+          memcpy (devices[count].name, run->name, STATS_DEVICE_NAME_LEN);
+          count++;
+        }
+
+      add_stats (&devices[x], run);
+
+      struct stats_header h = { .version = STATS_VERSION, .count = count,
+                                .record_size = sizeof (struct device_stats) };
+      ssize_t len = (ssize_t)count * sizeof (*devices);
+
+      memcpy (h.magic, STATS_MAGIC, sizeof (h.magic));
+
+      result = 0 == ftruncate (fd, 0) &&
+        sizeof (h) == pwrite (fd, &h, sizeof (h), 0) &&
+        len == pwrite (fd, devices, len, sizeof (h));
+    }
+
+  free (devices);
+  close (fd);
+
+  return result;
+}
+
+bool stats_close_device (int fd)
+{
+  struct device_stats run;
+  bool found = false;
+  bool used = false;
+  unsigned int x;
+
+  pthread_mutex_lock (&stats_lock);
+
+  for (x = 0; x < STATS_MAX_OPEN; x++)
+    if (open_devices[x].used && open_devices[x].fd == fd)
+      {
+        run = open_devices[x].stats;
+        open_devices[x].used = false;
+        found = true;
+        break;
+      }
+
+  pthread_mutex_unlock (&stats_lock);
+
+  if (!found)
+    return true;
+
+  for (x = 0; x < STATS_OPCODES; x++)
+    used = used || run.ops[x].count > 0;
+
+  if (!used)
+    return true;
+
+  char *filename = home_file_name (STATS_FILE);
+  bool result = save_stats (filename, &run);
+
+  if (!result)
+    CTX_LOG (DEBUG, "Failed to update %s", filename);
+
+  free (filename);
+
+  return result;
+}
+
+bool load_stats (const char *filename, struct device_stats **devices,
+                 unsigned int *count)
+{
+  int fd;
+  bool result;
+
+  assert (NULL != filename); assert (NULL != devices); assert (NULL != count);
+
+  if ((fd = open (filename, O_RDONLY)) < 0)
+    return false;
+
+  flock (fd, LOCK_SH);
+  result = read_stats (fd, devices, count);
+  close (fd);
+
+  return result;
+}
+
+uint64_t stats_percentile (const struct opcode_stats *ops, double quantile)
+{
+  uint64_t seen = 0;
+  uint64_t target;
+  unsigned int x;
+
+  assert (NULL != ops);
+
+  if (0 == ops->count)
+    return 0;
+
+  target = (uint64_t)(quantile * ops->count + 0.5);
+  if (target < 1)
+    target = 1;
+
+  for (x = 0; x < STATS_BUCKETS; x++)
+    {
+      seen += ops->buckets[x];
+      if (seen >= target)
+        {
+          uint64_t upper = bucket_upper (x);
+          return upper < ops->max_us ? upper : ops->max_us;
+        }
+    }
+
+  return ops->max_us;
+}
+
+void output_stats (FILE *stream, const struct device_stats *devices,
+                   unsigned int count)
+{
+  unsigned int x, y;
+
+  for (x = 0; x < count; x++)
+    {
+      fprintf (stream, "Device %s\n", devices[x].name);
+      fprintf (stream, "%-12s %8s %7s %7s %5s %5s %5s %9s %9s"
+               " %8s %8s %8s %8s\n", "opcode", "count", "retries", "naks",
+               "crc", "awake", "fail", "sent", "received",
+               "p50 us", "p90 us", "p99 us", "max us");
+
+      for (y = 0; y < STATS_OPCODES; y++)
+        {
+          const struct opcode_stats *o = &devices[x].ops[y];
+
+          if (0 == o->count)
+            continue;
+
+          fprintf (stream, "%-12s %8llu %7llu %7llu %5llu %5llu %5llu %9llu"
+                   " %9llu %8llu %8llu %8llu %8llu\n", OPCODE_NAMES[y],
+                   (unsigned long long)o->count,
+                   (unsigned long long)o->events[STATS_RETRY],
+                   (unsigned long long)o->events[STATS_NAK],
+                   (unsigned long long)o->events[STATS_CRC_ERROR],
+                   (unsigned long long)o->events[STATS_AWAKE],
+                   (unsigned long long)o->events[STATS_FAILURE],
+                   (unsigned long long)o->bytes_sent,
+                   (unsigned long long)o->bytes_received,
+                   (unsigned long long)stats_percentile (o, 0.50),
+                   (unsigned long long)stats_percentile (o, 0.90),
+                   (unsigned long long)stats_percentile (o, 0.99),
+                   (unsigned long long)o->max_us);
+        }
+    }
+}
+
+void output_prometheus (FILE *stream, const struct device_stats *devices,
+                        unsigned int count)
+{
+  /* Histogram bounds in microseconds.  Each holds the samples of the
+     log-linear buckets that end at or below it, so a bound may be
+     under-counted by up to one bucket's width. */
+  static const uint64_t BOUNDS[] =
+    {
+      100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+      250000, 500000, 1000000, 2500000, 5000000
+    };
+  const unsigned int NUM_BOUNDS = sizeof (BOUNDS) / sizeof (BOUNDS[0]);
+  unsigned int x, y, z, b;
+
+  fprintf (stream, "# HELP hashlet_command_duration_seconds Time from "
+           "sending a command to its final response.\n"
+           "# TYPE hashlet_command_duration_seconds histogram\n");
+
+  for (x = 0; x < count; x++)
+    for (y = 0; y < STATS_OPCODES; y++)
+      {
+        const struct opcode_stats *o = &devices[x].ops[y];
+        uint64_t cumulative = 0;
+
+        if (0 == o->count)
+          continue;
+
+        for (b = 0, z = 0; b < NUM_BOUNDS; b++)
+          {
+            for (; z < STATS_BUCKETS && bucket_upper (z) <= BOUNDS[b]; z++)
+              cumulative += o->buckets[z];
+
+            fprintf (stream, "hashlet_command_duration_seconds_bucket"
+                     "{device=\"%s\",opcode=\"%s\",le=\"%g\"} %llu\n",
+                     devices[x].name, OPCODE_NAMES[y], BOUNDS[b] / 1e6,
+                     (unsigned long long)cumulative);
+          }
+
+        fprintf (stream, "hashlet_command_duration_seconds_bucket"
+                 "{device=\"%s\",opcode=\"%s\",le=\"+Inf\"} %llu\n"
+                 "hashlet_command_duration_seconds_sum"
+                 "{device=\"%s\",opcode=\"%s\"} %g\n"
+                 "hashlet_command_duration_seconds_count"
+                 "{device=\"%s\",opcode=\"%s\"} %llu\n",
+                 devices[x].name, OPCODE_NAMES[y],
+                 (unsigned long long)o->count,
+                 devices[x].name, OPCODE_NAMES[y], o->sum_us / 1e6,
+                 devices[x].name, OPCODE_NAMES[y],
+                 (unsigned long long)o->count);
+      }
+
+  fprintf (stream, "# HELP hashlet_command_events_total Retries, NAKs, "
+           "CRC errors, awake responses and failures.\n"
+           "# TYPE hashlet_command_events_total counter\n");
+
+  for (x = 0; x < count; x++)
+    for (y = 0; y < STATS_OPCODES; y++)
+      if (devices[x].ops[y].count > 0)
+        for (z = 0; z < STATS_NUM_EVENTS; z++)
+          fprintf (stream, "hashlet_command_events_total"
+                   "{device=\"%s\",opcode=\"%s\",event=\"%s\"} %llu\n",
+                   devices[x].name, OPCODE_NAMES[y], EVENT_NAMES[z],
+                   (unsigned long long)devices[x].ops[y].events[z]);
+
+  fprintf (stream, "# HELP hashlet_command_bytes_total Bytes moved over "
+           "I2C.\n# TYPE hashlet_command_bytes_total counter\n");
+
+  for (x = 0; x < count; x++)
+    for (y = 0; y < STATS_OPCODES; y++)
+      if (devices[x].ops[y].count > 0)
+        fprintf (stream, "hashlet_command_bytes_total"
+                 "{device=\"%s\",opcode=\"%s\",direction=\"sent\"} %llu\n"
+                 "hashlet_command_bytes_total"
+                 "{device=\"%s\",opcode=\"%s\",direction=\"received\"} %llu\n",
+                 devices[x].name, OPCODE_NAMES[y],
+                 (unsigned long long)devices[x].ops[y].bytes_sent,
+                 devices[x].name, OPCODE_NAMES[y],
+                 (unsigned long long)devices[x].ops[y].bytes_received);
+}
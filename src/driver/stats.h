@@ -0,0 +1,177 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Command instrumentation.  send_and_receive records, for each device
+   and opcode, how long commands take from the first write to the
+   final response, along with retries, NAKs, CRC errors, awake
+   responses and bytes moved.  The counts of each run are added to
+   ~/.hashlet_stats when the device is torn down, and hashlet stats
+   prints them or exports them for Prometheus. */
+
+#define STATS_FILE "/.hashlet_stats"
+
+/* Latencies are kept in microseconds in a log-linear histogram: 16
+   linear sub-buckets per power of two, so each bucket is within about
+   6% of its values, up to 2^31 us. */
+#define STATS_SUB_BUCKETS 16
+#define STATS_BUCKETS (28 * STATS_SUB_BUCKETS)
+
+/* The ATSHA204 opcodes, plus one slot for anything else */
+#define STATS_OPCODES 14
+
+#define STATS_DEVICE_NAME_LEN 64
+
+enum STATS_EVENT
+  {
+    STATS_RETRY = 0,            /**< Command sent again after an awake */
+    STATS_NAK,                  /**< Response polled while still busy */
+    STATS_CRC_ERROR,            /**< Response failed its CRC */
+    STATS_AWAKE,                /**< Device answered awake, out of sync */
+    STATS_FAILURE,              /**< Command finished without success */
+    STATS_NUM_EVENTS
+  };
+
+struct opcode_stats
+{
+  uint64_t count;               /**< Commands completed */
+  uint64_t events[STATS_NUM_EVENTS];
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t sum_us;              /**< Total latency */
+  uint64_t max_us;
+  uint32_t buckets[STATS_BUCKETS];
+};
+
+struct device_stats
+{
+  char name[STATS_DEVICE_NAME_LEN]; /**< bus:address */
+  struct opcode_stats ops[STATS_OPCODES];
+};
+
+/**
+ * Starts recording for a newly opened device.
+ *
+ * @param fd The open file descriptor
+ * @param bus The I2C bus
+ * @param address The device's I2C address
+ */
+void stats_register_device (int fd, const char *bus, unsigned int address);
+
+/**
+ * Records a completed command.
+ *
+ * @param fd The device's file descriptor
+ * @param opcode The command opcode
+ * @param latency_us Time from the first write to the final response
+ * @param success True if the command succeeded
+ */
+void stats_record_command (int fd, uint8_t opcode, uint64_t latency_us,
+                           bool success);
+
+/**
+ * Counts an event for a command in progress.
+ *
+ * @param fd The device's file descriptor
+ * @param opcode The command opcode
+ * @param event The event
+ */
+void stats_record_event (int fd, uint8_t opcode, enum STATS_EVENT event);
+
+/**
+ * Counts bytes moved for a command.
+ *
+ * @param fd The device's file descriptor
+ * @param opcode The command opcode
+ * @param sent Bytes written to the device
+ * @param received Bytes read from the device
+ */
+void stats_record_bytes (int fd, uint8_t opcode, unsigned int sent,
+                         unsigned int received);
+
+/**
+ * Adds the device's counts to the stats file and stops recording it.
+ *
+ * @param fd The device's file descriptor
+ *
+ * @return False if the stats file could not be updated
+ */
+bool stats_close_device (int fd);
+
+/**
+ * Loads every device from a stats file.
+ *
+ * @param filename The stats file
+ * @param devices Set to a malloc'd array
+ * @param count Set to the number of devices
+ *
+ * @return False if the file is missing or invalid
+ */
+bool load_stats (const char *filename, struct device_stats **devices,
+                 unsigned int *count);
+
+/**
+ * Returns the latency at a quantile.
+ *
+ * @param ops The opcode stats
+ * @param quantile Between 0 and 1
+ *
+ * @return The upper bound, in microseconds, of the bucket holding the
+ * quantile, 0 if there are no samples
+ */
+uint64_t stats_percentile (const struct opcode_stats *ops, double quantile);
+
+/**
+ * Returns the name of an opcode slot.
+ *
+ * @param index The slot, less than STATS_OPCODES
+ *
+ * @return The lower case command name
+ */
+const char* stats_opcode_name (unsigned int index);
+
+/**
+ * Prints a table of the devices' counts and latencies.
+ *
+ * @param stream Where to print
+ * @param devices The devices
+ * @param count The number of devices
+ */
+void output_stats (FILE *stream, const struct device_stats *devices,
+                   unsigned int count);
+
+/**
+ * Writes the devices' counts in the Prometheus text format, as
+ * scraped from a node exporter's textfile directory.
+ *
+ * @param stream Where to write
+ * @param devices The devices
+ * @param count The number of devices
+ */
+void output_prometheus (FILE *stream, const struct device_stats *devices,
+                        unsigned int count);
+
+#endif /* STATS_H */
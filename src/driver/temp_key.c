@@ -0,0 +1,336 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "temp_key.h"
+#include <assert.h>
+#include <gcrypt.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+
+/* Devices open at once, as for the command statistics */
+#define TEMP_KEY_MAX_OPEN 16
+
+struct open_device
+{
+  int fd;
+  bool used;
+  bool valid;
+  struct timespec woke;         /**< When the watchdog started */
+  struct temp_key tk;
+};
+
+static struct open_device open_devices[TEMP_KEY_MAX_OPEN];
+static pthread_mutex_t temp_key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Finds an open device.  Called with the lock held.
+ *
+ * @return The device, NULL if it was not registered
+ */
+static struct open_device* find_device (int fd)
+{
+  unsigned int x;
+
+  for (x = 0; x < TEMP_KEY_MAX_OPEN; x++)
+    if (open_devices[x].used && open_devices[x].fd == fd)
+      return &open_devices[x];
+
+  return NULL;
+}
+
+static uint64_t ms_awake (const struct open_device *dev)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - dev->woke.tv_sec) * 1000LL +
+    (now.tv_nsec - dev->woke.tv_nsec) / 1000000;
+}
+
+static bool watchdog_expired (const struct open_device *dev)
+{
+  return ms_awake (dev) >= TEMP_KEY_WATCHDOG_MS;
+}
+
+void temp_key_register_device (int fd)
+{
+  unsigned int x;
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  for (x = 0; x < TEMP_KEY_MAX_OPEN; x++)
+    if (!open_devices[x].used)
+      {
+        open_devices[x].used = true;
+        open_devices[x].fd = fd;
+        open_devices[x].valid = false;
+        clock_gettime (CLOCK_MONOTONIC, &open_devices[x].woke);
+        break;
+      }
+
+  pthread_mutex_unlock (&temp_key_lock);
+
+  if (TEMP_KEY_MAX_OPEN == x)
+    CTX_LOG (DEBUG, "Too many open devices, TempKey is not tracked");
+}
+
+void temp_key_close_device (int fd)
+{
+  struct open_device *dev;
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    {
+      wipe ((uint8_t *)&dev->tk, sizeof (dev->tk));
+      dev->valid = dev->used = false;
+    }
+
+  pthread_mutex_unlock (&temp_key_lock);
+}
+
+void temp_key_device_woke (int fd)
+{
+  struct open_device *dev;
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    {
+      wipe ((uint8_t *)&dev->tk, sizeof (dev->tk));
+      dev->valid = false;
+      clock_gettime (CLOCK_MONOTONIC, &dev->woke);
+    }
+
+  pthread_mutex_unlock (&temp_key_lock);
+}
+
+unsigned int temp_key_watchdog_left (int fd)
+{
+  struct open_device *dev;
+  unsigned int left = 0;
+  uint64_t ms;
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)) &&
+      (ms = ms_awake (dev)) < TEMP_KEY_WATCHDOG_MS)
+    left = TEMP_KEY_WATCHDOG_MS - ms;
+
+  pthread_mutex_unlock (&temp_key_lock);
+
+  return left;
+}
+
+bool temp_key_get (int fd, struct temp_key *tk)
+{
+  struct open_device *dev;
+  bool valid = false;
+
+  assert (NULL != tk);
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)) && dev->valid &&
+      watchdog_expired (dev))
+    dev->valid = false;
+
+  if (NULL != dev && dev->valid)
+    {
+      *tk = dev->tk;
+      valid = true;
+    }
+
+  pthread_mutex_unlock (&temp_key_lock);
+
+  return valid;
+}
+
+void temp_key_set (int fd, const struct temp_key *tk)
+{
+  struct open_device *dev;
+
+  assert (NULL != tk);
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    {
+      dev->tk = *tk;
+      dev->valid = true;
+    }
+
+  pthread_mutex_unlock (&temp_key_lock);
+}
+
+void temp_key_after_command (int fd, uint8_t opcode, unsigned int data_len,
+                             bool success)
+{
+  const unsigned int MAC_LEN = 32;
+  struct open_device *dev;
+  bool keeps = false;
+
+  /* Reads, and writes without a MAC, don't touch TempKey.  Anything
+     else may have used or replaced it, and a failed command may have
+     run part way. */
+  switch (opcode)
+    {
+    case COMMAND_READ:
+    case COMMAND_DEV_REV:
+      keeps = true;
+      break;
+    case COMMAND_WRITE:
+      keeps = data_len < MAC_LEN + 4;
+      break;
+    default:
+      break;
+    }
+
+  if (keeps && success)
+    return;
+
+  pthread_mutex_lock (&temp_key_lock);
+
+  if (NULL != (dev = find_device (fd)))
+    dev->valid = false;
+
+  pthread_mutex_unlock (&temp_key_lock);
+}
+
+void temp_key_nonce_value (const uint8_t *random, const uint8_t *num_in,
+                           uint8_t mode, uint8_t *out)
+{
+  assert (NULL != random);
+  assert (NULL != num_in);
+  assert (NULL != out);
+
+  uint8_t msg[TEMP_KEY_LEN + NUM_IN_LEN + 3];
+
+  memcpy (msg, random, TEMP_KEY_LEN);
+  memcpy (msg + TEMP_KEY_LEN, num_in, NUM_IN_LEN);
+  msg[TEMP_KEY_LEN + NUM_IN_LEN] = COMMAND_NONCE;
+  msg[TEMP_KEY_LEN + NUM_IN_LEN + 1] = mode;
+  msg[TEMP_KEY_LEN + NUM_IN_LEN + 2] = 0;
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, out, msg, sizeof (msg));
+
+  wipe (msg, sizeof (msg));
+}
+
+void temp_key_gen_dig_value (const uint8_t *prev, unsigned int slot,
+                             const uint8_t *key, uint8_t *out)
+{
+  assert (NULL != prev);
+  assert (NULL != key);
+  assert (NULL != out);
+  assert (slot < MAX_NUM_DATA_SLOTS);
+
+  const uint8_t DATA_ZONE_PARAM1 = 0x02;
+  const uint8_t SN8 = 0xEE, SN0 = 0x01, SN1 = 0x23;
+  const unsigned int ZERO_25 = 25;
+  uint8_t msg[32 + 4 + 3 + 25 + TEMP_KEY_LEN];
+  uint8_t *p = msg;
+
+  memcpy (p, key, 32);
+  p += 32;
+  *p++ = COMMAND_GEN_DIG;
+  *p++ = DATA_ZONE_PARAM1;
+  *p++ = slot;
+  *p++ = 0;
+  *p++ = SN8;
+  *p++ = SN0;
+  *p++ = SN1;
+  memset (p, 0, ZERO_25);
+  p += ZERO_25;
+  memcpy (p, prev, TEMP_KEY_LEN);
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, out, msg, sizeof (msg));
+
+  wipe (msg, sizeof (msg));
+}
+
+bool temp_key_start_gen_dig (int fd, unsigned int slot,
+                             struct octet_buffer key,
+                             struct temp_key_gen_dig *g)
+{
+  assert (NULL != key.ptr && 32 == key.len);
+  assert (NULL != g);
+  assert (slot < MAX_NUM_DATA_SLOTS);
+
+  struct temp_key *tk = &g->tk;
+  bool known = temp_key_get (fd, tk);
+
+  g->pending = false;
+
+  if (known && TEMP_KEY_RANDOM == tk->source && tk->gen_data &&
+      DATA_ZONE == tk->zone && slot == tk->key_id)
+    {
+      CTX_LOG (DEBUG, "TempKey already holds the digest of slot %u", slot);
+      return true;
+    }
+
+  if (!known || TEMP_KEY_RANDOM != tk->source || tk->gen_data)
+    {
+      uint8_t num_in[NUM_IN_LEN];
+      uint8_t random[TEMP_KEY_LEN];
+
+      /* Any fresh input will do, the OTP zone needn't be read for it */
+      gcry_create_nonce (num_in, sizeof (num_in));
+
+      if (RSP_SUCCESS != gen_nonce_into (fd, ARRAY_BUFFER (num_in),
+                                         ARRAY_BUFFER (random)) ||
+          !temp_key_get (fd, tk))
+        return false;
+    }
+  else
+    CTX_LOG (DEBUG, "Reusing the nonce in TempKey");
+
+  gen_digest_issue (fd, DATA_ZONE, slot, &g->p);
+  g->pending = true;
+
+  /* Worked out while the device executes the GenDig */
+  temp_key_gen_dig_value (tk->value, slot, key.ptr, tk->value);
+  tk->gen_data = true;
+  tk->zone = DATA_ZONE;
+  tk->key_id = slot;
+
+  return true;
+}
+
+bool temp_key_finish_gen_dig (int fd, struct temp_key_gen_dig *g)
+{
+  assert (NULL != g);
+
+  if (!g->pending)
+    return true;
+
+  g->pending = false;
+
+  if (!gen_digest_complete (fd, &g->p))
+    return false;
+
+  temp_key_set (fd, &g->tk);
+
+  return true;
+}
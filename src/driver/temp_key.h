@@ -0,0 +1,189 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TEMP_KEY_H
+#define TEMP_KEY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command.h"
+#include "command_adaptation.h"
+#include "util.h"
+
+/* A host copy of the device's TempKey register, kept for each open
+   device from hashlet_setup to hashlet_teardown.  Nonce and GenDig set
+   it, as the host can compute what they leave in TempKey, and every
+   other command that may use or clear TempKey invalidates it.  A
+   sequence of commands can then tell what the device already holds
+   and issue only the Nonce or GenDig it is missing. */
+
+#define TEMP_KEY_LEN 32
+
+/* The host's input to a Nonce that mixes in the device's RNG */
+#define NUM_IN_LEN 20
+
+/* The device may fall asleep, losing TempKey, as soon as 0.7 s after
+   waking (tWATCHDOG is 1.3 s typical, 0.7 s minimum).  The minimum is
+   used, less 100 ms for the time between the host reading the clock
+   and the device receiving the command. */
+#define TEMP_KEY_WATCHDOG_MS 600
+
+enum TEMP_KEY_SOURCE
+  {
+    TEMP_KEY_RANDOM = 0,        /**< Nonce mixed in the device's RNG */
+    TEMP_KEY_INPUT              /**< Nonce passed the host's value through */
+  };
+
+struct temp_key
+{
+  uint8_t value[TEMP_KEY_LEN];
+  enum TEMP_KEY_SOURCE source;  /**< The SourceFlag */
+  bool gen_data;                /**< True after GenDig */
+  enum DATA_ZONE zone;          /**< The zone GenDig read, if gen_data */
+  unsigned int key_id;          /**< The slot GenDig read, if gen_data */
+};
+
+/**
+ * Starts tracking TempKey for a newly woken device, which holds none.
+ *
+ * @param fd The open file descriptor
+ */
+void temp_key_register_device (int fd);
+
+/**
+ * Stops tracking the device, as it is put to sleep.
+ *
+ * @param fd The open file descriptor
+ */
+void temp_key_close_device (int fd);
+
+/**
+ * Restarts tracking after the device was put to sleep and woken
+ * again: TempKey is lost and the watchdog starts over.
+ *
+ * @param fd The open file descriptor
+ */
+void temp_key_device_woke (int fd);
+
+/**
+ * Returns how long the device has before its watchdog puts it to
+ * sleep, taking TempKey with it.
+ *
+ * @param fd The open file descriptor
+ *
+ * @return The time left in milliseconds, 0 if the device isn't tracked
+ */
+unsigned int temp_key_watchdog_left (int fd);
+
+/**
+ * Returns the device's TempKey, if the host knows it.
+ *
+ * @param fd The open file descriptor
+ * @param tk Filled in with TempKey
+ *
+ * @return True if TempKey is valid and known
+ */
+bool temp_key_get (int fd, struct temp_key *tk);
+
+/**
+ * Records TempKey after a command that set it.
+ *
+ * @param fd The open file descriptor
+ * @param tk The device's TempKey
+ */
+void temp_key_set (int fd, const struct temp_key *tk);
+
+/**
+ * Updates the host copy after any command: only commands known to
+ * leave TempKey alone keep it valid.  Called by process_command.
+ *
+ * @param fd The open file descriptor
+ * @param opcode The command's opcode
+ * @param data_len The length of the command's data
+ * @param success True if the command succeeded
+ */
+void temp_key_after_command (int fd, uint8_t opcode, unsigned int data_len,
+                             bool success);
+
+/**
+ * Computes TempKey after a Nonce command that mixed the device's
+ * random number with the host's input.
+ *
+ * @param random The 32 byte random number the device returned
+ * @param num_in The host's 20 byte input
+ * @param mode The Nonce command's mode
+ * @param out Filled in with the 32 byte TempKey
+ */
+void temp_key_nonce_value (const uint8_t *random, const uint8_t *num_in,
+                           uint8_t mode, uint8_t *out);
+
+/**
+ * Computes TempKey after a GenDig of a data slot.
+ *
+ * @param prev The 32 byte TempKey before GenDig
+ * @param slot The data slot
+ * @param key The 32 byte contents of the slot
+ * @param out Filled in with the 32 byte TempKey, may be prev
+ */
+void temp_key_gen_dig_value (const uint8_t *prev, unsigned int slot,
+                             const uint8_t *key, uint8_t *out);
+
+/* A GenDig of a data slot that may still be executing.  The host
+   knows what it will leave in TempKey as soon as it is sent, and can
+   use that before the response is collected. */
+struct temp_key_gen_dig
+{
+  struct temp_key tk;           /**< TempKey once the GenDig completes */
+  struct pending_command p;
+  bool pending;                 /**< False if TempKey already held it */
+};
+
+/**
+ * Starts leaving the device's TempKey as a GenDig of the data slot
+ * over a random nonce, as a MAC'd write of that slot needs.  Nothing
+ * is sent if TempKey already is, and the Nonce is skipped if TempKey
+ * holds an unused one.  The GenDig is left executing; nothing else
+ * may be sent until temp_key_finish_gen_dig.
+ *
+ * @param fd The open file descriptor
+ * @param slot The data slot
+ * @param key The current 32 byte contents of the slot
+ * @param g Filled in with the resulting TempKey and the GenDig in
+ * flight.  Wipe it after use.
+ *
+ * @return True on success, in which case temp_key_finish_gen_dig
+ * must be called
+ */
+bool temp_key_start_gen_dig (int fd, unsigned int slot,
+                             struct octet_buffer key,
+                             struct temp_key_gen_dig *g);
+
+/**
+ * Collects the response of the GenDig temp_key_start_gen_dig sent, if
+ * any, and records the TempKey it left.
+ *
+ * @param fd The open file descriptor
+ * @param g The GenDig in flight
+ *
+ * @return True if TempKey holds g->tk
+ */
+bool temp_key_finish_gen_dig (int fd, struct temp_key_gen_dig *g);
+
+#endif /* TEMP_KEY_H */
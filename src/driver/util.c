@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "log.h"
+#include "secure_arena.h"
+#include "hex.h"
 #include <ctype.h>
 #include <limits.h>
 
@@ -48,6 +50,12 @@ uint8_t* malloc_wipe(unsigned int len)
 
 void free_wipe(unsigned char* buf, unsigned int len)
 {
+  if (arena_owns (buf))
+    {
+      arena_free (buf);
+      return;
+    }
+
   wipe(buf, len);
 
   free(buf);
@@ -68,7 +76,10 @@ struct octet_buffer make_buffer(unsigned int len)
 {
     struct octet_buffer b = {};
     b.len = len;
-    b.ptr = malloc_wipe(len);
+    /* Small buffers hold keys, MACs and digests, so keep them off the
+       heap when the secure arena has room */
+    if (NULL == (b.ptr = arena_alloc (len)))
+      b.ptr = malloc_wipe(len);
 
     return b;
 }
@@ -95,22 +106,6 @@ bool memcmp_octet_buffer (struct octet_buffer lhs, struct octet_buffer rhs)
 
 }
 
-unsigned int c2b (char c)
-{
-  unsigned int result = 0;
-
-  if (c >= '0' && c <= '9')
-    result = c - '0';
-  else if (c >= 'A' && c <= 'F')
-    result = c - 'A' + 10;
-  else if (c >= 'a' && c >= 'f')
-    result = c - 'a' + 10;
-  else
-    result = UINT_MAX;
-
-  return result;
-
-}
 struct octet_buffer ascii_hex_2_bin (const char* hex, unsigned int max_len)
 {
   struct octet_buffer result = {0,0};
@@ -126,26 +121,7 @@ struct octet_buffer ascii_hex_2_bin (const char* hex, unsigned int max_len)
     {
       result = make_buffer (len / 2);
 
-      int x;
-
-      bool ishex = true;
-      for (x=0; x<len && ishex; x++)
-        {
-          unsigned int a;
-
-          if ((a = c2b (hex[x])) != UINT_MAX)
-            {
-              if (x % 2 == 0)
-                result.ptr[x/2] = (a << 4);
-              else
-                result.ptr[x/2] += a;
-            }
-          else
-            ishex = false;
-
-        }
-
-      if (!ishex)
+      if (!hex_decode (result.ptr, hex, len))
         {
           free_octet_buffer (result);
           result.ptr = NULL;
@@ -158,16 +134,25 @@ struct octet_buffer ascii_hex_2_bin (const char* hex, unsigned int max_len)
 
 bool is_all_hex (const char* hex, unsigned int max_len)
 {
-  struct octet_buffer bin = ascii_hex_2_bin (hex, max_len);
-  bool ishex = false;
+  assert (NULL != hex);
 
-  if (NULL != bin.ptr)
-    {
-      ishex = true;
-      free_octet_buffer (bin);
-    }
+  if (0 == memcmp("0x", hex, 2))
+    hex +=2;
 
-  return ishex;
+  unsigned int len = strnlen (hex, max_len);
+
+  return len % 2 == 0 && hex_validate (hex, len);
+}
+
+const char* octet_buffer2hex_string (struct octet_buffer buf)
+{
+  assert (NULL != buf.ptr);
+
+  char *str = (char *)malloc_wipe (HEX_LEN (buf.len) + 1);
+
+  hex_encode (str, buf.ptr, buf.len);
+
+  return str;
 }
 
 unsigned int copy_buffer (struct octet_buffer dst, unsigned int offset,
@@ -186,7 +171,7 @@ unsigned int copy_to_buffer (struct octet_buffer buf, unsigned int offset,
   assert (NULL != p);
   assert (buf.ptr != NULL);
 
-  assert (len <= buf.len + offset);
+  assert (offset <= buf.len && len <= buf.len - offset);
 
   memcpy (buf.ptr + offset, p, len);
 
@@ -194,6 +179,50 @@ unsigned int copy_to_buffer (struct octet_buffer buf, unsigned int offset,
 
 }
 
+unsigned int copy_byte_to_buffer (struct octet_buffer buf, unsigned int offset,
+                                  uint8_t b)
+{
+  return copy_to_buffer (buf, offset, &b, 1);
+}
+
+unsigned int zero_fill_buffer (struct octet_buffer buf, unsigned int offset,
+                               unsigned int len)
+{
+  assert (buf.ptr != NULL);
+  assert (offset <= buf.len && len <= buf.len - offset);
+
+  memset (buf.ptr + offset, 0, len);
+
+  return offset + len;
+}
+
+struct fixed_buffer make_fixed_buffer (unsigned int len)
+{
+  struct fixed_buffer b = {};
+
+  assert (len <= FIXED_BUFFER_MAX);
+  b.len = len;
+
+  return b;
+}
+
+struct octet_buffer fixed_buffer_view (struct fixed_buffer *buf)
+{
+  assert (NULL != buf);
+  assert (buf->len <= FIXED_BUFFER_MAX);
+
+  struct octet_buffer view = {buf->data, buf->len};
+
+  return view;
+}
+
+void wipe_fixed_buffer (struct fixed_buffer *buf)
+{
+  assert (NULL != buf);
+
+  wipe (buf->data, sizeof (buf->data));
+}
+
 
 struct octet_buffer xor_buffers (const struct octet_buffer lhs,
                                  const struct octet_buffer rhs)
@@ -137,6 +137,72 @@ unsigned int copy_buffer (struct octet_buffer dst, unsigned int offset,
 unsigned int copy_to_buffer (struct octet_buffer buf, unsigned int offset,
                              const uint8_t *p, unsigned int len);
 
+/**
+ * Writes one byte into the octet buffer.
+ *
+ * @param buf The destination buffer
+ * @param offset The offset in the destination buffer.
+ * @param b The byte to write
+ *
+ * @return The updated offset (offset + 1)
+ */
+unsigned int copy_byte_to_buffer (struct octet_buffer buf, unsigned int offset,
+                                  uint8_t b);
+
+/**
+ * Writes len zero bytes into the octet buffer.
+ *
+ * @param buf The destination buffer
+ * @param offset The offset in the destination buffer.
+ * @param len The number of zero bytes
+ *
+ * @return The updated offset (offset + len)
+ */
+unsigned int zero_fill_buffer (struct octet_buffer buf, unsigned int offset,
+                               unsigned int len);
+
+/* Wraps an array, usually on the stack, as an octet buffer so messages
+   can be built in place with copy_to_buffer and friends.  Never free
+   the result. */
+#define ARRAY_BUFFER(array) ((struct octet_buffer){ (array), sizeof (array) })
+
+/* The largest value a fixed buffer holds: one SHA-256 block */
+#define FIXED_BUFFER_MAX 64
+
+/* A key, digest or other short field held inline, so it can live on
+   the stack or inside another struct instead of the heap. */
+struct fixed_buffer
+{
+  unsigned char data[FIXED_BUFFER_MAX];
+  unsigned int len;
+};
+
+/**
+ * Creates a zeroed fixed buffer.
+ *
+ * @param len The length of the value, at most FIXED_BUFFER_MAX
+ *
+ * @return The fixed buffer
+ */
+struct fixed_buffer make_fixed_buffer (unsigned int len);
+
+/**
+ * Returns an octet buffer that refers to the fixed buffer's data.  It
+ * is only valid while the fixed buffer is and must not be freed.
+ *
+ * @param buf The fixed buffer
+ *
+ * @return The octet buffer view
+ */
+struct octet_buffer fixed_buffer_view (struct fixed_buffer *buf);
+
+/**
+ * Wipes a fixed buffer that held a secret.
+ *
+ * @param buf The fixed buffer
+ */
+void wipe_fixed_buffer (struct fixed_buffer *buf);
+
 /**
  * XOR two buffers.  The buffers must not be zero and must be the same size.
  *
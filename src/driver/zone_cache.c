@@ -0,0 +1,272 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config_zone.h"
+#include "crc.h"
+#include "log.h"
+#include "personalize.h"
+#include "zone_cache.h"
+
+/* Devices open at once, as for the command statistics */
+#define ZONE_CACHE_MAX_OPEN 16
+
+/* The configuration zone byte holding the OTP mode */
+#define OTP_MODE 18
+#define OTP_READ_ONLY 0xAA
+
+struct open_device
+{
+  int fd;
+  bool used;
+  bool identified;              /**< The serial and OTP mode are known */
+  bool data_locked;             /**< Known to be locked */
+  uint8_t otp_mode;
+  struct zone_cache_record record;
+};
+
+static const struct record_format ZONE_CACHE_FORMAT =
+  {
+    .magic = { 'H', 'L', 'Z', 'C' },
+    .version = ZONE_CACHE_VERSION,
+    .record_size = sizeof (struct zone_cache_record),
+    .min_slots = 64,
+    .max_slots = 4096
+  };
+
+static struct open_device open_devices[ZONE_CACHE_MAX_OPEN];
+static pthread_mutex_t zone_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Finds an open device.  Only the thread using fd touches its entry,
+ * so the lock is held just for the search.
+ *
+ * @return The device, NULL if it was not registered
+ */
+static struct open_device* find_device (int fd)
+{
+  struct open_device *dev = NULL;
+  unsigned int x;
+
+  pthread_mutex_lock (&zone_cache_lock);
+
+  for (x = 0; x < ZONE_CACHE_MAX_OPEN && NULL == dev; x++)
+    if (open_devices[x].used && open_devices[x].fd == fd)
+      dev = &open_devices[x];
+
+  pthread_mutex_unlock (&zone_cache_lock);
+
+  return dev;
+}
+
+void zone_cache_register_device (int fd)
+{
+  unsigned int x;
+
+  pthread_mutex_lock (&zone_cache_lock);
+
+  for (x = 0; x < ZONE_CACHE_MAX_OPEN; x++)
+    if (!open_devices[x].used)
+      {
+        memset (&open_devices[x], 0, sizeof (open_devices[x]));
+        open_devices[x].used = true;
+        open_devices[x].fd = fd;
+        break;
+      }
+
+  pthread_mutex_unlock (&zone_cache_lock);
+
+  if (ZONE_CACHE_MAX_OPEN == x)
+    CTX_LOG (DEBUG, "Too many open devices, zones are not cached");
+}
+
+void zone_cache_close_device (int fd)
+{
+  struct open_device *dev = find_device (fd);
+
+  if (NULL != dev)
+    {
+      pthread_mutex_lock (&zone_cache_lock);
+      dev->used = false;
+      pthread_mutex_unlock (&zone_cache_lock);
+    }
+}
+
+static uint16_t record_crc (const struct zone_cache_record *r)
+{
+  struct crc16_ctx ctx;
+
+  crc16_init (&ctx);
+  crc16_update (&ctx, r->serial, sizeof (r->serial));
+  crc16_update (&ctx, &r->zones, sizeof (r->zones));
+  crc16_update (&ctx, r->config, sizeof (r->config));
+  crc16_update (&ctx, r->otp, sizeof (r->otp));
+
+  return crc16_final (&ctx);
+}
+
+/**
+ * Loads the zones cached by an earlier run, if any.
+ */
+static void load_record (struct open_device *dev)
+{
+  char *filename = home_file_name (ZONE_CACHE_FILE);
+  struct zone_cache_record record;
+  struct record_file f;
+
+  if (open_record_file (&f, filename, &ZONE_CACHE_FORMAT, false))
+    {
+      if (read_record (&f, dev->record.serial, &record) &&
+          record_crc (&record) == record.crc)
+        dev->record = record;
+
+      close_record_file (&f);
+    }
+
+  free (filename);
+}
+
+/**
+ * Saves the device's record, so later runs needn't read its zones.
+ * It is only a cache, so it isn't synced.
+ */
+static void save_record (struct open_device *dev)
+{
+  char *filename = home_file_name (ZONE_CACHE_FILE);
+  struct record_file f;
+  bool saved = false;
+
+  dev->record.crc = record_crc (&dev->record);
+
+  if (open_record_file (&f, filename, &ZONE_CACHE_FORMAT, true))
+    {
+      saved = write_record (&f, &dev->record);
+      close_record_file (&f);
+    }
+
+  if (!saved)
+    CTX_LOG (DEBUG, "Failed to save the zone cache %s", filename);
+
+  free (filename);
+}
+
+/**
+ * Takes the serial number and OTP mode from the start of the
+ * configuration zone, then loads what an earlier run cached.
+ */
+static void adopt (struct open_device *dev, const uint8_t *config)
+{
+  memcpy (dev->record.serial, config, 4);
+  memcpy (dev->record.serial + 4, config + 8, 5);
+  dev->otp_mode = config[OTP_MODE];
+  dev->identified = true;
+
+  load_record (dev);
+}
+
+/**
+ * Reads the start of the configuration zone to identify the device,
+ * for when the OTP zone is wanted first.
+ */
+static bool identify (int fd, struct open_device *dev)
+{
+  uint8_t block[ZONE_CACHE_IDENTIFY_LEN];
+
+  if (!dev->identified &&
+      RSP_SUCCESS == read32_into (fd, CONFIG_ZONE, 0, ARRAY_BUFFER (block)))
+    adopt (dev, block);
+
+  return dev->identified;
+}
+
+bool zone_cache_lookup (int fd, enum DATA_ZONE zone, uint8_t *out)
+{
+  assert (NULL != out);
+  assert (CONFIG_ZONE == zone || OTP_ZONE == zone);
+
+  struct open_device *dev = find_device (fd);
+
+  /* The configuration zone's reader offers its start first */
+  if (NULL == dev ||
+      !(CONFIG_ZONE == zone ? dev->identified : identify (fd, dev)))
+    return false;
+
+  if (CONFIG_ZONE == zone && (dev->record.zones & ZONE_CACHE_HAS_CONFIG))
+    memcpy (out, dev->record.config, sizeof (dev->record.config));
+  else if (OTP_ZONE == zone && (dev->record.zones & ZONE_CACHE_HAS_OTP))
+    memcpy (out, dev->record.otp, sizeof (dev->record.otp));
+  else
+    return false;
+
+  return true;
+}
+
+void zone_cache_offer (int fd, enum DATA_ZONE zone, const uint8_t *data,
+                       unsigned int len)
+{
+  assert (NULL != data);
+  assert ((CONFIG_ZONE == zone && len >= ZONE_CACHE_IDENTIFY_LEN) ||
+          (OTP_ZONE == zone && OTP_ZONE_LEN == len));
+
+  struct open_device *dev = find_device (fd);
+  uint32_t lock_word;
+
+  if (NULL == dev)
+    return;
+
+  if (CONFIG_ZONE == zone)
+    {
+      if (!dev->identified)
+        adopt (dev, data);
+
+      if (len < CONFIG_ZONE_LEN)
+        return;
+
+      dev->data_locked = UNLOCKED != data[LOCK_VALUE];
+
+      if (UNLOCKED != data[LOCK_CONFIG] &&
+          !(dev->record.zones & ZONE_CACHE_HAS_CONFIG))
+        {
+          memcpy (dev->record.config, data, sizeof (dev->record.config));
+          dev->record.zones |= ZONE_CACHE_HAS_CONFIG;
+          save_record (dev);
+        }
+    }
+  else if (!(dev->record.zones & ZONE_CACHE_HAS_OTP) &&
+           identify (fd, dev) && OTP_READ_ONLY == dev->otp_mode)
+    {
+      /* The data zone lock is the one thing that may have changed */
+      if (!dev->data_locked &&
+          read4 (fd, CONFIG_ZONE, CONFIG_LOCK_WORD, &lock_word))
+        dev->data_locked =
+          UNLOCKED != ((uint8_t *)&lock_word)[LOCK_VALUE % 4];
+
+      if (dev->data_locked)
+        {
+          memcpy (dev->record.otp, data, sizeof (dev->record.otp));
+          dev->record.zones |= ZONE_CACHE_HAS_OTP;
+          save_record (dev);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ZONE_CACHE_H
+#define ZONE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command.h"
+#include "record_file.h"
+
+/* Zones that can no longer change are cached under the device's serial
+   number, in memory for each open device and in ~/.hashlet_zones
+   across runs, so reading them again doesn't touch the bus.  The
+   configuration zone is cached once it is locked, all but its last
+   word, whose lock bytes Lock and UpdateExtra still change.  The OTP
+   zone is cached once the data zone is locked in read only OTP mode.
+   The device is identified by the serial number in the first 32 bytes
+   of the configuration zone.  get_config_zone_into reads those first
+   and offers them, so reading the configuration zone costs one 32 byte
+   read and the lock word when cached.  A session that reads the OTP
+   zone before the configuration zone still needs a 32 byte read to
+   identify the device, so there a hit saves one of the OTP zone's two
+   reads.  The file is a record file, see record_file.h, of limited
+   size: once full, a new device takes the place of one already
+   there. */
+
+#define ZONE_CACHE_FILE "/.hashlet_zones"
+
+#define ZONE_CACHE_VERSION 2
+#define ZONE_CACHE_SERIAL_LEN RECORD_SERIAL_LEN
+
+/* The configuration zone up to the lock word */
+#define ZONE_CACHE_CONFIG_LEN 84
+
+/* The start of the configuration zone, which identifies the device */
+#define ZONE_CACHE_IDENTIFY_LEN 32
+
+#define ZONE_CACHE_HAS_CONFIG 0x01
+#define ZONE_CACHE_HAS_OTP 0x02
+
+struct zone_cache_record
+{
+  uint8_t serial[ZONE_CACHE_SERIAL_LEN];
+  uint8_t zones;                /**< ZONE_CACHE_HAS_ bits */
+  uint16_t crc;                 /**< CRC16 of the other fields */
+  uint8_t config[ZONE_CACHE_CONFIG_LEN];
+  uint8_t otp[OTP_ZONE_LEN];
+};
+
+/**
+ * Starts caching for a newly opened device.
+ *
+ * @param fd The open file descriptor
+ */
+void zone_cache_register_device (int fd);
+
+/**
+ * Forgets the in memory copy of the device's zones.
+ *
+ * @param fd The open file descriptor
+ */
+void zone_cache_close_device (int fd);
+
+/**
+ * Copies a zone from the cache.  The configuration zone only hits once
+ * its first ZONE_CACHE_IDENTIFY_LEN bytes have been offered, while the
+ * OTP zone reads them from the device if they haven't.
+ *
+ * @param fd The open file descriptor
+ * @param zone CONFIG_ZONE or OTP_ZONE
+ * @param out The zone's length.  For the configuration zone, only the
+ * first ZONE_CACHE_CONFIG_LEN bytes are filled in.
+ *
+ * @return True if the zone was cached
+ */
+bool zone_cache_lookup (int fd, enum DATA_ZONE zone, uint8_t *out);
+
+/**
+ * Offers a zone just read from the device to the cache, which keeps it
+ * if it can no longer change.  The start of the configuration zone
+ * may be offered on its own to identify the device.
+ *
+ * @param fd The open file descriptor
+ * @param zone CONFIG_ZONE or OTP_ZONE
+ * @param data The zone, from its start
+ * @param len The bytes in data: the whole zone, or for the
+ * configuration zone at least ZONE_CACHE_IDENTIFY_LEN
+ */
+void zone_cache_offer (int fd, enum DATA_ZONE zone, const uint8_t *data,
+                       unsigned int len);
+
+#endif /* ZONE_CACHE_H */
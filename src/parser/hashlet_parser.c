@@ -20,49 +20,251 @@
 
 #include "hashlet_parser.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../driver/hex.h"
 #include "../driver/util.h"
 
-extern FILE *yyin;
+#define KEYSLOT "key_slot_"
 
-#define NUM_KEYS 16
+/* Value of each hex digit, -1 for anything else */
+static const int8_t HEX_VALUE[256] =
+  {
+    ['0'] = 0 + 1, ['1'] = 1 + 1, ['2'] = 2 + 1, ['3'] = 3 + 1,
+    ['4'] = 4 + 1, ['5'] = 5 + 1, ['6'] = 6 + 1, ['7'] = 7 + 1,
+    ['8'] = 8 + 1, ['9'] = 9 + 1,
+    ['A'] = 10 + 1, ['B'] = 11 + 1, ['C'] = 12 + 1,
+    ['D'] = 13 + 1, ['E'] = 14 + 1, ['F'] = 15 + 1,
+    ['a'] = 10 + 1, ['b'] = 11 + 1, ['c'] = 12 + 1,
+    ['d'] = 13 + 1, ['e'] = 14 + 1, ['f'] = 15 + 1
+  };
 
-const char* keys [NUM_KEYS] = {0};
+/* The table is stored off by one so that it can be zero filled */
+#define HEX(c) (HEX_VALUE[(unsigned char)(c)] - 1)
 
-void put_key (unsigned int slot, const char* key)
+struct scanner
 {
+  const char *start;
+  const char *p;
+  const char *end;
+};
 
-  if (slot < NUM_KEYS)
-    keys[slot] = key;
+/**
+ * Fills in the error, working out the line and column of the failing
+ * position.  Only done on failure so the scan itself doesn't track
+ * lines.
+ *
+ * @param s The scanner, positioned at the error
+ * @param message The description
+ * @param error The error to fill in, may be NULL
+ *
+ * @return -1
+ */
+static int fail (const struct scanner *s, const char *message,
+                 struct key_file_error *error)
+{
+  const char *p;
+
+  if (NULL == error)
+    return -1;
+
+  error->line = 1;
+  error->column = 1;
+  error->message = message;
 
+  for (p = s->start; p < s->p; p++)
+    {
+      if ('\n' == *p)
+        {
+          error->line++;
+          error->column = 1;
+        }
+      else
+        error->column++;
+    }
+
+  return -1;
 }
 
-const char* get_key (unsigned int slot)
+/**
+ * Skips white space and comments.
+ *
+ * @param s The scanner
+ */
+static void skip_blank (struct scanner *s)
 {
-  assert (slot < NUM_KEYS);
-  return keys[slot];
+  while (s->p < s->end)
+    {
+      switch (*s->p)
+        {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+          s->p++;
+          break;
+        case '#':
+          s->p = memchr (s->p, '\n', s->end - s->p);
+          if (NULL == s->p)
+            s->p = s->end;
+          break;
+        default:
+          return;
+        }
+    }
 }
 
-void free_parsed_keys (void)
+int parse_key_buffer (const char *buf, size_t len,
+                      struct parsed_key *keys,
+                      struct key_file_error *error)
 {
-  int x;
+  assert (NULL != buf || 0 == len);
+  assert (NULL != keys);
+
+  const size_t KEYSLOT_LEN = sizeof (KEYSLOT) - 1;
+  struct scanner s = { buf, buf, buf + len };
+  unsigned int entries = 0;
 
-  for (x=0; x< NUM_KEYS; x++)
+  memset (keys, 0, KEY_FILE_SLOTS * sizeof (struct parsed_key));
+
+  for (skip_blank (&s); s.p < s.end; skip_blank (&s))
     {
-      if (NULL != keys[x])
-        free_wipe ((uint8_t *)keys[x], strnlen (keys[x], 64));
+      unsigned int slot;
+      uint8_t key[KEY_FILE_KEY_LEN];
+      unsigned int x;
+
+      if ((size_t)(s.end - s.p) < KEYSLOT_LEN ||
+          0 != memcmp (s.p, KEYSLOT, KEYSLOT_LEN))
+        return fail (&s, "expected key_slot_", error);
+
+      s.p += KEYSLOT_LEN;
+
+      if (s.end - s.p < 2 || HEX (s.p[0]) < 0 || HEX (s.p[0]) > 9 ||
+          HEX (s.p[1]) < 0 || HEX (s.p[1]) > 9 ||
+          (s.end - s.p > 2 && HEX (s.p[2]) >= 0))
+        return fail (&s, "expected a two digit slot number", error);
+
+      slot = HEX (s.p[0]) * 10 + HEX (s.p[1]);
+      s.p += 2;
+
+      skip_blank (&s);
+
+      /* Decode the whole key at once, falling back to a digit at a
+         time only to find where a bad key goes wrong */
+      x = 0;
+      if (s.end - s.p >= HEX_LEN (KEY_FILE_KEY_LEN) &&
+          hex_decode (key, s.p, HEX_LEN (KEY_FILE_KEY_LEN)))
+        {
+          s.p += HEX_LEN (KEY_FILE_KEY_LEN);
+          x = KEY_FILE_KEY_LEN;
+        }
 
+      for (; x < KEY_FILE_KEY_LEN; x++)
+        {
+          int hi, lo;
+
+          if (s.end - s.p < 2 ||
+              (hi = HEX (s.p[0])) < 0 || (lo = HEX (s.p[1])) < 0)
+            {
+              if (s.p < s.end && HEX (s.p[0]) >= 0)
+                s.p++;
+              wipe (key, sizeof (key));
+              return fail (&s, "expected 64 hex digits", error);
+            }
+
+          key[x] = hi << 4 | lo;
+          s.p += 2;
+        }
+
+      if (s.p < s.end && HEX (*s.p) >= 0)
+        {
+          wipe (key, sizeof (key));
+          return fail (&s, "expected 64 hex digits", error);
+        }
+
+      if (slot < KEY_FILE_SLOTS)
+        {
+          memcpy (keys[slot].key, key, KEY_FILE_KEY_LEN);
+          keys[slot].present = true;
+        }
+
+      wipe (key, sizeof (key));
+      entries++;
     }
 
+  if (0 == entries)
+    return fail (&s, "no keys", error);
+
+  return 0;
 }
 
-int parse_file (FILE *fp)
+int parse_key_file (FILE *fp, struct parsed_key *keys,
+                    struct key_file_error *error)
 {
   assert (NULL != fp);
+  assert (NULL != keys);
+
+  static const struct key_file_error READ_ERROR = { 0, 0, "read failed" };
+  int fd = fileno (fp);
+  struct stat st;
+  char *buf = NULL;
+  size_t len = 0, capacity = 0;
+  ssize_t n;
+  int result;
+
+  if (0 == fstat (fd, &st) && S_ISREG (st.st_mode) && st.st_size > 0)
+    {
+      void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (MAP_FAILED != map)
+        {
+          result = parse_key_buffer (map, st.st_size, keys, error);
+          munmap (map, st.st_size);
+          return result;
+        }
+    }
+
+  /* Pipes and the like */
+  do
+    {
+      if (len == capacity)
+        {
+          capacity = capacity ? capacity * 2 : 4096;
+          char *bigger = (char *)malloc_wipe (capacity);
+          if (NULL != buf)
+            {
+              memcpy (bigger, buf, len);
+              free_wipe ((uint8_t *)buf, len);
+            }
+          buf = bigger;
+        }
+
+      n = read (fd, buf + len, capacity - len);
+      if (n > 0)
+        len += n;
+    }
+  while (n > 0);
 
-  yyin = fp;
+  if (n < 0)
+    {
+      if (NULL != error)
+        *error = READ_ERROR;
+      result = -1;
+    }
+  else
+    result = parse_key_buffer (buf, len, keys, error);
 
-  return yyparse ();
+  free_wipe ((uint8_t *)buf, capacity);
 
+  return result;
+}
+
+void wipe_parsed_keys (struct parsed_key *keys)
+{
+  assert (NULL != keys);
 
+  wipe ((uint8_t *)keys, KEY_FILE_SLOTS * sizeof (struct parsed_key));
 }
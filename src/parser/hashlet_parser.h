@@ -17,49 +17,75 @@
  * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+
 #ifndef HASHLET_PARSER_H
 #define HASHLET_PARSER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
-/**
- * Store the key from the text file into a table.
- *
- * @param slot The key slot corresponding to this key
- * @param key The ASCII hex encoded string
- */
-void put_key (unsigned int slot, const char* key);
+#define KEY_FILE_SLOTS 16
+#define KEY_FILE_KEY_LEN 32
 
-/**
- * Retrieve the key from the table
- *
- * @param slot The slot (the lookup value)
- *
- * @return An ASCII encoded hex string
- */
-const char* get_key (unsigned int slot);
+/* A key file is a list of entries of the form
+
+     key_slot_NN    64 hex digits
+
+   separated by white space, with comments running from '#' to the end
+   of the line.  A later entry for a slot replaces an earlier one and
+   slots of 16 and above are ignored. */
+
+struct parsed_key
+{
+  bool present;                 /**< True if the file had this slot */
+  uint8_t key[KEY_FILE_KEY_LEN];
+};
+
+struct key_file_error
+{
+  unsigned int line;            /**< 1 based line of the error */
+  unsigned int column;          /**< 1 based column of the error */
+  const char *message;          /**< Static description */
+};
 
 /**
- * Free the parsed key table
+ * Parses a key file held in memory.  The buffer is scanned once and
+ * the keys are decoded straight into the caller's array, so nothing is
+ * allocated and concurrent calls are safe.
  *
+ * @param buf The key file contents, which need not be NUL terminated
+ * @param len The length of buf
+ * @param keys The KEY_FILE_SLOTS keys to fill in.  Slots not in the
+ * file are left not present.
+ * @param error If not NULL, filled in on failure
+ *
+ * @return 0 on success
  */
-void free_parsed_keys (void);
+int parse_key_buffer (const char *buf, size_t len,
+                      struct parsed_key *keys,
+                      struct key_file_error *error);
 
 /**
- * Parse the given file stream
+ * Parses a key file from an open stream.  Regular files are mapped,
+ * anything else is read into memory first.
  *
  * @param fp The open file pointer
+ * @param keys The KEY_FILE_SLOTS keys to fill in
+ * @param error If not NULL, filled in on failure.  line is 0 if the
+ * file could not be read.
  *
  * @return 0 on success
  */
-int parse_file (FILE *fp);
+int parse_key_file (FILE *fp, struct parsed_key *keys,
+                    struct key_file_error *error);
 
 /**
- * Initiate the parsing
- * Included to prevent compile warnings
+ * Wipes the parsed keys.
  *
- * @return 0 on success
+ * @param keys The KEY_FILE_SLOTS keys
  */
-int yyparse(void);
+void wipe_parsed_keys (struct parsed_key *keys);
 
 #endif
@@ -0,0 +1,208 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks that checkpoints round trip with their OTP image, that a
+   damaged record is ignored, and that personalize resumed on the fake
+   device locks the OTP image an earlier run wrote, not its own. */
+
+#include "config.h"
+#include <assert.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../bench/fake_device.h"
+#include "../driver/checkpoint.h"
+#include "../driver/command.h"
+#include "../driver/hashlet.h"
+#include "../driver/personalize.h"
+
+static const uint8_t SERIAL[CHECKPOINT_SERIAL_LEN] =
+  { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xee };
+
+static void make_otp (uint8_t *otp, const char *version)
+{
+  memset (otp, 0, OTP_ZONE_LEN);
+  strcpy ((char *)otp, "CRYPTOTRONIX HASHLET REV: A");
+  snprintf ((char *)otp + 32, 32, "SOFTWARE VERSION: %s", version);
+}
+
+static void test_round_trip (const char *filename)
+{
+  uint8_t otp[OTP_ZONE_LEN], loaded[OTP_ZONE_LEN];
+  const uint8_t ZEROS[OTP_ZONE_LEN] = { 0 };
+
+  memset (loaded, 0xff, sizeof (loaded));
+  assert (0 == load_checkpoint (filename, SERIAL, loaded));
+  assert (0 == memcmp (loaded, ZEROS, OTP_ZONE_LEN));
+
+  make_otp (otp, "0.0.1");
+  assert (save_checkpoint (filename, SERIAL, 0x15, otp));
+  assert (0x15 == load_checkpoint (filename, SERIAL, loaded));
+  assert (0 == memcmp (loaded, otp, OTP_ZONE_LEN));
+  assert (0x15 == load_checkpoint (filename, SERIAL, NULL));
+
+  assert (save_checkpoint (filename, SERIAL, 0x01, NULL));
+  assert (0x01 == load_checkpoint (filename, SERIAL, loaded));
+  assert (0 == memcmp (loaded, ZEROS, OTP_ZONE_LEN));
+
+  assert (clear_checkpoint (filename, SERIAL));
+  assert (0 == load_checkpoint (filename, SERIAL, NULL));
+  assert (clear_checkpoint (filename, SERIAL));
+}
+
+static void test_damaged (const char *filename)
+{
+  uint8_t otp[OTP_ZONE_LEN];
+  uint8_t *contents;
+  long size, x;
+  FILE *fp;
+
+  make_otp (otp, "0.0.1");
+  assert (save_checkpoint (filename, SERIAL, 0x15, otp));
+
+  assert (NULL != (fp = fopen (filename, "r+b")));
+  assert (0 == fseek (fp, 0, SEEK_END) && (size = ftell (fp)) > 0);
+  assert (NULL != (contents = malloc (size)));
+  rewind (fp);
+  assert (1 == fread (contents, size, 1, fp));
+
+  /* Change a byte of the record's OTP image */
+  for (x = 0; x + sizeof (SERIAL) <= size &&
+         0 != memcmp (contents + x, SERIAL, sizeof (SERIAL)); x++)
+    ;
+
+  assert (x + sizeof (struct checkpoint_record) <= size);
+  contents[x + offsetof (struct checkpoint_record, otp) + 40] ^= 0x01;
+
+  rewind (fp);
+  assert (1 == fwrite (contents, size, 1, fp));
+  assert (0 == fclose (fp));
+  free (contents);
+
+  assert (0 == load_checkpoint (filename, SERIAL, NULL));
+}
+
+static bool fail_record (void *ctx, const uint8_t *serial,
+                         struct key_container *keys)
+{
+  return false;
+}
+
+static bool accept_record (void *ctx, const uint8_t *serial,
+                           struct key_container *keys)
+{
+  return true;
+}
+
+static struct key_container* recall_nothing (void *ctx,
+                                             const uint8_t *serial)
+{
+  return NULL;
+}
+
+static void test_resume (const char *filename)
+{
+  const struct key_sink FAILING = { fail_record, recall_nothing, NULL };
+  const struct key_sink ACCEPTING = { accept_record, recall_nothing, NULL };
+  struct personalize_run run = { .sink = &FAILING, .host_rng = true,
+                                 .checkpoint_file = filename };
+  uint8_t otp[OTP_ZONE_LEN];
+  uint32_t done;
+  int fd;
+
+  fake_device_reset ();
+  assert ((fd = hashlet_setup ("/dev/i2c-1", 0x64)) >= 0);
+
+  /* The keys can't be recorded, so the run stops after the OTP zone */
+  assert (STATE_INITIALIZED == personalize_device (fd, STATE_PERSONALIZED,
+                                                   &run));
+  assert (PERSONALIZE_KEYS == run.failed);
+
+  done = load_checkpoint (filename, run.serial, otp);
+  assert (done & 1u << PERSONALIZE_OTP);
+
+  /* As if an earlier version of hashlet had written the zone */
+  make_otp (otp, "0.0.1");
+  assert (write32 (fd, OTP_ZONE, 0, (struct octet_buffer){ otp, 32 }, NULL));
+  assert (write32 (fd, OTP_ZONE, 8, (struct octet_buffer){ otp + 32, 32 },
+                   NULL));
+  assert (save_checkpoint (filename, run.serial, done, otp));
+
+  run.sink = &ACCEPTING;
+  assert (STATE_PERSONALIZED == personalize_device (fd, STATE_PERSONALIZED,
+                                                    &run));
+  assert (run.skipped & 1u << PERSONALIZE_OTP);
+
+  /* Once the device is personalized its checkpoint is removed */
+  assert (0 == load_checkpoint (filename, run.serial, NULL));
+
+  hashlet_teardown (fd);
+}
+
+static void remove_home (const char *home)
+{
+  DIR *dir = opendir (home);
+  struct dirent *d;
+  char path[PATH_MAX];
+
+  assert (NULL != dir);
+
+  while (NULL != (d = readdir (dir)))
+    {
+      if (0 == strcmp (".", d->d_name) || 0 == strcmp ("..", d->d_name))
+        continue;
+
+      snprintf (path, sizeof (path), "%s/%s", home, d->d_name);
+      unlink (path);
+    }
+
+  closedir (dir);
+  rmdir (home);
+}
+
+int main (void)
+{
+  char home[] = "/tmp/test_checkpoint.XXXXXX";
+  char filename[sizeof (home) + sizeof ("/checkpoints")];
+
+  /* The driver keeps the zone cache and statistics under $HOME, and
+     the cache would remember the fake device from an earlier run */
+  assert (NULL != mkdtemp (home));
+  assert (0 == setenv ("HOME", home, 1));
+  snprintf (filename, sizeof (filename), "%s/checkpoints", home);
+
+  test_round_trip (filename);
+
+  unlink (filename);
+  test_damaged (filename);
+
+  unlink (filename);
+  test_resume (filename);
+
+  remove_home (home);
+
+  printf ("Checkpoint tests passed\n");
+
+  return 0;
+}
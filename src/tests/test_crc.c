@@ -0,0 +1,109 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks the sliced CRC against the table driven one byte at a time,
+   whole and split into pieces at every boundary. */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../driver/crc.h"
+
+#define DATA_LEN 200
+
+static uint16_t reference_crc (const uint8_t *p, unsigned int len)
+{
+  uint16_t crc = 0;
+
+  while (len-- > 0)
+    crc = update_crc16_8005 (crc, *p++);
+
+  return crc;
+}
+
+static uint16_t sliced_crc (const uint8_t *p, unsigned int len)
+{
+  struct crc16_ctx ctx;
+
+  crc16_init (&ctx);
+  crc16_update (&ctx, p, len);
+
+  return ctx.crc;
+}
+
+static void test_known_value (void)
+{
+  /* The response to a wake, as the device sends it */
+  const uint8_t wake[] = { 0x04, 0x11, 0x33, 0x43 };
+
+  assert (is_crc_16_valid (wake, 2, wake + 2));
+}
+
+static void test_lengths (const uint8_t *data)
+{
+  unsigned int len, start;
+
+  for (start = 0; start < 8; start++)
+    for (len = 0; len + start <= DATA_LEN; len++)
+      {
+        struct crc16_ctx ctx = { reference_crc (data + start, len) };
+
+        assert (sliced_crc (data + start, len) == ctx.crc);
+        assert (calculate_crc16 (data + start, len) == crc16_final (&ctx));
+      }
+}
+
+static void test_splits (const uint8_t *data)
+{
+  const uint16_t whole = calculate_crc16 (data, DATA_LEN);
+  unsigned int a, b;
+
+  for (a = 0; a <= DATA_LEN; a++)
+    for (b = a; b <= DATA_LEN; b += 7)
+      {
+        struct crc16_ctx ctx;
+
+        crc16_init (&ctx);
+        crc16_update (&ctx, data, a);
+        crc16_update (&ctx, data + a, b - a);
+        assert (crc16_final (&ctx) == calculate_crc16 (data, b));
+        crc16_update (&ctx, data + b, DATA_LEN - b);
+        assert (crc16_final (&ctx) == whole);
+      }
+}
+
+int main (void)
+{
+  uint8_t data[DATA_LEN];
+  unsigned int x;
+
+  srand (1);
+  for (x = 0; x < DATA_LEN; x++)
+    data[x] = rand ();
+
+  test_known_value ();
+  test_lengths (data);
+  test_splits (data);
+
+  printf ("CRC tests passed\n");
+
+  return 0;
+}
@@ -0,0 +1,170 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks that the digest cache file is named from $HOME, that entries
+   survive a save and load, that a changed file misses, and that
+   entries not seen in a run are dropped when the cache is saved. */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../cli/digest_cache.h"
+
+#define FILES 3
+
+static char dir[] = "/tmp/test_digest_cache.XXXXXX";
+static char paths[FILES][64];
+static char cache_file[64];
+
+/* Older than the racy window, so the digests are recorded */
+static void make_files (struct stat *st)
+{
+  const struct timespec old[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+  unsigned int x;
+  int fd;
+
+  for (x = 0; x < FILES; x++)
+    {
+      snprintf (paths[x], sizeof (paths[x]), "%s/file%u", dir, x);
+      assert ((fd = open (paths[x], O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0);
+      assert (1 == write (fd, &x, 1));
+      assert (0 == futimens (fd, old));
+      assert (0 == fstat (fd, &st[x]));
+      close (fd);
+    }
+}
+
+static void test_name (void)
+{
+  char *name;
+  char expected[128];
+
+  snprintf (expected, sizeof (expected), "%s%s", dir, DIGEST_CACHE);
+  name = get_digest_cache_name ();
+  assert (0 == strcmp (expected, name));
+  free (name);
+}
+
+static void test_round_trip (const struct stat *st)
+{
+  struct digest_cache cache;
+  uint8_t digest[32];
+  unsigned int x;
+
+  load_digest_cache (cache_file, &cache);
+  assert (0 == cache.count);
+
+  for (x = 0; x < FILES; x++)
+    {
+      memset (digest, x + 1, sizeof (digest));
+      update_digest_cache (&cache, &st[x], digest);
+    }
+
+  assert (save_digest_cache (cache_file, &cache));
+  free_digest_cache (&cache);
+
+  load_digest_cache (cache_file, &cache);
+  assert (FILES == cache.count);
+
+  for (x = 0; x < FILES; x++)
+    {
+      const uint8_t *hit = lookup_digest_cache (&cache, &st[x]);
+
+      memset (digest, x + 1, sizeof (digest));
+      assert (NULL != hit);
+      assert (0 == memcmp (digest, hit, sizeof (digest)));
+    }
+
+  free_digest_cache (&cache);
+}
+
+static void test_changed (const struct stat *st)
+{
+  struct digest_cache cache;
+  struct stat changed = st[0];
+
+  changed.st_mtim.tv_nsec++;
+
+  load_digest_cache (cache_file, &cache);
+  assert (NULL == lookup_digest_cache (&cache, &changed));
+  changed = st[0];
+  changed.st_size++;
+  assert (NULL == lookup_digest_cache (&cache, &changed));
+  free_digest_cache (&cache);
+}
+
+static void test_prune (const struct stat *st)
+{
+  struct digest_cache cache;
+
+  /* Only the first file is seen in this run */
+  load_digest_cache (cache_file, &cache);
+  assert (NULL != lookup_digest_cache (&cache, &st[0]));
+  assert (save_digest_cache (cache_file, &cache));
+  free_digest_cache (&cache);
+
+  load_digest_cache (cache_file, &cache);
+  assert (1 == cache.count);
+  assert (NULL != lookup_digest_cache (&cache, &st[0]));
+  assert (NULL == lookup_digest_cache (&cache, &st[1]));
+  assert (NULL == lookup_digest_cache (&cache, &st[2]));
+
+  /* A run that sees nothing leaves an empty cache */
+  free_digest_cache (&cache);
+  load_digest_cache (cache_file, &cache);
+  assert (save_digest_cache (cache_file, &cache));
+  free_digest_cache (&cache);
+
+  load_digest_cache (cache_file, &cache);
+  assert (0 == cache.count);
+  free_digest_cache (&cache);
+}
+
+int main (void)
+{
+  struct stat st[FILES];
+  unsigned int x;
+
+  assert (NULL != mkdtemp (dir));
+  setenv ("HOME", dir, 1);
+  snprintf (cache_file, sizeof (cache_file), "%s%s", dir, DIGEST_CACHE);
+
+  make_files (st);
+
+  test_name ();
+  test_round_trip (st);
+  test_changed (st);
+  test_prune (st);
+
+  for (x = 0; x < FILES; x++)
+    unlink (paths[x]);
+  unlink (cache_file);
+  assert (0 == rmdir (dir));
+
+  printf ("4 tests passed\n");
+
+  return 0;
+}
@@ -0,0 +1,186 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Adds enough devices to a new fleet store for its table to grow
+   twice, replaces some, and checks every lookup while writing and
+   after reopening it read only. */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../driver/fleet_store.h"
+
+#define DEVICES 1200
+
+static void make_serial (unsigned int device, uint8_t *serial)
+{
+  /* Like real serial numbers, most bytes are the same on every device */
+  const uint8_t FIXED[FLEET_SERIAL_LEN] = { 0x01, 0x23, 0, 0, 0, 0, 0, 0,
+                                            0xee };
+
+  memcpy (serial, FIXED, FLEET_SERIAL_LEN);
+  serial[2] = device >> 8;
+  serial[3] = device;
+}
+
+/* Devices have a key in every slot, except that device d leaves out
+   slot d % 17, which is no slot at all for some */
+static bool has_key (unsigned int device, unsigned int slot)
+{
+  return slot != device % 17;
+}
+
+static uint8_t key_byte (unsigned int device, unsigned int version,
+                         unsigned int slot)
+{
+  return device * 31 + version * 7 + slot;
+}
+
+static bool add_device (struct fleet_store *fleet, unsigned int device,
+                        unsigned int version)
+{
+  struct key_container *keys = make_key_container ();
+  uint8_t serial[FLEET_SERIAL_LEN];
+  unsigned int x;
+  bool ok;
+
+  assert (NULL != keys);
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (!has_key (device, x))
+        continue;
+
+      keys->keys[x] = make_buffer (FLEET_KEY_LEN);
+      memset (keys->keys[x].ptr, key_byte (device, version, x), FLEET_KEY_LEN);
+    }
+
+  make_serial (device, serial);
+  ok = fleet_add (fleet, serial, keys);
+  free_key_container (keys);
+
+  return ok;
+}
+
+static void check_device (const struct fleet_store *fleet,
+                          unsigned int device, unsigned int version)
+{
+  uint8_t serial[FLEET_SERIAL_LEN];
+  const struct fleet_record *record;
+  unsigned int x;
+
+  make_serial (device, serial);
+  record = fleet_lookup (fleet, serial);
+
+  assert (NULL != record);
+  assert (0 == memcmp (record->serial, serial, FLEET_SERIAL_LEN));
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      const uint8_t *key = fleet_record_slot (record, x);
+
+      if (!has_key (device, x))
+        {
+          assert (NULL == key);
+          continue;
+        }
+
+      assert (NULL != key);
+      assert (key_byte (device, version, x) == key[0] &&
+              key_byte (device, version, x) == key[FLEET_KEY_LEN - 1]);
+    }
+
+  if (device % 17 >= MAX_NUM_DATA_SLOTS)
+    {
+      struct key_container *keys = fleet_record_keys (record);
+
+      assert (NULL != keys);
+      assert (key_byte (device, version, 3) == keys->keys[3].ptr[0]);
+      free_key_container (keys);
+    }
+  else
+    assert (NULL == fleet_record_keys (record));
+}
+
+/* Every third device was provisioned again */
+static unsigned int version_of (unsigned int device)
+{
+  return 0 == device % 3 ? 1 : 0;
+}
+
+static void check_all (const struct fleet_store *fleet)
+{
+  uint8_t serial[FLEET_SERIAL_LEN];
+  unsigned int x;
+
+  for (x = 0; x < DEVICES; x++)
+    check_device (fleet, x, version_of (x));
+
+  make_serial (DEVICES, serial);
+  assert (NULL == fleet_lookup (fleet, serial));
+}
+
+int main (void)
+{
+  char filename[] = "/tmp/test_fleet.XXXXXX";
+  struct fleet_store *fleet;
+  const struct fleet_header *h;
+  unsigned int x;
+  int fd;
+
+  assert ((fd = mkstemp (filename)) >= 0);
+  close (fd);
+  unlink (filename);
+
+  assert (NULL != (fleet = open_fleet_store (filename, true)));
+
+  for (x = 0; x < DEVICES; x++)
+    {
+      assert (add_device (fleet, x, 0));
+      check_device (fleet, x, 0);
+      check_device (fleet, x / 2, 0);
+    }
+
+  h = (const struct fleet_header *)fleet->map;
+  assert (h->buckets >= 2 * DEVICES);
+
+  for (x = 0; x < DEVICES; x += 3)
+    assert (add_device (fleet, x, 1));
+
+  h = (const struct fleet_header *)fleet->map;
+  assert (DEVICES == h->devices);
+  assert (DEVICES + (DEVICES + 2) / 3 == h->records);
+
+  check_all (fleet);
+  close_fleet_store (fleet);
+
+  assert (NULL != (fleet = open_fleet_store (filename, false)));
+  check_all (fleet);
+  close_fleet_store (fleet);
+
+  unlink (filename);
+
+  printf ("Fleet store tests passed\n");
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks that hashing a mapped file survives another writer truncating
+   it part way, both for whole files and for the ranges of a tree hash,
+   and that the digest covers what was left. */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../cli/hash.h"
+
+/* Sparse, so it costs nothing to create but takes a while to hash */
+#define BIG_LEN ((off_t) 1024 * 1024 * 1024)
+/* Not on a page boundary, so the last page is only partly backed */
+#define KEEP_LEN ((off_t) 64 * 1024 * 1024 + 100)
+#define TRUNCATE_DELAY_MS 30
+
+static int truncate_fd;
+
+static void *truncate_later (void *arg)
+{
+  struct timespec delay = { 0, TRUNCATE_DELAY_MS * 1000000L };
+
+  (void) arg;
+  nanosleep (&delay, NULL);
+  assert (0 == ftruncate (truncate_fd, KEEP_LEN));
+
+  return NULL;
+}
+
+static void make_file (int fd)
+{
+  uint8_t pattern[4096];
+  unsigned int x;
+
+  for (x = 0; x < sizeof (pattern); x++)
+    pattern[x] = x * 7 + 1;
+
+  assert (0 == ftruncate (fd, 0));
+  assert (sizeof (pattern) == pwrite (fd, pattern, sizeof (pattern), 0));
+  assert (sizeof (pattern) == pwrite (fd, pattern, sizeof (pattern),
+                                      KEEP_LEN - sizeof (pattern)));
+  assert (0 == ftruncate (fd, BIG_LEN));
+}
+
+static void test_whole_file (int fd, const struct octet_buffer *expected)
+{
+  pthread_t truncator;
+  struct octet_buffer digest;
+
+  make_file (fd);
+  assert (0 == lseek (fd, 0, SEEK_SET));
+
+  truncate_fd = fd;
+  assert (0 == pthread_create (&truncator, NULL, truncate_later, NULL));
+  digest = sha256_fd (fd);
+  assert (0 == pthread_join (truncator, NULL));
+
+  assert (NULL != digest.ptr);
+  assert (expected->len == digest.len);
+  assert (0 == memcmp (expected->ptr, digest.ptr, digest.len));
+
+  free_octet_buffer (digest);
+}
+
+static void test_range (int fd)
+{
+  pthread_t truncator;
+  gcry_md_hd_t hd;
+
+  make_file (fd);
+
+  assert (GPG_ERR_NO_ERROR == gcry_md_open (&hd, GCRY_MD_SHA256, 0));
+
+  truncate_fd = fd;
+  assert (0 == pthread_create (&truncator, NULL, truncate_later, NULL));
+  /* The range runs past the new end, so it can't be read in full */
+  assert (!sha256_write_range (hd, fd, 0, BIG_LEN));
+  assert (0 == pthread_join (truncator, NULL));
+
+  gcry_md_close (hd);
+}
+
+int main (void)
+{
+  char filename[] = "/tmp/test_hash.XXXXXX";
+  struct octet_buffer expected;
+  int fd;
+
+  assert (NULL != gcry_check_version (NULL));
+  assert ((fd = mkstemp (filename)) >= 0);
+
+  /* What should be left once the truncation lands */
+  make_file (fd);
+  assert (0 == ftruncate (fd, KEEP_LEN));
+  expected = sha256_file (filename);
+  assert (NULL != expected.ptr);
+
+  test_whole_file (fd, &expected);
+  test_range (fd);
+
+  free_octet_buffer (expected);
+  close (fd);
+  unlink (filename);
+
+  printf ("2 tests passed\n");
+
+  return 0;
+}
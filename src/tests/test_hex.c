@@ -0,0 +1,117 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks whichever hex implementation the CPU gets against a plain one
+   byte at a time encoding, over every length that exercises the block
+   and remainder code, with a bad character at every position. */
+
+#include "config.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../driver/hex.h"
+
+#define MAX_LEN 100
+
+static void reference_encode (char *hex, const uint8_t *bin, unsigned int len)
+{
+  const char DIGITS[] = "0123456789ABCDEF";
+  unsigned int x;
+
+  for (x = 0; x < len; x++)
+    {
+      hex[2 * x] = DIGITS[bin[x] >> 4];
+      hex[2 * x + 1] = DIGITS[bin[x] & 0xf];
+    }
+}
+
+static void test_round_trip (const uint8_t *data)
+{
+  char hex[HEX_LEN (MAX_LEN)], expected[HEX_LEN (MAX_LEN)];
+  uint8_t bin[MAX_LEN];
+  unsigned int len, x;
+
+  for (len = 0; len <= MAX_LEN; len++)
+    {
+      hex_encode (hex, data, len);
+      reference_encode (expected, data, len);
+      assert (0 == memcmp (hex, expected, HEX_LEN (len)));
+
+      assert (hex_validate (hex, HEX_LEN (len)));
+      assert (hex_decode (bin, hex, HEX_LEN (len)));
+      assert (0 == memcmp (bin, data, len));
+
+      for (x = 0; x < HEX_LEN (len); x++)
+        hex[x] = tolower (hex[x]);
+
+      assert (hex_validate (hex, HEX_LEN (len)));
+      assert (hex_decode (bin, hex, HEX_LEN (len)));
+      assert (0 == memcmp (bin, data, len));
+
+      if (len > 0)
+        assert (!hex_decode (bin, hex, HEX_LEN (len) - 1));
+    }
+}
+
+static void test_invalid (const uint8_t *data)
+{
+  /* Either side of each range of digits, and bytes that are digits
+     once the top bit is dropped */
+  const char BAD[] = { '/', ':', '@', 'G', '`', 'g', ' ', '\0',
+                       (char)('0' | 0x80), (char)('a' | 0x80), (char)0xff };
+  char hex[HEX_LEN (MAX_LEN)];
+  uint8_t bin[MAX_LEN];
+  unsigned int len, x, b;
+
+  for (len = 1; len <= MAX_LEN; len++)
+    {
+      hex_encode (hex, data, len);
+
+      for (x = 0; x < HEX_LEN (len); x++)
+        for (b = 0; b < sizeof (BAD); b++)
+          {
+            char saved = hex[x];
+
+            hex[x] = BAD[b];
+            assert (!hex_validate (hex, HEX_LEN (len)));
+            assert (!hex_decode (bin, hex, HEX_LEN (len)));
+            hex[x] = saved;
+          }
+    }
+}
+
+int main (void)
+{
+  uint8_t data[MAX_LEN];
+  unsigned int x;
+
+  srand (1);
+  for (x = 0; x < MAX_LEN; x++)
+    data[x] = rand ();
+
+  test_round_trip (data);
+  test_invalid (data);
+
+  printf ("Hex tests passed (%s)\n", hex_implementation ());
+
+  return 0;
+}
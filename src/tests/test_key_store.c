@@ -0,0 +1,212 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks the binary key store: writing and mapping it, rejecting a
+   damaged one, rebuilding it from a newer text key store, and using
+   the text keys from memory when the binary one can't be written. */
+
+#include "config.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../driver/key_store.h"
+
+static char home[] = "/tmp/test_key_store.XXXXXX";
+static char text_name[PATH_MAX], bin_name[PATH_MAX], tmp_name[PATH_MAX];
+
+static uint8_t key_byte (uint8_t version, unsigned int slot)
+{
+  return version * 16 + slot;
+}
+
+static struct key_container* make_keys (uint8_t version)
+{
+  struct key_container *keys = make_key_container ();
+  unsigned int x;
+
+  assert (NULL != keys);
+
+  /* Slot 5 is left out */
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (5 == x)
+        continue;
+
+      keys->keys[x] = make_buffer (KEY_STORE_KEY_LEN);
+      memset (keys->keys[x].ptr, key_byte (version, x), KEY_STORE_KEY_LEN);
+    }
+
+  return keys;
+}
+
+static void check_store (struct key_store *store, uint8_t version)
+{
+  unsigned int x;
+
+  assert (NULL != store);
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      const uint8_t *key = key_store_slot (store, x);
+
+      if (5 == x)
+        assert (NULL == key);
+      else
+        assert (NULL != key && key_byte (version, x) == key[0] &&
+                key_byte (version, x) == key[KEY_STORE_KEY_LEN - 1]);
+    }
+
+  assert (NULL == key_store_slot (store, MAX_NUM_DATA_SLOTS));
+
+  close_key_store (store);
+}
+
+/**
+ * Writes the text key store, with the slot left out, and sets its
+ * time relative to the binary one.
+ */
+static void write_text (uint8_t version, int seconds)
+{
+  struct timespec times[2];
+  unsigned int x, y;
+  FILE *fp;
+
+  assert (NULL != (fp = fopen (text_name, "w")));
+
+  fprintf (fp, "# version %u\n", version);
+
+  for (x = 0; x < MAX_NUM_DATA_SLOTS; x++)
+    {
+      if (5 == x)
+        continue;
+
+      fprintf (fp, "key_slot_%02u ", x);
+      for (y = 0; y < KEY_STORE_KEY_LEN; y++)
+        fprintf (fp, "%02x", key_byte (version, x));
+      fprintf (fp, "\n");
+    }
+
+  assert (0 == fclose (fp));
+
+  clock_gettime (CLOCK_REALTIME, &times[0]);
+  times[0].tv_sec += seconds;
+  times[1] = times[0];
+  assert (0 == utimensat (AT_FDCWD, text_name, times, 0));
+}
+
+static void test_write_open (void)
+{
+  struct key_container *keys = make_keys (1);
+  struct stat st;
+  uint8_t byte;
+  int fd;
+
+  assert (write_key_store (bin_name, keys));
+  free_key_container (keys);
+
+  assert (0 == stat (bin_name, &st));
+  assert ((S_IRUSR | S_IWUSR) == (st.st_mode & 0777));
+  assert (sizeof (struct key_store_file) == st.st_size);
+
+  check_store (open_key_store (bin_name), 1);
+
+  /* A changed byte fails the CRC */
+  assert ((fd = open (bin_name, O_RDWR)) >= 0);
+  assert (1 == pread (fd, &byte, 1, 100));
+  byte ^= 0x01;
+  assert (1 == pwrite (fd, &byte, 1, 100));
+  assert (NULL == open_key_store (bin_name));
+
+  /* As does a file of the wrong size */
+  assert (0 == ftruncate (fd, st.st_size - 1));
+  assert (NULL == open_key_store (bin_name));
+  close (fd);
+
+  assert (0 == unlink (bin_name));
+  assert (NULL == open_key_store (bin_name));
+}
+
+static void test_rebuild (void)
+{
+  struct stat st;
+
+  /* No binary key store yet, as with keys from older versions */
+  write_text (1, 0);
+  check_store (load_key_store (), 1);
+  assert (0 == stat (bin_name, &st));
+  check_store (load_key_store (), 1);
+
+  /* An older text key store is ignored */
+  write_text (2, -60);
+  check_store (load_key_store (), 1);
+
+  /* A newer one replaces the binary key store */
+  write_text (3, 60);
+  check_store (load_key_store (), 3);
+  check_store (open_key_store (bin_name), 3);
+
+  /* A newer one that doesn't parse leaves no keys to use */
+  write_text (4, 120);
+  assert (0 == truncate (text_name, 40));
+  assert (NULL == load_key_store ());
+}
+
+static void test_unwritable (void)
+{
+  struct stat st;
+
+  unlink (bin_name);
+
+  /* Nothing can be created where the new file is written */
+  assert (0 == mkdir (tmp_name, S_IRWXU));
+
+  write_text (5, 0);
+  check_store (load_key_store (), 5);
+  assert (0 != stat (bin_name, &st));
+
+  assert (0 == rmdir (tmp_name));
+}
+
+int main (void)
+{
+  assert (NULL != mkdtemp (home));
+  assert (0 == setenv ("HOME", home, 1));
+
+  snprintf (text_name, sizeof (text_name), "%s/.hashlet", home);
+  snprintf (bin_name, sizeof (bin_name), "%s%s", home, KEY_STORE_BIN);
+  snprintf (tmp_name, sizeof (tmp_name), "%s.tmp", bin_name);
+
+  test_write_open ();
+  test_rebuild ();
+  test_unwritable ();
+
+  unlink (text_name);
+  unlink (bin_name);
+  assert (0 == rmdir (home));
+
+  printf ("Key store tests passed\n");
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks that key files parse, and that each kind of error is reported
+   at the line and column where it is. */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "../parser/hashlet_parser.h"
+
+#define KEY_HEX_LEN (2 * KEY_FILE_KEY_LEN)
+
+static char key_hex[KEY_HEX_LEN + 1];
+
+static void make_key_hex (void)
+{
+  unsigned int x;
+
+  for (x = 0; x < KEY_FILE_KEY_LEN; x++)
+    sprintf (key_hex + 2 * x, "%02x", x * 7 & 0xff);
+}
+
+/**
+ * Parses a buffer that should fail, checking where.
+ */
+static void expect_error (const char *buf, unsigned int line,
+                          unsigned int column)
+{
+  struct parsed_key keys[KEY_FILE_SLOTS];
+  struct key_file_error error = { 0, 0, NULL };
+
+  assert (0 != parse_key_buffer (buf, strlen (buf), keys, &error));
+
+  if (line != error.line || column != error.column)
+    {
+      fprintf (stderr, "Expected %u:%u, got %u:%u (%s) for:\n%s\n",
+               line, column, error.line, error.column, error.message, buf);
+      assert (0);
+    }
+
+  assert (NULL != error.message);
+}
+
+static void test_valid (void)
+{
+  struct parsed_key keys[KEY_FILE_SLOTS];
+  char buf[512];
+  unsigned int x;
+
+  snprintf (buf, sizeof (buf),
+            "# keys\nkey_slot_00 %s\n  key_slot_15\t%s # last\n"
+            "key_slot_20 %s\n", key_hex, key_hex, key_hex);
+
+  assert (0 == parse_key_buffer (buf, strlen (buf), keys, NULL));
+
+  for (x = 0; x < KEY_FILE_SLOTS; x++)
+    {
+      assert (keys[x].present == (0 == x || 15 == x));
+
+      if (keys[x].present)
+        assert (0x07 == keys[x].key[1] && 0xd9 == keys[x].key[31]);
+    }
+
+  /* Without a trailing newline, or a terminator */
+  assert (0 == parse_key_buffer (buf, strlen (buf) - 1, keys, NULL));
+}
+
+static void test_bad_digit (void)
+{
+  char buf[512];
+  unsigned int x;
+
+  for (x = 0; x < KEY_HEX_LEN; x++)
+    {
+      char *key;
+
+      snprintf (buf, sizeof (buf), "key_slot_00 %s\n\n  key_slot_01 %s\n",
+                key_hex, key_hex);
+      key = strrchr (buf, ' ') + 1;
+      key[x] = 'g';
+
+      expect_error (buf, 3, 15 + x);
+    }
+}
+
+static void test_errors (void)
+{
+  char buf[512];
+
+  expect_error ("", 1, 1);
+  expect_error ("# nothing\n\n", 3, 1);
+  expect_error ("slot_01", 1, 1);
+
+  snprintf (buf, sizeof (buf), "key_slot_1x %s", key_hex);
+  expect_error (buf, 1, 10);
+
+  snprintf (buf, sizeof (buf), "key_slot_123 %s", key_hex);
+  expect_error (buf, 1, 10);
+
+  snprintf (buf, sizeof (buf), "key_slot_01 %.*s\n", KEY_HEX_LEN - 1, key_hex);
+  expect_error (buf, 1, 13 + KEY_HEX_LEN - 1);
+
+  snprintf (buf, sizeof (buf), "key_slot_01 %sa\n", key_hex);
+  expect_error (buf, 1, 13 + KEY_HEX_LEN);
+
+  /* A missing key is noticed where the next thing starts */
+  snprintf (buf, sizeof (buf), "key_slot_01 %s\n\tkey_slot_02\n", key_hex);
+  expect_error (buf, 3, 1);
+}
+
+int main (void)
+{
+  make_key_hex ();
+
+  test_valid ();
+  test_bad_digit ();
+  test_errors ();
+
+  printf ("Parser tests passed\n");
+
+  return 0;
+}
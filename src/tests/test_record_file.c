@@ -0,0 +1,251 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks the record file against a model through random writes and
+   deletes across table growths, the cap on a limited table, starting
+   over an invalid file, and writers in several processes at once. */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../driver/record_file.h"
+
+#define DEVICES 2000
+#define OPERATIONS 20000
+#define WRITERS 4
+
+struct test_record
+{
+  uint8_t serial[RECORD_SERIAL_LEN];
+  uint8_t pad[3];
+  uint32_t value;
+};
+
+static const struct record_format GROWING =
+  { { 'T', 'E', 'S', 'T' }, 1, sizeof (struct test_record), 4, 0, false };
+
+static const struct record_format CAPPED =
+  { { 'T', 'E', 'S', 'C' }, 1, sizeof (struct test_record), 4, 64, false };
+
+static void make_record (unsigned int device, uint32_t value,
+                         struct test_record *r)
+{
+  memset (r, 0, sizeof (*r));
+  r->serial[0] = 0x01;
+  r->serial[1] = 0x23;
+  r->serial[2] = device >> 8;
+  r->serial[3] = device;
+  r->serial[8] = 0xee;
+  r->value = value;
+}
+
+static void check_model (const char *filename, const uint32_t *model,
+                         unsigned int devices)
+{
+  struct record_file f;
+  struct test_record r, key;
+  unsigned int x, live = 0;
+
+  assert (open_record_file (&f, filename, &GROWING, false));
+
+  for (x = 0; x < devices; x++)
+    {
+      make_record (x, 0, &key);
+
+      if (0 != model[x])
+        {
+          assert (read_record (&f, key.serial, &r));
+          assert (model[x] == r.value);
+          live++;
+        }
+      else
+        assert (!read_record (&f, key.serial, &r));
+    }
+
+  assert (live == f.header.used);
+  assert (4 * f.header.used <= 3 * f.header.slots);
+
+  close_record_file (&f);
+}
+
+static void test_model (const char *filename)
+{
+  static uint32_t model[DEVICES];
+  struct record_file f;
+  struct test_record r;
+  struct stat st;
+  unsigned int x;
+
+  srand (1);
+
+  /* Reopened for each change, as the callers do */
+  for (x = 1; x <= OPERATIONS; x++)
+    {
+      unsigned int device = rand () % DEVICES;
+
+      assert (open_record_file (&f, filename, &GROWING, true));
+
+      make_record (device, x, &r);
+
+      if (0 != rand () % 3)
+        {
+          assert (write_record (&f, &r));
+          model[device] = x;
+        }
+      else
+        {
+          assert (delete_record (&f, r.serial));
+          model[device] = 0;
+        }
+
+      close_record_file (&f);
+    }
+
+  check_model (filename, model, DEVICES);
+
+  assert (0 == stat (filename, &st));
+  assert ((S_IRUSR | S_IWUSR) == (st.st_mode & 0777));
+}
+
+static void test_capped (const char *filename)
+{
+  struct record_file f;
+  struct test_record r, key;
+  unsigned int x, found = 0;
+
+  assert (open_record_file (&f, filename, &CAPPED, true));
+
+  for (x = 0; x < 1000; x++)
+    {
+      make_record (x, x + 1, &key);
+      assert (write_record (&f, &key));
+
+      /* The record just written always survives */
+      assert (read_record (&f, key.serial, &r) && x + 1 == r.value);
+    }
+
+  assert (CAPPED.max_slots == f.header.slots);
+  assert (f.header.used <= f.header.slots);
+
+  for (x = 0; x < 1000; x++)
+    {
+      make_record (x, 0, &key);
+      if (read_record (&f, key.serial, &r))
+        {
+          assert (x + 1 == r.value);
+          found++;
+        }
+    }
+
+  assert (found == f.header.used);
+
+  close_record_file (&f);
+}
+
+static void test_invalid (const char *filename)
+{
+  const char GARBAGE[] = "not a record file";
+  struct record_file f;
+  FILE *fp;
+
+  assert (NULL != (fp = fopen (filename, "w")));
+  assert (1 == fwrite (GARBAGE, sizeof (GARBAGE), 1, fp));
+  assert (0 == fclose (fp));
+
+  assert (!open_record_file (&f, filename, &GROWING, false));
+
+  assert (open_record_file (&f, filename, &GROWING, true));
+  assert (0 == f.header.used);
+  close_record_file (&f);
+
+  /* Nor is a file of one format read as another */
+  assert (!open_record_file (&f, filename, &CAPPED, false));
+}
+
+static void test_writers (const char *filename)
+{
+  static uint32_t model[DEVICES];
+  unsigned int w, x;
+  int status;
+
+  for (w = 0; w < WRITERS; w++)
+    {
+      if (0 != fork ())
+        continue;
+
+      for (x = w; x < DEVICES; x += WRITERS)
+        {
+          struct record_file f;
+          struct test_record r;
+
+          make_record (x, x + 1, &r);
+
+          if (!open_record_file (&f, filename, &GROWING, true) ||
+              !write_record (&f, &r))
+            _exit (1);
+
+          close_record_file (&f);
+        }
+
+      _exit (0);
+    }
+
+  for (w = 0; w < WRITERS; w++)
+    {
+      assert (wait (&status) > 0);
+      assert (WIFEXITED (status) && 0 == WEXITSTATUS (status));
+    }
+
+  for (x = 0; x < DEVICES; x++)
+    model[x] = x + 1;
+
+  check_model (filename, model, DEVICES);
+}
+
+int main (void)
+{
+  char filename[] = "/tmp/test_record_file.XXXXXX";
+  int fd;
+
+  assert ((fd = mkstemp (filename)) >= 0);
+  close (fd);
+
+  unlink (filename);
+  test_model (filename);
+
+  unlink (filename);
+  test_capped (filename);
+
+  test_invalid (filename);
+
+  unlink (filename);
+  test_writers (filename);
+
+  unlink (filename);
+
+  printf ("Record file tests passed\n");
+
+  return 0;
+}
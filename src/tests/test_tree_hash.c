@@ -0,0 +1,129 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2013 Cryptotronix, LLC.
+ *
+ * This file is part of Hashlet.
+ *
+ * Hashlet is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Hashlet is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashlet.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks that the tree hash of a pipe matches that of the same data in
+   a file, across leaf sizes from one byte to far more than the input,
+   and that a single leaf is the plain RFC 6962 leaf hash. */
+
+#include "config.h"
+#include <assert.h>
+#include <gcrypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../cli/tree_hash.h"
+
+#define DATA_LEN (200 * 1024 + 17)
+
+static uint8_t data[DATA_LEN];
+
+static struct tree_hash hash_pipe (size_t len, uint64_t chunk_size)
+{
+  struct tree_hash tree;
+  int fds[2];
+  pid_t child;
+  int status;
+
+  assert (0 == pipe (fds));
+  assert ((child = fork ()) >= 0);
+
+  if (0 == child)
+    {
+      close (fds[0]);
+      _exit (len == (size_t) write (fds[1], data, len) ? 0 : 1);
+    }
+
+  close (fds[1]);
+  tree = tree_hash_fd (fds[0], chunk_size, 0);
+  close (fds[0]);
+
+  assert (child == waitpid (child, &status, 0));
+  assert (WIFEXITED (status) && 0 == WEXITSTATUS (status));
+
+  return tree;
+}
+
+static struct tree_hash hash_file (int fd, uint64_t chunk_size)
+{
+  assert (0 == lseek (fd, 0, SEEK_SET));
+
+  return tree_hash_fd (fd, chunk_size, 2);
+}
+
+static void check_same (struct tree_hash a, struct tree_hash b)
+{
+  assert (NULL != a.root.ptr && NULL != b.root.ptr);
+  assert (a.leaves == b.leaves);
+  assert (0 == memcmp (a.root.ptr, b.root.ptr, a.root.len));
+
+  free_octet_buffer (a.root);
+  free_octet_buffer (b.root);
+}
+
+static void check_single_leaf (struct tree_hash tree, size_t len)
+{
+  uint8_t *leaf = malloc (len + 1);
+  uint8_t expected[32];
+
+  assert (NULL != leaf);
+  leaf[0] = TREE_LEAF_PREFIX;
+  memcpy (leaf + 1, data, len);
+  gcry_md_hash_buffer (GCRY_MD_SHA256, expected, leaf, len + 1);
+
+  assert (NULL != tree.root.ptr);
+  assert (1 == tree.leaves);
+  assert (0 == memcmp (expected, tree.root.ptr, sizeof (expected)));
+
+  free_octet_buffer (tree.root);
+  free (leaf);
+}
+
+int main (void)
+{
+  const uint64_t sizes[] = { 1, 7, 4096, 65536, 65537, DATA_LEN,
+                             (uint64_t) 100 * 1024 * 1024 * 1024 };
+  char filename[] = "/tmp/test_tree_hash.XXXXXX";
+  unsigned int x;
+  int fd;
+
+  assert (NULL != gcry_check_version (NULL));
+
+  for (x = 0; x < DATA_LEN; x++)
+    data[x] = x * 31 + (x >> 8);
+
+  assert ((fd = mkstemp (filename)) >= 0);
+  assert (DATA_LEN == write (fd, data, DATA_LEN));
+
+  for (x = 0; x < sizeof (sizes) / sizeof (sizes[0]); x++)
+    check_same (hash_pipe (DATA_LEN, sizes[x]), hash_file (fd, sizes[x]));
+
+  /* A leaf larger than the input, on a pipe, is never buffered whole */
+  check_single_leaf (hash_pipe (DATA_LEN, sizes[x - 1]), DATA_LEN);
+  check_single_leaf (hash_pipe (0, sizes[x - 1]), 0);
+
+  close (fd);
+  unlink (filename);
+
+  printf ("%u tests passed\n", x + 2);
+
+  return 0;
+}